@@ -4,6 +4,10 @@
 //
 
 #include "agent_controller.hpp"
+
+#include <algorithm>
+#include <cstring>
+
 #include "util/log.hpp"
 #include "util/lock.hpp"
 
@@ -141,11 +145,54 @@ namespace irobot::agent {
         return 0;
     }
 
+    bool AgentController::OnReceived(void *userdata, const uint8_t *data, size_t len) {
+        auto *controller = (AgentController *) userdata;
+        while (len) {
+            size_t n = std::min(len, sizeof(controller->recv_buf) - controller->recv_head);
+            memcpy(&controller->recv_buf[controller->recv_head], data, n);
+            controller->recv_head += n;
+            data += n;
+            len -= n;
+
+            ssize_t consumed = controller->ProcessMessages(controller->recv_buf,
+                                                           controller->recv_head);
+            if (consumed == -1) {
+                // an error occurred
+                return false;
+            }
+            // shift the remaining data in the buffer
+            memmove(controller->recv_buf, &controller->recv_buf[consumed],
+                    controller->recv_head - consumed);
+            controller->recv_head -= consumed;
+            if (controller->recv_head == sizeof(controller->recv_buf)) {
+                LOGW("Invalid control message, discarded");
+                controller->recv_head = 0;
+            }
+        }
+        return true;
+    }
+
     int AgentController::RunAgentController(void *data) {
         auto *controller = (AgentController *) data;
         if (!controller->WaitForClientConnection()) {
             return 0;
         }
+        if (controller->io_loop) {
+            while (!controller->stopped) {
+                controller->recv_head = 0;
+                if (!controller->io_loop->RecvUntilClosed(controller->control_socket,
+                                                          OnReceived, controller)) {
+                    // the io loop is stopped
+                    break;
+                }
+                LOGI("Control socket closed, trying to re-establish connection");
+                if (!controller->WaitForClientConnection()) {
+                    LOGD("Failed to re-establish connection");
+                    break;
+                }
+            }
+            return 0;
+        }
         unsigned char buf[CONTROL_MSG_SERIALIZED_MAX_SIZE * 2];
         size_t head = 0;
         while (!controller->stopped) {
@@ -9,6 +9,7 @@
 #include <cassert>
 
 #include "core/actor.hpp"
+#include "platform/io_loop.hpp"
 #include "platform/net.hpp"
 #include "message/control_msg.hpp"
 #include "util/cbuf.hpp"
@@ -24,6 +25,8 @@ namespace irobot::agent {
         SDL_Thread *record_thread = nullptr;
         message::MessageHandler message_handler = nullptr;
         void *entity = nullptr;
+        // if set, the socket is read by the io loop instead of this thread
+        platform::IoLoop *io_loop = nullptr;
 
         bool Init(socket_t server_socket,
                   message::MessageHandler message_handler, void *entity);
@@ -40,7 +43,12 @@ namespace irobot::agent {
 
         static int RunAgentRecorder(void *data);
 
+        static bool OnReceived(void *userdata, const uint8_t *data, size_t len);
+
     private:
+        unsigned char recv_buf[CONTROL_MSG_SERIALIZED_MAX_SIZE * 2]{};
+        size_t recv_head = 0;
+
         bool SendMessage(message::ControlMessage *msg);
 
         ssize_t ProcessMessages(const unsigned char *buf, size_t len);
@@ -6,15 +6,24 @@
 #include "agent_manager.hpp"
 #include "ui/events.hpp"
 #include <sys/time.h>
+#include <ctime>
 #include <iostream>
+#include <new>
 #include "util/log.hpp"
 #include "util/lock.hpp"
-#include "util/buffer_util.hpp"
 #include "platform/net.hpp"
 #include "ai/brain.hpp"
 
 namespace irobot::agent {
 
+    // keeps the memory of a mat alive until its blob message is sent
+    class MatRef : public message::BlobRef {
+    public:
+        cv::Mat mat;
+
+        explicit MatRef(const cv::Mat &mat) : mat(mat) {}
+    };
+
     bool AgentManager::Init(uint16_t port) {
         this->local_port = port;
         this->control_server_socket = platform::listen_on_port(this->local_port + 1);
@@ -29,6 +38,15 @@ namespace irobot::agent {
                  (unsigned short) (this->local_port + 2));
             return false;
         }
+        // PHash is not reentrant, one per job
+        for (auto &phash_func : this->phash_funcs) {
+            phash_func = cv::img_hash::PHash::create();
+        }
+        this->image_jobs[0] = {this, nullptr, message::BLOB_MSG_TYPE_OPENCV_MAT, 800, false};
+        this->image_jobs[1] = {this, nullptr, message::BLOB_MSG_TYPE_SCREEN_SHOT, 240, true};
+        if (!this->workers.Init("agent worker", AGENT_IMAGE_TYPES)) {
+            return false;
+        }
         bool initialzied = this->agent_stream->Init(this->video_server_socket);
 
         initialzied &= this->agent_controller->Init(this->control_server_socket,
@@ -41,9 +59,80 @@ namespace irobot::agent {
     bool AgentManager::Start() {
         bool started = this->agent_stream->Start();
         started &= this->agent_controller->Start();
+        if (this->frame_consumer != -1) {
+            started &= this->workers.Start();
+            this->frame_thread = SDL_CreateThread(RunFrameConsumer,
+                                                  "agent frames", this);
+            if (!this->frame_thread) {
+                LOGC("Could not start agent frame thread");
+                started = false;
+            }
+        }
         return started;
     }
 
+    int AgentManager::RunFrameConsumer(void *data) {
+        auto *agent_manager = (AgentManager *) data;
+        video::VideoBuffer *vb = agent_manager->video_buffer;
+        int consumer = agent_manager->frame_consumer;
+        int last_sent = 0;
+        uint64_t last_checksum = 0;
+        // if the last sent frame has been hashed
+        bool last_hashed = false;
+        while (vb->WaitFrame(consumer)) {
+            bool save = SDL_AtomicCAS(&agent_manager->save_frame, 1, 0);
+            bool resend = SDL_AtomicCAS(&agent_manager->resend_frame, 1, 0);
+            bool key_frame = SDL_AtomicCAS(&agent_manager->key_frame, 1, 0);
+            if (resend || key_frame) {
+                // a new client, or a client which lost a delta
+                for (auto &encoder : agent_manager->delta_encoders) {
+                    encoder.RequestKeyFrame();
+                }
+            }
+            // pin the last frame, the decoder and the screen are not blocked
+            // during the conversions
+            if (vb->AcquireFrame(consumer)) {
+                const video::FrameSlot *slot = vb->GetFrameSlot(consumer);
+                // shared by the analyses of this frame
+                ai::FrameSnapshot *snapshot = nullptr;
+                if (save && (snapshot = ai::FrameSnapshot::Create(vb, consumer))) {
+                    ai::SaveFrame(snapshot);
+                }
+                bool fresh = slot->frame_number != last_sent;
+                // on the pinned slot, off the decoder thread, only when a
+                // client gets the images
+                bool hashed = (fresh || resend) && agent_manager->agent_stream->IsConnected();
+                uint64_t checksum = hashed ? video::VideoBuffer::ComputeChecksum(slot->frame) : 0;
+                if (!resend && hashed && last_hashed && checksum == last_checksum) {
+                    // static screen: the agent already has these images, skip
+                    // the conversions, the hash and the send
+                    vb->CountStaticFrame(consumer);
+                    last_sent = slot->frame_number;
+                } else if (fresh || resend) {
+                    if (!snapshot) {
+                        snapshot = ai::FrameSnapshot::Create(vb, consumer);
+                    }
+                    if (snapshot) {
+                        agent_manager->ProduceImages(snapshot);
+                    }
+                    last_sent = slot->frame_number;
+                    last_checksum = checksum;
+                    last_hashed = hashed;
+                }
+                if (snapshot) {
+                    snapshot->Release();
+                }
+            }
+            vb->ReleaseFrame(consumer);
+            agent_manager->ReportStats();
+        }
+        for (auto &encoder : agent_manager->delta_encoders) {
+            encoder.Destroy();
+        }
+        LOGD("Agent frame thread stopped");
+        return 0;
+    }
+
     void AgentManager::Stop() {
         if (this->video_server_socket != INVALID_SOCKET) {
             platform::close_socket(&this->video_server_socket);
@@ -53,11 +142,16 @@ namespace irobot::agent {
         }
         this->agent_stream->Stop();
         this->agent_controller->Stop();
+        this->workers.Stop();
+        if (this->frame_thread) {
+            this->video_buffer->Interrupt();
+        }
     }
 
     void AgentManager::Destroy() {
         this->agent_stream->Destroy();
         this->agent_controller->Destroy();
+        this->workers.Destroy();
         LOGD("Agent manager stopped");
 
     }
@@ -65,6 +159,63 @@ namespace irobot::agent {
     void AgentManager::Join() {
         this->agent_stream->Join();
         this->agent_controller->Join();
+        SDL_WaitThread(this->frame_thread, nullptr);
+        this->frame_thread = nullptr;
+        // after the frame thread, which may wait for its jobs
+        this->workers.Join();
+    }
+
+    void AgentManager::RunImageJob(void *data) {
+        auto *job = (AgentImageJob *) data;
+        job->agent_manager->SendOpenCVImage(job->snapshot, job->type,
+                                            job->max_size, job->color);
+        job->snapshot->Release();
+    }
+
+    void AgentManager::ProduceImages(ai::FrameSnapshot *snapshot) {
+        // the jobs share the snapshot (and its conversions), the decoder and
+        // the screen never wait for them
+        Uint64 start = SDL_GetPerformanceCounter();
+        for (auto &job : this->image_jobs) {
+            job.snapshot = snapshot;
+            snapshot->Acquire();
+            if (!this->workers.Submit(RunImageJob, &job)) {
+                snapshot->Release();
+                // stopped
+                break;
+            }
+        }
+        this->workers.Wait();
+        this->produce_time += (SDL_GetPerformanceCounter() - start) * 1000000
+                              / SDL_GetPerformanceFrequency();
+        ++this->nr_produced;
+    }
+
+    static void ReportLockWait(const char *name, util::LockWaitStats *stats) {
+        int nr_locks = SDL_AtomicSet(&stats->nr_locks, 0);
+        int nr_waits = SDL_AtomicSet(&stats->nr_waits, 0);
+        int wait_us = SDL_AtomicSet(&stats->wait_us, 0);
+        int max_wait_us = SDL_AtomicSet(&stats->max_wait_us, 0);
+        if (nr_waits) {
+            LOGI("%s lock: %d/%d contended, %.3f ms waited (max %.3f ms)",
+                 name, nr_waits, nr_locks, wait_us / 1000.0, max_wait_us / 1000.0);
+        }
+    }
+
+    void AgentManager::ReportStats() {
+        Uint32 now = SDL_GetTicks();
+        if (now - this->last_report < AGENT_STATS_INTERVAL) {
+            return;
+        }
+        if (this->nr_produced) {
+            LOGI("Agent frames: %u produced in %.2f ms on average", this->nr_produced,
+                 (double) this->produce_time / this->nr_produced / 1000.0);
+        }
+        ReportLockWait("Agent stream", &this->agent_stream->lock_stats);
+        ReportLockWait("Video buffer", &this->video_buffer->lock_stats);
+        this->nr_produced = 0;
+        this->produce_time = 0;
+        this->last_report = now;
     }
 
 
@@ -77,6 +228,18 @@ namespace irobot::agent {
             case message::CONTROL_MSG_TYPE_END_RECORDING:
                 agent_manager->StopRecordEvents();
                 break;
+            case message::CONTROL_MSG_TYPE_SAVE_REPLAY:
+                agent_manager->SaveReplay(msg->save_replay.filename);
+                break;
+            case message::CONTROL_MSG_TYPE_REQUEST_KEY_FRAME:
+                agent_manager->RequestKeyFrame();
+                break;
+            case message::CONTROL_MSG_TYPE_SET_BLOB_CODEC:
+                agent_manager->agent_stream->SetCodec(msg->set_blob_codec.codec);
+                break;
+            case message::CONTROL_MSG_TYPE_SET_BLOB_VERSION:
+                agent_manager->agent_stream->SetVersion(msg->set_blob_version.version);
+                break;
             default:
                 agent_manager->controller->PushMessage(msg);
         }
@@ -103,6 +266,32 @@ namespace irobot::agent {
     }
 
 
+    void AgentManager::SaveReplay(const char *filename) {
+        if (!this->replay_buffer) {
+            LOGW("Replay buffer disabled (--replay-buffer)");
+            return;
+        }
+        char name[64];
+        if (!filename) {
+            time_t now = time(nullptr);
+            strftime(name, sizeof(name), REPLAY_FILE_NAME, localtime(&now));
+            filename = name;
+        }
+        // muxed on the replay thread
+        if (this->replay_buffer->Save(filename)) {
+            LOGI("Saving replay to %s...", filename);
+        }
+    }
+
+
+    void AgentManager::RequestKeyFrame() {
+        // the encoders belong to the frame thread, the current frame is sent
+        // again even if the screen is static
+        SDL_AtomicSet(&this->key_frame, 1);
+        SDL_AtomicSet(&this->resend_frame, 1);
+        this->video_buffer->WakeConsumer(this->frame_consumer);
+    }
+
     void AgentManager::ProcessKey(const SDL_KeyboardEvent *event) {
         // control: indicates the state of the command-line option --no-control
         // ctrl: the Ctrl key
@@ -147,7 +336,9 @@ namespace irobot::agent {
                     break;
                 case SDLK_k:
                     if (cmd && !shift && !repeat && down) {
-                        ai::SaveFrame(*this->video_buffer);
+                        // the frame consumer belongs to the frame thread
+                        SDL_AtomicSet(&this->save_frame, 1);
+                        this->video_buffer->WakeConsumer(this->frame_consumer);
                     }
                     break;
                 default:
@@ -158,60 +349,118 @@ namespace irobot::agent {
         }
     }
 
-    void AgentManager::SendOpenCVImage(message::BlobMessageType type, int max_size, bool color) {
+    void AgentManager::SendOpenCVImage(ai::FrameSnapshot *snapshot,
+                                       message::BlobMessageType type, int max_size,
+                                       bool color) {
 
         if (this->agent_stream->IsConnected()) {
-            auto mat = ai::ConvertToMat(*this->video_buffer, max_size,
-                                        color);
+            // shared, not modified
+            cv::Mat mat = snapshot->GetScaled(max_size, color);
+            if (mat.empty()) {
+                return;
+            }
+            int latency_id = 0;
+            video::LatencyTracker *latency = this->video_buffer->latency;
+            if (latency) {
+                latency_id = (int) snapshot->frame->reordered_opaque;
+                latency->Mark(latency_id, video::LATENCY_STAGE_CONVERTED);
+            }
             cv::Mat hashImage;
-            this->phash_func->compute(mat, hashImage);
+            auto version = (message::BlobVersion) SDL_AtomicGet(&this->agent_stream->version);
+            if (version >= message::BLOB_VERSION_3) {
+                // the same for all the images of the frame
+                hashImage = snapshot->GetHash();
+            } else {
+                this->phash_funcs[color ? 1 : 0]->compute(mat, hashImage);
+            }
+            if (hashImage.empty()) {
+                return;
+            }
 
-            unsigned char *data = mat.data;
+            if (!mat.isContinuous()) {
+                mat = mat.clone();
+            }
             int width = mat.size().width;
             int height = mat.size().height;
             struct message::BlobMessage msg{};
             msg.type = type;
+            msg.image_type = type;
             struct timeval tm_now{};
             gettimeofday(&tm_now, nullptr);
             Uint64 milli_seconds = tm_now.tv_sec * 1000LL + tm_now.tv_usec / 1000;
             msg.timestamp = milli_seconds;
-            msg.id = 0;
+            msg.id = (Uint64) snapshot->frame_number;
+            if (this->clock_offset) {
+                msg.capture_time = (Uint64) this->clock_offset->ToHost(snapshot->pts);
+            }
+            msg.decode_time = (Uint64) snapshot->decode_time;
+            msg.latency_id = latency_id;
             msg.count = 2;
             msg.total_length = 0;
             bool ok = true;
-            int length = mat.total() * mat.elemSize();
-            Uint64 size = length + 16;
-            msg.buffers[0].data = (unsigned char *) SDL_malloc(size);
-            if (msg.buffers[0].data != nullptr) {
-                util::buffer_write64be(msg.buffers[0].data, (uint64_t) width);
-                util::buffer_write64be(msg.buffers[0].data + 8, (uint64_t) height);
-                memcpy(msg.buffers[0].data + 16, data, length);
-                msg.buffers[0].length = length;
-
+            size_t length = mat.total() * mat.elemSize();
+            message::TileDeltaEncoder *encoder = nullptr;
+            msg.buffers[0].width = (Uint64) width;
+            msg.buffers[0].height = (Uint64) height;
+            if (this->tile_delta) {
+                msg.type = message::BLOB_MSG_TYPE_TILE_DELTA;
+                encoder = &this->delta_encoders[color ? 1 : 0];
+                message::BlobMessage pending{};
+                if (this->agent_stream->TakePending(type, &pending)) {
+                    // the previous delta is not sent yet: this one replaces
+                    // it, with its tiles
+                    if (pending.type == message::BLOB_MSG_TYPE_TILE_DELTA) {
+                        encoder->Cancel(pending.buffers[0].data,
+                                        pending.buffers[0].length);
+                    }
+                    pending.Destroy();
+                }
+                length = message::TileDeltaEncoder::GetMaxSize(width, height,
+                                                               mat.channels());
+                auto *delta = (unsigned char *) SDL_malloc(length);
+                if (delta) {
+                    // only the tiles changed since the previous image
+                    length = encoder->Encode(type, mat.data, width, height,
+                                             mat.channels(), mat.step, delta);
+                    msg.SetBuffer(0, delta, length, nullptr);
+                    ok = length != 0;
+                } else {
+                    LOGW("Unable to allow memory");
+                    ok = false;
+                }
             } else {
-                LOGW("Unable to allow memory");
-                ok = false;
+                // sent from the mat, not copied
+                auto *ref = new(std::nothrow) MatRef(mat);
+                if (ref) {
+                    msg.SetBuffer(0, mat.data, length, ref);
+                } else {
+                    LOGW("Unable to allow memory");
+                    ok = false;
+                }
             }
-            msg.total_length += length + 24;
-
-            length = hashImage.total() * hashImage.elemSize();
-            width = hashImage.size().width;
-            height = hashImage.size().height;
-            size = length + 16;
-            data = hashImage.data;
-            msg.buffers[1].data = (unsigned char *) SDL_malloc(size);
-            if (msg.buffers[1].data != nullptr) {
-                util::buffer_write64be(msg.buffers[1].data, (uint64_t) width);
-                util::buffer_write64be(msg.buffers[1].data + 8, (uint64_t) height);
-                memcpy(msg.buffers[1].data + 16, data, length);
-                msg.buffers[1].length = length;
+            msg.total_length += msg.buffers[0].length + BLOB_MSG_BUFFER_HEADER_SIZE;
 
+            if (!hashImage.isContinuous()) {
+                hashImage = hashImage.clone();
+            }
+            msg.buffers[1].width = (Uint64) hashImage.size().width;
+            msg.buffers[1].height = (Uint64) hashImage.size().height;
+            auto *hash_ref = new(std::nothrow) MatRef(hashImage);
+            if (hash_ref) {
+                msg.SetBuffer(1, hashImage.data,
+                              hashImage.total() * hashImage.elemSize(), hash_ref);
             } else {
                 LOGW("Unable to allow memory");
                 ok = false;
             }
-            msg.total_length += length + 24;
-            if (ok) this->agent_stream->PushMessage(&msg);
+            msg.total_length += msg.buffers[1].length + BLOB_MSG_BUFFER_HEADER_SIZE;
+            if (!ok || !this->agent_stream->PushMessage(&msg)) {
+                msg.Destroy();
+                if (encoder) {
+                    // the client would miss this delta
+                    encoder->RequestKeyFrame();
+                }
+            }
         }
     }
 
@@ -223,22 +472,10 @@ namespace irobot::agent {
             case SDL_QUIT:
                 LOGD("User requested to quit");
                 return ui::EVENT_RESULT_STOPPED_BY_USER;
-            case EVENT_NEW_OPENCV_FRAME:
             case EVENT_NEW_DATA_STREAM_CONNECTION:
-                util::mutex_lock(this->video_buffer->mutex);
-                //LOGD("Agent Manager received Opencv Frame %d\r", this->video_buffer->frame_number);
-                {
-                    this->SendOpenCVImage(message::BLOB_MSG_TYPE_OPENCV_MAT, 800, false);
-                    this->SendOpenCVImage(message::BLOB_MSG_TYPE_SCREEN_SHOT, 240, true);
-                }
-                util::mutex_unlock(this->video_buffer->mutex);
-                return ui::EVENT_RESULT_CONTINUE;
-            case EVENT_NEW_FRAME:
-                if (!has_screen) {
-                    util::mutex_lock(this->video_buffer->mutex);
-                    this->video_buffer->ConsumeRenderedFrame();
-                    util::mutex_unlock(this->video_buffer->mutex);
-                }
+                // send the current frame to the new client
+                SDL_AtomicSet(&this->resend_frame, 1);
+                this->video_buffer->WakeConsumer(this->frame_consumer);
                 return ui::EVENT_RESULT_CONTINUE;
             case SDL_KEYDOWN:
             case SDL_KEYUP:
@@ -6,24 +6,75 @@
 #ifndef ANDROID_IROBOT_AGENT_MANAGER_HPP
 #define ANDROID_IROBOT_AGENT_MANAGER_HPP
 
+#include <SDL2/SDL_atomic.h>
 #include <SDL2/SDL_events.h>
+#include <SDL2/SDL_thread.h>
 
 #include "agent/agent_controller.hpp"
 #include "agent/agent_stream.hpp"
+#include "ai/frame_snapshot.hpp"
 #include "core/controller.hpp"
+#include "core/worker_pool.hpp"
+#include "message/tile_delta.hpp"
 #include <opencv2/img_hash.hpp>
 #include "ui/events.hpp"
+#include "video/clock_offset.hpp"
+#include "video/replay_buffer.hpp"
 #include "video/video_buffer.hpp"
 
 #define EVENT_FILE_NAME "events.json"
+// strftime() format of the replays saved without a filename
+#define REPLAY_FILE_NAME "replay-%Y%m%d-%H%M%S.mp4"
+// the images of a frame (mat, screen shot) are produced in parallel
+#define AGENT_IMAGE_TYPES 2
+// interval of the agent production stats, in ms
+#define AGENT_STATS_INTERVAL 5000
 
 namespace irobot::agent {
 
+    class AgentManager;
+
+    // an image produced from a frame snapshot by a worker
+    struct AgentImageJob {
+        AgentManager *agent_manager;
+        // referenced by the job while it runs
+        ai::FrameSnapshot *snapshot;
+        message::BlobMessageType type;
+        int max_size;
+        bool color;
+    };
+
     class AgentManager { // implements all methods of Actor
 
     public:
 
         video::VideoBuffer *video_buffer = nullptr;
+        // consumer id in the video buffer
+        int frame_consumer = -1;
+        // maps the frame PTS to the host clock, if set
+        video::ClockOffset *clock_offset = nullptr;
+        // saved on CONTROL_MSG_TYPE_SAVE_REPLAY, if set
+        video::ReplayBuffer *replay_buffer = nullptr;
+        // pins the frames, off the event loop
+        SDL_Thread *frame_thread = nullptr;
+        // convert, hash and encode the images of the frames
+        WorkerPool workers{};
+        AgentImageJob image_jobs[AGENT_IMAGE_TYPES]{};
+        // frames produced, and the time they were pinned for (in us), since
+        // the last report
+        unsigned nr_produced = 0;
+        Uint64 produce_time = 0;
+        Uint32 last_report = 0;
+        // requests to the frame thread
+        SDL_atomic_t resend_frame{};
+        SDL_atomic_t save_frame{};
+        SDL_atomic_t key_frame{};
+        // send the images as BLOB_MSG_TYPE_TILE_DELTA (--agent-tile-delta)
+        bool tile_delta = false;
+        // one per image type, only accessed by its job
+        message::TileDeltaEncoder delta_encoders[AGENT_IMAGE_TYPES];
+        // the hash of the image sent, before BLOB_VERSION_3
+        cv::Ptr<cv::img_hash::ImgHashBase> phash_funcs[AGENT_IMAGE_TYPES];
         SDL_RWops *fp_events = nullptr;
         socket_t video_server_socket = INVALID_SOCKET;;
         socket_t control_server_socket = INVALID_SOCKET;;
@@ -44,23 +95,35 @@ namespace irobot::agent {
 
         void Join();
 
-        void SendOpenCVImage(message::BlobMessageType type, int size, bool color);
+        void SendOpenCVImage(ai::FrameSnapshot *snapshot, message::BlobMessageType type,
+                             int size, bool color);
+
+        void RequestKeyFrame();
 
         ui::EventResult HandleEvent(SDL_Event *event, bool has_screen);
 
         bool PushDeviceControlMessage(const message::ControlMessage *msg); // Agent-->Device
 
-        cv::Ptr<cv::img_hash::ImgHashBase> phash_func;
-
     private:
         void ProcessKey(const SDL_KeyboardEvent *event);
 
         static void ProcessAgentControlMessage(void *entity, message::ControlMessage *msg); //Client<--Agent
 
+        static int RunFrameConsumer(void *data);
+
+        static void RunImageJob(void *data);
+
+        // convert and send the images of the frame, return once done
+        void ProduceImages(ai::FrameSnapshot *snapshot);
+
+        void ReportStats();
+
         void StartRecordEvents();
 
         void StopRecordEvents();
 
+        void SaveReplay(const char *filename);
+
 
     };
 
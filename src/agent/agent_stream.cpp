@@ -14,16 +14,19 @@
 
 namespace irobot::agent {
 
-    unsigned char data_buffer[2][BLOB_MSG_SERIALIZED_MAX_SIZE];
-
     bool AgentStream::Init(socket_t socket) {
-        cbuf_init(&this->queue);
+        cbuf_init(&this->send_queue);
         bool initialized = Actor::Init();
         if (!initialized) {
 
             return false;
         }
+        if (!(this->compress_cond = SDL_CreateCond())) {
+            Actor::Destroy();
+            return false;
+        }
         this->video_server_socket = socket;
+        SDL_AtomicSet(&this->version, message::BLOB_VERSION_1);
         this->stopped = false;
         return true;
     }
@@ -32,57 +35,112 @@ namespace irobot::agent {
     bool AgentStream::WaitForClientConnection() {
         if (this->video_socket != INVALID_SOCKET) {
             platform::close_socket(&this->video_socket);
+            // the next client negotiates its own codec and version
+            this->SetCodec(message::BLOB_CODEC_NONE);
+            this->SetVersion(message::BLOB_VERSION_1);
         }
+        // the messages compressed until now are not for the next client
+        SDL_AtomicIncRef(&this->connection);
         this->video_socket = platform::net_accept(this->video_server_socket);
         LOGI("Agent stream client connected");
-        static SDL_Event new_opencv_frame_event = {
-                .type = EVENT_NEW_OPENCV_FRAME,
+        static SDL_Event new_connection_event = {
+                .type = EVENT_NEW_DATA_STREAM_CONNECTION,
         };
-        SDL_PushEvent(&new_opencv_frame_event);
+        SDL_PushEvent(&new_connection_event);
         return this->video_socket != INVALID_SOCKET;
     }
 
     void AgentStream::Destroy() {
         Actor::Destroy();
+        SDL_DestroyCond(this->compress_cond);
         message::BlobMessage msg{};
-        while (cbuf_take(&this->queue, &msg)) {
+        while (this->mailbox.Take(&msg)) {
+            msg.Destroy();
+        }
+        while (cbuf_take(&this->send_queue, &msg)) {
             msg.Destroy();
         }
+        this->compressor.Destroy();
         LOGI("Agent stream stopped");
 
     }
 
     bool AgentStream::PushMessage(
             const message::BlobMessage *msg) {
-        util::mutex_lock(this->mutex);
-        bool was_full = cbuf_is_full(&this->queue);
-        if (!was_full) {
-            bool was_empty = cbuf_is_empty(&this->queue);
-            bool res = cbuf_push(&this->queue, *msg);
-            if (was_empty) {
-                util::cond_signal(this->thread_cond);
-            }
+        util::mutex_lock(this->mutex, &this->lock_stats);
+        if (this->stopped) {
             util::mutex_unlock(this->mutex);
-            return res;
-        } else {
-            LOGD("Queue is full,skip video frame");
             return false;
         }
+        message::BlobMessage replaced{};
+        bool was_full = this->mailbox.Put(msg, &replaced);
+        util::cond_signal(this->compress_cond);
+        util::mutex_unlock(this->mutex);
+        if (was_full) {
+            // the network is slower than the frames, skip the stale one
+            SDL_AtomicIncRef(&this->nr_replaced[message::BlobMailbox::GetSlot(msg)]);
+            replaced.Destroy();
+        }
+        return true;
+    }
+
+    bool AgentStream::TakePending(message::BlobMessageType image_type,
+                                  message::BlobMessage *msg) {
+        util::mutex_lock(this->mutex, &this->lock_stats);
+        bool taken = this->mailbox.TakeSlot(image_type < BLOB_MSG_TYPE_COUNT
+                                            ? image_type : 0, msg);
+        util::mutex_unlock(this->mutex);
+        if (taken) {
+            SDL_AtomicIncRef(&this->nr_replaced[message::BlobMailbox::GetSlot(msg)]);
+        }
+        return taken;
     }
 
     bool AgentStream::ProcessMessage(
             message::BlobMessage *msg) {
+        if (msg->connection != SDL_AtomicGet(&this->connection)) {
+            // compressed (LZ4 or not) for the previous client, the new one
+            // gets the current frame anyway
+            SDL_AtomicIncRef(&this->nr_dropped[message::BlobMailbox::GetSlot(msg)]);
+            return true;
+        }
         if (this->video_socket != INVALID_SOCKET) {
-            int length = msg->Serialize(data_buffer[buffer_index % 2]);
-            if (!length) {
-                return false;
+            // only the headers are serialized, the data is sent from the
+            // buffers of the message
+            unsigned char headers[BLOB_MSG_HEADER_SIZE
+                                  + BLOB_MSG_DATA_MAX_COUNT * BLOB_MSG_BUFFER_HEADER_SIZE];
+            struct platform::NetBuffer bufs[2 * BLOB_MSG_DATA_MAX_COUNT + 1];
+            int count = 0;
+            auto version = (message::BlobVersion) SDL_AtomicGet(&this->version);
+            size_t header_size = msg->SerializeHeader(headers, version);
+            bufs[count++] = {headers, header_size};
+            unsigned char *header = headers + header_size;
+            for (int i = 0; i < msg->count; i++) {
+                msg->SerializeBufferHeader(i, header);
+                if (i) {
+                    bufs[count++] = {header, BLOB_MSG_BUFFER_HEADER_SIZE};
+                } else {
+                    // with the message header
+                    bufs[0].len += BLOB_MSG_BUFFER_HEADER_SIZE;
+                }
+                bufs[count++] = {msg->buffers[i].data, msg->buffers[i].length};
+                header += BLOB_MSG_BUFFER_HEADER_SIZE;
             }
-            int w = platform::net_send_all(this->video_socket,
-                                           data_buffer[buffer_index % 2], length);
+            ssize_t length = header_size + msg->total_length;
+            ssize_t w = platform::net_send_all_v(this->video_socket, bufs, count);
 
-            buffer_index += 1;
+            if (this->latency && w == length) {
+                this->latency->Mark(msg->latency_id, video::LATENCY_STAGE_SERIALIZED);
+            }
             this->total_bytes += length;
             this->total_frame += 1;
+            if (msg->raw_length) {
+                this->raw_bytes += length + msg->raw_length - msg->total_length;
+                this->compress_in_bytes += msg->raw_length;
+                this->compress_time += msg->compress_time;
+            } else {
+                this->raw_bytes += length;
+            }
             GetTransferSpeed();
             return w == length;
         }
@@ -96,15 +154,51 @@ namespace irobot::agent {
                               (double) (currentTime - this->start_ticks) * 1000.0 / (1024.0 * 1024.0));
         auto delta = currentTime - this->last_ticks;
         if (delta > 5000) {
-            LOGI("Video transfer speed: %.2fM/s  %.3fG in %.1f seconds with %.1f fps\n", speed,
-                 this->total_bytes / (1024.0 * 1024.0 * 1024.0),
-                 (float) (currentTime - this->start_ticks) / 1000.0,
-                 (float) this->total_frame * 500.0 / ((float) (currentTime - this->start_ticks)));
+            if (this->compress_in_bytes) {
+                // ratio of all the bytes, throughput of the compressor thread
+                LOGI("Video transfer speed: %.2fM/s  %.3fG in %.1f seconds with %.1f fps,"
+                     " compression %.2fx at %.1fM/s\n", speed,
+                     this->total_bytes / (1024.0 * 1024.0 * 1024.0),
+                     (float) (currentTime - this->start_ticks) / 1000.0,
+                     (float) this->total_frame * 500.0 / ((float) (currentTime - this->start_ticks)),
+                     (double) this->raw_bytes / (double) this->total_bytes,
+                     (double) this->compress_in_bytes / (double) (this->compress_time + 1)
+                     * 1000000.0 / (1024.0 * 1024.0));
+            } else {
+                LOGI("Video transfer speed: %.2fM/s  %.3fG in %.1f seconds with %.1f fps\n", speed,
+                     this->total_bytes / (1024.0 * 1024.0 * 1024.0),
+                     (float) (currentTime - this->start_ticks) / 1000.0,
+                     (float) this->total_frame * 500.0 / ((float) (currentTime - this->start_ticks)));
+            }
+            static const char *const type_names[BLOB_MSG_TYPE_COUNT] = {
+                    "unknown", "screen shot", "opencv mat", "tile delta"};
+            for (int i = 0; i < BLOB_MSG_TYPE_COUNT; ++i) {
+                int replaced = SDL_AtomicSet(&this->nr_replaced[i], 0);
+                int dropped = SDL_AtomicSet(&this->nr_dropped[i], 0);
+                if (replaced || dropped) {
+                    LOGI("Agent %s images: %d replaced, %d dropped", type_names[i],
+                         replaced, dropped);
+                }
+            }
             this->last_ticks = currentTime;
         }
         return speed;
     }
 
+    void AgentStream::SetCodec(message::BlobCodec blob_codec) {
+        int previous = SDL_AtomicSet(&this->codec, blob_codec);
+        if (previous != blob_codec) {
+            LOGI("Agent stream codec: %s", message::GetBlobCodecName(blob_codec));
+        }
+    }
+
+    void AgentStream::SetVersion(message::BlobVersion blob_version) {
+        int previous = SDL_AtomicSet(&this->version, blob_version);
+        if (previous != blob_version) {
+            LOGI("Agent stream message version: %d", (int) blob_version);
+        }
+    }
+
     bool AgentStream::IsConnected() {
         if (this->video_socket != INVALID_SOCKET) {
             bool connected = platform::net_try_recv(this->video_socket);
@@ -114,11 +208,34 @@ namespace irobot::agent {
     }
 
 
+    bool AgentStream::OnReceived(void *userdata, const uint8_t *data, size_t len) {
+        // the client never sends anything on the video socket
+        (void) userdata;
+        (void) data;
+        (void) len;
+        return true;
+    }
+
     int AgentStream::RunAgentReceiver(void *data) {
         auto *controller = (AgentStream *) data;
         if (!controller->WaitForClientConnection()) {
             return 0;
         }
+        if (controller->io_loop) {
+            while (!controller->stopped) {
+                if (!controller->io_loop->RecvUntilClosed(controller->video_socket,
+                                                          OnReceived, controller)) {
+                    // the io loop is stopped
+                    break;
+                }
+                LOGI("Agent stream client disconnected, trying to re-establish connection");
+                if (!controller->WaitForClientConnection()) {
+                    LOGD("Failed to re-establish connection");
+                    break;
+                }
+            }
+            return 0;
+        }
 
         while (!controller->stopped) {
             bool connected = controller->IsConnected();
@@ -142,7 +259,7 @@ namespace irobot::agent {
         for (;;) {
 
             util::mutex_lock(stream->mutex);
-            while (!stream->stopped && cbuf_is_empty(&stream->queue)) {
+            while (!stream->stopped && cbuf_is_empty(&stream->send_queue)) {
                 util::cond_wait(stream->thread_cond, stream->mutex);
             }
             if (stream->stopped) {
@@ -151,12 +268,19 @@ namespace irobot::agent {
                 break;
             }
             message::BlobMessage msg{};
-            bool non_empty = cbuf_take(&stream->queue, &msg);
+            bool non_empty = cbuf_take(&stream->send_queue, &msg);
             assert(non_empty);
             (void) non_empty;
+            // room for the compressor
+            util::cond_signal(stream->compress_cond);
+            util::mutex_unlock(stream->mutex);
+
+            // off the lock, the next message is compressed meanwhile
             bool ok = stream->ProcessMessage(&msg);
+            if (!ok) {
+                SDL_AtomicIncRef(&stream->nr_dropped[message::BlobMailbox::GetSlot(&msg)]);
+            }
             msg.Destroy();
-            util::mutex_unlock(stream->mutex);
 
             if (!ok) {
                 LOGD("stream socket error 2,trying to re-establish connection");
@@ -167,8 +291,66 @@ namespace irobot::agent {
         return 0;
     }
 
+    int AgentStream::RunCompressor(void *data) {
+        auto *stream = static_cast<AgentStream *>(data);
+
+        for (;;) {
+            util::mutex_lock(stream->mutex);
+            // the messages stay in the mailbox (replaceable by newer ones)
+            // until they can be sent
+            while (!stream->stopped && (stream->mailbox.IsEmpty()
+                                        || cbuf_is_full(&stream->send_queue))) {
+                util::cond_wait(stream->compress_cond, stream->mutex);
+            }
+            if (stream->stopped) {
+                util::mutex_unlock(stream->mutex);
+                break;
+            }
+            message::BlobMessage msg{};
+            bool non_empty = stream->mailbox.Take(&msg);
+            assert(non_empty);
+            (void) non_empty;
+            util::mutex_unlock(stream->mutex);
+
+            // messages go through this thread even uncompressed, to keep
+            // their order (tile deltas) when the codec changes
+            // the connection before the codec: the codec of a previous client
+            // is never tagged with the connection of the next one
+            msg.connection = SDL_AtomicGet(&stream->connection);
+            auto codec = (message::BlobCodec) SDL_AtomicGet(&stream->codec);
+            stream->compressor.Compress(&msg, codec);
+
+            util::mutex_lock(stream->mutex);
+            // send_queue only fills while this message is compressed
+            while (!stream->stopped && cbuf_is_full(&stream->send_queue)) {
+                util::cond_wait(stream->compress_cond, stream->mutex);
+            }
+            if (stream->stopped) {
+                util::mutex_unlock(stream->mutex);
+                SDL_AtomicIncRef(&stream->nr_dropped[message::BlobMailbox::GetSlot(&msg)]);
+                msg.Destroy();
+                break;
+            }
+            bool was_empty = cbuf_is_empty(&stream->send_queue);
+            cbuf_push(&stream->send_queue, msg);
+            if (was_empty) {
+                util::cond_signal(stream->thread_cond);
+            }
+            util::mutex_unlock(stream->mutex);
+        }
+        return 0;
+    }
+
+    void AgentStream::Stop() {
+        Actor::Stop();
+        util::mutex_lock(this->mutex);
+        util::cond_signal(this->compress_cond);
+        util::mutex_unlock(this->mutex);
+    }
+
     void AgentStream::Join() {
         SDL_WaitThread(this->thread, nullptr);
+        SDL_WaitThread(this->compress_thread, nullptr);
         SDL_WaitThread(this->receiver_thread, nullptr);
 
     }
@@ -184,6 +366,14 @@ namespace irobot::agent {
             return false;
         }
 
+        LOGD("Starting agent compressor thread");
+        this->compress_thread = SDL_CreateThread(RunCompressor, "agent compressor",
+                                                 this);
+        if (!this->compress_thread) {
+            LOGC("Could not start agent compressor thread");
+            return false;
+        }
+
         LOGD("Starting agent stream thread");
         this->thread = SDL_CreateThread(RunStream, "agent stream",
                                         this);
@@ -6,12 +6,17 @@
 #ifndef ANDROID_IROBOT_AGENT_STREAM_HPP
 #define ANDROID_IROBOT_AGENT_STREAM_HPP
 
+#include <SDL2/SDL_atomic.h>
 #include <SDL2/SDL_timer.h>
 
 #include "core/actor.hpp"
 #include "util/cbuf.hpp"
+#include "util/lock.hpp"
+#include "platform/io_loop.hpp"
 #include "platform/net.hpp"
+#include "message/blob_codec.hpp"
 #include "message/blob_msg.hpp"
+#include "video/latency.hpp"
 
 namespace irobot::agent {
 
@@ -20,7 +25,25 @@ namespace irobot::agent {
         socket_t video_socket = INVALID_SOCKET;
         socket_t video_server_socket = INVALID_SOCKET;
         SDL_Thread *receiver_thread = nullptr;
-        message::BlobMessageQueue queue{};
+        // compresses the pushed messages into send_queue (in order)
+        SDL_Thread *compress_thread = nullptr;
+        SDL_cond *compress_cond = nullptr;
+        // the pushed messages, until send_queue has room
+        message::BlobMailbox mailbox{};
+        message::BlobMessageQueue send_queue{};
+        // BlobCodec negotiated with the client, reset on disconnection
+        SDL_atomic_t codec{};
+        // BlobVersion of the message headers, reset on disconnection
+        SDL_atomic_t version{};
+        // incremented on each client connection, after the codec reset
+        SDL_atomic_t connection{};
+        message::BlobCompressor compressor{};
+        // if set, the io loop reports the disconnections, instead of polling
+        platform::IoLoop *io_loop = nullptr;
+        // marks the frames (BlobMessage.latency_id) sent, if set
+        video::LatencyTracker *latency = nullptr;
+        // waits of the producers (PushMessage(), TakePending())
+        util::LockWaitStats lock_stats{};
 
         bool Init(socket_t server_socket);
 
@@ -28,18 +51,35 @@ namespace irobot::agent {
 
         void Destroy() override;
 
+        void Stop() override;
+
         void Join() override;
 
         bool Start() override;
 
+        void SetCodec(message::BlobCodec blob_codec);
+
+        void SetVersion(message::BlobVersion blob_version);
+
+        // never blocks: replaces the unsent message of the same image type
         bool PushMessage(const message::BlobMessage *msg);
 
+        // take back the unsent message of image_type, to merge it with the
+        // next one (tile deltas)
+        bool TakePending(message::BlobMessageType image_type,
+                         message::BlobMessage *msg);
+
+        // a message compressed for a previous connection is dropped
         bool ProcessMessage(message::BlobMessage *msg);
 
         static int RunStream(void *data);
 
+        static int RunCompressor(void *data);
+
         static int RunAgentReceiver(void *data);
 
+        static bool OnReceived(void *userdata, const uint8_t *data, size_t len);
+
         bool IsConnected();
 
         float GetTransferSpeed();
@@ -47,9 +87,15 @@ namespace irobot::agent {
 
     private:
 
-        int buffer_index = 0;
         unsigned long total_bytes = 0;
         unsigned long total_frame = 0;
+        // before compression
+        unsigned long raw_bytes = 0;
+        unsigned long compress_in_bytes = 0;
+        Uint64 compress_time = 0;
+        // per mailbox slot: replaced by a newer message, failed to send
+        SDL_atomic_t nr_replaced[BLOB_MSG_TYPE_COUNT]{};
+        SDL_atomic_t nr_dropped[BLOB_MSG_TYPE_COUNT]{};
         Uint32 start_ticks = 0;
         Uint32 last_ticks = 0;
 
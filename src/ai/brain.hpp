@@ -11,13 +11,11 @@
 #include <opencv2/highgui.hpp>
 #include <opencv2/imgproc/imgproc.hpp>
 
-#include "video/video_buffer.hpp"
+#include "frame_snapshot.hpp"
 
 namespace irobot::ai {
-    void SaveFrame(video::VideoBuffer video_buffer);
-
-    cv::Mat ConvertToMat(video::VideoBuffer video_buffer,
-                         int max_size, bool color);
+    // save the BGR image of the frame to capture<frame number>.ppm
+    void SaveFrame(FrameSnapshot *snapshot);
 
 }
 
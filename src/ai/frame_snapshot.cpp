@@ -0,0 +1,215 @@
+//
+// Created by James Shen on 17/10/26.
+// Copyright (c) 2020 GUIDEBEE IT. All rights reserved
+//
+
+#include "frame_snapshot.hpp"
+
+#if defined (__cplusplus)
+extern "C" {
+#endif
+
+#include <libswscale/swscale.h>
+
+#if defined (__cplusplus)
+}
+#endif
+
+#include <algorithm>
+#include <new>
+
+#include <opencv2/img_hash.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+
+#include "image_scaler.hpp"
+#include "util/lock.hpp"
+#include "util/log.hpp"
+
+namespace irobot::ai {
+
+    FrameSnapshot *FrameSnapshot::Create(video::VideoBuffer *vb, int consumer) {
+        const video::FrameSlot *frame_slot = vb->GetFrameSlot(consumer);
+        if (!frame_slot) {
+            return nullptr;
+        }
+        auto *snapshot = new(std::nothrow) FrameSnapshot();
+        if (!snapshot) {
+            LOGW("Could not allocate frame snapshot");
+            return nullptr;
+        }
+        if (!(snapshot->mutex = SDL_CreateMutex())) {
+            delete snapshot;
+            return nullptr;
+        }
+        if (!(snapshot->ready_cond = SDL_CreateCond())) {
+            delete snapshot;
+            return nullptr;
+        }
+        snapshot->video_buffer = vb;
+        snapshot->slot = vb->PinFrame(consumer);
+        const AVFrame *frame = frame_slot->frame;
+        snapshot->frame = frame;
+        snapshot->frame_number = frame_slot->frame_number;
+        snapshot->pts = frame->pts;
+        snapshot->width = frame->width;
+        snapshot->height = frame->height;
+        snapshot->decode_time = frame_slot->decode_time;
+        SDL_AtomicSet(&snapshot->refs, 1);
+        return snapshot;
+    }
+
+    FrameSnapshot::~FrameSnapshot() {
+        if (this->slot != -1) {
+            this->video_buffer->UnpinFrame(this->slot);
+        }
+        if (this->ready_cond) {
+            SDL_DestroyCond(this->ready_cond);
+        }
+        if (this->mutex) {
+            SDL_DestroyMutex(this->mutex);
+        }
+    }
+
+    void FrameSnapshot::Acquire() {
+        SDL_AtomicIncRef(&this->refs);
+    }
+
+    void FrameSnapshot::Release() {
+        if (SDL_AtomicDecRef(&this->refs)) {
+            delete this;
+        }
+    }
+
+    int FrameSnapshot::GetLevelSize(int max_size) {
+        return max_size >= std::max(this->width, this->height) ? 0 : max_size;
+    }
+
+    cv::Mat FrameSnapshot::GetBGR() {
+        return this->GetDerived(DERIVED_IMAGE, 0, true);
+    }
+
+    cv::Mat FrameSnapshot::GetGray() {
+        return this->GetDerived(DERIVED_IMAGE, 0, false);
+    }
+
+    cv::Mat FrameSnapshot::GetScaled(int max_size, bool color) {
+        return this->GetDerived(DERIVED_IMAGE, this->GetLevelSize(max_size), color);
+    }
+
+    cv::Mat FrameSnapshot::GetHash() {
+        return this->GetDerived(DERIVED_HASH, 0, false);
+    }
+
+    int FrameSnapshot::GetImageCount() {
+        util::mutex_lock(this->mutex);
+        int count = this->nr_images;
+        util::mutex_unlock(this->mutex);
+        return count;
+    }
+
+    cv::Mat FrameSnapshot::GetDerived(enum DerivedKind kind, int max_size, bool color) {
+        util::mutex_lock(this->mutex);
+        struct DerivedImage *image = nullptr;
+        for (int i = 0; i < this->nr_images; ++i) {
+            if (this->images[i].kind == kind && this->images[i].max_size == max_size
+                && this->images[i].color == color) {
+                image = &this->images[i];
+                break;
+            }
+        }
+        if (image) {
+            // converted by another analysis, maybe right now
+            while (!image->ready) {
+                util::cond_wait(this->ready_cond, this->mutex);
+            }
+            cv::Mat mat = image->mat;
+            util::mutex_unlock(this->mutex);
+            return mat;
+        }
+        if (this->nr_images == FRAME_SNAPSHOT_MAX_IMAGES) {
+            util::mutex_unlock(this->mutex);
+            LOGW("Too many images of frame %d, not cached", this->frame_number);
+            return kind == DERIVED_HASH ? this->ComputeHash() : this->Convert(max_size, color);
+        }
+        image = &this->images[this->nr_images++];
+        image->kind = kind;
+        image->max_size = max_size;
+        image->color = color;
+        image->ready = false;
+        util::mutex_unlock(this->mutex);
+
+        // the other images are available meanwhile
+        cv::Mat mat = kind == DERIVED_HASH ? this->ComputeHash() : this->Convert(max_size, color);
+
+        util::mutex_lock(this->mutex);
+        image->mat = mat;
+        image->ready = true;
+        util::cond_broadcast(this->ready_cond);
+        util::mutex_unlock(this->mutex);
+        return mat;
+    }
+
+    cv::Mat FrameSnapshot::Convert(int max_size, bool color) {
+        int out_width = this->width;
+        int out_height = this->height;
+        if (max_size) {
+            GetScaledSize(this->width, this->height, max_size, &out_width, &out_height);
+        }
+        cv::Mat image(out_height, out_width, color ? CV_8UC3 : CV_8UC1);
+        // scale the decoded planes directly, in one pass
+        bool ok = color
+                  ? ScaleI420ToBGR(this->frame, image.data, (int) image.step,
+                                   out_width, out_height, SCALER_ISA_AUTO)
+                  : ScaleI420ToGray(this->frame, image.data, (int) image.step,
+                                    out_width, out_height, SCALER_ISA_AUTO);
+        if (ok) {
+            return image;
+        }
+
+        // other pixel formats: from the full size BGR image
+        if (max_size || !color) {
+            cv::Mat bgr = this->GetBGR();
+            if (bgr.empty()) {
+                return cv::Mat();
+            }
+            cv::Mat scaled = bgr;
+            if (max_size) {
+                cv::resize(bgr, scaled, cv::Size(out_width, out_height));
+            }
+            if (color) {
+                return scaled;
+            }
+            cv::Mat gray;
+            cv::cvtColor(scaled, gray, cv::COLOR_BGR2GRAY);
+            return gray;
+        }
+
+        SwsContext *sws_ctx = sws_getContext(this->width, this->height,
+                                             (enum AVPixelFormat) this->frame->format,
+                                             this->width, this->height,
+                                             AV_PIX_FMT_BGR24, SWS_BILINEAR,
+                                             nullptr, nullptr, nullptr);
+        if (!sws_ctx) {
+            LOGE("Could not create BGR conversion context");
+            return cv::Mat();
+        }
+        uint8_t *dst_data[4] = {image.data};
+        int dst_linesize[4] = {(int) image.step};
+        sws_scale(sws_ctx, (const uint8_t *const *) this->frame->data,
+                  this->frame->linesize, 0, this->height, dst_data, dst_linesize);
+        sws_freeContext(sws_ctx);
+        return image;
+    }
+
+    cv::Mat FrameSnapshot::ComputeHash() {
+        cv::Mat image = this->GetScaled(FRAME_HASH_SIZE, false);
+        if (image.empty()) {
+            return cv::Mat();
+        }
+        cv::Mat hash;
+        // a PHash instance is not reentrant
+        cv::img_hash::pHash(image, hash);
+        return hash;
+    }
+
+}
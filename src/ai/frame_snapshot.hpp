@@ -0,0 +1,112 @@
+//
+// Created by James Shen on 17/10/26.
+// Copyright (c) 2020 GUIDEBEE IT. All rights reserved
+//
+
+#ifndef ANDROID_IROBOT_FRAME_SNAPSHOT_HPP
+#define ANDROID_IROBOT_FRAME_SNAPSHOT_HPP
+
+#include <SDL2/SDL_atomic.h>
+#include <SDL2/SDL_mutex.h>
+
+#include <opencv2/core.hpp>
+
+#include "video/video_buffer.hpp"
+
+// derived images cached per snapshot (BGR, gray, downscaled...)
+#define FRAME_SNAPSHOT_MAX_IMAGES 8
+// the pHash of a frame is computed from its gray image of this size
+#define FRAME_HASH_SIZE 64
+
+namespace irobot::ai {
+
+    // Refcounted, immutable view of a decoded frame, shared by the analyses
+    // of the frame (on any thread).
+    //
+    // The slot of the frame stays pinned in the video buffer until the last
+    // reference is released, so the decoded planes are read without any
+    // lock. Each derived image is converted on its first request only; the
+    // others get the same mat, which owns its data (it remains valid after
+    // the release) and MUST NOT be modified.
+    class FrameSnapshot {
+    public:
+        const AVFrame *frame = nullptr;
+        int frame_number = 0;
+        int64_t pts = 0;
+        int width = 0;
+        int height = 0;
+        // av_gettime_relative() when the frame was offered
+        int64_t decode_time = 0;
+
+        // snapshot of the frame pinned by the consumer (see
+        // VideoBuffer::AcquireFrame()), with one reference
+        // release it before the consumer acquires the next frame, or it
+        // keeps one more slot from the decoder
+        // return nullptr if no frame is pinned (or on error)
+        static FrameSnapshot *Create(video::VideoBuffer *vb, int consumer);
+
+        void Acquire();
+
+        // the snapshot is deleted with its last reference
+        void Release();
+
+        // full size BGR24 image
+        cv::Mat GetBGR();
+
+        // full size 8-bit gray image, with the levels of the BGR one
+        cv::Mat GetGray();
+
+        // image scaled so that its largest side is max_size (the full size
+        // one if it is not smaller)
+        cv::Mat GetScaled(int max_size, bool color);
+
+        // pHash (cv::img_hash::PHash) of the frame, from its gray image of
+        // FRAME_HASH_SIZE
+        cv::Mat GetHash();
+
+        // return the number of images converted so far
+        int GetImageCount();
+
+    private:
+        enum DerivedKind {
+            DERIVED_IMAGE,
+            DERIVED_HASH,
+        };
+
+        struct DerivedImage {
+            enum DerivedKind kind;
+            // 0 for the full size
+            int max_size;
+            bool color;
+            // false while being converted
+            bool ready;
+            cv::Mat mat;
+        };
+
+        video::VideoBuffer *video_buffer = nullptr;
+        int slot = -1;
+        SDL_atomic_t refs{};
+        // protects the images, held only to look them up
+        SDL_mutex *mutex = nullptr;
+        SDL_cond *ready_cond = nullptr;
+        struct DerivedImage images[FRAME_SNAPSHOT_MAX_IMAGES];
+        int nr_images = 0;
+
+        FrameSnapshot() = default;
+
+        ~FrameSnapshot();
+
+        cv::Mat GetDerived(enum DerivedKind kind, int max_size, bool color);
+
+        cv::Mat Convert(int max_size, bool color);
+
+        cv::Mat ComputeHash();
+
+        // max_size normalized: 0 for the full size
+        int GetLevelSize(int max_size);
+
+    };
+
+}
+
+#endif //ANDROID_IROBOT_FRAME_SNAPSHOT_HPP
@@ -0,0 +1,325 @@
+//
+// Created by James Shen on 17/10/26.
+// Copyright (c) 2020 GUIDEBEE IT. All rights reserved
+//
+
+#include "image_scaler.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define SCALER_HAVE_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+// MSVC compiles the intrinsics without any target flag
+#define SCALER_TARGET(isa)
+#else
+#define SCALER_TARGET(isa) __attribute__((target(isa)))
+#endif
+#endif
+
+// bilinear weights, in 1/256
+#define SCALER_WEIGHT_BITS 8
+#define SCALER_WEIGHT_ONE (1 << SCALER_WEIGHT_BITS)
+
+namespace irobot::ai {
+
+    // source line (or column) and weight for each destination one
+    struct ScalerAxis {
+        std::vector<int> ofs0;
+        std::vector<int> ofs1;
+        std::vector<int> weight; // of ofs1, ofs0 is weighted SCALER_WEIGHT_ONE - weight
+    };
+
+    // map destination pixel centers to the source, like cv::resize()
+    static void init_axis(struct ScalerAxis *axis, int src_size, int dst_size) {
+        axis->ofs0.resize(dst_size);
+        axis->ofs1.resize(dst_size);
+        axis->weight.resize(dst_size);
+        for (int i = 0; i < dst_size; ++i) {
+            // position in 1/65536 of a source pixel
+            int64_t pos = ((int64_t) (2 * i + 1) * src_size << 16) / (2 * dst_size)
+                          - (1 << 15);
+            if (pos < 0) {
+                pos = 0;
+            }
+            auto ofs = (int) (pos >> 16);
+            int weight = (int) (((pos & 0xFFFF) + (1 << (15 - SCALER_WEIGHT_BITS)))
+                    >> (16 - SCALER_WEIGHT_BITS));
+            if (weight == SCALER_WEIGHT_ONE) {
+                ++ofs;
+                weight = 0;
+            }
+            if (ofs >= src_size - 1) {
+                ofs = src_size - 1;
+                weight = 0;
+            }
+            axis->ofs0[i] = ofs;
+            axis->ofs1[i] = weight ? ofs + 1 : ofs;
+            axis->weight[i] = weight;
+        }
+    }
+
+    // blend two source rows, weight in [1, SCALER_WEIGHT_ONE - 1]
+    typedef void (*LerpRowFunc)(const uint8_t *a, const uint8_t *b, int weight,
+                                uint8_t *dst, int n);
+
+    static void lerp_row_scalar(const uint8_t *a, const uint8_t *b, int weight,
+                                uint8_t *dst, int n) {
+        int weight_a = SCALER_WEIGHT_ONE - weight;
+        for (int i = 0; i < n; ++i) {
+            dst[i] = (uint8_t) ((a[i] * weight_a + b[i] * weight + 128)
+                    >> SCALER_WEIGHT_BITS);
+        }
+    }
+
+#ifdef SCALER_HAVE_X86
+
+    // the products fit in unsigned 16 bits: 255 * 256 + 128 < 65536
+
+    SCALER_TARGET("sse4.1")
+    static void lerp_row_sse41(const uint8_t *a, const uint8_t *b, int weight,
+                               uint8_t *dst, int n) {
+        __m128i wa = _mm_set1_epi16((short) (SCALER_WEIGHT_ONE - weight));
+        __m128i wb = _mm_set1_epi16((short) weight);
+        __m128i round = _mm_set1_epi16(128);
+        int i = 0;
+        for (; i + 16 <= n; i += 16) {
+            __m128i va = _mm_loadu_si128((const __m128i *) &a[i]);
+            __m128i vb = _mm_loadu_si128((const __m128i *) &b[i]);
+            __m128i lo = _mm_add_epi16(
+                    _mm_add_epi16(_mm_mullo_epi16(_mm_cvtepu8_epi16(va), wa),
+                                  _mm_mullo_epi16(_mm_cvtepu8_epi16(vb), wb)),
+                    round);
+            __m128i hi = _mm_add_epi16(
+                    _mm_add_epi16(
+                            _mm_mullo_epi16(_mm_cvtepu8_epi16(_mm_srli_si128(va, 8)), wa),
+                            _mm_mullo_epi16(_mm_cvtepu8_epi16(_mm_srli_si128(vb, 8)), wb)),
+                    round);
+            lo = _mm_srli_epi16(lo, SCALER_WEIGHT_BITS);
+            hi = _mm_srli_epi16(hi, SCALER_WEIGHT_BITS);
+            _mm_storeu_si128((__m128i *) &dst[i], _mm_packus_epi16(lo, hi));
+        }
+        lerp_row_scalar(&a[i], &b[i], weight, &dst[i], n - i);
+    }
+
+    SCALER_TARGET("avx2")
+    static void lerp_row_avx2(const uint8_t *a, const uint8_t *b, int weight,
+                              uint8_t *dst, int n) {
+        __m256i wa = _mm256_set1_epi16((short) (SCALER_WEIGHT_ONE - weight));
+        __m256i wb = _mm256_set1_epi16((short) weight);
+        __m256i round = _mm256_set1_epi16(128);
+        int i = 0;
+        for (; i + 32 <= n; i += 32) {
+            __m256i a_lo = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *) &a[i]));
+            __m256i a_hi = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *) &a[i + 16]));
+            __m256i b_lo = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *) &b[i]));
+            __m256i b_hi = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *) &b[i + 16]));
+            __m256i lo = _mm256_add_epi16(
+                    _mm256_add_epi16(_mm256_mullo_epi16(a_lo, wa),
+                                     _mm256_mullo_epi16(b_lo, wb)), round);
+            __m256i hi = _mm256_add_epi16(
+                    _mm256_add_epi16(_mm256_mullo_epi16(a_hi, wa),
+                                     _mm256_mullo_epi16(b_hi, wb)), round);
+            lo = _mm256_srli_epi16(lo, SCALER_WEIGHT_BITS);
+            hi = _mm256_srli_epi16(hi, SCALER_WEIGHT_BITS);
+            // packus works per 128-bit lane, restore the order of the quadwords
+            __m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi16(lo, hi), 0xD8);
+            _mm256_storeu_si256((__m256i *) &dst[i], packed);
+        }
+        lerp_row_sse41(&a[i], &b[i], weight, &dst[i], n - i);
+    }
+
+    static enum ScalerIsa detect_isa() {
+#ifdef _MSC_VER
+        int info[4];
+        __cpuid(info, 0);
+        int nr_ids = info[0];
+        if (nr_ids < 1) {
+            return SCALER_ISA_SCALAR;
+        }
+        __cpuid(info, 1);
+        bool sse41 = info[2] & (1 << 19);
+        bool osxsave = info[2] & (1 << 27);
+        bool avx = info[2] & (1 << 28);
+        bool avx2 = false;
+        if (nr_ids >= 7 && osxsave && avx && (_xgetbv(0) & 6) == 6) {
+            __cpuidex(info, 7, 0);
+            avx2 = info[1] & (1 << 5);
+        }
+#else
+        __builtin_cpu_init();
+        bool sse41 = __builtin_cpu_supports("sse4.1");
+        bool avx2 = __builtin_cpu_supports("avx2");
+#endif
+        if (avx2) {
+            return SCALER_ISA_AVX2;
+        }
+        return sse41 ? SCALER_ISA_SSE41 : SCALER_ISA_SCALAR;
+    }
+
+#else
+
+    static enum ScalerIsa detect_isa() {
+        return SCALER_ISA_SCALAR;
+    }
+
+#endif
+
+    enum ScalerIsa GetScalerIsa() {
+        static enum ScalerIsa isa = detect_isa();
+        return isa;
+    }
+
+    const char *GetScalerIsaName(enum ScalerIsa isa) {
+        switch (isa) {
+            case SCALER_ISA_AUTO:
+                return "auto";
+            case SCALER_ISA_SCALAR:
+                return "scalar";
+            case SCALER_ISA_SSE41:
+                return "sse4.1";
+            case SCALER_ISA_AVX2:
+                return "avx2";
+        }
+        return "unknown";
+    }
+
+    static LerpRowFunc get_lerp_row(enum ScalerIsa isa) {
+        enum ScalerIsa best = GetScalerIsa();
+        if (isa == SCALER_ISA_AUTO || isa > best) {
+            isa = best;
+        }
+        switch (isa) {
+#ifdef SCALER_HAVE_X86
+            case SCALER_ISA_AVX2:
+                return lerp_row_avx2;
+            case SCALER_ISA_SSE41:
+                return lerp_row_sse41;
+#endif
+            default:
+                return lerp_row_scalar;
+        }
+    }
+
+    void GetScaledSize(int width, int height, int max_size,
+                       int *scaled_width, int *scaled_height) {
+        double scale = (double) max_size / std::max(width, height);
+        *scaled_width = std::max(1, (int) std::lround(width * scale));
+        *scaled_height = std::max(1, (int) std::lround(height * scale));
+    }
+
+    static bool is_supported(const AVFrame *frame, int dst_width, int dst_height) {
+        return (frame->format == AV_PIX_FMT_YUV420P
+                || frame->format == AV_PIX_FMT_YUVJ420P)
+               && frame->width > 0 && frame->height > 0
+               && dst_width > 0 && dst_height > 0;
+    }
+
+    // blend the source rows of the destination row i, without copying when
+    // a single source row is used
+    static const uint8_t *vertical_pass(LerpRowFunc lerp_row,
+                                        const struct ScalerAxis *axis, int i,
+                                        const uint8_t *plane, int linesize,
+                                        int width, uint8_t *tmp) {
+        const uint8_t *row0 = &plane[(ptrdiff_t) axis->ofs0[i] * linesize];
+        if (!axis->weight[i]) {
+            return row0;
+        }
+        const uint8_t *row1 = &plane[(ptrdiff_t) axis->ofs1[i] * linesize];
+        lerp_row(row0, row1, axis->weight[i], tmp, width);
+        return tmp;
+    }
+
+    static inline int horizontal_sample(const struct ScalerAxis *axis, int i,
+                                        const uint8_t *row) {
+        int weight = axis->weight[i];
+        return (row[axis->ofs0[i]] * (SCALER_WEIGHT_ONE - weight)
+                + row[axis->ofs1[i]] * weight + 128) >> SCALER_WEIGHT_BITS;
+    }
+
+    static inline uint8_t clip_uint8(int value) {
+        return (uint8_t) (value < 0 ? 0 : value > 255 ? 255 : value);
+    }
+
+    bool ScaleI420ToGray(const AVFrame *frame, uint8_t *dst, int dst_stride,
+                         int dst_width, int dst_height, enum ScalerIsa isa) {
+        if (!is_supported(frame, dst_width, dst_height)) {
+            return false;
+        }
+        LerpRowFunc lerp_row = get_lerp_row(isa);
+        // gray as computed from the BGR image: the luma expanded to full range
+        bool full_range = frame->format == AV_PIX_FMT_YUVJ420P;
+        uint8_t luma[256];
+        for (int i = 0; i < 256; ++i) {
+            luma[i] = full_range ? (uint8_t) i : clip_uint8((298 * (i - 16) + 128) >> 8);
+        }
+        struct ScalerAxis x_axis, y_axis;
+        init_axis(&x_axis, frame->width, dst_width);
+        init_axis(&y_axis, frame->height, dst_height);
+        std::vector<uint8_t> tmp(frame->width);
+
+        for (int j = 0; j < dst_height; ++j) {
+            const uint8_t *row = vertical_pass(lerp_row, &y_axis, j,
+                                               frame->data[0], frame->linesize[0],
+                                               frame->width, tmp.data());
+            uint8_t *out = &dst[(ptrdiff_t) j * dst_stride];
+            for (int i = 0; i < dst_width; ++i) {
+                out[i] = luma[horizontal_sample(&x_axis, i, row)];
+            }
+        }
+        return true;
+    }
+
+    bool ScaleI420ToBGR(const AVFrame *frame, uint8_t *dst, int dst_stride,
+                        int dst_width, int dst_height, enum ScalerIsa isa) {
+        if (!is_supported(frame, dst_width, dst_height)) {
+            return false;
+        }
+        LerpRowFunc lerp_row = get_lerp_row(isa);
+        // BT.601 coefficients, in 1/256
+        bool full_range = frame->format == AV_PIX_FMT_YUVJ420P;
+        int luma_offset = full_range ? 0 : 16;
+        int c_y = full_range ? 256 : 298;
+        int c_bu = full_range ? 454 : 516;
+        int c_gu = full_range ? 88 : 100;
+        int c_gv = full_range ? 183 : 208;
+        int c_rv = full_range ? 359 : 409;
+        int chroma_width = (frame->width + 1) / 2;
+        int chroma_height = (frame->height + 1) / 2;
+        struct ScalerAxis x_axis, y_axis, cx_axis, cy_axis;
+        init_axis(&x_axis, frame->width, dst_width);
+        init_axis(&y_axis, frame->height, dst_height);
+        init_axis(&cx_axis, chroma_width, dst_width);
+        init_axis(&cy_axis, chroma_height, dst_height);
+        std::vector<uint8_t> tmp_y(frame->width);
+        std::vector<uint8_t> tmp_u(chroma_width);
+        std::vector<uint8_t> tmp_v(chroma_width);
+
+        for (int j = 0; j < dst_height; ++j) {
+            const uint8_t *row_y = vertical_pass(lerp_row, &y_axis, j,
+                                                 frame->data[0], frame->linesize[0],
+                                                 frame->width, tmp_y.data());
+            const uint8_t *row_u = vertical_pass(lerp_row, &cy_axis, j,
+                                                 frame->data[1], frame->linesize[1],
+                                                 chroma_width, tmp_u.data());
+            const uint8_t *row_v = vertical_pass(lerp_row, &cy_axis, j,
+                                                 frame->data[2], frame->linesize[2],
+                                                 chroma_width, tmp_v.data());
+            uint8_t *out = &dst[(ptrdiff_t) j * dst_stride];
+            for (int i = 0; i < dst_width; ++i) {
+                int c = c_y * (horizontal_sample(&x_axis, i, row_y) - luma_offset);
+                int d = horizontal_sample(&cx_axis, i, row_u) - 128;
+                int e = horizontal_sample(&cx_axis, i, row_v) - 128;
+                out[3 * i] = clip_uint8((c + c_bu * d + 128) >> 8);
+                out[3 * i + 1] = clip_uint8((c - c_gu * d - c_gv * e + 128) >> 8);
+                out[3 * i + 2] = clip_uint8((c + c_rv * e + 128) >> 8);
+            }
+        }
+        return true;
+    }
+
+}
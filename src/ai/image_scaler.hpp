@@ -0,0 +1,57 @@
+//
+// Created by James Shen on 17/10/26.
+// Copyright (c) 2020 GUIDEBEE IT. All rights reserved
+//
+
+#ifndef ANDROID_IROBOT_IMAGE_SCALER_HPP
+#define ANDROID_IROBOT_IMAGE_SCALER_HPP
+
+#include <cstdint>
+
+#if defined (__cplusplus)
+extern "C" {
+#endif
+
+#include <libavutil/frame.h>
+
+#if defined (__cplusplus)
+}
+#endif
+
+namespace irobot::ai {
+
+    enum ScalerIsa {
+        SCALER_ISA_AUTO,   // the best one supported by the cpu
+        SCALER_ISA_SCALAR,
+        SCALER_ISA_SSE41,
+        SCALER_ISA_AVX2,
+    };
+
+    // the best instruction set supported by the cpu (detected once)
+    enum ScalerIsa GetScalerIsa();
+
+    const char *GetScalerIsaName(enum ScalerIsa isa);
+
+    // size of the image scaled so that its largest side is max_size, the
+    // way cv::resize() computes it
+    void GetScaledSize(int width, int height, int max_size,
+                       int *scaled_width, int *scaled_height);
+
+    // Downscale a decoded YUV420P frame directly to a gray image, reading
+    // the Y plane only (bilinear, like cv::resize() INTER_LINEAR), with the
+    // levels of the gray computed from the BGR image.
+    // isa is lowered to the best supported one, all the paths give the same
+    // output.
+    // return false if the frame format is not supported
+    bool ScaleI420ToGray(const AVFrame *frame, uint8_t *dst, int dst_stride,
+                         int dst_width, int dst_height, enum ScalerIsa isa);
+
+    // Downscale a decoded YUV420P frame directly to a BGR24 image (BT.601,
+    // like swscale defaults).
+    // return false if the frame format is not supported
+    bool ScaleI420ToBGR(const AVFrame *frame, uint8_t *dst, int dst_stride,
+                        int dst_width, int dst_height, enum ScalerIsa isa);
+
+}
+
+#endif //ANDROID_IROBOT_IMAGE_SCALER_HPP
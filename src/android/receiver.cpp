@@ -7,7 +7,9 @@
 
 #include <SDL2/SDL_clipboard.h>
 
+#include <algorithm>
 #include <cassert>
+#include <cstring>
 #include "util/log.hpp"
 
 namespace irobot::android {
@@ -66,8 +68,46 @@ namespace irobot::android {
         }
     }
 
+    struct ReceiveBuffer {
+        unsigned char data[DEVICE_MSG_SERIALIZED_MAX_SIZE];
+        size_t head;
+    };
+
+    bool Receiver::OnReceived(void *userdata, const uint8_t *data, size_t len) {
+        auto *buf = (struct ReceiveBuffer *) userdata;
+        while (len) {
+            size_t n = std::min(len, DEVICE_MSG_SERIALIZED_MAX_SIZE - buf->head);
+            memcpy(&buf->data[buf->head], data, n);
+            buf->head += n;
+            data += n;
+            len -= n;
+
+            ssize_t consumed = ProcessMessages(buf->data, buf->head);
+            if (consumed == -1) {
+                // an error occurred
+                return false;
+            }
+            // shift the remaining data in the buffer
+            memmove(buf->data, &buf->data[consumed], buf->head - consumed);
+            buf->head -= consumed;
+            if (buf->head == DEVICE_MSG_SERIALIZED_MAX_SIZE) {
+                LOGE("Device message too large");
+                return false;
+            }
+        }
+        return true;
+    }
+
     int Receiver::RunReceiver(void *data) {
         auto *receiver = (Receiver *) data;
+        if (receiver->io_loop) {
+            struct ReceiveBuffer recv_buf{};
+            receiver->io_loop->RecvUntilClosed(receiver->control_socket,
+                                               OnReceived, &recv_buf);
+            LOGD("Receiver stopped");
+            return 0;
+        }
+
         unsigned char buf[DEVICE_MSG_SERIALIZED_MAX_SIZE];
         size_t head = 0;
 
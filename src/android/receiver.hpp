@@ -9,6 +9,7 @@
 #include "core/actor.hpp"
 #include "core/common.hpp"
 #include "message/device_msg.hpp"
+#include "platform/io_loop.hpp"
 #include "platform/net.hpp"
 
 #define DEVICE_NAME_FIELD_LENGTH 64
@@ -21,6 +22,8 @@ namespace irobot::android {
 
     public:
         socket_t control_socket;
+        // if set, the socket is read by the io loop instead of this thread
+        platform::IoLoop *io_loop = nullptr;
 
         bool Init(socket_t socket);
 
@@ -32,6 +35,8 @@ namespace irobot::android {
 
         static int RunReceiver(void *data);
 
+        static bool OnReceived(void *userdata, const uint8_t *data, size_t len);
+
         // name must be at least DEVICE_NAME_FIELD_LENGTH bytes
         static bool ReadDeviceInfomation(socket_t device_socket,
                                          char *device_name, struct Size *size);
@@ -214,6 +214,7 @@ namespace irobot {
         this->local_port = 0;
         this->tunnel_enabled = false;
         this->tunnel_forward = false;
+        this->mock = false;
     }
 
     bool DeviceServer::Start(const char *pSerial,
@@ -227,6 +228,15 @@ namespace irobot {
             }
         }
 
+        if (params->mock) {
+            // the mock device server listens on the local port, as a device
+            // server behind "adb forward" would
+            LOGI("Using the mock device server on port %" PRIu16, this->local_port);
+            this->mock = true;
+            this->tunnel_forward = true;
+            return true;
+        }
+
         if (!PushServer(pSerial)) {
             SDL_free(this->serial);
             return false;
@@ -310,8 +320,10 @@ namespace irobot {
         }
 
         // we don't need the adb tunnel anymore
-        DisableTunnel(); // ignore failure
-        this->tunnel_enabled = false;
+        if (!this->mock) {
+            DisableTunnel(); // ignore failure
+            this->tunnel_enabled = false;
+        }
 
         return true;
     }
@@ -328,6 +340,11 @@ namespace irobot {
             CloseSocket(&this->control_socket);
         }
 
+        if (this->mock) {
+            // no server process, no tunnel
+            return;
+        }
+
         assert(this->process != PROCESS_NONE);
 
         if (!cmd_terminate(this->process)) {
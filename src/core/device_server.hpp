@@ -22,6 +22,7 @@ namespace irobot {
         uint32_t bit_rate;
         uint16_t max_fps;
         bool control;
+        bool mock; // connect to the mock device server, without adb
     };
 
 
@@ -36,6 +37,7 @@ namespace irobot {
         uint16_t local_port;
         bool tunnel_enabled;
         bool tunnel_forward; // use "adb forward" instead of "adb reverse"
+        bool mock;
 
         // init default values
         void Init();
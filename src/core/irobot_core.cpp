@@ -13,10 +13,13 @@
 #include "core/common.hpp"
 #include "core/controller.hpp"
 #include "device_server.hpp"
+#include "platform/io_loop.hpp"
 #include "platform/net.hpp"
 #include "ui/screen.hpp"
+#include "video/clock_offset.hpp"
 #include "video/decoder.hpp"
 #include "video/fps_counter.hpp"
+#include "video/latency.hpp"
 #include "video/recorder.hpp"
 #include "video/stream.hpp"
 #include "video/video_buffer.hpp"
@@ -39,6 +42,21 @@
 #define OPT_SCREEN_WIDTH          1013
 #define OPT_SCREEN_HEIGHT         1014
 #define OPT_HEADLESS              1015
+#define OPT_VIDEO_BUFFER_SIZE     1016
+#define OPT_IO_URING              1017
+#define OPT_DECODE_MODE           1018
+#define OPT_FRAME_BUFFERS         1019
+#define OPT_MOCK_SERVER           1020
+#define OPT_RECORD_BUFFER_SIZE    1021
+#define OPT_RECORD_OVERFLOW       1022
+#define OPT_RECORD_SEGMENT_TIME   1023
+#define OPT_RECORD_SEGMENT_SIZE   1024
+#define OPT_RECORD_SEGMENTS       1025
+#define OPT_REPLAY_BUFFER         1026
+#define OPT_REPLAY_BUFFER_SIZE    1027
+#define OPT_RECORD_FRAGMENT_DURATION 1028
+#define OPT_AGENT_TILE_DELTA      1029
+#define OPT_LATENCY_REPORT        1030
 
 namespace irobot {
 
@@ -50,22 +68,25 @@ namespace irobot {
     DeviceServer server;
     FpsCounter fps_counter;
     VideoBuffer video_buffer;
+    LatencyTracker latency_tracker;
+    ClockOffset clock_offset;
     VideoStream stream;
     Recorder recorder;
+    ReplayBuffer replay_buffer;
     Controller controller;
     FileHandler file_handler;
     Decoder decoder;
     Screen screen;
+    platform::IoLoop io_loop;
 
     agent::AgentController agent_controller;
     agent::AgentStream agent_stream;
     agent::AgentManager agent_manager = {
             .video_buffer = &video_buffer,
+            .clock_offset = &clock_offset,
             .controller = &controller,
             .agent_controller=&agent_controller,
             .agent_stream = &agent_stream,
-            .phash_func=cv::img_hash::PHash::create()
-
     };
     InputManager input_manager = {
             .agent_manager=&agent_manager,
@@ -81,10 +102,22 @@ namespace irobot {
         this->window_title = nullptr;
         this->push_target = nullptr;
         this->record_format = RECORDER_FORMAT_AUTO;
+        this->record_buffer_size = RECORDER_DEFAULT_MAX_BYTES;
+        this->record_overflow = RECORDER_OVERFLOW_DROP;
+        this->record_segment_time = 0;
+        this->record_segment_size = 0;
+        this->record_segments = 0;
+        this->record_fragment_duration = 0;
+        this->replay_buffer_time = 0;
+        this->replay_buffer_size = REPLAY_DEFAULT_MAX_BYTES;
+        this->decode_mode = DECODE_MODE_LOW_DELAY;
         this->port = DEFAULT_LOCAL_PORT;
         this->max_size = DEFAULT_MAX_SIZE;
         this->bit_rate = DEFAULT_BIT_RATE;
         this->max_fps = 0;
+        this->video_buffer_size = 0;
+        this->latency_report = 0;
+        this->frame_buffers = VIDEO_BUFFER_DEFAULT_SLOTS;
         this->window_x = -1;
         this->window_y = -1;
         this->screen_width = 0;
@@ -103,6 +136,9 @@ namespace irobot {
         this->help = false;
         this->version = false;
         this->headless = false;
+        this->io_uring = false;
+        this->mock_server = false;
+        this->agent_tile_delta = false;
 
     }
 
@@ -116,6 +152,7 @@ namespace irobot {
                 .bit_rate = options->bit_rate,
                 .max_fps = options->max_fps,
                 .control = options->control,
+                .mock = options->mock_server,
         };
 
         if (!server.Start(options->serial, &params)) {
@@ -134,9 +171,11 @@ namespace irobot {
         bool video_buffer_initialized = false;
         bool file_handler_initialized = false;
         bool recorder_initialized = false;
+        bool replay_buffer_initialized = false;
         bool controller_initialized = false;
         bool controller_started = false;
 
+        agent_manager.tile_delta = options->agent_tile_delta;
         if (!agent_manager.Init(options->port)) {
             return false;
         }
@@ -177,10 +216,31 @@ namespace irobot {
             fps_counter_initialized = true;
 
             if (!cannot_cont & !video_buffer.Init(&fps_counter,
-                                                  options->render_expired_frames)) {
+                                                  options->render_expired_frames,
+                                                  options->frame_buffers)) {
                 cannot_cont = true;
             }
             video_buffer_initialized = true;
+            video_buffer.latency = &latency_tracker;
+            latency_tracker.report_interval =
+                    (int64_t) options->latency_report * 1000000;
+
+            if (!cannot_cont) {
+                // each consumer reads the last frame at its own pace
+                if (!options->headless) {
+                    screen.frame_consumer = video_buffer.RegisterConsumer(
+                            "screen", EVENT_NEW_FRAME, true);
+                    if (screen.frame_consumer == -1) {
+                        cannot_cont = true;
+                    }
+                }
+                // the agent converts the frames on its own thread
+                agent_manager.frame_consumer = video_buffer.RegisterConsumer(
+                        "agent", 0, false);
+                if (agent_manager.frame_consumer == -1) {
+                    cannot_cont = true;
+                }
+            }
 
             if (!cannot_cont & options->control) {
                 if (!file_handler.Init(server.serial,
@@ -190,7 +250,7 @@ namespace irobot {
                 file_handler_initialized = true;
             }
 
-            decoder.Init(&video_buffer);
+            decoder.Init(&video_buffer, options->decode_mode);
             dec = &decoder;
         }
 
@@ -199,16 +259,63 @@ namespace irobot {
             if (!recorder.Init(
                     options->record_filename,
                     options->record_format,
-                    frame_size)) {
+                    frame_size,
+                    options->record_buffer_size,
+                    options->record_overflow)) {
                 cannot_cont = true;
             }
+            recorder.segment_duration =
+                    (int64_t) options->record_segment_time * 1000000;
+            recorder.segment_size = options->record_segment_size;
+            recorder.max_segments = options->record_segments;
+            recorder.fragment_duration =
+                    (int64_t) options->record_fragment_duration * 1000;
             rec = &recorder;
             recorder_initialized = true;
         }
 
+        if (!cannot_cont & (options->replay_buffer_time > 0)) {
+            if (!replay_buffer.Init(frame_size,
+                                    (int64_t) options->replay_buffer_time * 1000000,
+                                    options->replay_buffer_size)) {
+                cannot_cont = true;
+            } else {
+                replay_buffer_initialized = true;
+                stream.replay = &replay_buffer;
+                agent_manager.replay_buffer = &replay_buffer;
+            }
+        }
+
         av_log_set_callback(AVLogCallback);
 
-        stream.Init(server.video_socket, dec, rec);
+        bool io_loop_started = false;
+        if (!cannot_cont & options->io_uring) {
+            if (io_loop.Init()) {
+                if (io_loop.Start()) {
+                    io_loop_started = true;
+                } else {
+                    io_loop.Destroy();
+                }
+            }
+            if (!io_loop_started) {
+                LOGW("Could not start io_uring loop, using blocking sockets");
+            }
+        }
+        platform::IoLoop *loop = io_loop_started ? &io_loop : nullptr;
+        stream.io_loop = loop;
+        controller.receiver.io_loop = loop;
+        agent_stream.io_loop = loop;
+        agent_controller.io_loop = loop;
+        stream.latency = &latency_tracker;
+        stream.clock_offset = &clock_offset;
+        agent_stream.latency = &latency_tracker;
+
+        bool stream_initialized = false;
+        if (stream.Init(server.video_socket, dec, rec, options->video_buffer_size)) {
+            stream_initialized = true;
+        } else {
+            cannot_cont = true;
+        }
 
         // now we consumed the header values, the socket receives the video stream
         // start the stream
@@ -216,8 +323,13 @@ namespace irobot {
             cannot_cont = true;
         }
 
-        if (!cannot_cont & !agent_manager.Start()) {
-            cannot_cont = true;
+        bool agent_manager_started = false;
+        if (!cannot_cont) {
+            // even partially started, its threads must be joined
+            agent_manager_started = true;
+            if (!agent_manager.Start()) {
+                cannot_cont = true;
+            }
         }
 
         if (!cannot_cont & options->display) {
@@ -279,22 +391,20 @@ namespace irobot {
             SDL_Event event;
             bool quit = false;
             InputManager::SwitchFpsCounterState(&fps_counter);
-            while (!quit) {
-                while (SDL_PollEvent(&event)) {
-                    enum EventResult result = agent_manager.HandleEvent(&event, false);
-                    switch (result) {
-                        case EVENT_RESULT_STOPPED_BY_USER:
-                            quit = true;
-                            break;
-                        case EVENT_RESULT_STOPPED_BY_EOS:
-                            LOGW("Device disconnected");
-                            quit = true;
-                            break;
-                        case EVENT_RESULT_CONTINUE:
-                            break;
-                    }
-
-
+            // the frames are not dispatched by the event loop, just wait
+            while (!quit && SDL_WaitEvent(&event)) {
+                fps_counter.AddDispatchedEvent(InputManager::IsInputEvent(&event));
+                enum EventResult result = agent_manager.HandleEvent(&event, false);
+                switch (result) {
+                    case EVENT_RESULT_STOPPED_BY_USER:
+                        quit = true;
+                        break;
+                    case EVENT_RESULT_STOPPED_BY_EOS:
+                        LOGW("Device disconnected");
+                        quit = true;
+                        break;
+                    case EVENT_RESULT_CONTINUE:
+                        break;
                 }
             }
             printf("Exting ...\n");
@@ -306,6 +416,8 @@ namespace irobot {
 
         if (controller_started) {
             controller.Stop();
+        }
+        if (agent_manager_started) {
             agent_manager.Stop();
         }
         if (file_handler_initialized) {
@@ -318,15 +430,29 @@ namespace irobot {
         // shutdown the sockets and kill the server
         server.Stop();
 
+        // release the threads waiting for their socket on the io loop
+        if (io_loop_started) {
+            io_loop.Stop();
+        }
+
         // now that the sockets are shutdown, the stream and controller are
         // interrupted, we can join them
         stream.Join();
-
+        if (stream_initialized) {
+            stream.Destroy();
+        }
 
         if (controller_started) {
             controller.Join();
+        }
+        if (agent_manager_started) {
             agent_manager.Join();
         }
+        latency_tracker.Dump();
+        if (io_loop_started) {
+            io_loop.Join();
+            io_loop.Destroy();
+        }
         if (controller_initialized) {
             controller.Destroy();
             agent_manager.Destroy();
@@ -336,6 +462,10 @@ namespace irobot {
             recorder.Destroy();
         }
 
+        if (replay_buffer_initialized) {
+            replay_buffer.Destroy();
+        }
+
         if (file_handler_initialized) {
             file_handler.Join();
             file_handler.Destroy();
@@ -425,6 +555,12 @@ namespace irobot {
                 "\n"
                 "Options:\n"
                 "\n"
+                "    --agent-tile-delta\n"
+                "        Send the agent images as tile deltas: a key frame, then\n"
+                "        only the tiles changed since the previous image\n"
+                "        (BLOB_MSG_TYPE_TILE_DELTA). The agent may request a key\n"
+                "        frame at any time (CONTROL_MSG_TYPE_REQUEST_KEY_FRAME).\n"
+                "\n"
                 "    --always-on-top\n"
                 "        Make irobot window always on top (above other windows).\n"
                 "\n"
@@ -439,12 +575,33 @@ namespace irobot {
                 "        (typically, portrait for a phone, landscape for a tablet).\n"
                 "        Any --max-size value is computed on the cropped size.\n"
                 "\n"
+                "    --decode-mode mode\n"
+                "        Set the H.264 decoding mode:\n"
+                "          low-delay: single-threaded, lowest latency\n"
+                "          slice: slice threading, effective only if the device\n"
+                "                 encodes several slices per frame\n"
+                "          frame: frame threading, highest throughput at the cost\n"
+                "                 of additional frames of latency\n"
+                "        Default is low-delay.\n"
+                "\n"
                 "    -f, --fullscreen\n"
                 "        Start in fullscreen.\n"
                 "\n"
+                "    --frame-buffers n\n"
+                "        Set the number of decoded frames kept in memory (3 to %d).\n"
+                "        The screen and the agent each read the last frame at\n"
+                "        their own pace: each of them needs one, plus 2 for the\n"
+                "        decoder.\n"
+                "        Default is %d.\n"
+                "\n"
                 "    -h, --help\n"
                 "        Print this help.\n"
                 "\n"
+                "    --latency-report seconds\n"
+                "        Log the latency percentiles of each video stage every\n"
+                "        given seconds (e.g. without a screen, see Ctrl+Shift+i).\n"
+                "        Default is 0 (only on exit).\n"
+                "\n"
                 "    --max-fps value\n"
                 "        Limit the frame rate of screen capture (only supported on\n"
                 "        devices with Android >= 10).\n"
@@ -455,6 +612,11 @@ namespace irobot {
                 "        is preserved.\n"
                 "        Default is %d%s.\n"
                 "\n"
+                "    --mock-server\n"
+                "        Connect to a mock_device_server listening on the port\n"
+                "        (see -p) instead of starting the server on a device with\n"
+                "        adb.\n"
+                "\n"
                 "    -n, --no-control\n"
                 "        Disable device control (mirror the device in read-only).\n"
                 "\n"
@@ -481,10 +643,45 @@ namespace irobot {
                 "    -r, --record file.mp4\n"
                 "        Record screen to file.\n"
                 "        The format is determined by the --record-format option if\n"
-                "        set, or by the file extension (.mp4 or .mkv).\n"
+                "        set, or by the file extension (.mp4, .mkv or .h264).\n"
+                "\n"
+                "    --record-buffer-size value\n"
+                "        Limit the memory used by the packets waiting to be\n"
+                "        written to the recording. Supports suffix 'K' (x1000)\n"
+                "        and 'M' (x1000000).\n"
+                "        Default is %dM.\n"
                 "\n"
                 "    --record-format format\n"
-                "        Force recording format (either mp4 or mkv).\n"
+                "        Force recording format (mp4, mkv or raw).\n"
+                "        raw writes the H.264 stream as is, with an index of the\n"
+                "        packets in file.idx; raw_remux converts it to mp4.\n"
+                "\n"
+                "    --record-fragment-duration ms\n"
+                "        Write the MP4 recording as fragments of about this\n"
+                "        duration (cut at the next key frame), flushed to disk\n"
+                "        one by one: the file stays readable if irobot is killed,\n"
+                "        and the memory does not grow with the recording length.\n"
+                "        Default is 0 (plain MP4).\n"
+                "\n"
+                "    --record-overflow policy\n"
+                "        Set what to do when the recording buffer is full:\n"
+                "            block: stall the stream until the packets are written\n"
+                "            drop: drop the packets until the next key frame\n"
+                "            spill: write the packets to a temporary file\n"
+                "        Default is drop.\n"
+                "\n"
+                "    --record-segment-size value\n"
+                "        Split the recording into files (file-0000.mp4,\n"
+                "        file-0001.mp4...) of about this size, cut at the next key\n"
+                "        frame. Supports suffix 'K' (x1000) and 'M' (x1000000).\n"
+                "\n"
+                "    --record-segment-time seconds\n"
+                "        Split the recording into files of about this duration,\n"
+                "        cut at the next key frame.\n"
+                "\n"
+                "    --record-segments n\n"
+                "        Keep only the last n segments, the oldest are deleted once\n"
+                "        closed. Default is 0 (keep all).\n"
                 "\n"
                 "    --render-expired-frames\n"
                 "        By default, to minimize latency, irobot always renders the\n"
@@ -492,6 +689,16 @@ namespace irobot {
                 "        This flag forces to render all frames, at a cost of a\n"
                 "        possible increased latency.\n"
                 "\n"
+                "    --replay-buffer seconds\n"
+                "        Keep the last seconds of video in memory, to be saved by\n"
+                "        the agent (CONTROL_MSG_TYPE_SAVE_REPLAY) instead of\n"
+                "        recording all the time.\n"
+                "\n"
+                "    --replay-buffer-size value\n"
+                "        Limit the memory used by the replay buffer. Supports\n"
+                "        suffix 'K' (x1000) and 'M' (x1000000).\n"
+                "        Default is %dM.\n"
+                "\n"
                 "    -s, --serial serial\n"
                 "        The device serial number. Mandatory only if several devices\n"
                 "        are connected to adb.\n"
@@ -506,12 +713,23 @@ namespace irobot {
                 "    -v, --version\n"
                 "        Print the version of irobot.\n"
                 "\n"
+                "    --video-buffer-size value\n"
+                "        Set the kernel receive buffer size (SO_RCVBUF) of the video\n"
+                "        socket. Supports suffix 'K' (x1000) and 'M' (x1000000).\n"
+                "        Default is 0 (system default).\n"
+                "\n"
                 "    --window-borderless\n"
                 "        Disable window decorations (display borderless window).\n"
                 "\n"
                 "    --headless\n"
                 "        Headless ui.\n"
                 "\n"
+                "    --io-uring\n"
+                "        Receive from the video, control and agent sockets on a single\n"
+                "        io_uring completion loop instead of one blocking thread each\n"
+                "        (Linux only). Fall back to the blocking threads if io_uring\n"
+                "        is not available.\n"
+                "\n"
                 "    --window-title text\n"
                 "        Set a custom window title.\n"
                 "\n"
@@ -602,13 +820,19 @@ namespace irobot {
                 "    " CTRL_OR_CMD "+i\n"
                 "        enable/disable FPS counter (print frames/second in logs)\n"
                 "\n"
+                "    " CTRL_OR_CMD "+Shift+i\n"
+                "        print the latency of each video stage (also printed on exit)\n"
+                "\n"
                 "    Drag & drop APK file\n"
                 "        install APK from computer\n"
                 "\n",
                 arg0,
                 DEFAULT_BIT_RATE,
+                VIDEO_BUFFER_MAX_SLOTS, VIDEO_BUFFER_DEFAULT_SLOTS,
                 DEFAULT_MAX_SIZE, " (unlimited)",
-                DEFAULT_LOCAL_PORT);
+                DEFAULT_LOCAL_PORT,
+                RECORDER_DEFAULT_MAX_BYTES / 1000000,
+                REPLAY_DEFAULT_MAX_BYTES / 1000000);
     }
 
     bool IRobotCore::ParseIntegerArg(const char *s, long *out,
@@ -671,6 +895,125 @@ namespace irobot {
         return true;
     }
 
+    bool IRobotCore::ParseVideoBufferSize(const char *s, uint32_t *size) {
+        long value;
+        bool ok = ParseIntegerArg(s, &value, true, 0, 0x7FFFFFFF,
+                                  "video buffer size");
+        if (!ok) {
+            return false;
+        }
+
+        *size = (uint32_t) value;
+        return true;
+    }
+
+    bool IRobotCore::ParseLatencyReport(const char *s, uint32_t *seconds) {
+        long value;
+        bool ok = ParseIntegerArg(s, &value, false, 0, 3600, "latency report");
+        if (!ok) {
+            return false;
+        }
+
+        *seconds = (uint32_t) value;
+        return true;
+    }
+
+    bool IRobotCore::ParseRecordBufferSize(const char *s, uint64_t *size) {
+        long value;
+        bool ok = ParseIntegerArg(s, &value, true, 1000000, 0x7FFFFFFF,
+                                  "record buffer size");
+        if (!ok) {
+            return false;
+        }
+
+        *size = (uint64_t) value;
+        return true;
+    }
+
+    bool IRobotCore::ParseRecordSegmentSize(const char *s, uint64_t *size) {
+        long value;
+        bool ok = ParseIntegerArg(s, &value, true, 1000000, 0x7FFFFFFF,
+                                  "record segment size");
+        if (!ok) {
+            return false;
+        }
+
+        *size = (uint64_t) value;
+        return true;
+    }
+
+    bool IRobotCore::ParseRecordSegmentTime(const char *s, uint32_t *seconds) {
+        long value;
+        bool ok = ParseIntegerArg(s, &value, false, 1, 86400,
+                                  "record segment time");
+        if (!ok) {
+            return false;
+        }
+
+        *seconds = (uint32_t) value;
+        return true;
+    }
+
+    bool IRobotCore::ParseRecordSegments(const char *s, int *segments) {
+        long value;
+        bool ok = ParseIntegerArg(s, &value, false, 0, 0xFFFF,
+                                  "record segments");
+        if (!ok) {
+            return false;
+        }
+
+        *segments = (int) value;
+        return true;
+    }
+
+    bool IRobotCore::ParseRecordFragmentDuration(const char *s, uint32_t *ms) {
+        long value;
+        bool ok = ParseIntegerArg(s, &value, false, 0, 600000,
+                                  "record fragment duration");
+        if (!ok) {
+            return false;
+        }
+
+        *ms = (uint32_t) value;
+        return true;
+    }
+
+    bool IRobotCore::ParseReplayBufferTime(const char *s, uint32_t *seconds) {
+        long value;
+        bool ok = ParseIntegerArg(s, &value, false, 1, 3600,
+                                  "replay buffer time");
+        if (!ok) {
+            return false;
+        }
+
+        *seconds = (uint32_t) value;
+        return true;
+    }
+
+    bool IRobotCore::ParseReplayBufferSize(const char *s, uint64_t *size) {
+        long value;
+        bool ok = ParseIntegerArg(s, &value, true, 1000000, 0x7FFFFFFF,
+                                  "replay buffer size");
+        if (!ok) {
+            return false;
+        }
+
+        *size = (uint64_t) value;
+        return true;
+    }
+
+    bool IRobotCore::ParseFrameBuffers(const char *s, int *frame_buffers) {
+        long value;
+        bool ok = ParseIntegerArg(s, &value, false, 3, VIDEO_BUFFER_MAX_SLOTS,
+                                  "frame buffers");
+        if (!ok) {
+            return false;
+        }
+
+        *frame_buffers = (int) value;
+        return true;
+    }
+
     bool IRobotCore::ParseWindowPosition(const char *s, int16_t *position) {
         long value;
         bool ok = ParseIntegerArg(s, &value, false, -1, 0x7FFF,
@@ -715,7 +1058,48 @@ namespace irobot {
             *format = RECORDER_FORMAT_MKV;
             return true;
         }
-        LOGE("Unsupported format: %s (expected mp4 or mkv)", opt_arg);
+        if (!strcmp(opt_arg, "raw")) {
+            *format = RECORDER_FORMAT_RAW;
+            return true;
+        }
+        LOGE("Unsupported format: %s (expected mp4, mkv or raw)", opt_arg);
+        return false;
+    }
+
+    bool IRobotCore::ParseDecodeMode(const char *opt_arg, enum DecodeMode *mode) {
+        if (!strcmp(opt_arg, "low-delay")) {
+            *mode = DECODE_MODE_LOW_DELAY;
+            return true;
+        }
+        if (!strcmp(opt_arg, "slice")) {
+            *mode = DECODE_MODE_SLICE;
+            return true;
+        }
+        if (!strcmp(opt_arg, "frame")) {
+            *mode = DECODE_MODE_FRAME;
+            return true;
+        }
+        LOGE("Unsupported decode mode: %s (expected low-delay, slice or frame)",
+             opt_arg);
+        return false;
+    }
+
+    bool IRobotCore::ParseRecordOverflow(const char *opt_arg,
+                                         enum RecordOverflow *overflow) {
+        if (!strcmp(opt_arg, "block")) {
+            *overflow = RECORDER_OVERFLOW_BLOCK;
+            return true;
+        }
+        if (!strcmp(opt_arg, "drop")) {
+            *overflow = RECORDER_OVERFLOW_DROP;
+            return true;
+        }
+        if (!strcmp(opt_arg, "spill")) {
+            *overflow = RECORDER_OVERFLOW_SPILL;
+            return true;
+        }
+        LOGE("Unsupported record overflow policy: %s (expected block, drop or "
+             "spill)", opt_arg);
         return false;
     }
 
@@ -731,6 +1115,9 @@ namespace irobot {
         if (!strcmp(ext, ".mkv")) {
             return RECORDER_FORMAT_MKV;
         }
+        if (len >= 5 && !strcmp(&filename[len - 5], ".h264")) {
+            return RECORDER_FORMAT_RAW;
+        }
         return static_cast<RecordFormat>(0);
     }
 
@@ -738,26 +1125,47 @@ namespace irobot {
     bool IRobotCore::ParseArgs(int argc, char **argv) {
         struct IRobotCore *args = this;
         static const struct option long_options[] = {
+                {"agent-tile-delta",      no_argument,       nullptr, OPT_AGENT_TILE_DELTA},
                 {"always-on-top",         no_argument,       nullptr, OPT_ALWAYS_ON_TOP},
                 {"bit-rate",              required_argument, nullptr, 'b'},
                 {"crop",                  required_argument, nullptr, OPT_CROP},
+                {"decode-mode",           required_argument, nullptr, OPT_DECODE_MODE},
+                {"frame-buffers",         required_argument, nullptr, OPT_FRAME_BUFFERS},
                 {"fullscreen",            no_argument,       nullptr, 'f'},
                 {"help",                  no_argument,       nullptr, 'h'},
+                {"io-uring",              no_argument,       nullptr, OPT_IO_URING},
+                {"latency-report",        required_argument, nullptr, OPT_LATENCY_REPORT},
                 {"max-fps",               required_argument, nullptr, OPT_MAX_FPS},
+                {"mock-server",           no_argument,       nullptr, OPT_MOCK_SERVER},
                 {"max-size",              required_argument, nullptr, 'm'},
                 {"no-control",            no_argument,       nullptr, 'n'},
                 {"no-display",            no_argument,       nullptr, 'N'},
                 {"port",                  required_argument, nullptr, 'p'},
                 {"push-target",           required_argument, nullptr, OPT_PUSH_TARGET},
                 {"record",                required_argument, nullptr, 'r'},
+                {"record-buffer-size",    required_argument, nullptr,
+                                                                      OPT_RECORD_BUFFER_SIZE},
                 {"record-format",         required_argument, nullptr, OPT_RECORD_FORMAT},
+                {"record-fragment-duration", required_argument, nullptr,
+                                                                      OPT_RECORD_FRAGMENT_DURATION},
+                {"record-overflow",       required_argument, nullptr, OPT_RECORD_OVERFLOW},
+                {"record-segment-size",   required_argument, nullptr,
+                                                                      OPT_RECORD_SEGMENT_SIZE},
+                {"record-segment-time",   required_argument, nullptr,
+                                                                      OPT_RECORD_SEGMENT_TIME},
+                {"record-segments",       required_argument, nullptr, OPT_RECORD_SEGMENTS},
                 {"render-expired-frames", no_argument,       nullptr,
                                                                       OPT_RENDER_EXPIRED_FRAMES},
+                {"replay-buffer",         required_argument, nullptr, OPT_REPLAY_BUFFER},
+                {"replay-buffer-size",    required_argument, nullptr,
+                                                                      OPT_REPLAY_BUFFER_SIZE},
                 {"serial",                required_argument, nullptr, 's'},
                 {"show-touches",          no_argument,       nullptr, 't'},
                 {"turn-screen-off",       no_argument,       nullptr, 'S'},
                 {"prefer-text",           no_argument,       nullptr, OPT_PREFER_TEXT},
                 {"version",               no_argument,       nullptr, 'v'},
+                {"video-buffer-size",     required_argument, nullptr,
+                                                                      OPT_VIDEO_BUFFER_SIZE},
                 {"window-title",          required_argument, nullptr, OPT_WINDOW_TITLE},
                 {"window-x",              required_argument, nullptr, OPT_WINDOW_X},
                 {"window-y",              required_argument, nullptr, OPT_WINDOW_Y},
@@ -791,9 +1199,19 @@ namespace irobot {
                 case OPT_CROP:
                     opts->crop = optarg;
                     break;
+                case OPT_DECODE_MODE:
+                    if (!ParseDecodeMode(optarg, &opts->decode_mode)) {
+                        return false;
+                    }
+                    break;
                 case 'f':
                     opts->fullscreen = true;
                     break;
+                case OPT_FRAME_BUFFERS:
+                    if (!ParseFrameBuffers(optarg, &opts->frame_buffers)) {
+                        return false;
+                    }
+                    break;
                 case 'F':
                     LOGW("Deprecated option -F. Use --record-format instead.");
                     // fall through
@@ -802,6 +1220,47 @@ namespace irobot {
                         return false;
                     }
                     break;
+                case OPT_RECORD_BUFFER_SIZE:
+                    if (!ParseRecordBufferSize(optarg, &opts->record_buffer_size)) {
+                        return false;
+                    }
+                    break;
+                case OPT_RECORD_OVERFLOW:
+                    if (!ParseRecordOverflow(optarg, &opts->record_overflow)) {
+                        return false;
+                    }
+                    break;
+                case OPT_RECORD_SEGMENT_SIZE:
+                    if (!ParseRecordSegmentSize(optarg, &opts->record_segment_size)) {
+                        return false;
+                    }
+                    break;
+                case OPT_RECORD_SEGMENT_TIME:
+                    if (!ParseRecordSegmentTime(optarg, &opts->record_segment_time)) {
+                        return false;
+                    }
+                    break;
+                case OPT_RECORD_SEGMENTS:
+                    if (!ParseRecordSegments(optarg, &opts->record_segments)) {
+                        return false;
+                    }
+                    break;
+                case OPT_RECORD_FRAGMENT_DURATION:
+                    if (!ParseRecordFragmentDuration(optarg,
+                                                     &opts->record_fragment_duration)) {
+                        return false;
+                    }
+                    break;
+                case OPT_REPLAY_BUFFER:
+                    if (!ParseReplayBufferTime(optarg, &opts->replay_buffer_time)) {
+                        return false;
+                    }
+                    break;
+                case OPT_REPLAY_BUFFER_SIZE:
+                    if (!ParseReplayBufferSize(optarg, &opts->replay_buffer_size)) {
+                        return false;
+                    }
+                    break;
                 case 'h':
                     args->help = true;
                     break;
@@ -889,6 +1348,25 @@ namespace irobot {
                 case OPT_HEADLESS:
                     opts->headless = true;
                     break;
+                case OPT_MOCK_SERVER:
+                    opts->mock_server = true;
+                    break;
+                case OPT_IO_URING:
+                    opts->io_uring = true;
+                    break;
+                case OPT_AGENT_TILE_DELTA:
+                    opts->agent_tile_delta = true;
+                    break;
+                case OPT_VIDEO_BUFFER_SIZE:
+                    if (!ParseVideoBufferSize(optarg, &opts->video_buffer_size)) {
+                        return false;
+                    }
+                    break;
+                case OPT_LATENCY_REPORT:
+                    if (!ParseLatencyReport(optarg, &opts->latency_report)) {
+                        return false;
+                    }
+                    break;
                 case OPT_PUSH_TARGET:
                     opts->push_target = optarg;
                     break;
@@ -922,6 +1400,18 @@ namespace irobot {
             return false;
         }
 
+        bool segmented = opts->record_segment_time || opts->record_segment_size;
+        if (segmented && !opts->record_filename) {
+            LOGE("Record segments specified without recording");
+            return false;
+        }
+
+        if (opts->record_segments && !segmented) {
+            LOGE("--record-segments requires --record-segment-time or "
+                 "--record-segment-size");
+            return false;
+        }
+
         if (opts->record_filename && !opts->record_format) {
             opts->record_format = GuessRecordFormat(opts->record_filename);
             if (!opts->record_format) {
@@ -931,11 +1421,27 @@ namespace irobot {
             }
         }
 
+        if (segmented && opts->record_format == RECORDER_FORMAT_RAW) {
+            LOGE("Raw recording cannot be segmented");
+            return false;
+        }
+
+        if (opts->record_fragment_duration
+            && opts->record_format != RECORDER_FORMAT_MP4) {
+            LOGE("--record-fragment-duration requires an mp4 recording");
+            return false;
+        }
+
         if (!opts->control && opts->turn_screen_off) {
             LOGE("Could not request to turn screen off if control is disabled");
             return false;
         }
 
+        if (opts->mock_server && opts->show_touches) {
+            LOGE("-t/--show-touches requires adb, incompatible with --mock-server");
+            return false;
+        }
+
         return true;
     }
 
@@ -24,7 +24,9 @@ extern "C" {
 #include "config.hpp"
 #include "platform/command.hpp"
 #include "ui/input_manager.hpp"
+#include "video/decoder.hpp"
 #include "video/recorder.hpp"
+#include "video/replay_buffer.hpp"
 
 namespace irobot {
 
@@ -37,10 +39,22 @@ namespace irobot {
         const char *window_title;
         const char *push_target;
         enum video::RecordFormat record_format;
+        uint64_t record_buffer_size;
+        enum video::RecordOverflow record_overflow;
+        uint32_t record_segment_time; // seconds
+        uint64_t record_segment_size;
+        int record_segments;
+        uint32_t record_fragment_duration; // ms, 0 for a plain MP4
+        uint32_t replay_buffer_time; // seconds, 0 if disabled
+        uint64_t replay_buffer_size;
+        enum video::DecodeMode decode_mode;
         uint16_t port;
         uint16_t max_size;
         uint32_t bit_rate;
         uint16_t max_fps;
+        uint32_t video_buffer_size;
+        uint32_t latency_report; // seconds, 0 if disabled
+        int frame_buffers;
         int16_t window_x;
         int16_t window_y;
         uint16_t window_width;
@@ -55,6 +69,9 @@ namespace irobot {
         bool prefer_text;
         bool window_borderless;
         bool headless;
+        bool io_uring;
+        bool mock_server;
+        bool agent_tile_delta;
         uint16_t screen_width;
         uint16_t screen_height;
         bool help;
@@ -89,6 +106,29 @@ namespace irobot {
 
         static bool ParseMaxFps(const char *s, uint16_t *max_fps);
 
+        static bool ParseVideoBufferSize(const char *s, uint32_t *size);
+
+        static bool ParseLatencyReport(const char *s, uint32_t *seconds);
+
+        static bool ParseFrameBuffers(const char *s, int *frame_buffers);
+
+        static bool ParseRecordBufferSize(const char *s, uint64_t *size);
+
+        static bool ParseRecordSegmentSize(const char *s, uint64_t *size);
+
+        static bool ParseRecordSegmentTime(const char *s, uint32_t *seconds);
+
+        static bool ParseRecordSegments(const char *s, int *segments);
+
+        static bool ParseRecordFragmentDuration(const char *s, uint32_t *ms);
+
+        static bool ParseReplayBufferTime(const char *s, uint32_t *seconds);
+
+        static bool ParseReplayBufferSize(const char *s, uint64_t *size);
+
+        static bool ParseRecordOverflow(const char *opt_arg,
+                                        enum video::RecordOverflow *overflow);
+
         static bool ParseWindowPosition(const char *s, int16_t *position);
 
         static bool ParseWindowDimension(const char *s, uint16_t *dimension);
@@ -100,6 +140,9 @@ namespace irobot {
 
         static enum video::RecordFormat GuessRecordFormat(const char *filename);
 
+        static bool ParseDecodeMode(const char *opt_arg,
+                                    enum video::DecodeMode *mode);
+
         static void PrintUsage(const char *arg0);
 
         static void PrintVersion();
@@ -0,0 +1,111 @@
+//
+// Created by James Shen on 17/10/26.
+// Copyright (c) 2020 GUIDEBEE IT. All rights reserved
+//
+
+#include "worker_pool.hpp"
+
+#include "util/lock.hpp"
+#include "util/log.hpp"
+
+namespace irobot {
+
+    bool WorkerPool::Init(const char *pool_name, int count) {
+        if (count < 1 || count > WORKER_POOL_MAX_THREADS) {
+            LOGE("Invalid number of %s threads: %d", pool_name, count);
+            return false;
+        }
+        if (!Actor::Init()) {
+            return false;
+        }
+        if (!(this->done_cond = SDL_CreateCond())) {
+            Actor::Destroy();
+            return false;
+        }
+        this->name = pool_name;
+        this->nr_threads = count;
+        this->nr_pending = 0;
+        cbuf_init(&this->tasks);
+        return true;
+    }
+
+    void WorkerPool::Destroy() {
+        SDL_DestroyCond(this->done_cond);
+        Actor::Destroy();
+    }
+
+    bool WorkerPool::Start() {
+        LOGD("Starting %d %s threads", this->nr_threads, this->name);
+        for (int i = 0; i < this->nr_threads; ++i) {
+            this->threads[i] = SDL_CreateThread(Run, this->name, this);
+            if (!this->threads[i]) {
+                LOGC("Could not start %s thread", this->name);
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void WorkerPool::Stop() {
+        util::mutex_lock(this->mutex);
+        this->stopped = true;
+        // all the threads
+        util::cond_broadcast(this->thread_cond);
+        util::mutex_unlock(this->mutex);
+    }
+
+    void WorkerPool::Join() {
+        for (auto &thread : this->threads) {
+            SDL_WaitThread(thread, nullptr);
+            thread = nullptr;
+        }
+    }
+
+    bool WorkerPool::Submit(WorkerJob job, void *data) {
+        util::mutex_lock(this->mutex);
+        bool ok = !this->stopped && cbuf_push(&this->tasks, (WorkerTask{job, data}));
+        if (ok) {
+            ++this->nr_pending;
+            util::cond_signal(this->thread_cond);
+        }
+        util::mutex_unlock(this->mutex);
+        return ok;
+    }
+
+    void WorkerPool::Wait() {
+        util::mutex_lock(this->mutex);
+        while (this->nr_pending) {
+            util::cond_wait(this->done_cond, this->mutex);
+        }
+        util::mutex_unlock(this->mutex);
+    }
+
+    int WorkerPool::Run(void *data) {
+        auto *pool = static_cast<WorkerPool *>(data);
+
+        for (;;) {
+            util::mutex_lock(pool->mutex);
+            while (!pool->stopped && cbuf_is_empty(&pool->tasks)) {
+                util::cond_wait(pool->thread_cond, pool->mutex);
+            }
+            struct WorkerTask task{};
+            // the submitted jobs are run even when stopped, so that Wait()
+            // returns
+            if (!cbuf_take(&pool->tasks, &task)) {
+                util::mutex_unlock(pool->mutex);
+                break;
+            }
+            util::mutex_unlock(pool->mutex);
+
+            task.job(task.data);
+
+            util::mutex_lock(pool->mutex);
+            if (!--pool->nr_pending) {
+                util::cond_broadcast(pool->done_cond);
+            }
+            util::mutex_unlock(pool->mutex);
+        }
+        return 0;
+    }
+
+}
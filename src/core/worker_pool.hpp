@@ -0,0 +1,61 @@
+//
+// Created by James Shen on 17/10/26.
+// Copyright (c) 2020 GUIDEBEE IT. All rights reserved
+//
+
+#ifndef ANDROID_IROBOT_WORKER_POOL_HPP
+#define ANDROID_IROBOT_WORKER_POOL_HPP
+
+#include "core/actor.hpp"
+#include "util/cbuf.hpp"
+
+#define WORKER_POOL_MAX_THREADS 8
+#define WORKER_POOL_MAX_JOBS 16
+
+namespace irobot {
+
+    typedef void (*WorkerJob)(void *data);
+
+    struct WorkerTask {
+        WorkerJob job;
+        void *data;
+    };
+
+    struct WorkerTaskQueue CBUF(struct WorkerTask, WORKER_POOL_MAX_JOBS);
+
+    // A few threads running the submitted jobs in parallel; the submitter
+    // waits for all of them in Wait() (fork-join).
+    class WorkerPool : public Actor {
+    public:
+        const char *name = "worker";
+        int nr_threads = 0;
+        SDL_Thread *threads[WORKER_POOL_MAX_THREADS]{};
+        // signaled when the last running job is done
+        SDL_cond *done_cond = nullptr;
+        struct WorkerTaskQueue tasks{};
+        // submitted and not done yet
+        int nr_pending = 0;
+
+        bool Init(const char *pool_name, int count);
+
+        void Destroy() override;
+
+        bool Start() override;
+
+        void Stop() override;
+
+        void Join() override;
+
+        // return false if the queue is full or the pool is stopped
+        bool Submit(WorkerJob job, void *data);
+
+        // block until all the submitted jobs are done
+        void Wait();
+
+    private:
+        static int Run(void *data);
+
+    };
+
+}
+#endif //ANDROID_IROBOT_WORKER_POOL_HPP
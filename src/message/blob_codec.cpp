@@ -0,0 +1,114 @@
+//
+// Created by James Shen on 17/10/26.
+// Copyright (c) 2020 GUIDEBEE IT. All rights reserved
+//
+
+#include "blob_codec.hpp"
+
+#include <SDL2/SDL_stdinc.h>
+#include <SDL2/SDL_timer.h>
+
+#include <cstring>
+#include <new>
+
+#include "util/buffer_util.hpp"
+#include "util/log.hpp"
+#include "util/lz4.hpp"
+
+namespace irobot::message {
+
+    const char *GetBlobCodecName(BlobCodec codec) {
+        switch (codec) {
+            case BLOB_CODEC_LZ4:
+                return "lz4";
+            default:
+                return "none";
+        }
+    }
+
+    bool ParseBlobCodec(const char *name, BlobCodec *codec) {
+        if (!strcmp(name, "lz4")) {
+            *codec = BLOB_CODEC_LZ4;
+            return true;
+        }
+        if (!strcmp(name, "none")) {
+            *codec = BLOB_CODEC_NONE;
+            return true;
+        }
+        return false;
+    }
+
+    BlobBuffer *BlobCompressor::GetOutput(int index, size_t size) {
+        for (auto &output : this->outputs[index]) {
+            if (!output) {
+                output = new(std::nothrow) BlobBuffer();
+                if (!output) {
+                    return nullptr;
+                }
+            } else if (output->GetRefCount() != 1) {
+                // not sent yet
+                continue;
+            }
+            return output->Reserve(size) ? output : nullptr;
+        }
+        return nullptr;
+    }
+
+    void BlobCompressor::Compress(BlobMessage *msg, BlobCodec codec) {
+        if (codec != BLOB_CODEC_LZ4) {
+            return;
+        }
+        if (!this->table) {
+            this->table = (uint32_t *) SDL_calloc(LZ4_HASH_SIZE, sizeof(uint32_t));
+            if (!this->table) {
+                LOGW("Could not allocate compression table");
+                return;
+            }
+        }
+        Uint64 start = SDL_GetPerformanceCounter();
+        msg->raw_length = msg->total_length;
+        for (Uint64 i = 0; i < msg->count; ++i) {
+            auto &buffer = msg->buffers[i];
+            size_t length = buffer.length;
+            if (buffer.codec != BLOB_CODEC_NONE || !buffer.data
+                || length < BLOB_CODEC_MIN_LENGTH) {
+                continue;
+            }
+            BlobBuffer *output = this->GetOutput((int) i, length);
+            if (!output) {
+                LOGW("Could not allocate compression buffer");
+                continue;
+            }
+            // raw length, then at most length - 9 bytes: not worth it if not
+            // smaller
+            size_t compressed = util::lz4_compress(buffer.data, length,
+                                                   output->data + 8, length - 9,
+                                                   this->table);
+            if (!compressed) {
+                continue;
+            }
+            util::buffer_write64be(output->data, (uint64_t) length);
+            output->Acquire();
+            msg->SetBuffer((int) i, output->data, 8 + compressed, output);
+            buffer.codec = BLOB_CODEC_LZ4;
+            msg->total_length -= length - buffer.length;
+        }
+        msg->compress_time = (SDL_GetPerformanceCounter() - start) * 1000000
+                             / SDL_GetPerformanceFrequency();
+    }
+
+    void BlobCompressor::Destroy() {
+        for (auto &outputs : this->outputs) {
+            for (auto &output : outputs) {
+                if (output) {
+                    // deleted once its message is sent
+                    output->Release();
+                    output = nullptr;
+                }
+            }
+        }
+        SDL_free(this->table);
+        this->table = nullptr;
+    }
+
+}
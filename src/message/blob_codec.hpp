@@ -0,0 +1,51 @@
+//
+// Created by James Shen on 17/10/26.
+// Copyright (c) 2020 GUIDEBEE IT. All rights reserved
+//
+
+#ifndef ANDROID_IROBOT_BLOB_CODEC_HPP
+#define ANDROID_IROBOT_BLOB_CODEC_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+#include "message/blob_msg.hpp"
+
+// smaller buffers (the image hashes) are never compressed
+#define BLOB_CODEC_MIN_LENGTH 64
+// outputs per buffer index: the messages queued, sent and compressed
+#define BLOB_COMPRESSOR_OUTPUTS 4
+
+namespace irobot::message {
+
+    // name in CONTROL_MSG_TYPE_SET_BLOB_CODEC
+    const char *GetBlobCodecName(BlobCodec codec);
+
+    // return false if the codec is not supported
+    bool ParseBlobCodec(const char *name, BlobCodec *codec);
+
+    // Compress the buffers of the blob messages, off the frame thread.
+    // Only accessed by the agent compressor thread.
+    class BlobCompressor {
+    public:
+        // outputs of each buffer index, reused once their message is sent,
+        // so that the compression needs no allocation while the image size
+        // does not change
+        BlobBuffer *outputs[BLOB_MSG_DATA_MAX_COUNT][BLOB_COMPRESSOR_OUTPUTS] = {};
+        uint32_t *table = nullptr;
+
+        // compress the buffers in place, the ones which would not be smaller
+        // are kept raw
+        // set msg->raw_length and msg->compress_time
+        void Compress(BlobMessage *msg, BlobCodec codec);
+
+        void Destroy();
+
+    private:
+        // nullptr if all of them are still referenced
+        BlobBuffer *GetOutput(int index, size_t size);
+    };
+
+}
+
+#endif //ANDROID_IROBOT_BLOB_CODEC_HPP
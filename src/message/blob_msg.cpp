@@ -4,37 +4,157 @@
 //
 
 #include "blob_msg.hpp"
+
+#include <SDL2/SDL_stdinc.h>
+
+#include <cstring>
+
 #include "util/buffer_util.hpp"
 
 namespace irobot::message {
-    size_t BlobMessage::Serialize(unsigned char *buf) {
-        int index = 0;
+
+    BlobRef::BlobRef() {
+        SDL_AtomicSet(&this->refs, 1);
+    }
+
+    void BlobRef::Acquire() {
+        SDL_AtomicIncRef(&this->refs);
+    }
+
+    void BlobRef::Release() {
+        if (SDL_AtomicDecRef(&this->refs)) {
+            delete this;
+        }
+    }
+
+    int BlobRef::GetRefCount() {
+        return SDL_AtomicGet(&this->refs);
+    }
+
+    BlobBuffer::~BlobBuffer() {
+        SDL_free(this->data);
+    }
+
+    bool BlobBuffer::Reserve(size_t min_size) {
+        if (this->size >= min_size) {
+            return true;
+        }
+        auto *new_data = (unsigned char *) SDL_realloc(this->data, min_size);
+        if (!new_data) {
+            return false;
+        }
+        this->data = new_data;
+        this->size = min_size;
+        return true;
+    }
+
+    size_t BlobMessage::GetHeaderSize(BlobVersion version) {
+        return version == BLOB_VERSION_1 ? BLOB_MSG_HEADER_SIZE_V1 : BLOB_MSG_HEADER_SIZE;
+    }
+
+    size_t BlobMessage::SerializeHeader(unsigned char *buf, BlobVersion version) {
+        size_t index = 0;
         util::buffer_write64be(&buf[index], this->type);
         index += 8;
         util::buffer_write64be(&buf[index], this->timestamp);
         index += 8;
         util::buffer_write64be(&buf[index], this->id);
         index += 8;
+        if (version >= BLOB_VERSION_2) {
+            util::buffer_write64be(&buf[index], this->capture_time);
+            index += 8;
+            util::buffer_write64be(&buf[index], this->decode_time);
+            index += 8;
+        }
         util::buffer_write64be(&buf[index], this->count);
         index += 8;
         util::buffer_write64be(&buf[index], this->total_length);
         index += 8;
+        return index;
+    }
+
+    void BlobMessage::SerializeBufferHeader(int index, unsigned char *buf) {
+        util::buffer_write64be(buf, this->buffers[index].length
+                                    | ((uint64_t) this->buffers[index].codec
+                                       << BLOB_MSG_CODEC_SHIFT));
+        util::buffer_write64be(&buf[8], this->buffers[index].width);
+        util::buffer_write64be(&buf[16], this->buffers[index].height);
+    }
+
+    size_t BlobMessage::Serialize(unsigned char *buf, BlobVersion version) {
+        size_t index = SerializeHeader(buf, version);
         for (int i = 0; i < this->count; i++) {
-            int length = this->buffers[i].length;
-            util::buffer_write64be(&buf[index], length);
-            index += 8;
-            memcpy(&buf[index], this->buffers[i].data, length + 16);
-            index += length + 16;
+            SerializeBufferHeader(i, &buf[index]);
+            index += BLOB_MSG_BUFFER_HEADER_SIZE;
+            size_t length = this->buffers[i].length;
+            memcpy(&buf[index], this->buffers[i].data, length);
+            index += length;
         }
         return index;
     }
 
+    void BlobMessage::SetBuffer(int index, unsigned char *data, Uint64 length,
+                                BlobRef *ref) {
+        auto &buffer = this->buffers[index];
+        if (buffer.ref) {
+            buffer.ref->Release();
+        } else {
+            SDL_free(buffer.data);
+        }
+        buffer.data = data;
+        buffer.length = length;
+        buffer.ref = ref;
+    }
+
     void BlobMessage::Destroy() {
         for (int i = 0; i < this->count; i++) {
-            if (this->buffers[i].data != nullptr) {
-                SDL_free(this->buffers[i].data);
-                this->buffers[i].data = nullptr;
+            SetBuffer(i, nullptr, 0, nullptr);
+        }
+    }
+
+    int BlobMailbox::GetSlot(const BlobMessage *msg) {
+        int type = msg->image_type != BLOB_MSG_TYPE_UNKNOWN
+                   ? msg->image_type : msg->type;
+        return type >= 0 && type < BLOB_MSG_TYPE_COUNT ? type : 0;
+    }
+
+    bool BlobMailbox::Put(const BlobMessage *msg, BlobMessage *replaced) {
+        int slot = GetSlot(msg);
+        bool was_full = this->order[slot] != 0;
+        if (was_full) {
+            *replaced = this->slots[slot];
+        }
+        this->slots[slot] = *msg;
+        this->order[slot] = this->next_order++;
+        return was_full;
+    }
+
+    bool BlobMailbox::Take(BlobMessage *msg) {
+        int oldest = -1;
+        for (int i = 0; i < BLOB_MSG_TYPE_COUNT; ++i) {
+            if (this->order[i] && (oldest < 0 || this->order[i] < this->order[oldest])) {
+                oldest = i;
+            }
+        }
+        return oldest >= 0 && TakeSlot(oldest, msg);
+    }
+
+    bool BlobMailbox::TakeSlot(int slot, BlobMessage *msg) {
+        if (!this->order[slot]) {
+            return false;
+        }
+        *msg = this->slots[slot];
+        this->slots[slot] = BlobMessage{};
+        this->order[slot] = 0;
+        return true;
+    }
+
+    bool BlobMailbox::IsEmpty() {
+        for (auto order : this->order) {
+            if (order) {
+                return false;
             }
         }
+        return true;
     }
-}
\ No newline at end of file
+}
@@ -6,41 +6,166 @@
 #ifndef ANDROID_IROBOT_BLOB_MSG_HPP
 #define ANDROID_IROBOT_BLOB_MSG_HPP
 
+#include <SDL2/SDL_atomic.h>
 #include <SDL2/SDL_types.h>
+
+#include <cstddef>
+
 #include "util/cbuf.hpp"
 
 #define BLOB_MSG_DATA_MAX_COUNT 16
-#define BLOB_MSG_SERIALIZED_MAX_SIZE 10485760
+// the serialized message is the header, then for each buffer its header
+// (length, width, height, BE64) and its data
+#define BLOB_MSG_HEADER_SIZE_V1 40
+// the largest header, of the latest BlobVersion
+#define BLOB_MSG_HEADER_SIZE 56
+#define BLOB_MSG_BUFFER_HEADER_SIZE 24
+#define BLOB_MSG_CODEC_SHIFT 56
+#define BLOB_MSG_TYPE_COUNT 4
 
 namespace irobot::message {
 
     enum BlobMessageType {
         BLOB_MSG_TYPE_UNKNOWN = 0,
         BLOB_MSG_TYPE_SCREEN_SHOT = 1,
-        BLOB_MSG_TYPE_OPENCV_MAT = 2
+        BLOB_MSG_TYPE_OPENCV_MAT = 2,
+        // with --agent-tile-delta: the images are sent as key frames or as
+        // their changed tiles, see tile_delta.hpp
+        BLOB_MSG_TYPE_TILE_DELTA = 3
+    };
+
+    // compression of a buffer, in the 8 most significant bits of its
+    // serialized length, chosen by CONTROL_MSG_TYPE_SET_BLOB_CODEC
+    enum BlobCodec {
+        BLOB_CODEC_NONE = 0,
+        // the data is the raw length (BE64), then a LZ4 block
+        BLOB_CODEC_LZ4 = 1
+    };
+
+    // layout of the message header, BLOB_VERSION_1 until the client asks
+    // for a later one (CONTROL_MSG_TYPE_SET_BLOB_VERSION)
+    enum BlobVersion {
+        // type, timestamp, id, count, total_length
+        BLOB_VERSION_1 = 1,
+        // capture_time and decode_time after id
+        BLOB_VERSION_2 = 2,
+        // the header of BLOB_VERSION_2, the hash buffer of the images is the
+        // pHash of the frame (the same for all its images), instead of the
+        // pHash of the image sent
+        BLOB_VERSION_3 = 3,
+        BLOB_VERSION_LATEST = BLOB_VERSION_3
+    };
+
+    // Owner of the memory of blob buffers (e.g. a cv::Mat), shared by the
+    // messages referencing it, deleted by the last Release(), on any thread
+    class BlobRef {
+    public:
+        BlobRef();
+
+        virtual ~BlobRef() = default;
+
+        void Acquire();
+
+        void Release();
+
+        // 1 if only its creator holds it
+        int GetRefCount();
+
+    private:
+        SDL_atomic_t refs{};
+    };
+
+    // SDL_malloc()'ed memory, reused while not referenced
+    class BlobBuffer : public BlobRef {
+    public:
+        unsigned char *data = nullptr;
+        size_t size = 0;
+
+        ~BlobBuffer() override;
+
+        // grow data to at least size bytes, the content is not kept
+        bool Reserve(size_t min_size);
     };
 
     struct BlobMessage {
         BlobMessageType type = BLOB_MSG_TYPE_UNKNOWN;
-        Uint64 timestamp = 0;
-        Uint64 id = 0;
+        Uint64 timestamp = 0; // host wall clock when sent, in ms
+        Uint64 id = 0; // decoded frame number, a gap means dropped frames
+        // host monotonic clock (CLOCK_MONOTONIC on Linux), in us, 0 if unknown
+        Uint64 capture_time = 0; // device capture, mapped to the host clock
+        Uint64 decode_time = 0;
         Uint64 count = 0;
         Uint64 total_length = 0;
         struct {
             Uint64 length = 0;
+            BlobCodec codec = BLOB_CODEC_NONE;
+            Uint64 width = 0;
+            Uint64 height = 0;
+            // length bytes, sent as is (not copied), kept alive by ref if
+            // set, else SDL_malloc()'ed and owned by the message
             unsigned char *data = nullptr;
+            BlobRef *ref = nullptr;
         } buffers[BLOB_MSG_DATA_MAX_COUNT];
+        // the image type, also of a BLOB_MSG_TYPE_TILE_DELTA, selects the
+        // mailbox slot (not serialized)
+        BlobMessageType image_type = BLOB_MSG_TYPE_UNKNOWN;
+        // latency timeline of the frame (not serialized)
+        int latency_id = 0;
+        // total_length before compression, 0 if no codec (not serialized)
+        Uint64 raw_length = 0;
+        Uint64 compress_time = 0; // in us
+        // AgentStream connection the buffers were compressed (their codec
+        // chosen) for, a message of a previous client is not sent (not
+        // serialized)
+        int connection = 0;
+
+        static size_t GetHeaderSize(BlobVersion version);
 
-        // buf size must be at least CONTROL_MSG_SERIALIZED_MAX_SIZE
+        // write the GetHeaderSize(version) bytes of the message header
+        size_t SerializeHeader(unsigned char *buf, BlobVersion version);
+
+        // write the BLOB_MSG_BUFFER_HEADER_SIZE bytes of the header of
+        // buffer index
+        void SerializeBufferHeader(int index, unsigned char *buf);
+
+        // copy the whole message, buf size must be at least
+        // GetHeaderSize(version) + total_length
         // return the number of bytes written
-        size_t Serialize(unsigned char *buf);
+        size_t Serialize(unsigned char *buf, BlobVersion version);
+
+        // replace the data of buffer index (the previous one is released)
+        void SetBuffer(int index, unsigned char *data, Uint64 length, BlobRef *ref);
 
         void Destroy();
 
     };
 
     // only allow 1 buffer, since video image is big,may cause OOM
-    struct BlobMessageQueue CBUF(BlobMessage, 2);
+    struct BlobMessageQueue CBUF(BlobMessage, 1);
+
+    // Latest-wins: one slot per image type, a new message replaces the
+    // unsent one of its type, so that the agent always gets the freshest
+    // images. Guarded by its owner.
+    struct BlobMailbox {
+        BlobMessage slots[BLOB_MSG_TYPE_COUNT];
+        // push order of the full slots, 0 if empty
+        Uint64 order[BLOB_MSG_TYPE_COUNT] = {};
+        Uint64 next_order = 1;
+
+        static int GetSlot(const BlobMessage *msg);
+
+        // return true if an unsent message has been replaced, moved to
+        // replaced (to be destroyed by the caller)
+        bool Put(const BlobMessage *msg, BlobMessage *replaced);
+
+        // take the oldest message, return false if empty
+        bool Take(BlobMessage *msg);
+
+        // take the message of slot, return false if empty
+        bool TakeSlot(int slot, BlobMessage *msg);
+
+        bool IsEmpty();
+    };
 
 }
 #endif //ANDROID_IROBOT_BLOB_MSG_HPP
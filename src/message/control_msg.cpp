@@ -14,6 +14,7 @@
 #include <sys/time.h>
 #include <string>
 
+#include "message/blob_codec.hpp"
 #include "util/buffer_util.hpp"
 #include "util/log.hpp"
 #include "util/str_util.hpp"
@@ -73,6 +74,72 @@ namespace irobot::message {
         }
     }
 
+    ssize_t ControlMessage::Deserialize(const unsigned char *buf, size_t len) {
+        if (!len) {
+            return 0; // not available
+        }
+        this->type = (enum ControlMessageType) buf[0];
+        switch (this->type) {
+            case CONTROL_MSG_TYPE_INJECT_KEYCODE:
+                if (len < 10) {
+                    return 0;
+                }
+                this->inject_keycode.action = (enum AndroidKeyEventAction) buf[1];
+                this->inject_keycode.keycode =
+                        (enum AndroidKeycode) util::buffer_read32be(&buf[2]);
+                this->inject_keycode.metastate =
+                        (enum AndroidMetaState) util::buffer_read32be(&buf[6]);
+                return 10;
+            case CONTROL_MSG_TYPE_INJECT_TEXT: {
+                ssize_t r = ReadString(&buf[1], len - 1, &this->inject_text.text);
+                return r > 0 ? 1 + r : r;
+            }
+            case CONTROL_MSG_TYPE_INJECT_TOUCH_EVENT:
+                if (len < 28) {
+                    return 0;
+                }
+                this->inject_touch_event.action =
+                        (enum AndroidMotionEventAction) buf[1];
+                this->inject_touch_event.pointer_id = util::buffer_read64be(&buf[2]);
+                ReadPosition(&buf[10], &this->inject_touch_event.position);
+                this->inject_touch_event.pressure =
+                        util::buffer_read16be(&buf[22]) / 0x1p16f;
+                this->inject_touch_event.buttons =
+                        (enum AndroidMotionEventButtons) util::buffer_read32be(&buf[24]);
+                return 28;
+            case CONTROL_MSG_TYPE_INJECT_SCROLL_EVENT:
+                if (len < 21) {
+                    return 0;
+                }
+                ReadPosition(&buf[1], &this->inject_scroll_event.position);
+                this->inject_scroll_event.hscroll =
+                        (int32_t) util::buffer_read32be(&buf[13]);
+                this->inject_scroll_event.vscroll =
+                        (int32_t) util::buffer_read32be(&buf[17]);
+                return 21;
+            case CONTROL_MSG_TYPE_SET_CLIPBOARD: {
+                ssize_t r = ReadString(&buf[1], len - 1, &this->set_clipboard.text);
+                return r > 0 ? 1 + r : r;
+            }
+            case CONTROL_MSG_TYPE_SET_SCREEN_POWER_MODE:
+                if (len < 2) {
+                    return 0;
+                }
+                this->set_screen_power_mode.mode = (enum ScreenPowerMode) buf[1];
+                return 2;
+            case CONTROL_MSG_TYPE_BACK_OR_SCREEN_ON:
+            case CONTROL_MSG_TYPE_EXPAND_NOTIFICATION_PANEL:
+            case CONTROL_MSG_TYPE_COLLAPSE_NOTIFICATION_PANEL:
+            case CONTROL_MSG_TYPE_GET_CLIPBOARD:
+            case CONTROL_MSG_TYPE_ROTATE_DEVICE:
+                // no additional data
+                return 1;
+            default:
+                LOGW("Unknown message type: %u", (unsigned) this->type);
+                return -1; // error, we cannot recover
+        }
+    }
+
     std::string ControlMessage::JsonSerialize() {
         char buffer[2 * CONTROL_MSG_SERIALIZED_MAX_SIZE];
         char temp[256];
@@ -135,6 +202,47 @@ namespace irobot::message {
                 strcat(buffer, temp);
             }
                 break;
+            case CONTROL_MSG_TYPE_SAVE_REPLAY: {
+                if (this->save_replay.filename) {
+                    sprintf(temp, "    \"msg_type\" : \"%s\",\n", "CONTROL_MSG_TYPE_SAVE_REPLAY");
+                    strcat(buffer, temp);
+                    sprintf(temp, "    \"save_replay\" : {\n");
+                    strcat(buffer, temp);
+                    sprintf(temp, "        \"filename\" : \"%s\"\n", this->save_replay.filename);
+                    strcat(buffer, temp);
+                    strcat(buffer, "    }\n");
+                } else {
+                    sprintf(temp, "    \"msg_type\" : \"%s\"\n", "CONTROL_MSG_TYPE_SAVE_REPLAY");
+                    strcat(buffer, temp);
+                }
+            }
+                break;
+            case CONTROL_MSG_TYPE_REQUEST_KEY_FRAME: {
+                sprintf(temp, "    \"msg_type\" : \"%s\"\n", "CONTROL_MSG_TYPE_REQUEST_KEY_FRAME");
+                strcat(buffer, temp);
+            }
+                break;
+            case CONTROL_MSG_TYPE_SET_BLOB_CODEC: {
+                sprintf(temp, "    \"msg_type\" : \"%s\",\n", "CONTROL_MSG_TYPE_SET_BLOB_CODEC");
+                strcat(buffer, temp);
+                sprintf(temp, "    \"blob_codec\" : {\n");
+                strcat(buffer, temp);
+                sprintf(temp, "        \"codecs\" : [\"%s\"]\n",
+                        GetBlobCodecName(this->set_blob_codec.codec));
+                strcat(buffer, temp);
+                strcat(buffer, "    }\n");
+            }
+                break;
+            case CONTROL_MSG_TYPE_SET_BLOB_VERSION: {
+                sprintf(temp, "    \"msg_type\" : \"%s\",\n", "CONTROL_MSG_TYPE_SET_BLOB_VERSION");
+                strcat(buffer, temp);
+                sprintf(temp, "    \"blob_version\" : {\n");
+                strcat(buffer, temp);
+                sprintf(temp, "        \"version\" : %d\n", (int) this->set_blob_version.version);
+                strcat(buffer, temp);
+                strcat(buffer, "    }\n");
+            }
+                break;
 
             case CONTROL_MSG_TYPE_INJECT_TOUCH_EVENT: {
                 sprintf(temp, "    \"msg_type\" : \"%s\",\n", "CONTROL_MSG_TYPE_INJECT_TOUCH_EVENT");
@@ -248,6 +356,14 @@ namespace irobot::message {
                 this->type = CONTROL_MSG_TYPE_START_RECORDING;
             } else if (msg_type == "CONTROL_MSG_TYPE_END_RECORDING") {
                 this->type = CONTROL_MSG_TYPE_END_RECORDING;
+            } else if (msg_type == "CONTROL_MSG_TYPE_SAVE_REPLAY") {
+                this->type = CONTROL_MSG_TYPE_SAVE_REPLAY;
+            } else if (msg_type == "CONTROL_MSG_TYPE_REQUEST_KEY_FRAME") {
+                this->type = CONTROL_MSG_TYPE_REQUEST_KEY_FRAME;
+            } else if (msg_type == "CONTROL_MSG_TYPE_SET_BLOB_CODEC") {
+                this->type = CONTROL_MSG_TYPE_SET_BLOB_CODEC;
+            } else if (msg_type == "CONTROL_MSG_TYPE_SET_BLOB_VERSION") {
+                this->type = CONTROL_MSG_TYPE_SET_BLOB_VERSION;
             } else /* default: */
             {
                 this->type = CONTROL_MSG_TYPE_UNKNOWN;
@@ -347,6 +463,54 @@ namespace irobot::message {
                 case CONTROL_MSG_TYPE_END_RECORDING:
                     LOGD("CONTROL_MSG_TYPE_END_RECORDING: %d", (int) this->type);
                     break;
+                case CONTROL_MSG_TYPE_SAVE_REPLAY:
+                    LOGD("CONTROL_MSG_TYPE_SAVE_REPLAY: %d", (int) this->type);
+                    {
+                        this->save_replay.filename = nullptr;
+                        auto save_replay = j["save_replay"];
+                        if (save_replay != nullptr) {
+                            std::string filename = save_replay["filename"];
+                            this->save_replay.filename = SDL_strdup(filename.c_str());
+                        }
+                    }
+                    break;
+                case CONTROL_MSG_TYPE_REQUEST_KEY_FRAME:
+                    LOGD("CONTROL_MSG_TYPE_REQUEST_KEY_FRAME: %d", (int) this->type);
+                    break;
+                case CONTROL_MSG_TYPE_SET_BLOB_CODEC:
+                    LOGD("CONTROL_MSG_TYPE_SET_BLOB_CODEC: %d", (int) this->type);
+                    {
+                        // the codecs of the client, in its order of preference
+                        this->set_blob_codec.codec = BLOB_CODEC_NONE;
+                        auto blob_codec = j["blob_codec"];
+                        if (blob_codec != nullptr) {
+                            for (auto &name : blob_codec["codecs"]) {
+                                if (name.is_string()
+                                    && ParseBlobCodec(name.get<std::string>().c_str(),
+                                                      &this->set_blob_codec.codec)) {
+                                    break;
+                                }
+                            }
+                        }
+                    }
+                    break;
+                case CONTROL_MSG_TYPE_SET_BLOB_VERSION:
+                    LOGD("CONTROL_MSG_TYPE_SET_BLOB_VERSION: %d", (int) this->type);
+                    {
+                        int version = BLOB_VERSION_1;
+                        auto blob_version = j["blob_version"];
+                        if (blob_version != nullptr
+                            && blob_version["version"].is_number_integer()) {
+                            version = blob_version["version"];
+                        }
+                        if (version < BLOB_VERSION_1) {
+                            version = BLOB_VERSION_1;
+                        } else if (version > BLOB_VERSION_LATEST) {
+                            version = BLOB_VERSION_LATEST;
+                        }
+                        this->set_blob_version.version = (enum BlobVersion) version;
+                    }
+                    break;
                 default:
                     LOGW("Unknown remote control message type: %d", (int) this->type);
                     ret = 0; // error, we cannot recover
@@ -364,6 +528,9 @@ namespace irobot::message {
             case CONTROL_MSG_TYPE_SET_CLIPBOARD:
                 SDL_free(this->set_clipboard.text);
                 break;
+            case CONTROL_MSG_TYPE_SAVE_REPLAY:
+                SDL_free(this->save_replay.filename);
+                break;
             default:
                 // do nothing
                 break;
@@ -378,6 +545,32 @@ namespace irobot::message {
         util::buffer_write16be(&buf[10], position->screen_size.height);
     }
 
+    void ControlMessage::ReadPosition(const uint8_t *buf, struct Position *position) {
+        position->point.x = (int32_t) util::buffer_read32be(&buf[0]);
+        position->point.y = (int32_t) util::buffer_read32be(&buf[4]);
+        position->screen_size.width = util::buffer_read16be(&buf[8]);
+        position->screen_size.height = util::buffer_read16be(&buf[10]);
+    }
+
+    ssize_t ControlMessage::ReadString(const unsigned char *buf, size_t len, char **utf8) {
+        if (len < 2) {
+            return 0; // not available
+        }
+        uint16_t text_len = util::buffer_read16be(buf);
+        if (text_len > len - 2) {
+            return 0; // not available
+        }
+        char *text = (char *) SDL_malloc(text_len + 1);
+        if (!text) {
+            LOGW("Could not allocate text");
+            return -1;
+        }
+        memcpy(text, &buf[2], text_len);
+        text[text_len] = '\0';
+        *utf8 = text;
+        return 2 + text_len;
+    }
+
 // write length (2 bytes) + string (non nul-terminated)
     size_t ControlMessage::WriteString(const char *utf8, size_t max_len, unsigned char *buf) {
         size_t len = util::utf8_truncation_index(utf8, max_len);
@@ -6,6 +6,16 @@
 #ifndef ANDROID_IROBOT_CONTROL_MSG_HPP
 #define ANDROID_IROBOT_CONTROL_MSG_HPP
 
+#if defined (__cplusplus)
+extern "C" {
+#endif
+
+#include <unistd.h>
+
+#if defined (__cplusplus)
+}
+#endif
+
 #include <cstddef>
 #include <cstdint>
 #include <string>
@@ -14,6 +24,7 @@
 #include "android/keycodes.hpp"
 #include "util/cbuf.hpp"
 #include "core/common.hpp"
+#include "message/blob_msg.hpp"
 
 #define CONTROL_MSG_TEXT_MAX_LENGTH 300
 #define CONTROL_MSG_CLIPBOARD_TEXT_MAX_LENGTH 4093
@@ -40,6 +51,14 @@ namespace irobot::message {
         CONTROL_MSG_TYPE_ROTATE_DEVICE,
         CONTROL_MSG_TYPE_START_RECORDING,
         CONTROL_MSG_TYPE_END_RECORDING,
+        // agent only: save the replay buffer
+        CONTROL_MSG_TYPE_SAVE_REPLAY,
+        // agent only: send the next images as key frames (tile deltas)
+        CONTROL_MSG_TYPE_REQUEST_KEY_FRAME,
+        // agent only: compress the blob messages, on connect
+        CONTROL_MSG_TYPE_SET_BLOB_CODEC,
+        // agent only: layout of the blob message headers, on connect
+        CONTROL_MSG_TYPE_SET_BLOB_VERSION,
         CONTROL_MSG_TYPE_UNKNOWN,
     };
 
@@ -79,12 +98,27 @@ namespace irobot::message {
             struct {
                 enum ScreenPowerMode mode;
             } set_screen_power_mode;
+            struct {
+                char *filename; // owned, to be freed by SDL_free(), may be null
+            } save_replay;
+            struct {
+                // the first codec of the client list supported
+                enum BlobCodec codec;
+            } set_blob_codec;
+            struct {
+                // the client version, down to the latest supported
+                enum BlobVersion version;
+            } set_blob_version;
         };
 
         // buf size must be at least CONTROL_MSG_SERIALIZED_MAX_SIZE
         // return the number of bytes written
         size_t Serialize(unsigned char *buf);
 
+        // inverse of Serialize(), for the mock device server
+        // return the number of bytes read, 0 if incomplete, -1 on error
+        ssize_t Deserialize(const unsigned char *buf, size_t len);
+
         void Destroy();
 
         std::string JsonSerialize();
@@ -93,9 +127,15 @@ namespace irobot::message {
 
         static void WritePosition(uint8_t *buf, const struct Position *position);
 
+        static void ReadPosition(const uint8_t *buf, struct Position *position);
+
         // write length (2 bytes) + string (non nul-terminated)
         static size_t WriteString(const char *utf8, size_t max_len, unsigned char *buf);
 
+        // read length (2 bytes) + string into a new nul-terminated string
+        // return the number of bytes read, 0 if incomplete, -1 on error
+        static ssize_t ReadString(const unsigned char *buf, size_t len, char **utf8);
+
         static uint16_t ToFixedPoint16(float f);
     };
 
@@ -7,6 +7,7 @@
 
 #include "util/buffer_util.hpp"
 #include "util/log.hpp"
+#include "util/str_util.hpp"
 
 namespace irobot::message {
 
@@ -45,6 +46,22 @@ namespace irobot::message {
         }
     }
 
+    size_t DeviceMessage::Serialize(unsigned char *buf) {
+        buf[0] = this->type;
+        switch (this->type) {
+            case DEVICE_MSG_TYPE_CLIPBOARD: {
+                size_t len = util::utf8_truncation_index(this->clipboard.text,
+                                                         DEVICE_MSG_TEXT_MAX_LENGTH);
+                util::buffer_write16be(&buf[1], (uint16_t) len);
+                memcpy(&buf[3], this->clipboard.text, len);
+                return 3 + len;
+            }
+            default:
+                LOGW("Unknown device message type: %d", (int) this->type);
+                return 0;
+        }
+    }
+
     void DeviceMessage::Destroy() {
         struct DeviceMessage *msg = this;
         if (msg->type == DEVICE_MSG_TYPE_CLIPBOARD) {
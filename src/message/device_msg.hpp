@@ -38,6 +38,10 @@ namespace irobot::message {
 
         ssize_t Deserialize(const unsigned char *buf, size_t len);
 
+        // buf size must be at least DEVICE_MSG_SERIALIZED_MAX_SIZE
+        // return the number of bytes written, for the mock device server
+        size_t Serialize(unsigned char *buf);
+
         void Destroy();
     };
 
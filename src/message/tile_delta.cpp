@@ -0,0 +1,170 @@
+//
+// Created by James Shen on 17/10/26.
+// Copyright (c) 2020 GUIDEBEE IT. All rights reserved
+//
+
+#include "tile_delta.hpp"
+
+#include <SDL2/SDL_stdinc.h>
+
+#include <cstring>
+
+#include "util/buffer_util.hpp"
+#include "util/log.hpp"
+
+namespace irobot::message {
+
+    size_t TileDeltaEncoder::GetMaxSize(int width, int height, int channels) {
+        // a delta with all its tiles changed is sent as a key frame
+        return TILE_DELTA_HEADER_SIZE + (size_t) width * height * channels;
+    }
+
+    void TileDeltaEncoder::RequestKeyFrame() {
+        this->key_requested = true;
+    }
+
+    void TileDeltaEncoder::Cancel(const uint8_t *payload, size_t len) {
+        if (!this->reference || len < TILE_DELTA_HEADER_SIZE
+            || (payload[1] & TILE_DELTA_FLAG_KEY)) {
+            // replaced by a key frame
+            this->key_requested = true;
+            return;
+        }
+        int tile = this->tile_size;
+        size_t bitmap_size = ((size_t) ((this->width + tile - 1) / tile)
+                              * ((this->height + tile - 1) / tile) + 7) / 8;
+        if (len < TILE_DELTA_HEADER_SIZE + bitmap_size) {
+            this->key_requested = true;
+            return;
+        }
+        if (this->pending_size < bitmap_size) {
+            auto *pending_bitmap = (uint8_t *) SDL_realloc(this->pending, bitmap_size);
+            if (!pending_bitmap) {
+                LOGW("Could not allocate tile delta bitmap");
+                this->key_requested = true;
+                return;
+            }
+            this->pending = pending_bitmap;
+            this->pending_size = bitmap_size;
+        }
+        if (!this->has_pending) {
+            memset(this->pending, 0, bitmap_size);
+        }
+        const uint8_t *bitmap = payload + TILE_DELTA_HEADER_SIZE;
+        for (size_t i = 0; i < bitmap_size; ++i) {
+            this->pending[i] |= bitmap[i];
+        }
+        this->has_pending = true;
+        --this->sequence;
+    }
+
+    void TileDeltaEncoder::Destroy() {
+        SDL_free(this->reference);
+        this->reference = nullptr;
+        SDL_free(this->pending);
+        this->pending = nullptr;
+        this->pending_size = 0;
+        this->has_pending = false;
+    }
+
+    size_t TileDeltaEncoder::EncodeKeyFrame(const uint8_t *data, size_t stride,
+                                            uint8_t *buf) {
+        size_t row_size = (size_t) this->width * this->channels;
+        buf[1] = TILE_DELTA_FLAG_KEY;
+        util::buffer_write32be(&buf[4], 0);
+        uint8_t *out = buf + TILE_DELTA_HEADER_SIZE;
+        for (int y = 0; y < this->height; ++y) {
+            memcpy(out, data + y * stride, row_size);
+            out += row_size;
+        }
+        memcpy(this->reference, buf + TILE_DELTA_HEADER_SIZE,
+               row_size * this->height);
+        this->sequence = 0;
+        this->key_requested = false;
+        this->has_pending = false;
+        return out - buf;
+    }
+
+    size_t TileDeltaEncoder::Encode(uint8_t type, const uint8_t *data,
+                                    int width, int height, int channels,
+                                    size_t stride, uint8_t *buf) {
+        if (width <= 0 || height <= 0 || channels <= 0
+            || this->tile_size <= 0 || this->tile_size > 255) {
+            return 0;
+        }
+        bool resized = !this->reference || width != this->width
+                       || height != this->height || channels != this->channels;
+        if (resized) {
+            // first image, or the device has been rotated
+            SDL_free(this->reference);
+            this->reference = (uint8_t *) SDL_malloc((size_t) width * height * channels);
+            if (!this->reference) {
+                LOGC("Could not allocate tile delta reference");
+                this->width = 0;
+                return 0;
+            }
+            this->width = width;
+            this->height = height;
+            this->channels = channels;
+            this->has_pending = false;
+        }
+
+        buf[0] = type;
+        buf[1] = 0;
+        buf[2] = (uint8_t) channels;
+        buf[3] = (uint8_t) this->tile_size;
+        if (resized || this->key_requested) {
+            return this->EncodeKeyFrame(data, stride, buf);
+        }
+
+        int tile = this->tile_size;
+        int tiles_x = (width + tile - 1) / tile;
+        int tiles_y = (height + tile - 1) / tile;
+        size_t row_size = (size_t) width * channels;
+        uint8_t *bitmap = buf + TILE_DELTA_HEADER_SIZE;
+        size_t bitmap_size = ((size_t) tiles_x * tiles_y + 7) / 8;
+        memset(bitmap, 0, bitmap_size);
+        uint8_t *out = bitmap + bitmap_size;
+        size_t max_size = GetMaxSize(width, height, channels);
+
+        for (int ty = 0; ty < tiles_y; ++ty) {
+            int y0 = ty * tile;
+            int rows = height - y0 < tile ? height - y0 : tile;
+            for (int tx = 0; tx < tiles_x; ++tx) {
+                size_t x0 = (size_t) tx * tile * channels;
+                size_t tile_row_size = (size_t) (width - tx * tile < tile
+                                                 ? width - tx * tile : tile)
+                                       * channels;
+                int index = ty * tiles_x + tx;
+                // sent by a cancelled delta: the client does not have it
+                bool changed = this->has_pending
+                               && (this->pending[index / 8] & (0x80 >> (index % 8)));
+                for (int y = y0; !changed && y < y0 + rows; ++y) {
+                    if (memcmp(data + y * stride + x0,
+                               this->reference + y * row_size + x0,
+                               tile_row_size)) {
+                        changed = true;
+                        break;
+                    }
+                }
+                if (!changed) {
+                    continue;
+                }
+                if ((size_t) (out - buf) + rows * tile_row_size >= max_size) {
+                    // not smaller than the image
+                    return this->EncodeKeyFrame(data, stride, buf);
+                }
+                bitmap[index / 8] |= 0x80 >> (index % 8);
+                for (int y = y0; y < y0 + rows; ++y) {
+                    memcpy(out, data + y * stride + x0, tile_row_size);
+                    memcpy(this->reference + y * row_size + x0, out, tile_row_size);
+                    out += tile_row_size;
+                }
+            }
+        }
+        util::buffer_write32be(&buf[4], ++this->sequence);
+        this->has_pending = false;
+        return out - buf;
+    }
+
+}
@@ -0,0 +1,74 @@
+//
+// Created by James Shen on 17/10/26.
+// Copyright (c) 2020 GUIDEBEE IT. All rights reserved
+//
+
+#ifndef ANDROID_IROBOT_TILE_DELTA_HPP
+#define ANDROID_IROBOT_TILE_DELTA_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+// Payload of a BLOB_MSG_TYPE_TILE_DELTA image buffer (after its width and
+// height):
+//   0: BlobMessageType of the image
+//   1: flags
+//   2: channels (1 for gray, 3 for BGR)
+//   3: tile size, in pixels
+//   4: sequence number (BE32), per image type, 0 for a key frame
+//   8: key frame: the image, rows of width * channels bytes
+//      delta: one bit per tile, row-major, most significant bit first, set
+//      if the tile changed since the previous image, then the changed tiles,
+//      rows of tile_width * channels bytes (smaller at the right and bottom
+//      edges)
+// a delta applies to the image of the previous sequence number, on a gap the
+// client must request a key frame (CONTROL_MSG_TYPE_REQUEST_KEY_FRAME)
+#define TILE_DELTA_HEADER_SIZE 8
+#define TILE_DELTA_FLAG_KEY 1
+#define TILE_DELTA_DEFAULT_TILE_SIZE 32
+
+namespace irobot::message {
+
+    // Encode the successive images of one type against the last one sent.
+    // Only accessed by the thread producing the images.
+    class TileDeltaEncoder {
+    public:
+        int tile_size = TILE_DELTA_DEFAULT_TILE_SIZE;
+        // the last image encoded, rows of width * channels bytes
+        uint8_t *reference = nullptr;
+        int width = 0;
+        int height = 0;
+        int channels = 0;
+        uint32_t sequence = 0;
+        bool key_requested = true;
+        // the tiles of the cancelled deltas, sent with the next one
+        uint8_t *pending = nullptr;
+        size_t pending_size = 0;
+        bool has_pending = false;
+
+        // upper bound of the payload size of an image
+        static size_t GetMaxSize(int width, int height, int channels);
+
+        // encode the image as a key frame or a delta, into buf (at least
+        // GetMaxSize() bytes), and make it the reference
+        // return the number of bytes written, 0 on error
+        size_t Encode(uint8_t type, const uint8_t *data, int width, int height,
+                      int channels, size_t stride, uint8_t *buf);
+
+        // the next image is a key frame (new client, lost delta...)
+        void RequestKeyFrame();
+
+        // the last payload encoded has not been sent (replaced by a newer
+        // image): the next delta applies to the image before it, with its
+        // tiles, and takes its sequence number
+        void Cancel(const uint8_t *payload, size_t len);
+
+        void Destroy();
+
+    private:
+        size_t EncodeKeyFrame(const uint8_t *data, size_t stride, uint8_t *buf);
+    };
+
+}
+
+#endif //ANDROID_IROBOT_TILE_DELTA_HPP
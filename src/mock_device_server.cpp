@@ -0,0 +1,492 @@
+//
+// Created by James Shen on 17/10/26.
+// Copyright (c) 2020 GUIDEBEE IT. All rights reserved
+//
+
+// A local stand-in for the device server, to benchmark the client without a
+// device nor adb (run the client with --mock-server).
+//
+// It listens on the local port like the device server behind "adb forward":
+// it sends a dummy byte on the video socket, the device information, then
+// replays a recorded video stream, i.e. a sequence of 12-byte meta headers
+// (pts + length) and H.264 packets, as sent by the real server after the
+// device information. The control stream is decoded and logged, a
+// GET_CLIPBOARD request is answered by a clipboard device message.
+
+#define SDL_MAIN_HANDLED
+
+#if defined (__cplusplus)
+extern "C" {
+#endif
+
+#include <getopt.h>
+#include <libavutil/time.h>
+
+#if defined (__cplusplus)
+}
+#endif
+
+#include <SDL2/SDL_thread.h>
+
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "config.hpp"
+#include "android/receiver.hpp"
+#include "message/control_msg.hpp"
+#include "message/device_msg.hpp"
+#include "platform/net.hpp"
+#include "util/buffer_util.hpp"
+#include "util/log.hpp"
+#include "util/str_util.hpp"
+
+#define NO_PTS UINT64_C(-1)
+#define HEADER_SIZE 12
+
+#define OPT_NAME      1000
+#define OPT_SIZE      1001
+#define OPT_SPEED     1002
+#define OPT_LOOP      1003
+#define OPT_CLIPBOARD 1004
+
+using namespace irobot;
+using namespace irobot::message;
+using namespace irobot::platform;
+
+struct MockOptions {
+    const char *filename;
+    const char *device_name;
+    const char *clipboard;
+    uint16_t port;
+    struct Size size;
+    // replay speed factor, 0 to send as fast as possible
+    double speed;
+    bool loop;
+};
+
+struct ReplayState {
+    int64_t start_time;
+    uint64_t pts_origin; // first pts of the stream
+    int64_t pts_offset; // added to the pts of the current loop
+    uint64_t nr_packets;
+    uint64_t nr_bytes;
+};
+
+struct ControlContext {
+    socket_t control_socket;
+    const char *clipboard;
+    char *device_clipboard; // set by SET_CLIPBOARD
+    unsigned nr_messages;
+};
+
+static void PrintUsage(const char *arg0) {
+    fprintf(stderr,
+            "Usage: %s [options] stream_file\n"
+            "\n"
+            "Replay a recorded video stream (12-byte meta headers + H.264\n"
+            "packets) to an irobot client started with --mock-server.\n"
+            "\n"
+            "Options:\n"
+            "\n"
+            "    -p, --port port\n"
+            "        Set the TCP port to listen on.\n"
+            "        Default is %d.\n"
+            "\n"
+            "    --name name\n"
+            "        Set the device name. Default is \"mock\".\n"
+            "\n"
+            "    --size WxH\n"
+            "        Set the initial frame size sent to the client.\n"
+            "        Default is 1080x1920.\n"
+            "\n"
+            "    --speed factor\n"
+            "        Replay the stream faster (> 1) or slower (< 1) than\n"
+            "        recorded, following the packet timestamps. 0 sends the\n"
+            "        packets as fast as the client reads them.\n"
+            "        Default is 1.\n"
+            "\n"
+            "    --loop\n"
+            "        Replay the stream until the client disconnects.\n"
+            "\n"
+            "    --clipboard text\n"
+            "        Set the device clipboard content.\n"
+            "\n",
+            arg0, DEFAULT_LOCAL_PORT);
+}
+
+static bool ParseArgs(struct MockOptions *opts, int argc, char *argv[]) {
+    static const struct option long_options[] = {
+            {"clipboard", required_argument, nullptr, OPT_CLIPBOARD},
+            {"help",      no_argument,       nullptr, 'h'},
+            {"loop",      no_argument,       nullptr, OPT_LOOP},
+            {"name",      required_argument, nullptr, OPT_NAME},
+            {"port",      required_argument, nullptr, 'p'},
+            {"size",      required_argument, nullptr, OPT_SIZE},
+            {"speed",     required_argument, nullptr, OPT_SPEED},
+            {nullptr, 0,                     nullptr, 0},
+    };
+
+    int c;
+    while ((c = getopt_long(argc, argv, "hp:", long_options, nullptr)) != -1) {
+        switch (c) {
+            case 'p': {
+                long value;
+                if (!util::parse_integer(optarg, &value)
+                    || value <= 0 || value > 0xFFFF) {
+                    LOGE("Could not parse port: %s", optarg);
+                    return false;
+                }
+                opts->port = (uint16_t) value;
+                break;
+            }
+            case OPT_NAME:
+                opts->device_name = optarg;
+                break;
+            case OPT_SIZE: {
+                unsigned width, height;
+                if (sscanf(optarg, "%ux%u", &width, &height) != 2
+                    || !width || width > 0xFFFF || !height || height > 0xFFFF) {
+                    LOGE("Could not parse size: %s", optarg);
+                    return false;
+                }
+                opts->size.width = (uint16_t) width;
+                opts->size.height = (uint16_t) height;
+                break;
+            }
+            case OPT_SPEED: {
+                char *end;
+                opts->speed = strtod(optarg, &end);
+                if (*end || opts->speed < 0) {
+                    LOGE("Could not parse speed: %s", optarg);
+                    return false;
+                }
+                break;
+            }
+            case OPT_LOOP:
+                opts->loop = true;
+                break;
+            case OPT_CLIPBOARD:
+                opts->clipboard = optarg;
+                break;
+            case 'h':
+                PrintUsage(argv[0]);
+                exit(0);
+            default:
+                // getopt prints the error message on stderr
+                return false;
+        }
+    }
+
+    if (optind != argc - 1) {
+        PrintUsage(argv[0]);
+        return false;
+    }
+    opts->filename = argv[optind];
+    return true;
+}
+
+static bool SendDeviceInformation(socket_t socket, const char *device_name,
+                                  struct Size size) {
+    unsigned char buf[DEVICE_NAME_FIELD_LENGTH + 4] = {};
+    util::xstrncpy((char *) buf, device_name, DEVICE_NAME_FIELD_LENGTH);
+    util::buffer_write16be(&buf[DEVICE_NAME_FIELD_LENGTH], size.width);
+    util::buffer_write16be(&buf[DEVICE_NAME_FIELD_LENGTH + 2], size.height);
+    return net_send_all(socket, buf, sizeof(buf)) == sizeof(buf);
+}
+
+static void LogControlMessage(struct ControlMessage *msg) {
+    switch (msg->type) {
+        case CONTROL_MSG_TYPE_INJECT_KEYCODE:
+            LOGI("Control: keycode %d action %d metastate 0x%x",
+                 (int) msg->inject_keycode.keycode,
+                 (int) msg->inject_keycode.action,
+                 (unsigned) msg->inject_keycode.metastate);
+            break;
+        case CONTROL_MSG_TYPE_INJECT_TEXT:
+            LOGI("Control: text \"%s\"", msg->inject_text.text);
+            break;
+        case CONTROL_MSG_TYPE_INJECT_TOUCH_EVENT:
+            LOGI("Control: touch action %d pointer %" PRIx64 " (%d, %d) in %ux%u",
+                 (int) msg->inject_touch_event.action,
+                 msg->inject_touch_event.pointer_id,
+                 msg->inject_touch_event.position.point.x,
+                 msg->inject_touch_event.position.point.y,
+                 msg->inject_touch_event.position.screen_size.width,
+                 msg->inject_touch_event.position.screen_size.height);
+            break;
+        case CONTROL_MSG_TYPE_INJECT_SCROLL_EVENT:
+            LOGI("Control: scroll (%d, %d) at (%d, %d)",
+                 msg->inject_scroll_event.hscroll,
+                 msg->inject_scroll_event.vscroll,
+                 msg->inject_scroll_event.position.point.x,
+                 msg->inject_scroll_event.position.point.y);
+            break;
+        case CONTROL_MSG_TYPE_SET_CLIPBOARD:
+            LOGI("Control: set clipboard \"%s\"", msg->set_clipboard.text);
+            break;
+        case CONTROL_MSG_TYPE_SET_SCREEN_POWER_MODE:
+            LOGI("Control: set screen power mode %d",
+                 (int) msg->set_screen_power_mode.mode);
+            break;
+        default:
+            LOGI("Control: message type %d", (int) msg->type);
+            break;
+    }
+}
+
+static bool SendClipboard(struct ControlContext *context) {
+    struct DeviceMessage msg{};
+    msg.type = DEVICE_MSG_TYPE_CLIPBOARD;
+    msg.clipboard.text = context->device_clipboard
+                         ? context->device_clipboard
+                         : const_cast<char *>(context->clipboard);
+    unsigned char buf[DEVICE_MSG_SERIALIZED_MAX_SIZE];
+    size_t length = msg.Serialize(buf);
+    return net_send_all(context->control_socket, buf, length) == (ssize_t) length;
+}
+
+// decode, log and answer the control messages until the socket is closed
+static int RunControl(void *data) {
+    auto *context = (struct ControlContext *) data;
+    static unsigned char buf[CONTROL_MSG_SERIALIZED_MAX_SIZE];
+    size_t head = 0;
+    for (;;) {
+        ssize_t r = net_recv(context->control_socket, &buf[head], sizeof(buf) - head);
+        if (r <= 0) {
+            break;
+        }
+        head += r;
+
+        size_t consumed = 0;
+        for (;;) {
+            struct ControlMessage msg{};
+            ssize_t length = msg.Deserialize(&buf[consumed], head - consumed);
+            if (length == -1) {
+                LOGE("Invalid control message, closing");
+                return 0;
+            }
+            if (!length) {
+                // incomplete
+                break;
+            }
+            consumed += length;
+            ++context->nr_messages;
+            LogControlMessage(&msg);
+
+            if (msg.type == CONTROL_MSG_TYPE_GET_CLIPBOARD) {
+                if (!SendClipboard(context)) {
+                    LOGW("Could not send the clipboard");
+                }
+            } else if (msg.type == CONTROL_MSG_TYPE_SET_CLIPBOARD) {
+                // keep the text, the message does not own it anymore
+                SDL_free(context->device_clipboard);
+                context->device_clipboard = msg.set_clipboard.text;
+                continue;
+            }
+            msg.Destroy();
+        }
+        memmove(buf, &buf[consumed], head - consumed);
+        head -= consumed;
+    }
+    LOGD("Control socket closed");
+    return 0;
+}
+
+// replay the stream once, return false if the client is gone or on error
+static bool ReplayStream(FILE *file, socket_t video_socket,
+                         const struct MockOptions *opts,
+                         struct ReplayState *state) {
+    unsigned char header[HEADER_SIZE];
+    unsigned char *data = nullptr;
+    size_t capacity = 0;
+    uint64_t first_pts = NO_PTS;
+    uint64_t last_pts = NO_PTS;
+    int64_t frame_duration = 0;
+    bool ok = true;
+
+    while (fread(header, 1, HEADER_SIZE, file) == HEADER_SIZE) {
+        uint64_t pts = util::buffer_read64be(header);
+        uint32_t length = util::buffer_read32be(&header[8]);
+        if (!length) {
+            LOGE("Invalid packet length");
+            ok = false;
+            break;
+        }
+        if (length > capacity) {
+            auto *new_data = (unsigned char *) realloc(data, length);
+            if (!new_data) {
+                LOGE("Could not allocate packet of %" PRIu32 " bytes", length);
+                ok = false;
+                break;
+            }
+            data = new_data;
+            capacity = length;
+        }
+        if (fread(data, 1, length, file) != length) {
+            LOGW("Truncated packet at the end of the stream");
+            break;
+        }
+
+        if (pts != NO_PTS) {
+            if (first_pts == NO_PTS) {
+                first_pts = pts;
+            }
+            if (state->pts_origin == NO_PTS) {
+                state->pts_origin = pts;
+            }
+            if (last_pts != NO_PTS && pts > last_pts) {
+                frame_duration = (int64_t) (pts - last_pts);
+            }
+            last_pts = pts;
+            // keep the timestamps increasing across the loops
+            pts += state->pts_offset;
+            util::buffer_write64be(header, pts);
+            if (opts->speed > 0) {
+                auto elapsed = (double) (pts - state->pts_origin);
+                auto due = state->start_time + (int64_t) (elapsed / opts->speed);
+                int64_t now = av_gettime_relative();
+                if (due > now) {
+                    av_usleep((unsigned) (due - now));
+                }
+            }
+        }
+
+        if (net_send_all(video_socket, header, HEADER_SIZE) != HEADER_SIZE
+            || net_send_all(video_socket, data, length) != (ssize_t) length) {
+            LOGI("Client disconnected");
+            ok = false;
+            break;
+        }
+        ++state->nr_packets;
+        state->nr_bytes += HEADER_SIZE + length;
+    }
+
+    if (last_pts != NO_PTS) {
+        state->pts_offset += (int64_t) (last_pts - first_pts) + frame_duration;
+    }
+    free(data);
+    return ok;
+}
+
+int main(int argc, char *argv[]) {
+#ifndef NDEBUG
+    SDL_LogSetAllPriority(SDL_LOG_PRIORITY_DEBUG);
+#endif
+
+    struct MockOptions opts = {
+            .filename = nullptr,
+            .device_name = "mock",
+            .clipboard = "",
+            .port = DEFAULT_LOCAL_PORT,
+            .size = {1080, 1920},
+            .speed = 1,
+            .loop = false,
+    };
+    if (!ParseArgs(&opts, argc, argv)) {
+        return 1;
+    }
+
+    FILE *file = fopen(opts.filename, "rb");
+    if (!file) {
+        LOGE("Could not open %s", opts.filename);
+        return 1;
+    }
+
+    if (!net_init()) {
+        fclose(file);
+        return 1;
+    }
+
+    int ret = 1;
+    socket_t video_socket = INVALID_SOCKET;
+    struct ControlContext context = {
+            .control_socket = INVALID_SOCKET,
+            .clipboard = opts.clipboard,
+            .device_clipboard = nullptr,
+            .nr_messages = 0,
+    };
+    SDL_Thread *control_thread = nullptr;
+    struct ReplayState state = {
+            .start_time = 0,
+            .pts_origin = NO_PTS,
+            .pts_offset = 0,
+            .nr_packets = 0,
+            .nr_bytes = 0,
+    };
+
+    socket_t server_socket = net_listen(IPV4_LOCALHOST, opts.port, 1);
+    if (server_socket == INVALID_SOCKET) {
+        LOGE("Could not listen on port %" PRIu16, opts.port);
+        goto end;
+    }
+    LOGI("Mock device server listening on port %" PRIu16, opts.port);
+
+    video_socket = net_accept(server_socket);
+    if (video_socket == INVALID_SOCKET) {
+        goto end;
+    }
+    {
+        // the client reads one byte to detect a working connection
+        char byte = 0;
+        if (net_send_all(video_socket, &byte, 1) != 1) {
+            goto end;
+        }
+    }
+    context.control_socket = net_accept(server_socket);
+    if (context.control_socket == INVALID_SOCKET) {
+        goto end;
+    }
+    close_socket(&server_socket);
+
+    if (!SendDeviceInformation(video_socket, opts.device_name, opts.size)) {
+        LOGE("Could not send device information");
+        goto end;
+    }
+
+    control_thread = SDL_CreateThread(RunControl, "mock_control", &context);
+    if (!control_thread) {
+        LOGE("Could not start control thread");
+        goto end;
+    }
+
+    state.start_time = av_gettime_relative();
+    do {
+        if (!ReplayStream(file, video_socket, &opts, &state)) {
+            break;
+        }
+        rewind(file);
+    } while (opts.loop);
+
+    {
+        double elapsed = (double) (av_gettime_relative() - state.start_time) / 1000000;
+        LOGI("Sent %" PRIu64 " packets, %" PRIu64 " bytes in %.2f s (%.2f Mbit/s)",
+             state.nr_packets, state.nr_bytes, elapsed,
+             elapsed > 0 ? (double) state.nr_bytes * 8 / elapsed / 1000000 : 0.0);
+    }
+    ret = 0;
+
+end:
+    if (video_socket != INVALID_SOCKET) {
+        close_socket(&video_socket);
+    }
+    if (context.control_socket != INVALID_SOCKET) {
+        // unblock the control thread
+        net_shutdown(context.control_socket, SHUT_RDWR);
+    }
+    if (control_thread) {
+        SDL_WaitThread(control_thread, nullptr);
+        LOGI("Received %u control messages", context.nr_messages);
+    }
+    if (context.control_socket != INVALID_SOCKET) {
+        close_socket(&context.control_socket);
+    }
+    if (server_socket != INVALID_SOCKET) {
+        close_socket(&server_socket);
+    }
+    SDL_free(context.device_clipboard);
+    net_cleanup();
+    fclose(file);
+    return ret;
+}
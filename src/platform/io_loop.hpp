@@ -0,0 +1,95 @@
+//
+// Created by James Shen on 17/10/26.
+// Copyright (c) 2020 GUIDEBEE IT. All rights reserved
+//
+
+#ifndef ANDROID_IROBOT_IO_LOOP_HPP
+#define ANDROID_IROBOT_IO_LOOP_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+#include "config.hpp"
+#include "core/actor.hpp"
+#include "platform/net.hpp"
+
+#define IO_LOOP_MAX_WATCHES 8
+
+namespace irobot::platform {
+
+    // called on the io loop thread for each chunk received from a socket
+    // return false to stop receiving from this socket
+    typedef bool (*IoRecvHandler)(void *userdata, const uint8_t *data, size_t len);
+
+    // called on the io loop thread, with the loop mutex locked, when a watch
+    // registered by Watch() ends
+    // closed: see RecvUntilClosed()
+    typedef void (*IoEndHandler)(void *userdata, bool closed);
+
+    struct IoWatch {
+        socket_t socket;
+        IoRecvHandler handler;
+        IoEndHandler end_handler; // nullptr for RecvUntilClosed()
+        void *userdata;
+        uint32_t generation;
+        bool active; // the slot is owned by a RecvUntilClosed() caller
+        bool ended;  // no more calls to handler
+        bool closed; // ended by the socket (or handler), not by Stop()
+    };
+
+    struct IoLoopStats {
+        uint64_t nr_completions;
+        uint64_t nr_bytes;
+    };
+
+    // backend state, only defined where the backend is available
+    struct IoRing;
+
+    // One completion loop receiving from all the registered sockets, instead
+    // of one thread blocked in recv() per socket.
+    //
+    // On Linux, it is backed by io_uring (if found at build time), with
+    // a ring of provided buffers and multishot recv when the kernel supports
+    // it. Init() fails when the backend is not available, so that the
+    // callers keep their blocking threads.
+    class IoLoop : public Actor {
+    public:
+        struct IoRing *ring = nullptr;
+        struct IoWatch watches[IO_LOOP_MAX_WATCHES]{};
+        struct IoLoopStats stats{};
+
+        bool Init() override;
+
+        void Destroy() override;
+
+        bool Start() override;
+
+        void Stop() override;
+
+        // receive from socket on the loop thread, and block the calling
+        // thread until the watch ends
+        // return true if the socket was closed (or handler returned false),
+        // false if the loop is stopped
+        bool RecvUntilClosed(socket_t socket, IoRecvHandler handler,
+                             void *userdata);
+
+        // receive from socket on the loop thread, without blocking the
+        // calling thread: end_handler is called once the watch ends (the
+        // slot is released then)
+        // return false if the watch could not be registered
+        bool Watch(socket_t socket, IoRecvHandler handler,
+                   IoEndHandler end_handler, void *userdata);
+
+        static int RunLoop(void *data);
+
+    private:
+        // register a watch and submit its first recv
+        // return its index, or -1 on error
+        // the mutex must be locked
+        int AddWatch(socket_t socket, IoRecvHandler handler,
+                     IoEndHandler end_handler, void *userdata);
+    };
+
+}
+
+#endif //ANDROID_IROBOT_IO_LOOP_HPP
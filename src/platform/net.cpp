@@ -39,6 +39,8 @@ typedef struct in_addr IN_ADDR;
 #include <cstdio>
 #include <cstring>
 
+#include "util/log.hpp"
+
 namespace irobot::platform {
 
     socket_t net_connect(uint32_t addr, uint16_t port) {
@@ -132,6 +134,16 @@ namespace irobot::platform {
         return !shutdown(socket, how);
     }
 
+    bool net_set_recv_buffer_size(socket_t socket, uint32_t size) {
+        int value = (int) size;
+        if (setsockopt(socket, SOL_SOCKET, SO_RCVBUF, (const char *) &value,
+                       sizeof(value)) == -1) {
+            LOGE("Could not set SO_RCVBUF to %u", (unsigned) size);
+            return false;
+        }
+        return true;
+    }
+
     socket_t listen_on_port(uint16_t port) {
         return net_listen(IPV4_LOCALHOST, port, 1);
     }
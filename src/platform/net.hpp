@@ -40,9 +40,15 @@ typedef int socket_t;
 
 #define IPV4_LOCALHOST 0x7F000001
 //#define IPV4_LOCALHOST 0x00000000
+#define NET_SEND_MAX_BUFFERS 32
 
 namespace irobot::platform {
 
+    struct NetBuffer {
+        const void *data;
+        size_t len;
+    };
+
     bool net_init();
 
     void net_cleanup();
@@ -64,9 +70,17 @@ namespace irobot::platform {
 
     ssize_t net_send_all(socket_t socket, const void *buf, size_t len);
 
+    // send the count (at most NET_SEND_MAX_BUFFERS) buffers in order, without
+    // copying them (writev), until all have been written
+    // return the number of bytes written, -1 on error
+    ssize_t net_send_all_v(socket_t socket, const struct NetBuffer *bufs, int count);
+
     // how is SHUT_RD (read), SHUT_WR (write) or SHUT_RDWR (both)
     bool net_shutdown(socket_t socket, int how);
 
+    // set the kernel receive buffer size (SO_RCVBUF) of socket
+    bool net_set_recv_buffer_size(socket_t socket, uint32_t size);
+
     bool net_close(socket_t socket);
 
     socket_t listen_on_port(uint16_t port);
@@ -0,0 +1,408 @@
+//
+// Created by James Shen on 17/10/26.
+// Copyright (c) 2020 GUIDEBEE IT. All rights reserved
+//
+
+#include "platform/io_loop.hpp"
+
+#include "util/log.hpp"
+
+#ifdef IROBOT_HAVE_LIBURING
+
+#include <liburing.h>
+
+#include <cerrno>
+#include <cstring>
+
+#include <SDL2/SDL_stdinc.h>
+
+#include "util/lock.hpp"
+
+#define IO_RING_ENTRIES 64
+#define IO_BUFFER_GROUP 0
+// must be a power of 2
+#define IO_NR_BUFFERS 64
+#define IO_BUFFER_SIZE (64 * 1024)
+// user data of the completions to ignore (wake up, cancel)
+#define IO_NO_WATCH UINT64_C(0)
+
+namespace irobot::platform {
+
+    struct IoRing {
+        struct io_uring ring;
+        struct io_uring_buf_ring *buf_ring;
+        uint8_t *buffers;
+        // cleared on the first -EINVAL, for kernels older than 6.0
+        bool multishot;
+    };
+
+    static inline uint64_t watch_data(unsigned index, uint32_t generation) {
+        return ((uint64_t) generation << 32) | (index + 1);
+    }
+
+    // must be called with the loop mutex locked
+    static bool submit_recv(struct IoRing *r, const struct IoWatch *watch,
+                            uint64_t data) {
+        struct io_uring_sqe *sqe = io_uring_get_sqe(&r->ring);
+        if (!sqe) {
+            return false;
+        }
+        if (r->multishot) {
+            io_uring_prep_recv_multishot(sqe, watch->socket, nullptr, 0, 0);
+        } else {
+            io_uring_prep_recv(sqe, watch->socket, nullptr, IO_BUFFER_SIZE, 0);
+        }
+        // let the kernel pick a buffer from the ring on completion
+        sqe->flags |= IOSQE_BUFFER_SELECT;
+        sqe->buf_group = IO_BUFFER_GROUP;
+        io_uring_sqe_set_data64(sqe, data);
+        return io_uring_submit(&r->ring) >= 0;
+    }
+
+    // must be called with the loop mutex locked
+    static void submit_nop_or_cancel(struct IoRing *r, uint64_t cancel_data) {
+        struct io_uring_sqe *sqe = io_uring_get_sqe(&r->ring);
+        if (!sqe) {
+            LOGW("io_uring submission queue full");
+            return;
+        }
+        if (cancel_data != IO_NO_WATCH) {
+            io_uring_prep_cancel64(sqe, cancel_data, 0);
+        } else {
+            io_uring_prep_nop(sqe);
+        }
+        io_uring_sqe_set_data64(sqe, IO_NO_WATCH);
+        io_uring_submit(&r->ring);
+    }
+
+    bool IoLoop::Init() {
+        if (!Actor::Init()) {
+            return false;
+        }
+        this->stats = {};
+        for (auto &watch : this->watches) {
+            watch = {};
+        }
+
+        int ret;
+        auto *r = (struct IoRing *) SDL_calloc(1, sizeof(struct IoRing));
+        if (!r) {
+            LOGC("Could not allocate io ring");
+            goto error_destroy_actor;
+        }
+        ret = io_uring_queue_init(IO_RING_ENTRIES, &r->ring, 0);
+        if (ret < 0) {
+            LOGW("Could not initialize io_uring: %s", strerror(-ret));
+            goto error_free_ring;
+        }
+        r->buffers = (uint8_t *) SDL_malloc(IO_NR_BUFFERS * IO_BUFFER_SIZE);
+        if (!r->buffers) {
+            LOGC("Could not allocate io buffers");
+            goto error_exit_queue;
+        }
+        // provided buffers (Linux >= 5.19)
+        r->buf_ring = io_uring_setup_buf_ring(&r->ring, IO_NR_BUFFERS,
+                                              IO_BUFFER_GROUP, 0, &ret);
+        if (!r->buf_ring) {
+            LOGW("Could not register io_uring buffer ring: %s", strerror(-ret));
+            goto error_free_buffers;
+        }
+        for (int i = 0; i < IO_NR_BUFFERS; ++i) {
+            io_uring_buf_ring_add(r->buf_ring, &r->buffers[i * IO_BUFFER_SIZE],
+                                  IO_BUFFER_SIZE, i,
+                                  io_uring_buf_ring_mask(IO_NR_BUFFERS), i);
+        }
+        io_uring_buf_ring_advance(r->buf_ring, IO_NR_BUFFERS);
+        r->multishot = true;
+
+        this->ring = r;
+        return true;
+
+        error_free_buffers:
+        SDL_free(r->buffers);
+        error_exit_queue:
+        io_uring_queue_exit(&r->ring);
+        error_free_ring:
+        SDL_free(r);
+        error_destroy_actor:
+        Actor::Destroy();
+        return false;
+    }
+
+    void IoLoop::Destroy() {
+        struct IoRing *r = this->ring;
+        io_uring_free_buf_ring(&r->ring, r->buf_ring, IO_NR_BUFFERS,
+                               IO_BUFFER_GROUP);
+        io_uring_queue_exit(&r->ring);
+        SDL_free(r->buffers);
+        SDL_free(r);
+        this->ring = nullptr;
+        Actor::Destroy();
+    }
+
+    bool IoLoop::Start() {
+        LOGD("Starting io loop thread");
+        this->thread = SDL_CreateThread(RunLoop, "io loop", this);
+        if (!this->thread) {
+            LOGC("Could not start io loop thread");
+            return false;
+        }
+        return true;
+    }
+
+    void IoLoop::Stop() {
+        util::mutex_lock(this->mutex);
+        this->stopped = true;
+        // wake up the loop
+        submit_nop_or_cancel(this->ring, IO_NO_WATCH);
+        util::mutex_unlock(this->mutex);
+    }
+
+    int IoLoop::AddWatch(socket_t socket, IoRecvHandler handler,
+                         IoEndHandler end_handler, void *userdata) {
+        if (this->stopped) {
+            return -1;
+        }
+
+        int index = -1;
+        for (int i = 0; i < IO_LOOP_MAX_WATCHES; ++i) {
+            if (!this->watches[i].active) {
+                index = i;
+                break;
+            }
+        }
+        if (index == -1) {
+            LOGE("Too many sockets watched by the io loop");
+            return -1;
+        }
+
+        struct IoWatch *watch = &this->watches[index];
+        watch->socket = socket;
+        watch->handler = handler;
+        watch->end_handler = end_handler;
+        watch->userdata = userdata;
+        ++watch->generation;
+        watch->active = true;
+        watch->ended = false;
+        watch->closed = false;
+
+        if (!submit_recv(this->ring, watch, watch_data(index, watch->generation))) {
+            watch->active = false;
+            LOGE("Could not submit io_uring recv");
+            return -1;
+        }
+        return index;
+    }
+
+    bool IoLoop::Watch(socket_t socket, IoRecvHandler handler,
+                       IoEndHandler end_handler, void *userdata) {
+        util::mutex_lock(this->mutex);
+        int index = this->AddWatch(socket, handler, end_handler, userdata);
+        util::mutex_unlock(this->mutex);
+        return index != -1;
+    }
+
+    bool IoLoop::RecvUntilClosed(socket_t socket, IoRecvHandler handler,
+                                 void *userdata) {
+        util::mutex_lock(this->mutex);
+        int index = this->AddWatch(socket, handler, nullptr, userdata);
+        if (index == -1) {
+            util::mutex_unlock(this->mutex);
+            return false;
+        }
+
+        struct IoWatch *watch = &this->watches[index];
+        while (!watch->ended) {
+            util::cond_wait(this->thread_cond, this->mutex);
+        }
+        bool closed = watch->closed;
+        // release the slot
+        watch->active = false;
+        util::mutex_unlock(this->mutex);
+        return closed;
+    }
+
+    // must be called with the loop mutex locked
+    static void end_watch(SDL_cond *cond, struct IoWatch *watch, bool closed) {
+        watch->ended = true;
+        watch->closed = closed;
+        if (watch->end_handler) {
+            // nobody waits for this watch
+            watch->end_handler(watch->userdata, closed);
+            watch->active = false;
+            return;
+        }
+        util::cond_broadcast(cond);
+    }
+
+    static void complete(IoLoop *loop, const struct io_uring_cqe *cqe) {
+        struct IoRing *r = loop->ring;
+        uint64_t data = cqe->user_data;
+        int res = cqe->res;
+        bool more = cqe->flags & IORING_CQE_F_MORE;
+        bool has_buffer = cqe->flags & IORING_CQE_F_BUFFER;
+        unsigned buffer_id = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+
+        ++loop->stats.nr_completions;
+        if (data == IO_NO_WATCH) {
+            return;
+        }
+        unsigned index = (unsigned) (data & 0xFFFFFFFF) - 1;
+        auto generation = (uint32_t) (data >> 32);
+        struct IoWatch *watch = &loop->watches[index];
+
+        util::mutex_lock(loop->mutex);
+        // a completion may still arrive for a watch which already ended
+        bool live = watch->active && !watch->ended
+                    && watch->generation == generation;
+        IoRecvHandler handler = watch->handler;
+        void *userdata = watch->userdata;
+        util::mutex_unlock(loop->mutex);
+
+        bool keep = live;
+        if (live && res > 0) {
+            // only this thread ends a watch, so it cannot end meanwhile
+            loop->stats.nr_bytes += res;
+            keep = handler(userdata, &r->buffers[buffer_id * IO_BUFFER_SIZE],
+                           (size_t) res);
+        }
+        if (has_buffer) {
+            // give the buffer back to the kernel
+            io_uring_buf_ring_add(r->buf_ring, &r->buffers[buffer_id * IO_BUFFER_SIZE],
+                                  IO_BUFFER_SIZE, buffer_id,
+                                  io_uring_buf_ring_mask(IO_NR_BUFFERS), 0);
+            io_uring_buf_ring_advance(r->buf_ring, 1);
+        }
+        if (!live) {
+            return;
+        }
+
+        util::mutex_lock(loop->mutex);
+        if (res == -EINVAL && r->multishot) {
+            LOGW("Multishot recv not supported, falling back to single-shot recv");
+            r->multishot = false;
+            keep = submit_recv(r, watch, data);
+        } else if (res == -ENOBUFS) {
+            // all the buffers are in use, the multishot recv is terminated
+            keep = more || submit_recv(r, watch, data);
+        } else if (res <= 0) {
+            // end of stream or error
+            keep = false;
+        } else if (keep && !more) {
+            // single-shot recv, or multishot recv terminated by the kernel
+            keep = submit_recv(r, watch, data);
+        }
+        if (!keep) {
+            if (more) {
+                submit_nop_or_cancel(r, data);
+            }
+            end_watch(loop->thread_cond, watch, true);
+        }
+        util::mutex_unlock(loop->mutex);
+    }
+
+    int IoLoop::RunLoop(void *data) {
+        auto *loop = (IoLoop *) data;
+        struct IoRing *r = loop->ring;
+
+        for (;;) {
+            struct io_uring_cqe *cqe;
+            int ret = io_uring_wait_cqe(&r->ring, &cqe);
+            if (ret == -EINTR) {
+                continue;
+            }
+            if (ret < 0) {
+                LOGE("Could not wait for io_uring completion: %s", strerror(-ret));
+                break;
+            }
+
+            // handle all the available completions at once
+            unsigned head;
+            unsigned count = 0;
+            io_uring_for_each_cqe(&r->ring, head, cqe) {
+                complete(loop, cqe);
+                ++count;
+            }
+            io_uring_cq_advance(&r->ring, count);
+
+            util::mutex_lock(loop->mutex);
+            bool stopped = loop->stopped;
+            util::mutex_unlock(loop->mutex);
+            if (stopped) {
+                break;
+            }
+        }
+
+        // wake up the threads still waiting for their socket
+        util::mutex_lock(loop->mutex);
+        loop->stopped = true;
+        for (auto &watch : loop->watches) {
+            if (watch.active && !watch.ended) {
+                end_watch(loop->thread_cond, &watch, false);
+            }
+        }
+        util::mutex_unlock(loop->mutex);
+
+        LOGD("Io loop: %llu completions, %llu bytes",
+             (unsigned long long) loop->stats.nr_completions,
+             (unsigned long long) loop->stats.nr_bytes);
+        return 0;
+    }
+
+}
+
+#else
+
+namespace irobot::platform {
+
+    bool IoLoop::Init() {
+        LOGW("io_uring is not available in this build");
+        return false;
+    }
+
+    void IoLoop::Destroy() {
+        // nothing to do
+    }
+
+    bool IoLoop::Start() {
+        return false;
+    }
+
+    void IoLoop::Stop() {
+        // nothing to do
+    }
+
+    bool IoLoop::RecvUntilClosed(socket_t socket, IoRecvHandler handler,
+                                 void *userdata) {
+        (void) socket;
+        (void) handler;
+        (void) userdata;
+        return false;
+    }
+
+    bool IoLoop::Watch(socket_t socket, IoRecvHandler handler,
+                       IoEndHandler end_handler, void *userdata) {
+        (void) socket;
+        (void) handler;
+        (void) end_handler;
+        (void) userdata;
+        return false;
+    }
+
+    int IoLoop::AddWatch(socket_t socket, IoRecvHandler handler,
+                         IoEndHandler end_handler, void *userdata) {
+        (void) socket;
+        (void) handler;
+        (void) end_handler;
+        (void) userdata;
+        return -1;
+    }
+
+    int IoLoop::RunLoop(void *data) {
+        (void) data;
+        return 0;
+    }
+
+}
+
+#endif
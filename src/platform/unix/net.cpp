@@ -5,6 +5,8 @@
 
 #include "platform/net.hpp"
 
+#include <sys/uio.h>
+
 #include <csignal>
 
 namespace irobot::platform {
@@ -29,4 +31,40 @@ namespace irobot::platform {
         return errno > 34 && errno < 45;
     }
 
+    ssize_t net_send_all_v(socket_t socket, const struct NetBuffer *bufs, int count) {
+        struct iovec iov[NET_SEND_MAX_BUFFERS];
+        if (count > NET_SEND_MAX_BUFFERS) {
+            return -1;
+        }
+        size_t total = 0;
+        for (int i = 0; i < count; ++i) {
+            iov[i].iov_base = (void *) bufs[i].data;
+            iov[i].iov_len = bufs[i].len;
+            total += bufs[i].len;
+        }
+        struct iovec *next = iov;
+        size_t left = total;
+        while (left > 0) {
+            ssize_t w = writev(socket, next, count);
+            if (w == -1) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return -1;
+            }
+            left -= w;
+            // skip the buffers written
+            while (count && (size_t) w >= next->iov_len) {
+                w -= (ssize_t) next->iov_len;
+                ++next;
+                --count;
+            }
+            if (count) {
+                next->iov_base = (char *) next->iov_base + w;
+                next->iov_len -= w;
+            }
+        }
+        return (ssize_t) total;
+    }
+
 }
\ No newline at end of file
@@ -0,0 +1,60 @@
+//
+// Created by James Shen on 17/10/26.
+// Copyright (c) 2020 GUIDEBEE IT. All rights reserved
+//
+
+#include "platform/io_loop.hpp"
+
+#include "util/log.hpp"
+
+namespace irobot::platform {
+
+    bool IoLoop::Init() {
+        LOGW("io_uring is not available on Windows");
+        return false;
+    }
+
+    void IoLoop::Destroy() {
+        // nothing to do
+    }
+
+    bool IoLoop::Start() {
+        return false;
+    }
+
+    void IoLoop::Stop() {
+        // nothing to do
+    }
+
+    bool IoLoop::RecvUntilClosed(socket_t socket, IoRecvHandler handler,
+                                 void *userdata) {
+        (void) socket;
+        (void) handler;
+        (void) userdata;
+        return false;
+    }
+
+    bool IoLoop::Watch(socket_t socket, IoRecvHandler handler,
+                       IoEndHandler end_handler, void *userdata) {
+        (void) socket;
+        (void) handler;
+        (void) end_handler;
+        (void) userdata;
+        return false;
+    }
+
+    int IoLoop::AddWatch(socket_t socket, IoRecvHandler handler,
+                         IoEndHandler end_handler, void *userdata) {
+        (void) socket;
+        (void) handler;
+        (void) end_handler;
+        (void) userdata;
+        return -1;
+    }
+
+    int IoLoop::RunLoop(void *data) {
+        (void) data;
+        return 0;
+    }
+
+}
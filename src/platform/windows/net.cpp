@@ -33,4 +33,37 @@ namespace irobot::platform {
         return l >= 0;
     }
 
+    ssize_t net_send_all_v(socket_t socket, const struct NetBuffer *bufs, int count) {
+        WSABUF wsa_bufs[NET_SEND_MAX_BUFFERS];
+        if (count > NET_SEND_MAX_BUFFERS) {
+            return -1;
+        }
+        size_t total = 0;
+        for (int i = 0; i < count; ++i) {
+            wsa_bufs[i].buf = (CHAR *) bufs[i].data;
+            wsa_bufs[i].len = (ULONG) bufs[i].len;
+            total += bufs[i].len;
+        }
+        WSABUF *next = wsa_bufs;
+        size_t left = total;
+        while (left > 0) {
+            DWORD w = 0;
+            if (WSASend(socket, next, (DWORD) count, &w, 0, nullptr, nullptr)) {
+                return -1;
+            }
+            left -= w;
+            // skip the buffers written
+            while (count && w >= next->len) {
+                w -= next->len;
+                ++next;
+                --count;
+            }
+            if (count) {
+                next->buf += w;
+                next->len -= w;
+            }
+        }
+        return (ssize_t) total;
+    }
+
 }
\ No newline at end of file
@@ -0,0 +1,440 @@
+//
+// Created by James Shen on 17/10/26.
+// Copyright (c) 2020 GUIDEBEE IT. All rights reserved
+//
+
+// Remux a range of a raw recording (irobot --record-format raw) to MP4 (or
+// any format guessed from the output filename).
+//
+// The sidecar index gives the offset, pts and flags of every packet, so the
+// range starts at the key frame before --start without reading the stream
+// before it, and the last config packet (SPS/PPS) before this key frame
+// becomes the extradata of the output.
+
+#define SDL_MAIN_HANDLED
+
+#if defined (__cplusplus)
+extern "C" {
+#endif
+
+#include <getopt.h>
+#include <libavformat/avformat.h>
+
+#if defined (__cplusplus)
+}
+#endif
+
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "config.hpp"
+#include "util/log.hpp"
+#include "video/raw_writer.hpp"
+
+// the raw recordings may exceed 2GB
+#ifdef _WIN32
+# define fseek64 _fseeki64
+# define ftell64 _ftelli64
+#else
+# define fseek64 fseeko
+# define ftell64 ftello
+#endif
+
+#define OPT_START 1000
+#define OPT_END   1001
+
+using namespace irobot;
+using namespace irobot::video;
+
+struct RemuxOptions {
+    const char *input;
+    const char *output;
+    double start; // seconds from the beginning of the recording
+    double end; // 0 for the end of the recording
+};
+
+struct RawRecording {
+    FILE *file;
+    uint64_t file_size;
+    struct RawIndexEntry *entries;
+    size_t count;
+};
+
+static const AVRational IROBOT_TIME_BASE = {1, 1000000}; // timestamps in us
+
+static void PrintUsage(const char *arg0) {
+    fprintf(stderr,
+            "Usage: %s [options] file.h264 output.mp4\n"
+            "\n"
+            "Remux a raw recording (with its file.h264.idx index) to a\n"
+            "playable file.\n"
+            "\n"
+            "Options:\n"
+            "\n"
+            "    --start seconds\n"
+            "        Start at the key frame before this time.\n"
+            "        Default is 0.\n"
+            "\n"
+            "    --end seconds\n"
+            "        Stop after this time.\n"
+            "        Default is the end of the recording.\n"
+            "\n",
+            arg0);
+}
+
+static bool ParseSeconds(const char *s, double *seconds) {
+    char *end;
+    *seconds = strtod(s, &end);
+    if (*end || *seconds < 0) {
+        LOGE("Could not parse time: %s", s);
+        return false;
+    }
+    return true;
+}
+
+static bool ParseArgs(struct RemuxOptions *opts, int argc, char *argv[]) {
+    static const struct option long_options[] = {
+            {"end",   required_argument, nullptr, OPT_END},
+            {"help",  no_argument,       nullptr, 'h'},
+            {"start", required_argument, nullptr, OPT_START},
+            {nullptr, 0,                 nullptr, 0},
+    };
+
+    int c;
+    while ((c = getopt_long(argc, argv, "h", long_options, nullptr)) != -1) {
+        switch (c) {
+            case OPT_START:
+                if (!ParseSeconds(optarg, &opts->start)) {
+                    return false;
+                }
+                break;
+            case OPT_END:
+                if (!ParseSeconds(optarg, &opts->end)) {
+                    return false;
+                }
+                break;
+            case 'h':
+                PrintUsage(argv[0]);
+                exit(0);
+            default:
+                // getopt prints the error message on stderr
+                return false;
+        }
+    }
+
+    if (optind != argc - 2) {
+        PrintUsage(argv[0]);
+        return false;
+    }
+    opts->input = argv[optind];
+    opts->output = argv[optind + 1];
+    if (opts->end && opts->end <= opts->start) {
+        LOGE("The end must be after the start");
+        return false;
+    }
+    return true;
+}
+
+static bool ReadIndex(const char *filename, struct RawRecording *recording) {
+    char *index_filename = RawWriter::GetIndexFilename(filename);
+    if (!index_filename) {
+        return false;
+    }
+    FILE *index_file = fopen(index_filename, "rb");
+    if (!index_file) {
+        LOGE("Could not open %s", index_filename);
+        SDL_free(index_filename);
+        return false;
+    }
+    SDL_free(index_filename);
+
+    bool ok = false;
+    uint8_t buf[RAW_INDEX_ENTRY_SIZE];
+    if (fread(buf, 1, RAW_INDEX_HEADER_SIZE, index_file) != RAW_INDEX_HEADER_SIZE
+        || !RawWriter::ReadIndexHeader(buf)) {
+        LOGE("Invalid index header");
+        goto end;
+    }
+
+    for (;;) {
+        if (fread(buf, 1, RAW_INDEX_ENTRY_SIZE, index_file) != RAW_INDEX_ENTRY_SIZE) {
+            // a truncated last entry is ignored
+            break;
+        }
+        struct RawIndexEntry entry{};
+        RawWriter::ReadIndexEntry(buf, &entry);
+        if (entry.offset >= recording->file_size) {
+            // the recording was interrupted before writing this packet
+            break;
+        }
+        if (!(recording->count & (recording->count + 1))) {
+            // grow at 0, 1, 3, 7...
+            size_t capacity = (recording->count + 1) * 2;
+            auto *entries = (struct RawIndexEntry *) SDL_realloc(
+                    recording->entries, capacity * sizeof(struct RawIndexEntry));
+            if (!entries) {
+                LOGC("Could not allocate index");
+                goto end;
+            }
+            recording->entries = entries;
+        }
+        recording->entries[recording->count++] = entry;
+    }
+    ok = true;
+
+    end:
+    fclose(index_file);
+    return ok;
+}
+
+static uint32_t GetPacketSize(const struct RawRecording *recording, size_t i) {
+    uint64_t next = i + 1 < recording->count
+                    ? recording->entries[i + 1].offset
+                    : recording->file_size;
+    return (uint32_t) (next - recording->entries[i].offset);
+}
+
+static bool ReadPacket(const struct RawRecording *recording, size_t i,
+                       AVPacket *packet) {
+    const struct RawIndexEntry *entry = &recording->entries[i];
+    if (av_new_packet(packet, (int) GetPacketSize(recording, i))) {
+        LOGC("Could not allocate packet");
+        return false;
+    }
+    if (fseek64(recording->file, (int64_t) entry->offset, SEEK_SET)
+        || fread(packet->data, 1, packet->size, recording->file)
+           != (size_t) packet->size) {
+        LOGE("Could not read packet at %" PRIu64, entry->offset);
+        av_packet_unref(packet);
+        return false;
+    }
+    packet->pts = entry->pts;
+    packet->dts = entry->pts;
+    if (entry->flags & RAW_INDEX_FLAG_KEY) {
+        packet->flags |= AV_PKT_FLAG_KEY;
+    }
+    return true;
+}
+
+// read the frame size from the SPS
+static bool GetFrameSize(const AVPacket *config, const AVPacket *key_frame,
+                         int *width, int *height) {
+    AVCodec *codec = avcodec_find_decoder(AV_CODEC_ID_H264);
+    if (!codec) {
+        LOGE("H.264 decoder not found");
+        return false;
+    }
+    AVCodecContext *codec_ctx = avcodec_alloc_context3(codec);
+    AVCodecParserContext *parser = av_parser_init(AV_CODEC_ID_H264);
+    AVPacket packet;
+    bool ok = codec_ctx && parser
+              && !av_new_packet(&packet, config->size + key_frame->size);
+    if (ok) {
+        memcpy(packet.data, config->data, config->size);
+        memcpy(packet.data + config->size, key_frame->data, key_frame->size);
+        parser->flags |= PARSER_FLAG_COMPLETE_FRAMES;
+        uint8_t *out_data;
+        int out_len;
+        av_parser_parse2(parser, codec_ctx, &out_data, &out_len,
+                         packet.data, packet.size,
+                         AV_NOPTS_VALUE, AV_NOPTS_VALUE, -1);
+        *width = parser->width;
+        *height = parser->height;
+        ok = *width > 0 && *height > 0;
+        if (!ok) {
+            LOGE("Could not parse the frame size");
+        }
+        av_packet_unref(&packet);
+    }
+    if (parser) {
+        av_parser_close(parser);
+    }
+    avcodec_free_context(&codec_ctx);
+    return ok;
+}
+
+static bool Remux(const struct RawRecording *recording,
+                  const struct RemuxOptions *opts) {
+    // the first data packet
+    size_t first = 0;
+    while (first < recording->count
+           && (recording->entries[first].flags & RAW_INDEX_FLAG_CONFIG)) {
+        ++first;
+    }
+    if (first == recording->count) {
+        LOGE("Empty recording");
+        return false;
+    }
+    int64_t origin = recording->entries[first].pts;
+    int64_t start_pts = origin + (int64_t) (opts->start * 1000000);
+    int64_t end_pts = opts->end ? origin + (int64_t) (opts->end * 1000000)
+                                : INT64_MAX;
+
+    ssize_t key = RawWriter::FindKeyFrame(recording->entries, recording->count,
+                                          start_pts);
+    if (key == -1) {
+        LOGE("No key frame in the recording");
+        return false;
+    }
+    ssize_t config_index = key;
+    while (config_index >= 0
+           && !(recording->entries[config_index].flags & RAW_INDEX_FLAG_CONFIG)) {
+        --config_index;
+    }
+    if (config_index == -1) {
+        LOGE("No config packet before the key frame");
+        return false;
+    }
+
+    AVPacket config;
+    AVPacket packet;
+    if (!ReadPacket(recording, config_index, &config)) {
+        return false;
+    }
+    if (!ReadPacket(recording, key, &packet)) {
+        av_packet_unref(&config);
+        return false;
+    }
+
+    bool ok = false;
+    int width;
+    int height;
+    AVFormatContext *ctx = nullptr;
+    AVStream *ostream;
+    size_t nr_packets = 0;
+    int64_t last_pts = packet.pts;
+    if (!GetFrameSize(&config, &packet, &width, &height)) {
+        goto finally_unref;
+    }
+
+    if (avformat_alloc_output_context2(&ctx, nullptr, nullptr, opts->output) < 0) {
+        LOGE("Could not find a muxer for %s", opts->output);
+        goto finally_unref;
+    }
+    av_dict_set(&ctx->metadata, "comment",
+                "Recorded by irobot "
+                IROBOT_SERVER_VERSION, 0);
+
+    ostream = avformat_new_stream(ctx, nullptr);
+    if (!ostream) {
+        goto finally_free_context;
+    }
+    ostream->codecpar->codec_type = AVMEDIA_TYPE_VIDEO;
+    ostream->codecpar->codec_id = AV_CODEC_ID_H264;
+    ostream->codecpar->format = AV_PIX_FMT_YUV420P;
+    ostream->codecpar->width = width;
+    ostream->codecpar->height = height;
+    // owned by the stream
+    ostream->codecpar->extradata = (uint8_t *) av_mallocz(
+            config.size + AV_INPUT_BUFFER_PADDING_SIZE);
+    if (!ostream->codecpar->extradata) {
+        goto finally_free_context;
+    }
+    memcpy(ostream->codecpar->extradata, config.data, config.size);
+    ostream->codecpar->extradata_size = config.size;
+
+    if (avio_open(&ctx->pb, opts->output, AVIO_FLAG_WRITE) < 0) {
+        LOGE("Failed to open output file: %s", opts->output);
+        goto finally_free_context;
+    }
+    if (avformat_write_header(ctx, nullptr) < 0) {
+        LOGE("Failed to write header to %s", opts->output);
+        goto finally_close;
+    }
+
+    ok = true;
+    for (size_t i = key; i < recording->count;) {
+        // the duration of a packet is known from the next one
+        size_t next = i + 1;
+        bool reconfigured = next < recording->count
+                            && (recording->entries[next].flags & RAW_INDEX_FLAG_CONFIG);
+        if (reconfigured) {
+            // a new config (rotation) cannot be stored in the same track
+            LOGW("Stream configuration changed, the output stops here");
+        }
+        bool last = next == recording->count || reconfigured
+                    || recording->entries[next].pts > end_pts;
+        if (!last) {
+            packet.duration = recording->entries[next].pts - packet.pts;
+        }
+        last_pts = packet.pts;
+        packet.pts -= recording->entries[key].pts;
+        packet.dts = packet.pts;
+        av_packet_rescale_ts(&packet, IROBOT_TIME_BASE, ostream->time_base);
+        bool written = av_write_frame(ctx, &packet) >= 0;
+        av_packet_unref(&packet);
+        if (!written) {
+            LOGE("Could not write packet");
+            ok = false;
+            break;
+        }
+        ++nr_packets;
+        if (last) {
+            break;
+        }
+        i = next;
+        if (!ReadPacket(recording, i, &packet)) {
+            ok = false;
+            break;
+        }
+    }
+
+    if (av_write_trailer(ctx) < 0) {
+        LOGE("Failed to write trailer to %s", opts->output);
+        ok = false;
+    }
+    if (ok) {
+        LOGI("Remuxed %zu packets (%.1f s) to %s", nr_packets,
+             (double) (last_pts - recording->entries[key].pts) / 1000000,
+             opts->output);
+    }
+
+    finally_close:
+    avio_close(ctx->pb);
+    finally_free_context:
+    avformat_free_context(ctx);
+    finally_unref:
+    av_packet_unref(&packet);
+    av_packet_unref(&config);
+    return ok;
+}
+
+int main(int argc, char *argv[]) {
+#ifndef NDEBUG
+    SDL_LogSetAllPriority(SDL_LOG_PRIORITY_DEBUG);
+#endif
+
+    struct RemuxOptions opts = {
+            .input = nullptr,
+            .output = nullptr,
+            .start = 0,
+            .end = 0,
+    };
+    if (!ParseArgs(&opts, argc, argv)) {
+        return 1;
+    }
+
+    struct RawRecording recording = {
+            .file = fopen(opts.input, "rb"),
+            .file_size = 0,
+            .entries = nullptr,
+            .count = 0,
+    };
+    if (!recording.file) {
+        LOGE("Could not open %s", opts.input);
+        return 1;
+    }
+    fseek64(recording.file, 0, SEEK_END);
+    recording.file_size = (uint64_t) ftell64(recording.file);
+
+    int ret = 1;
+    if (ReadIndex(opts.input, &recording) && Remux(&recording, &opts)) {
+        ret = 0;
+    }
+
+    SDL_free(recording.entries);
+    fclose(recording.file);
+    return ret;
+}
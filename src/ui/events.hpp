@@ -8,7 +8,6 @@
 
 #define EVENT_NEW_FRAME                 (SDL_USEREVENT + 1)
 #define EVENT_STREAM_STOPPED            (SDL_USEREVENT + 2)
-#define EVENT_NEW_OPENCV_FRAME          (SDL_USEREVENT + 3)
 #define EVENT_START_RECORD_UI_EVENT     (SDL_USEREVENT + 4)
 #define EVENT_END_RECORD_UI_EVENT       (SDL_USEREVENT + 5)
 #define EVENT_NEW_DATA_STREAM_CONNECTION                 (SDL_USEREVENT + 6)
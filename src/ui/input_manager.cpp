@@ -344,10 +344,13 @@ namespace irobot::ui {
                     }
                     return;
                 case SDLK_i:
-                    if (!shift && cmd && !repeat && down) {
-                        struct video::FpsCounter *fps_counter =
-                                this->agent_manager->video_buffer->fps_counter;
-                        SwitchFpsCounterState(fps_counter);
+                    if (cmd && !repeat && down) {
+                        video::VideoBuffer *vb = this->agent_manager->video_buffer;
+                        if (!shift) {
+                            SwitchFpsCounterState(vb->fps_counter);
+                        } else if (vb->latency) {
+                            vb->latency->Dump();
+                        }
                     }
                     return;
                 case SDLK_n:
@@ -539,6 +542,11 @@ namespace irobot::ui {
         }
     }
 
+    bool InputManager::IsInputEvent(const SDL_Event *event) {
+        // keyboard, mouse, joystick, controller, touch and gesture events
+        return event->type >= SDL_KEYDOWN && event->type < SDL_CLIPBOARDUPDATE;
+    }
+
     bool InputManager::IsApk(const char *file) {
         const char *ext = strrchr(file, '.');
         return ext && !strcmp(ext, ".apk");
@@ -648,8 +656,13 @@ namespace irobot::ui {
             SDL_AddEventWatch(EventWatcher, this);
         }
 #endif
+        struct video::FpsCounter *fps_counter =
+                this->agent_manager->video_buffer->fps_counter;
         SDL_Event event;
         while (SDL_WaitEvent(&event)) {
+            if (fps_counter) {
+                fps_counter->AddDispatchedEvent(IsInputEvent(&event));
+            }
             enum EventResult result = this->HandleEvent(&event, control);
             switch (result) {
                 case EVENT_RESULT_STOPPED_BY_USER:
@@ -118,6 +118,8 @@ namespace irobot::ui {
 
         static bool IsApk(const char *file);
 
+        static bool IsInputEvent(const SDL_Event *event);
+
         static int EventWatcher(void *data, SDL_Event *event);
 
 
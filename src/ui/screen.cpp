@@ -10,7 +10,6 @@
 #include "core/common.hpp"
 
 #include "video/video_buffer.hpp"
-#include "util/lock.hpp"
 #include "util/log.hpp"
 
 
@@ -161,6 +160,7 @@ namespace irobot::ui {
         this->has_frame = false;
         this->fullscreen = false;
         this->maximized = false;
+        this->frame_consumer = -1;
 
     }
 
@@ -304,17 +304,25 @@ namespace irobot::ui {
     }
 
     bool Screen::UpdateFrame(video::VideoBuffer *vb) {
-        util::mutex_lock(vb->mutex);
-        const AVFrame *frame = vb->ConsumeRenderedFrame();
+        // the frame is pinned, the decoder keeps decoding meanwhile
+        const AVFrame *frame = vb->AcquireFrame(this->frame_consumer);
+        if (!frame) {
+            return false;
+        }
+        vb->fps_counter->AddRenderedFrame();
         struct Size new_frame_size = {(uint16_t) frame->width, (uint16_t) frame->height};
         if (!PrepareForFrame(new_frame_size)) {
-            util::mutex_unlock(vb->mutex);
+            vb->ReleaseFrame(this->frame_consumer);
             return false;
         }
         UpdateTexture(frame);
-        util::mutex_unlock(vb->mutex);
+        auto frame_id = (int) frame->reordered_opaque;
+        vb->ReleaseFrame(this->frame_consumer);
 
         this->Render();
+        if (vb->latency) {
+            vb->latency->Mark(frame_id, video::LATENCY_STAGE_RENDERED);
+        }
         return true;
     }
 
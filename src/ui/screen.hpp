@@ -44,6 +44,8 @@ namespace irobot::ui {
 
         struct Size device_screen_size;
         android::FileHandler *file_handler;
+        // consumer id in the video buffer
+        int frame_consumer = -1;
 
         // initialize default values
         void Init();
@@ -63,7 +65,7 @@ namespace irobot::ui {
         // destroy window, renderer and texture (if any)
         void Destroy();
 
-        // resize if necessary and write the rendered frame into the texture
+        // resize if necessary and write the last decoded frame into the texture
         bool UpdateFrame(video::VideoBuffer *vb);
 
         // render the texture to the renderer
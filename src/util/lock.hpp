@@ -10,7 +10,9 @@
 extern "C" {
 #endif
 
+#include <SDL2/SDL_atomic.h>
 #include <SDL2/SDL_mutex.h>
+#include <SDL2/SDL_timer.h>
 
 #if defined (__cplusplus)
 }
@@ -46,6 +48,34 @@ namespace irobot::util {
         mutex_log(r, "Could not unlock mutex");
     }
 
+    // time spent waiting for a contended mutex
+    struct LockWaitStats {
+        SDL_atomic_t nr_locks;
+        // the mutex was held by another thread
+        SDL_atomic_t nr_waits;
+        SDL_atomic_t wait_us;
+        SDL_atomic_t max_wait_us;
+    };
+
+    // the uncontended case costs a try lock, without any clock read
+    static inline void mutex_lock(SDL_mutex *mutex, LockWaitStats *stats) {
+        SDL_AtomicIncRef(&stats->nr_locks);
+        if (!SDL_TryLockMutex(mutex)) {
+            return;
+        }
+        Uint64 start = SDL_GetPerformanceCounter();
+        mutex_lock(mutex);
+        auto wait_us = (int) ((SDL_GetPerformanceCounter() - start) * 1000000
+                              / SDL_GetPerformanceFrequency());
+        SDL_AtomicIncRef(&stats->nr_waits);
+        SDL_AtomicAdd(&stats->wait_us, wait_us);
+        int max_wait_us = SDL_AtomicGet(&stats->max_wait_us);
+        while (wait_us > max_wait_us
+               && !SDL_AtomicCAS(&stats->max_wait_us, max_wait_us, wait_us)) {
+            max_wait_us = SDL_AtomicGet(&stats->max_wait_us);
+        }
+    }
+
     static inline void cond_wait(SDL_cond *cond, SDL_mutex *mutex) {
         int r = SDL_CondWait(cond, mutex);
         mutex_log(r, "Could not wait on condition");
@@ -62,5 +92,10 @@ namespace irobot::util {
         mutex_log(r, "Could not signal a condition");
     }
 
+    static inline void cond_broadcast(SDL_cond *cond) {
+        int r = SDL_CondBroadcast(cond);
+        mutex_log(r, "Could not broadcast a condition");
+    }
+
 }
 #endif //ANDROID_IROBOT_LOCK_HPP
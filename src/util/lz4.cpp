@@ -0,0 +1,210 @@
+//
+// Created by James Shen on 17/10/26.
+// Copyright (c) 2020 GUIDEBEE IT. All rights reserved
+//
+
+#include "lz4.hpp"
+
+#include <cstring>
+
+// see <https://github.com/lz4/lz4/blob/dev/doc/lz4_Block_format.md>
+#define LZ4_MIN_MATCH 4
+// the last 5 bytes are literals
+#define LZ4_LAST_LITERALS 5
+// the last match starts at least 12 bytes before the end
+#define LZ4_MFLIMIT 12
+#define LZ4_MAX_DISTANCE 65535
+
+namespace irobot::util {
+
+    static inline uint32_t lz4_read32(const uint8_t *p) {
+        uint32_t value;
+        memcpy(&value, p, sizeof(value));
+        return value;
+    }
+
+    static inline uint64_t lz4_read64(const uint8_t *p) {
+        uint64_t value;
+        memcpy(&value, p, sizeof(value));
+        return value;
+    }
+
+    static inline uint32_t lz4_hash(uint32_t sequence) {
+        return (sequence * 2654435761U) >> (32 - LZ4_HASH_LOG);
+    }
+
+    static uint8_t *lz4_write_length(uint8_t *op, size_t len) {
+        while (len >= 255) {
+            *op++ = 255;
+            len -= 255;
+        }
+        *op++ = (uint8_t) len;
+        return op;
+    }
+
+    // match_length is 0 for the last literals
+    // returns nullptr if the sequence does not fit
+    static uint8_t *lz4_write_sequence(uint8_t *op, const uint8_t *oend,
+                                       const uint8_t *literals, size_t nr_literals,
+                                       size_t match_length, size_t offset) {
+        size_t max_size = 1 + nr_literals / 255 + 1 + nr_literals
+                          + 2 + match_length / 255 + 1;
+        if ((size_t) (oend - op) < max_size) {
+            return nullptr;
+        }
+        uint8_t *token = op++;
+        if (nr_literals >= 15) {
+            *token = 15 << 4;
+            op = lz4_write_length(op, nr_literals - 15);
+        } else {
+            *token = (uint8_t) (nr_literals << 4);
+        }
+        memcpy(op, literals, nr_literals);
+        op += nr_literals;
+        if (match_length) {
+            *op++ = (uint8_t) offset;
+            *op++ = (uint8_t) (offset >> 8);
+            size_t len = match_length - LZ4_MIN_MATCH;
+            if (len >= 15) {
+                *token |= 15;
+                op = lz4_write_length(op, len - 15);
+            } else {
+                *token |= (uint8_t) len;
+            }
+        }
+        return op;
+    }
+
+    size_t lz4_compress_bound(size_t len) {
+        return len + len / 255 + 16;
+    }
+
+    size_t lz4_compress(const uint8_t *src, size_t len, uint8_t *dst,
+                        size_t capacity, uint32_t *table) {
+        const uint8_t *ip = src;
+        const uint8_t *anchor = src;
+        const uint8_t *end = src + len;
+        uint8_t *op = dst;
+        const uint8_t *oend = dst + capacity;
+
+        if (len > LZ4_MFLIMIT) {
+            const uint8_t *mflimit = end - LZ4_MFLIMIT;
+            const uint8_t *match_limit = end - LZ4_LAST_LITERALS;
+            unsigned misses = 0;
+            while (ip < mflimit) {
+                uint32_t sequence = lz4_read32(ip);
+                uint32_t h = lz4_hash(sequence);
+                // the table may hold positions of a previous input
+                size_t ref_pos = table[h];
+                size_t pos = ip - src;
+                table[h] = (uint32_t) pos;
+                if (ref_pos >= pos || pos - ref_pos > LZ4_MAX_DISTANCE
+                    || lz4_read32(src + ref_pos) != sequence) {
+                    // skip faster in incompressible data
+                    ip += 1 + (misses++ >> 6);
+                    continue;
+                }
+                misses = 0;
+                const uint8_t *ref = src + ref_pos;
+                while (ip > anchor && ref > src && ip[-1] == ref[-1]) {
+                    --ip;
+                    --ref;
+                }
+                const uint8_t *mp = ip + LZ4_MIN_MATCH;
+                const uint8_t *mr = ref + LZ4_MIN_MATCH;
+                while (mp + 8 <= match_limit && lz4_read64(mp) == lz4_read64(mr)) {
+                    mp += 8;
+                    mr += 8;
+                }
+                while (mp < match_limit && *mp == *mr) {
+                    ++mp;
+                    ++mr;
+                }
+                op = lz4_write_sequence(op, oend, anchor, ip - anchor,
+                                        mp - ip, ip - ref);
+                if (!op) {
+                    return 0;
+                }
+                ip = anchor = mp;
+            }
+        }
+
+        op = lz4_write_sequence(op, oend, anchor, end - anchor, 0, 0);
+        if (!op) {
+            return 0;
+        }
+        return op - dst;
+    }
+
+    bool lz4_decompress(const uint8_t *src, size_t len, uint8_t *dst,
+                        size_t dst_len) {
+        const uint8_t *ip = src;
+        const uint8_t *iend = src + len;
+        uint8_t *op = dst;
+        uint8_t *oend = dst + dst_len;
+
+        for (;;) {
+            if (ip == iend) {
+                return false;
+            }
+            unsigned token = *ip++;
+            size_t nr_literals = token >> 4;
+            if (nr_literals == 15) {
+                uint8_t b;
+                do {
+                    if (ip == iend) {
+                        return false;
+                    }
+                    b = *ip++;
+                    nr_literals += b;
+                } while (b == 255);
+            }
+            if ((size_t) (iend - ip) < nr_literals
+                || (size_t) (oend - op) < nr_literals) {
+                return false;
+            }
+            memcpy(op, ip, nr_literals);
+            op += nr_literals;
+            ip += nr_literals;
+            if (ip == iend) {
+                // the last sequence has no match
+                return op == oend;
+            }
+
+            if (iend - ip < 2) {
+                return false;
+            }
+            size_t offset = ip[0] | (ip[1] << 8);
+            ip += 2;
+            if (!offset || offset > (size_t) (op - dst)) {
+                return false;
+            }
+            size_t match_length = token & 15;
+            if (match_length == 15) {
+                uint8_t b;
+                do {
+                    if (ip == iend) {
+                        return false;
+                    }
+                    b = *ip++;
+                    match_length += b;
+                } while (b == 255);
+            }
+            match_length += LZ4_MIN_MATCH;
+            if ((size_t) (oend - op) < match_length) {
+                return false;
+            }
+            const uint8_t *match = op - offset;
+            if (offset >= match_length) {
+                memcpy(op, match, match_length);
+            } else {
+                // overlapping: repeats the last offset bytes
+                for (size_t i = 0; i < match_length; ++i) {
+                    op[i] = match[i];
+                }
+            }
+            op += match_length;
+        }
+    }
+
+}
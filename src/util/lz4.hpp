@@ -0,0 +1,36 @@
+//
+// Created by James Shen on 17/10/26.
+// Copyright (c) 2020 GUIDEBEE IT. All rights reserved
+//
+
+#ifndef ANDROID_IROBOT_LZ4_HPP
+#define ANDROID_IROBOT_LZ4_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+// number of entries of the hash table of lz4_compress()
+#define LZ4_HASH_LOG 14
+#define LZ4_HASH_SIZE (1 << LZ4_HASH_LOG)
+
+namespace irobot::util {
+// Fast compression into the LZ4 block format, so that the clients can use
+// any LZ4 implementation (e.g. lz4.block.decompress() in Python)
+
+// worst case size of the compression of len bytes
+    size_t lz4_compress_bound(size_t len);
+
+// compress src into dst
+// table: LZ4_HASH_SIZE entries, reused between the calls (no need to clear
+// it)
+// returns the compressed size, or 0 if it does not fit in capacity
+    size_t lz4_compress(const uint8_t *src, size_t len, uint8_t *dst,
+                        size_t capacity, uint32_t *table);
+
+// decompress exactly dst_len bytes from src
+// returns true if src is a valid block of dst_len bytes
+    bool lz4_decompress(const uint8_t *src, size_t len, uint8_t *dst,
+                        size_t dst_len);
+
+}
+#endif //ANDROID_IROBOT_LZ4_HPP
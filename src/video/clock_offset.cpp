@@ -0,0 +1,60 @@
+//
+// Created by James Shen on 17/10/26.
+// Copyright (c) 2020 GUIDEBEE IT. All rights reserved
+//
+
+#include "clock_offset.hpp"
+
+#if defined (__cplusplus)
+extern "C" {
+#endif
+
+#include <libavutil/avutil.h>
+
+#if defined (__cplusplus)
+}
+#endif
+
+namespace irobot::video {
+
+    void ClockOffset::Update(int64_t pts, int64_t receive_time) {
+        if (pts == AV_NOPTS_VALUE) {
+            return;
+        }
+        int64_t sample = receive_time - pts;
+
+        SDL_AtomicLock(&this->lock);
+        if (!this->nr_windows
+            || receive_time - this->window_start >= CLOCK_OFFSET_WINDOW_US) {
+            // start a new window, forgetting the oldest one
+            this->index = (this->index + 1) % CLOCK_OFFSET_NR_WINDOWS;
+            this->minima[this->index] = sample;
+            this->window_start = receive_time;
+            if (this->nr_windows < CLOCK_OFFSET_NR_WINDOWS) {
+                ++this->nr_windows;
+            }
+        } else if (sample < this->minima[this->index]) {
+            this->minima[this->index] = sample;
+        }
+        int64_t offset = this->minima[this->index];
+        for (int i = 0; i < this->nr_windows; ++i) {
+            if (this->minima[i] < offset) {
+                offset = this->minima[i];
+            }
+        }
+        this->offset = offset;
+        SDL_AtomicUnlock(&this->lock);
+    }
+
+    int64_t ClockOffset::ToHost(int64_t pts) {
+        if (pts == AV_NOPTS_VALUE) {
+            return 0;
+        }
+        SDL_AtomicLock(&this->lock);
+        bool known = this->nr_windows > 0;
+        int64_t offset = this->offset;
+        SDL_AtomicUnlock(&this->lock);
+        return known ? pts + offset : 0;
+    }
+
+}
@@ -0,0 +1,49 @@
+//
+// Created by James Shen on 17/10/26.
+// Copyright (c) 2020 GUIDEBEE IT. All rights reserved
+//
+
+#ifndef ANDROID_IROBOT_CLOCK_OFFSET_HPP
+#define ANDROID_IROBOT_CLOCK_OFFSET_HPP
+
+#include <SDL2/SDL_atomic.h>
+
+#include <cstdint>
+
+#include "config.hpp"
+
+// the offset is the minimum over the last windows, so that it follows the
+// clock drift
+#define CLOCK_OFFSET_WINDOW_US 1000000
+#define CLOCK_OFFSET_NR_WINDOWS 8
+
+namespace irobot::video {
+
+    // Map the device PTS (in us) to the host monotonic clock
+    // (av_gettime_relative()).
+    //
+    // Each packet gives a sample "receive time - PTS", which is the clock
+    // offset plus the encoding and network delays of the packet. The smallest
+    // sample of the last seconds is the best estimate of the offset, so the
+    // mapped time of a frame is an upper bound of its capture time.
+    class ClockOffset {
+    public:
+        // protects the following fields
+        SDL_SpinLock lock = 0;
+        int64_t minima[CLOCK_OFFSET_NR_WINDOWS]{};
+        int nr_windows = 0;
+        // the first window is minima[0]
+        int index = CLOCK_OFFSET_NR_WINDOWS - 1;
+        int64_t window_start = 0;
+        int64_t offset = 0;
+
+        // add a sample, from the stream
+        void Update(int64_t pts, int64_t receive_time);
+
+        // return the host time of the device pts, 0 if unknown
+        int64_t ToHost(int64_t pts);
+    };
+
+}
+
+#endif //ANDROID_IROBOT_CLOCK_OFFSET_HPP
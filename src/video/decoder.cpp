@@ -5,34 +5,41 @@
 
 #include "decoder.hpp"
 
-#include "ui/events.hpp"
+#if defined (__cplusplus)
+extern "C" {
+#endif
+
+#include <libavutil/time.h>
+
+#if defined (__cplusplus)
+}
+#endif
+
 #include "util/log.hpp"
 #include "video/video_buffer.hpp"
 
 namespace irobot::video {
-// set the decoded frame as ready for rendering, and notify
+// set the decoded frame as ready for the consumers, and notify them
     void Decoder::PushFrame() {
-        bool previous_frame_skipped;
-        this->video_buffer->OfferDecodedFrame(
-                &previous_frame_skipped);
-        if (previous_frame_skipped) {
-            // the previous EVENT_NEW_FRAME will consume this frame
-            return;
-        }
-        static SDL_Event new_frame_event = {
-                .type = EVENT_NEW_FRAME,
-        };
-        SDL_PushEvent(&new_frame_event);
-        static SDL_Event new_opencv_frame_event = {
-                .type = EVENT_NEW_OPENCV_FRAME,
-        };
-        SDL_PushEvent(&new_opencv_frame_event);
+        this->video_buffer->OfferDecodedFrame();
     }
 
-    void Decoder::Init(VideoBuffer *vb) {
+    void Decoder::Init(VideoBuffer *vb, enum DecodeMode decode_mode) {
         this->video_buffer = vb;
-        this->sws_cv_ctx = nullptr;
+        this->mode = decode_mode;
+
+    }
 
+    const char *Decoder::GetModeName(enum DecodeMode decode_mode) {
+        switch (decode_mode) {
+            case DECODE_MODE_LOW_DELAY:
+                return "low-delay";
+            case DECODE_MODE_SLICE:
+                return "slice";
+            case DECODE_MODE_FRAME:
+                return "frame";
+        }
+        return "unknown";
     }
 
     bool Decoder::Open(const AVCodec *codec) {
@@ -41,10 +48,21 @@ namespace irobot::video {
             LOGC("Could not allocate decoder context");
             return false;
         }
-        this->codec_cv_ctx = avcodec_alloc_context3(codec);
-        if (!this->codec_cv_ctx) {
-            LOGC("Could not allocate decoder context");
-            return false;
+        switch (this->mode) {
+            case DECODE_MODE_LOW_DELAY:
+                this->codec_ctx->thread_count = 1;
+                this->codec_ctx->flags |= AV_CODEC_FLAG_LOW_DELAY;
+                break;
+            case DECODE_MODE_SLICE:
+                // 0 means one thread per core
+                this->codec_ctx->thread_count = 0;
+                this->codec_ctx->thread_type = FF_THREAD_SLICE;
+                this->codec_ctx->flags |= AV_CODEC_FLAG_LOW_DELAY;
+                break;
+            case DECODE_MODE_FRAME:
+                this->codec_ctx->thread_count = 0;
+                this->codec_ctx->thread_type = FF_THREAD_FRAME;
+                break;
         }
 
         if (avcodec_open2(this->codec_ctx, codec, nullptr) < 0) {
@@ -52,13 +70,8 @@ namespace irobot::video {
             avcodec_free_context(&this->codec_ctx);
             return false;
         }
-
-        if (avcodec_open2(this->codec_cv_ctx, codec, nullptr) < 0) {
-            LOGE("Could not open codec");
-            avcodec_free_context(&this->codec_ctx);
-            avcodec_free_context(&this->codec_cv_ctx);
-            return false;
-        }
+        LOGI("Decoder: %s mode, %d thread(s)", GetModeName(this->mode),
+             this->codec_ctx->thread_count);
 
         return true;
     }
@@ -66,83 +79,49 @@ namespace irobot::video {
     void Decoder::Close() {
         avcodec_close(this->codec_ctx);
         avcodec_free_context(&this->codec_ctx);
-        avcodec_close(this->codec_cv_ctx);
-        avcodec_free_context(&this->codec_cv_ctx);
-        sws_freeContext(this->sws_cv_ctx);
-        av_free(this->video_buffer->buffer);
-        this->sws_cv_ctx = nullptr;
     }
 
-    bool Decoder::Push(const AVPacket *packet) {
+    bool Decoder::Push(const AVPacket *packet, int frame_id) {
         // the new decoding/encoding API has been introduced by:
         // <http://git.videolan.org/?p=ffmpeg.git;a=commitdiff;h=7fc329e2dd6226dfecaa4a1d7adf353bf2773726>
         int ret;
+        // the frame id is passed along to the frame decoded from this packet
+        // (possibly several packets later with frame threading)
+        this->codec_ctx->reordered_opaque = frame_id;
         if ((ret = avcodec_send_packet(this->codec_ctx, packet)) < 0) {
             LOGE("Could not send video packet: %d", ret);
             return false;
         }
-        ret = avcodec_receive_frame(this->codec_ctx,
-                                    this->video_buffer->decoding_frame);
-        if (!ret) {
-
-            if (this->sws_cv_ctx == nullptr) {
-                this->codec_cv_ctx->height = this->video_buffer->decoding_frame->height;
-                this->codec_cv_ctx->width = video_buffer->decoding_frame->width;
-                this->codec_cv_ctx->pix_fmt = AV_PIX_FMT_YUV420P;
-                this->codec_cv_ctx->coded_height = this->codec_cv_ctx->height;
-                this->codec_cv_ctx->coded_width = this->codec_cv_ctx->width;
-
-                // initialize SWS context for software scaling
-                this->sws_cv_ctx = sws_getContext(this->codec_cv_ctx->width,
-                                                  this->codec_cv_ctx->height,
-                                                  this->codec_cv_ctx->pix_fmt,
-                                                  this->codec_cv_ctx->width,
-                                                  this->codec_cv_ctx->height,
-                                                  AV_PIX_FMT_BGR24,
-                                                  SWS_BILINEAR,
-                                                  nullptr,
-                                                  nullptr,
-                                                  nullptr
-                );
-
-                if (this->sws_cv_ctx == nullptr) {
-                    LOGE("Could not open sws_cv_ctx");
-                    avcodec_free_context(&this->codec_ctx);
-                    avcodec_free_context(&this->codec_cv_ctx);
-                    return false;
-                }
-
-                int numBytes = av_image_get_buffer_size(AV_PIX_FMT_RGB24, this->codec_cv_ctx->width,
-                                                        this->codec_cv_ctx->height, IMAGE_ALIGN);
-
-                this->video_buffer->rgb_frame->width = this->codec_cv_ctx->width;
-                this->video_buffer->rgb_frame->height = this->codec_cv_ctx->height;
-                this->video_buffer->rgb_frame->format = AV_PIX_FMT_RGB24;
-
-                this->video_buffer->buffer = (uint8_t *) av_malloc(numBytes * sizeof(uint8_t));
-
-                av_image_fill_arrays(this->video_buffer->rgb_frame->data, this->video_buffer->rgb_frame->linesize,
-                                     this->video_buffer->buffer, AV_PIX_FMT_RGB24,
-                                     this->codec_cv_ctx->width, this->codec_cv_ctx->height, IMAGE_ALIGN);
+
+        // drain all the available frames
+        for (;;) {
+            ret = avcodec_receive_frame(this->codec_ctx,
+                                        this->video_buffer->decoding_frame);
+            if (ret == AVERROR(EAGAIN)) {
+                break;
+            }
+            if (ret) {
+                LOGE("Could not receive video frame: %d", ret);
+                return false;
+            }
+            if (!this->ProcessFrame()) {
+                return false;
             }
+        }
 
-            // Convert the image from its native format to RGB
-            sws_scale(this->sws_cv_ctx,
-                      (uint8_t const *const *) this->video_buffer->decoding_frame->data,
-                      this->video_buffer->decoding_frame->linesize,
-                      0,
-                      this->codec_cv_ctx->height,
-                      this->video_buffer->rgb_frame->data,
-                      this->video_buffer->rgb_frame->linesize
-            );
-            this->video_buffer->frame_number = this->codec_ctx->frame_number;
-            this->PushFrame();
-
-        } else if (ret != AVERROR(EAGAIN)) {
-            LOGE("Could not receive video frame: %d", ret);
-            return false;
+        return true;
+    }
+
+    bool Decoder::ProcessFrame() {
+        const AVFrame *frame = this->video_buffer->decoding_frame;
+        int64_t latency = this->video_buffer->latency->Mark(
+                (int) frame->reordered_opaque, LATENCY_STAGE_DECODED);
+        if (latency >= 0) {
+            this->video_buffer->fps_counter->AddDecodedFrame((uint32_t) latency);
         }
 
+        // the BGR image is converted on demand, see ai::FrameSnapshot
+        this->PushFrame();
         return true;
     }
 
@@ -153,7 +132,7 @@ namespace irobot::video {
 
 #pragma ide diagnostic ignored "OCUnusedGlobalDeclarationInspection"
 
-    void Decoder::SaveFrame(AVFrame *pFrameRGB,
+    void Decoder::SaveFrame(const AVFrame *pFrameRGB,
                             int iFrame) {
         FILE *pFile;
         char szFilename[32];
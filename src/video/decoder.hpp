@@ -11,8 +11,6 @@ extern "C" {
 #endif
 
 #include <libavformat/avformat.h>
-#include <libswscale/swscale.h>
-#include <libavutil/imgutils.h>
 #if defined (__cplusplus)
 }
 #endif
@@ -20,33 +18,46 @@ extern "C" {
 #include <SDL2/SDL_events.h>
 #include "config.hpp"
 
-#define IMAGE_ALIGN 1
-
 namespace irobot::video {
 
     class VideoBuffer;
 
+    enum DecodeMode {
+        // single thread, AV_CODEC_FLAG_LOW_DELAY: the lowest latency
+        DECODE_MODE_LOW_DELAY,
+        // slice threading: no additional latency, but only effective if the
+        // device encoder produces several slices per frame
+        DECODE_MODE_SLICE,
+        // frame threading: the highest throughput, at the cost of up to one
+        // frame of latency per additional thread
+        DECODE_MODE_FRAME,
+    };
+
     class Decoder {
 
     public:
         VideoBuffer *video_buffer;
         AVCodecContext *codec_ctx;
-        AVCodecContext *codec_cv_ctx;
-        SwsContext *sws_cv_ctx;
+        enum DecodeMode mode;
 
-        void Init(VideoBuffer *vb);
+        void Init(VideoBuffer *vb, enum DecodeMode decode_mode);
 
         bool Open(const AVCodec *codec);
 
         void Close();
 
-        bool Push(const AVPacket *packet);
+        // frame_id: the latency timeline of the packet, if tracked
+        bool Push(const AVPacket *packet, int frame_id);
 
         void Interrupt();
 
-        static void SaveFrame(AVFrame *pFrameRGB, int iFrame);
+        static void SaveFrame(const AVFrame *pFrameRGB, int iFrame);
+
+        static const char *GetModeName(enum DecodeMode decode_mode);
 
     private:
+        bool ProcessFrame();
+
         void PushFrame();
     };
 }
@@ -29,12 +29,31 @@ namespace irobot::video {
     void FpsCounter::display_fps() {
         unsigned rendered_per_second =
                 this->nr_rendered * 1000 / FPS_COUNTER_INTERVAL_MS;
-        if (this->nr_skipped) {
-            LOGI("%u fps (+%u frames skipped)", rendered_per_second,
-                 this->nr_skipped);
-        } else {
-            LOGI("%u fps", rendered_per_second);
+        LOGI("%u fps", rendered_per_second);
+        if (this->reporter) {
+            this->reporter(this->reporter_data);
         }
+        if (this->nr_decoded) {
+            LOGI("%u frames decoded per second, latency %.2f ms avg, %.2f ms max",
+                 this->nr_decoded * 1000 / FPS_COUNTER_INTERVAL_MS,
+                 (double) this->decode_latency_sum / this->nr_decoded / 1000,
+                 (double) this->decode_latency_max / 1000);
+        }
+        auto nr_events = (unsigned) SDL_AtomicGet(&this->nr_events);
+        auto nr_input_events = (unsigned) SDL_AtomicGet(&this->nr_input_events);
+        LOGI("%u events dispatched per second, %u input",
+             nr_events * 1000 / FPS_COUNTER_INTERVAL_MS,
+             nr_input_events * 1000 / FPS_COUNTER_INTERVAL_MS);
+    }
+
+    // must be called with mutex locked
+    void FpsCounter::Reset() {
+        this->nr_rendered = 0;
+        this->nr_decoded = 0;
+        this->decode_latency_sum = 0;
+        this->decode_latency_max = 0;
+        SDL_AtomicSet(&this->nr_events, 0);
+        SDL_AtomicSet(&this->nr_input_events, 0);
     }
 
     // must be called with mutex locked
@@ -44,8 +63,7 @@ namespace irobot::video {
         }
 
         this->display_fps();
-        this->nr_rendered = 0;
-        this->nr_skipped = 0;
+        this->Reset();
         // add a multiple of the interval
         uint32_t elapsed_slices =
                 (now - this->next_timestamp) / FPS_COUNTER_INTERVAL_MS + 1;
@@ -78,8 +96,7 @@ namespace irobot::video {
     bool FpsCounter::Start() {
         util::mutex_lock(this->mutex);
         this->next_timestamp = SDL_GetTicks() + FPS_COUNTER_INTERVAL_MS;
-        this->nr_rendered = 0;
-        this->nr_skipped = 0;
+        this->Reset();
         util::mutex_unlock(this->mutex);
         SDL_AtomicSet(&this->started, 1);
         util::cond_signal(this->thread_cond);
@@ -129,14 +146,28 @@ namespace irobot::video {
         util::mutex_unlock(this->mutex);
     }
 
-    void FpsCounter::AddSkippedFrame() {
+    void FpsCounter::AddDispatchedEvent(bool input) {
+        if (!SDL_AtomicGet(&this->started)) {
+            return;
+        }
+        SDL_AtomicIncRef(&this->nr_events);
+        if (input) {
+            SDL_AtomicIncRef(&this->nr_input_events);
+        }
+    }
+
+    void FpsCounter::AddDecodedFrame(uint32_t latency) {
         if (!SDL_AtomicGet(&this->started)) {
             return;
         }
         util::mutex_lock(this->mutex);
         uint32_t now = SDL_GetTicks();
         this->CheckIntervalExpired(now);
-        ++this->nr_skipped;
+        ++this->nr_decoded;
+        this->decode_latency_sum += latency;
+        if (latency > this->decode_latency_max) {
+            this->decode_latency_max = latency;
+        }
         util::mutex_unlock(this->mutex);
     }
 }
\ No newline at end of file
@@ -26,8 +26,16 @@ namespace irobot::video {
         // the following fields are protected by the mutex
         bool interrupted = false;
         unsigned nr_rendered = 0;
-        unsigned nr_skipped = 0;
+        unsigned nr_decoded = 0;
+        uint64_t decode_latency_sum = 0; // in microseconds
+        uint32_t decode_latency_max = 0; // in microseconds
         uint32_t next_timestamp = 0;
+        // dispatched by the event loop, counted without locking
+        SDL_atomic_t nr_events{};
+        SDL_atomic_t nr_input_events{};
+        // called every interval after the fps are logged
+        void (*reporter)(void *data) = nullptr;
+        void *reporter_data = nullptr;
 
         bool Init() override;
 
@@ -43,7 +51,11 @@ namespace irobot::video {
 
         void AddRenderedFrame();
 
-        void AddSkippedFrame();
+        // latency: from the packet submission to the decoded frame, in us
+        void AddDecodedFrame(uint32_t latency);
+
+        // called by the event loop for each event
+        void AddDispatchedEvent(bool input);
 
         void CheckIntervalExpired(uint32_t now);
 
@@ -52,6 +64,8 @@ namespace irobot::video {
     private:
         void display_fps();
 
+        void Reset();
+
     };
 
 }
@@ -0,0 +1,212 @@
+//
+// Created by James Shen on 17/10/26.
+// Copyright (c) 2020 GUIDEBEE IT. All rights reserved
+//
+
+#include "latency.hpp"
+
+#if defined (__cplusplus)
+extern "C" {
+#endif
+
+#include <libavutil/time.h>
+
+#if defined (__cplusplus)
+}
+#endif
+
+#include <climits>
+#include <cmath>
+
+#include "util/log.hpp"
+
+namespace irobot::video {
+
+    int LatencyHistogram::GetBucket(uint32_t value) {
+        // the values below 2 * LATENCY_SUB_BUCKETS have their own bucket, the
+        // others keep their LATENCY_SUB_BUCKET_BITS + 1 most significant bits
+        int shift = 0;
+        while ((value >> shift) >= 2 * LATENCY_SUB_BUCKETS) {
+            ++shift;
+        }
+        return shift * LATENCY_SUB_BUCKETS + (int) (value >> shift);
+    }
+
+    uint32_t LatencyHistogram::GetBucketValue(int bucket) {
+        if (bucket < 2 * LATENCY_SUB_BUCKETS) {
+            return (uint32_t) bucket;
+        }
+        int shift = bucket / LATENCY_SUB_BUCKETS - 1;
+        uint64_t mantissa = bucket - shift * LATENCY_SUB_BUCKETS;
+        uint64_t value = ((mantissa + 1) << shift) - 1;
+        return value > UINT32_MAX ? UINT32_MAX : (uint32_t) value;
+    }
+
+    void LatencyHistogram::Record(uint32_t value) {
+        SDL_AtomicIncRef(&this->buckets[GetBucket(value)]);
+        SDL_AtomicIncRef(&this->count);
+        int v = value > INT_MAX ? INT_MAX : (int) value;
+        int max;
+        do {
+            max = SDL_AtomicGet(&this->max);
+        } while (v > max && !SDL_AtomicCAS(&this->max, max, v));
+    }
+
+    uint32_t LatencyHistogram::Percentile(double q) {
+        auto count = (unsigned) SDL_AtomicGet(&this->count);
+        if (!count) {
+            return 0;
+        }
+        auto rank = (unsigned) ceil(q * count);
+        if (rank < 1) {
+            rank = 1;
+        }
+        auto max = (uint32_t) SDL_AtomicGet(&this->max);
+        unsigned seen = 0;
+        for (int i = 0; i < LATENCY_NR_BUCKETS; ++i) {
+            seen += (unsigned) SDL_AtomicGet(&this->buckets[i]);
+            if (seen >= rank) {
+                uint32_t value = GetBucketValue(i);
+                return value < max ? value : max;
+            }
+        }
+        // records added during the scan
+        return max;
+    }
+
+    uint32_t LatencyTracker::GetTimestamp(int64_t time) {
+        // the durations are computed modulo 2^32 us (more than one hour)
+        auto timestamp = (uint32_t) time;
+        // 0 means "not marked"
+        return timestamp ? timestamp : 1;
+    }
+
+    enum LatencyStage LatencyTracker::GetReference(enum LatencyStage stage) {
+        switch (stage) {
+            case LATENCY_STAGE_BODY:
+                return LATENCY_STAGE_HEADER;
+            case LATENCY_STAGE_PARSED:
+                return LATENCY_STAGE_BODY;
+            case LATENCY_STAGE_DECODED:
+                return LATENCY_STAGE_PARSED;
+            case LATENCY_STAGE_CONVERTED:
+            case LATENCY_STAGE_RENDERED:
+                return LATENCY_STAGE_DECODED;
+            case LATENCY_STAGE_SERIALIZED:
+                return LATENCY_STAGE_CONVERTED;
+            default:
+                return LATENCY_STAGE_HEADER;
+        }
+    }
+
+    const char *LatencyTracker::GetStageName(enum LatencyStage stage) {
+        switch (stage) {
+            case LATENCY_STAGE_HEADER:
+                return "header";
+            case LATENCY_STAGE_BODY:
+                return "body";
+            case LATENCY_STAGE_PARSED:
+                return "parsed";
+            case LATENCY_STAGE_DECODED:
+                return "decoded";
+            case LATENCY_STAGE_CONVERTED:
+                return "converted";
+            case LATENCY_STAGE_RENDERED:
+                return "rendered";
+            case LATENCY_STAGE_SERIALIZED:
+                return "serialized";
+            default:
+                return "unknown";
+        }
+    }
+
+    int LatencyTracker::Begin(int64_t header_time, int64_t body_time) {
+        this->last_id = this->last_id == INT_MAX ? 1 : this->last_id + 1;
+        int id = this->last_id;
+        struct FrameTimeline *timeline = &this->timelines[id % LATENCY_NR_TIMELINES];
+        // invalidate the previous frame before resetting its marks
+        SDL_AtomicSet(&timeline->id, 0);
+        for (auto &mark : timeline->marks) {
+            SDL_AtomicSet(&mark, 0);
+        }
+        uint32_t header = GetTimestamp(header_time);
+        uint32_t body = GetTimestamp(body_time);
+        SDL_AtomicSet(&timeline->marks[LATENCY_STAGE_HEADER], (int) header);
+        SDL_AtomicSet(&timeline->marks[LATENCY_STAGE_BODY], (int) body);
+        SDL_AtomicSet(&timeline->id, id);
+        this->stages[LATENCY_STAGE_BODY].Record(body - header);
+        return id;
+    }
+
+    int64_t LatencyTracker::Mark(int id, enum LatencyStage stage) {
+        if (id <= 0) {
+            return -1;
+        }
+        struct FrameTimeline *timeline = &this->timelines[id % LATENCY_NR_TIMELINES];
+        if (SDL_AtomicGet(&timeline->id) != id) {
+            // too late, the timeline has been reused
+            return -1;
+        }
+        auto reference = (uint32_t) SDL_AtomicGet(&timeline->marks[GetReference(stage)]);
+        auto header = (uint32_t) SDL_AtomicGet(&timeline->marks[LATENCY_STAGE_HEADER]);
+        if (!reference) {
+            // the reference stage has been skipped (or not reached yet)
+            return -1;
+        }
+        uint32_t now = GetTimestamp(av_gettime_relative());
+        if (!SDL_AtomicCAS(&timeline->marks[stage], 0, (int) now)) {
+            // already marked
+            return -1;
+        }
+        if (SDL_AtomicGet(&timeline->id) != id) {
+            // reused meanwhile, the mark belongs to the new frame: undo it
+            SDL_AtomicCAS(&timeline->marks[stage], (int) now, 0);
+            return -1;
+        }
+        uint32_t latency = now - reference;
+        this->stages[stage].Record(latency);
+        if (stage == LATENCY_STAGE_RENDERED) {
+            this->screen_total.Record(now - header);
+        } else if (stage == LATENCY_STAGE_SERIALIZED) {
+            this->agent_total.Record(now - header);
+        }
+        return latency;
+    }
+
+    void LatencyTracker::DumpHistogram(const char *name, LatencyHistogram *histogram) {
+        if (!SDL_AtomicGet(&histogram->count)) {
+            return;
+        }
+        LOGI("Latency %-12s %6d frames, p50 %7.2f ms, p99 %7.2f ms, "
+             "p999 %7.2f ms, max %7.2f ms", name,
+             SDL_AtomicGet(&histogram->count),
+             histogram->Percentile(0.5) / 1000.0,
+             histogram->Percentile(0.99) / 1000.0,
+             histogram->Percentile(0.999) / 1000.0,
+             SDL_AtomicGet(&histogram->max) / 1000.0);
+    }
+
+    void LatencyTracker::Dump() {
+        for (int i = LATENCY_STAGE_BODY; i < LATENCY_STAGE_COUNT; ++i) {
+            DumpHistogram(GetStageName((enum LatencyStage) i), &this->stages[i]);
+        }
+        DumpHistogram("screen total", &this->screen_total);
+        DumpHistogram("agent total", &this->agent_total);
+    }
+
+    void LatencyTracker::Report(int64_t now) {
+        if (!this->report_interval) {
+            return;
+        }
+        if (!this->last_report) {
+            this->last_report = now;
+            return;
+        }
+        if (now - this->last_report < this->report_interval) {
+            return;
+        }
+        this->last_report = now;
+        this->Dump();
+    }
+
+}
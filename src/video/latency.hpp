@@ -0,0 +1,115 @@
+//
+// Created by James Shen on 17/10/26.
+// Copyright (c) 2020 GUIDEBEE IT. All rights reserved
+//
+
+#ifndef ANDROID_IROBOT_LATENCY_HPP
+#define ANDROID_IROBOT_LATENCY_HPP
+
+#include <SDL2/SDL_atomic.h>
+
+#include <cstdint>
+
+#include "config.hpp"
+
+// values below 2 * 32 us are exact, the others are rounded to 1/32 (~3%)
+#define LATENCY_SUB_BUCKET_BITS 5
+#define LATENCY_SUB_BUCKETS (1 << LATENCY_SUB_BUCKET_BITS)
+#define LATENCY_NR_BUCKETS ((32 - LATENCY_SUB_BUCKET_BITS + 1) * LATENCY_SUB_BUCKETS)
+// frames in flight whose marks are still accepted
+#define LATENCY_NR_TIMELINES 64
+
+namespace irobot::video {
+
+    enum LatencyStage {
+        LATENCY_STAGE_HEADER,     // "meta" header received
+        LATENCY_STAGE_BODY,       // packet body complete
+        LATENCY_STAGE_PARSED,     // parsed, sent to the decoder
+        LATENCY_STAGE_DECODED,    // offered to the consumers
+        LATENCY_STAGE_CONVERTED,  // first agent image converted
+        LATENCY_STAGE_RENDERED,   // rendered by the screen
+        LATENCY_STAGE_SERIALIZED, // first agent image sent
+        LATENCY_STAGE_COUNT,
+    };
+
+    // Log-linear (HDR-style) histogram of durations in microseconds.
+    // Record() is lock-free and may be called from any thread.
+    class LatencyHistogram {
+    public:
+        SDL_atomic_t buckets[LATENCY_NR_BUCKETS]{};
+        SDL_atomic_t count{};
+        SDL_atomic_t max{};
+
+        void Record(uint32_t value);
+
+        // return the (upper bound of the) q quantile, 0 if empty
+        uint32_t Percentile(double q);
+
+        static int GetBucket(uint32_t value);
+
+        // highest value of the bucket
+        static uint32_t GetBucketValue(int bucket);
+    };
+
+    // the timestamps of one frame, in (wrapping) microseconds
+    struct FrameTimeline {
+        // id of the frame, 0 while the timeline is being reset
+        SDL_atomic_t id;
+        // 0 if not marked yet
+        SDL_atomic_t marks[LATENCY_STAGE_COUNT];
+    };
+
+    // Per frame, stage by stage latencies of the video pipeline.
+    //
+    // The stream begins a timeline for each packet, and passes its id along
+    // with the frame (AVFrame.reordered_opaque); each thread then marks the
+    // stages it completes. Each stage is measured from the stage it depends on
+    // (see GetReference()), so that a regression can be located: network
+    // (body), parser, decoder, agent conversion, render or agent send.
+    //
+    // Marks of a frame more than LATENCY_NR_TIMELINES frames late are ignored.
+    class LatencyTracker {
+    public:
+        struct FrameTimeline timelines[LATENCY_NR_TIMELINES]{};
+        // last id, only accessed by the stream
+        int last_id = 0;
+        // indexed by the measured stage
+        LatencyHistogram stages[LATENCY_STAGE_COUNT];
+        // from the header to the screen, and to the agent
+        LatencyHistogram screen_total;
+        LatencyHistogram agent_total;
+        // Report() interval in us, 0 to disable (to be set before the stream
+        // starts)
+        int64_t report_interval = 0;
+        // only accessed by the stream
+        int64_t last_report = 0;
+
+        // start the timeline of a new frame, from av_gettime_relative() times
+        // return the frame id (never 0)
+        int Begin(int64_t header_time, int64_t body_time);
+
+        // mark the completion of a stage (only the first mark is recorded)
+        // return the latency since the reference stage in us, -1 if unknown
+        int64_t Mark(int id, enum LatencyStage stage);
+
+        // log p50/p99/p999 for each stage
+        void Dump();
+
+        // Dump() if report_interval elapsed since the last report, so that
+        // the latencies are available without a screen (--latency-report)
+        // now: av_gettime_relative()
+        void Report(int64_t now);
+
+        static enum LatencyStage GetReference(enum LatencyStage stage);
+
+        static const char *GetStageName(enum LatencyStage stage);
+
+    private:
+        static uint32_t GetTimestamp(int64_t time);
+
+        static void DumpHistogram(const char *name, LatencyHistogram *histogram);
+    };
+
+}
+
+#endif //ANDROID_IROBOT_LATENCY_HPP
@@ -0,0 +1,71 @@
+//
+// Created by James Shen on 17/10/26.
+// Copyright (c) 2020 GUIDEBEE IT. All rights reserved
+//
+
+#include "nal_scanner.hpp"
+
+#include <cstring>
+
+namespace irobot::video {
+
+    // non-zero if one of the 8 bytes of x is 0
+    static inline uint64_t HasZeroByte(uint64_t x) {
+        return (x - UINT64_C(0x0101010101010101)) & ~x
+               & UINT64_C(0x8080808080808080);
+    }
+
+    const uint8_t *NalFindStartCode(const uint8_t *data, const uint8_t *end) {
+        const uint8_t *p = data;
+        while (end - p >= 8 + 2) {
+            uint64_t word;
+            memcpy(&word, p, sizeof(word));
+            if (!HasZeroByte(word)) {
+                // a start code begins with two zeros, so it cannot begin in
+                // these 8 bytes
+                p += 8;
+                continue;
+            }
+            for (const uint8_t *q = p; q < p + 8; ++q) {
+                if (!q[0] && !q[1] && q[2] == 1) {
+                    return q;
+                }
+            }
+            p += 8;
+        }
+        for (; end - p >= 3; ++p) {
+            if (!p[0] && !p[1] && p[2] == 1) {
+                return p;
+            }
+        }
+        return end;
+    }
+
+    bool NalScan(const uint8_t *data, size_t len, struct NalInfo *info) {
+        const uint8_t *end = data + len;
+        info->type = 0;
+        info->ref_idc = 0;
+        info->types = 0;
+        info->key = false;
+
+        const uint8_t *p = NalFindStartCode(data, end);
+        while (p != end) {
+            p += 3;
+            if (p == end) {
+                break;
+            }
+            uint8_t header = *p;
+            uint8_t type = header & 0x1f;
+            info->types |= NAL_TYPE_MASK(type);
+            if (type == NAL_TYPE_SLICE || type == NAL_TYPE_IDR) {
+                info->type = type;
+                info->ref_idc = (header >> 5) & 3;
+                info->key = type == NAL_TYPE_IDR;
+                break;
+            }
+            p = NalFindStartCode(p + 1, end);
+        }
+        return info->types != 0;
+    }
+
+}
@@ -0,0 +1,48 @@
+//
+// Created by James Shen on 17/10/26.
+// Copyright (c) 2020 GUIDEBEE IT. All rights reserved
+//
+
+#ifndef ANDROID_IROBOT_NAL_SCANNER_HPP
+#define ANDROID_IROBOT_NAL_SCANNER_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+// H.264 nal_unit_type values
+#define NAL_TYPE_SLICE 1
+#define NAL_TYPE_IDR 5
+#define NAL_TYPE_SEI 6
+#define NAL_TYPE_SPS 7
+#define NAL_TYPE_PPS 8
+#define NAL_TYPE_AUD 9
+
+#define NAL_TYPE_MASK(type) (1u << (type))
+
+namespace irobot::video {
+
+    struct NalInfo {
+        // nal_unit_type and nal_ref_idc of the first slice, 0 if none
+        uint8_t type;
+        uint8_t ref_idc;
+        // NAL_TYPE_MASK() of each NAL unit found, up to the first slice
+        uint32_t types;
+        // the first slice is an IDR
+        bool key;
+    };
+
+    // return the first 00 00 01 in [data; end), or end if none
+    // the buffer is tested 8 bytes at a time for a zero byte
+    const uint8_t *NalFindStartCode(const uint8_t *data, const uint8_t *end);
+
+    // Classify the NAL units of an Annex-B access unit, like the
+    // av_parser_parse2() of a complete frame would.
+    //
+    // The slices of a picture share the type of the first one, so the scan
+    // stops there: the cost does not depend on the size of the frame.
+    // return false if the data contains no NAL unit
+    bool NalScan(const uint8_t *data, size_t len, struct NalInfo *info);
+
+}
+
+#endif //ANDROID_IROBOT_NAL_SCANNER_HPP
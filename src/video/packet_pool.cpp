@@ -0,0 +1,95 @@
+//
+// Created by James Shen on 17/10/26.
+// Copyright (c) 2020 GUIDEBEE IT. All rights reserved
+//
+
+#include "packet_pool.hpp"
+
+#include <cinttypes>
+#include <cstring>
+
+#include "util/log.hpp"
+
+namespace irobot::video {
+
+    bool PacketPool::Init() {
+        SDL_AtomicSet(&this->nr_requests, 0);
+        SDL_AtomicSet(&this->nr_misses, 0);
+        SDL_AtomicSet(&this->nr_rejected, 0);
+
+        for (int i = 0; i < PACKET_POOL_NR_CLASSES; ++i) {
+            int size = PACKET_POOL_MIN_CLASS_SIZE << (2 * i);
+            this->pools[i] = av_buffer_pool_init2(size, this, AllocBuffer, nullptr);
+            if (!this->pools[i]) {
+                LOGC("Could not create packet pool");
+                this->Destroy();
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void PacketPool::Destroy() {
+        for (auto &pool : this->pools) {
+            if (pool) {
+                av_buffer_pool_uninit(&pool);
+            }
+        }
+    }
+
+    // called by the pool only when it has no released buffer to reuse
+#if FF_API_BUFFER_SIZE_T
+    AVBufferRef *PacketPool::AllocBuffer(void *opaque, int size) {
+#else
+    AVBufferRef *PacketPool::AllocBuffer(void *opaque, size_t size) {
+#endif
+        auto *pool = static_cast<PacketPool *>(opaque);
+        SDL_AtomicIncRef(&pool->nr_misses);
+        return av_buffer_alloc(size);
+    }
+
+    int PacketPool::GetSizeClass(uint32_t size) {
+        uint64_t required = (uint64_t) size + AV_INPUT_BUFFER_PADDING_SIZE;
+        uint64_t class_size = PACKET_POOL_MIN_CLASS_SIZE;
+        for (int i = 0; i < PACKET_POOL_NR_CLASSES; ++i) {
+            if (required <= class_size) {
+                return i;
+            }
+            class_size <<= 2;
+        }
+        return -1;
+    }
+
+    bool PacketPool::Alloc(AVPacket *packet, uint32_t size) {
+        int size_class = size <= PACKET_MAX_SIZE ? GetSizeClass(size) : -1;
+        if (size_class < 0) {
+            SDL_AtomicIncRef(&this->nr_rejected);
+            LOGE("Packet too large: %" PRIu32 " bytes (max %d)", size,
+                 (int) PACKET_MAX_SIZE);
+            return false;
+        }
+
+        SDL_AtomicIncRef(&this->nr_requests);
+        AVBufferRef *buf = av_buffer_pool_get(this->pools[size_class]);
+        if (!buf) {
+            LOGC("Could not allocate packet");
+            return false;
+        }
+
+        av_init_packet(packet);
+        packet->buf = buf;
+        packet->data = buf->data;
+        packet->size = (int) size;
+        // the pooled buffer may contain a previous packet
+        memset(packet->data + size, 0, AV_INPUT_BUFFER_PADDING_SIZE);
+        return true;
+    }
+
+    void PacketPool::GetStats(struct PacketPoolStats *stats) {
+        unsigned requests = SDL_AtomicGet(&this->nr_requests);
+        stats->misses = SDL_AtomicGet(&this->nr_misses);
+        stats->hits = requests > stats->misses ? requests - stats->misses : 0;
+        stats->rejected = SDL_AtomicGet(&this->nr_rejected);
+    }
+
+}
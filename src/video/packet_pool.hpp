@@ -0,0 +1,82 @@
+//
+// Created by James Shen on 17/10/26.
+// Copyright (c) 2020 GUIDEBEE IT. All rights reserved
+//
+
+#ifndef ANDROID_IROBOT_PACKET_POOL_HPP
+#define ANDROID_IROBOT_PACKET_POOL_HPP
+
+#if defined (__cplusplus)
+extern "C" {
+#endif
+
+#include <libavcodec/avcodec.h>
+#include <libavutil/buffer.h>
+
+#if defined (__cplusplus)
+}
+#endif
+
+#include <SDL2/SDL_atomic.h>
+
+#include <cstdint>
+
+#include "config.hpp"
+
+// size classes grow by a factor of 4: 32K, 128K, 512K, 2M, 8M
+#define PACKET_POOL_NR_CLASSES 5
+#define PACKET_POOL_MIN_CLASS_SIZE (32 * 1024)
+
+// hard limit for the packet size announced by a "meta" header, so that a
+// corrupted header cannot trigger a huge allocation
+#define PACKET_MAX_SIZE \
+    ((PACKET_POOL_MIN_CLASS_SIZE << (2 * (PACKET_POOL_NR_CLASSES - 1))) \
+        - AV_INPUT_BUFFER_PADDING_SIZE)
+
+namespace irobot::video {
+
+    struct PacketPoolStats {
+        unsigned hits;     // packets served from a released buffer
+        unsigned misses;   // packets which required a new allocation
+        unsigned rejected; // packets larger than PACKET_MAX_SIZE
+    };
+
+    // Refcounted packet buffers, recycled through one AVBufferPool per size
+    // class.
+    //
+    // A packet filled by Alloc() owns a reference to a pooled buffer, so it
+    // can be passed by reference (av_packet_ref()) to the decoder and the
+    // recorder without any copy; the buffer returns to its pool once the last
+    // reference is released.
+    class PacketPool {
+    public:
+        AVBufferPool *pools[PACKET_POOL_NR_CLASSES]{};
+        SDL_atomic_t nr_requests{};
+        SDL_atomic_t nr_misses{};
+        SDL_atomic_t nr_rejected{};
+
+        bool Init();
+
+        // the pools are actually freed once all their buffers are released
+        void Destroy();
+
+        // initialize packet with a pooled buffer of (at least) size bytes
+        // packet->size is set to size, the padding is zeroed
+        // return false if size exceeds PACKET_MAX_SIZE or on allocation failure
+        bool Alloc(AVPacket *packet, uint32_t size);
+
+        void GetStats(struct PacketPoolStats *stats);
+
+        static int GetSizeClass(uint32_t size);
+
+    private:
+#if FF_API_BUFFER_SIZE_T
+        static AVBufferRef *AllocBuffer(void *opaque, int size);
+#else
+        static AVBufferRef *AllocBuffer(void *opaque, size_t size);
+#endif
+    };
+
+}
+
+#endif //ANDROID_IROBOT_PACKET_POOL_HPP
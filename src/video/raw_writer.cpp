@@ -0,0 +1,308 @@
+//
+// Created by James Shen on 17/10/26.
+// Copyright (c) 2020 GUIDEBEE IT. All rights reserved
+//
+
+#include "raw_writer.hpp"
+
+#include <cstring>
+
+#include "util/buffer_util.hpp"
+#include "util/lock.hpp"
+#include "util/log.hpp"
+
+namespace irobot::video {
+
+    char *RawWriter::GetIndexFilename(const char *filename) {
+        size_t len = strlen(filename);
+        auto *index_filename = (char *) SDL_malloc(len + sizeof(".idx"));
+        if (!index_filename) {
+            return nullptr;
+        }
+        memcpy(index_filename, filename, len);
+        memcpy(index_filename + len, ".idx", sizeof(".idx"));
+        return index_filename;
+    }
+
+    void RawWriter::WriteIndexHeader(uint8_t *buf) {
+        memcpy(buf, RAW_INDEX_MAGIC, 4);
+        util::buffer_write32be(&buf[4], RAW_INDEX_VERSION);
+    }
+
+    bool RawWriter::ReadIndexHeader(const uint8_t *buf) {
+        return !memcmp(buf, RAW_INDEX_MAGIC, 4)
+               && util::buffer_read32be(&buf[4]) == RAW_INDEX_VERSION;
+    }
+
+    void RawWriter::WriteIndexEntry(uint8_t *buf, const struct RawIndexEntry *entry) {
+        util::buffer_write64be(buf, entry->offset);
+        util::buffer_write64be(&buf[8], (uint64_t) entry->pts);
+        util::buffer_write32be(&buf[16], entry->flags);
+    }
+
+    void RawWriter::ReadIndexEntry(const uint8_t *buf, struct RawIndexEntry *entry) {
+        entry->offset = util::buffer_read64be(buf);
+        entry->pts = (int64_t) util::buffer_read64be(&buf[8]);
+        entry->flags = util::buffer_read32be(&buf[16]);
+    }
+
+    // a config packet has the pts of the next packet
+    static int64_t GetEntryPts(const struct RawIndexEntry *entries, size_t count,
+                               size_t i) {
+        while (i < count && (entries[i].flags & RAW_INDEX_FLAG_CONFIG)) {
+            ++i;
+        }
+        return i < count ? entries[i].pts : INT64_MAX;
+    }
+
+    ssize_t RawWriter::FindKeyFrame(const struct RawIndexEntry *entries,
+                                    size_t count, int64_t pts) {
+        if (!count) {
+            return -1;
+        }
+        // the last entry not after pts is in [low, high)
+        size_t low = 0;
+        size_t high = count;
+        while (high - low > 1) {
+            size_t mid = low + (high - low) / 2;
+            if (GetEntryPts(entries, count, mid) <= pts) {
+                low = mid;
+            } else {
+                high = mid;
+            }
+        }
+        for (ssize_t i = low; i >= 0; --i) {
+            if (entries[i].flags & RAW_INDEX_FLAG_KEY) {
+                return i;
+            }
+        }
+        for (size_t i = low + 1; i < count; ++i) {
+            if (entries[i].flags & RAW_INDEX_FLAG_KEY) {
+                return i;
+            }
+        }
+        return -1;
+    }
+
+    void RawWriter::Release() {
+        for (int i = 0; i < 2; ++i) {
+            SDL_free(this->allocations[i]);
+            SDL_free(this->buffers[i].index);
+        }
+        if (this->file) {
+            fclose(this->file);
+        }
+        if (this->index_file) {
+            fclose(this->index_file);
+        }
+        SDL_DestroyCond(this->done_cond);
+        Actor::Destroy();
+    }
+
+    bool RawWriter::Open(const char *filename) {
+        if (!Actor::Init()) {
+            return false;
+        }
+        this->file = nullptr;
+        this->index_file = nullptr;
+        this->active = 0;
+        this->pending = false;
+        this->failed = false;
+        this->offset = 0;
+        this->nr_entries = 0;
+        for (int i = 0; i < 2; ++i) {
+            this->allocations[i] = SDL_malloc(RAW_WRITER_BUFFER_SIZE
+                                              + RAW_WRITER_ALIGNMENT - 1);
+            auto address = (uintptr_t) this->allocations[i];
+            address = (address + RAW_WRITER_ALIGNMENT - 1)
+                      & ~(uintptr_t) (RAW_WRITER_ALIGNMENT - 1);
+            this->buffers[i].data = (uint8_t *) address;
+            this->buffers[i].size = 0;
+            this->buffers[i].index = (uint8_t *) SDL_malloc(
+                    RAW_WRITER_INDEX_ENTRIES * RAW_INDEX_ENTRY_SIZE);
+            this->buffers[i].index_size = 0;
+        }
+        this->done_cond = SDL_CreateCond();
+
+        char *index_filename = nullptr;
+        if (!this->allocations[0] || !this->allocations[1]
+            || !this->buffers[0].index || !this->buffers[1].index
+            || !this->done_cond) {
+            LOGC("Could not allocate raw writer buffers");
+            goto error;
+        }
+
+        this->file = fopen(filename, "wb");
+        if (!this->file) {
+            LOGE("Failed to open output file: %s", filename);
+            goto error;
+        }
+        // the buffers are already large
+        setvbuf(this->file, nullptr, _IONBF, 0);
+
+        index_filename = GetIndexFilename(filename);
+        if (!index_filename) {
+            LOGC("Could not allocate index filename");
+            goto error;
+        }
+        this->index_file = fopen(index_filename, "wb");
+        if (!this->index_file) {
+            LOGE("Failed to open index file: %s", index_filename);
+            SDL_free(index_filename);
+            goto error;
+        }
+        setvbuf(this->index_file, nullptr, _IONBF, 0);
+        SDL_free(index_filename);
+
+        WriteIndexHeader(this->buffers[0].index);
+        this->buffers[0].index_size = RAW_INDEX_HEADER_SIZE;
+
+        if (!this->Start()) {
+            goto error;
+        }
+        return true;
+
+        error:
+        this->Release();
+        return false;
+    }
+
+    bool RawWriter::Submit() {
+        util::mutex_lock(this->mutex);
+        while (this->pending) {
+            util::cond_wait(this->done_cond, this->mutex);
+        }
+        bool ok = !this->failed;
+        if (ok) {
+            this->pending = true;
+            this->active ^= 1;
+            util::cond_signal(this->thread_cond);
+        }
+        util::mutex_unlock(this->mutex);
+        return ok;
+    }
+
+    bool RawWriter::Append(const uint8_t *data, size_t len) {
+        while (len) {
+            struct RawBuffer *buffer = &this->buffers[this->active];
+            size_t chunk = RAW_WRITER_BUFFER_SIZE - buffer->size;
+            if (chunk > len) {
+                chunk = len;
+            }
+            memcpy(buffer->data + buffer->size, data, chunk);
+            buffer->size += chunk;
+            data += chunk;
+            len -= chunk;
+            if (buffer->size == RAW_WRITER_BUFFER_SIZE && !this->Submit()) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool RawWriter::AppendIndexEntry(const struct RawIndexEntry *entry) {
+        struct RawBuffer *buffer = &this->buffers[this->active];
+        if (buffer->index_size + RAW_INDEX_ENTRY_SIZE
+            > RAW_WRITER_INDEX_ENTRIES * RAW_INDEX_ENTRY_SIZE) {
+            if (!this->Submit()) {
+                return false;
+            }
+            buffer = &this->buffers[this->active];
+        }
+        WriteIndexEntry(buffer->index + buffer->index_size, entry);
+        buffer->index_size += RAW_INDEX_ENTRY_SIZE;
+        return true;
+    }
+
+    bool RawWriter::Write(const AVPacket *packet) {
+        struct RawIndexEntry entry = {
+                .offset = this->offset,
+                .pts = packet->pts,
+                .flags = 0,
+        };
+        if (packet->pts == AV_NOPTS_VALUE) {
+            entry.flags = RAW_INDEX_FLAG_CONFIG;
+        } else if (packet->flags & AV_PKT_FLAG_KEY) {
+            entry.flags = RAW_INDEX_FLAG_KEY;
+        }
+        if (!this->AppendIndexEntry(&entry)
+            || !this->Append(packet->data, packet->size)) {
+            return false;
+        }
+        this->offset += packet->size;
+        ++this->nr_entries;
+        return true;
+    }
+
+    bool RawWriter::Close() {
+        struct RawBuffer *buffer = &this->buffers[this->active];
+        if (buffer->size || buffer->index_size) {
+            this->Submit();
+        }
+        // the pending buffer is written before the thread ends
+        this->Stop();
+        this->Join();
+
+        bool ok = !this->failed;
+        if (fclose(this->file)) {
+            ok = false;
+        }
+        if (fclose(this->index_file)) {
+            ok = false;
+        }
+        this->file = nullptr;
+        this->index_file = nullptr;
+        this->Release();
+        return ok;
+    }
+
+    int RawWriter::RunWriter(void *data) {
+        auto *writer = static_cast<RawWriter *>(data);
+
+        for (;;) {
+            util::mutex_lock(writer->mutex);
+            while (!writer->stopped && !writer->pending) {
+                util::cond_wait(writer->thread_cond, writer->mutex);
+            }
+            if (!writer->pending) {
+                // stopped
+                util::mutex_unlock(writer->mutex);
+                break;
+            }
+            struct RawBuffer *buffer = &writer->buffers[writer->active ^ 1];
+            util::mutex_unlock(writer->mutex);
+
+            bool ok = fwrite(buffer->data, 1, buffer->size, writer->file) == buffer->size
+                      && fwrite(buffer->index, 1, buffer->index_size,
+                                writer->index_file) == buffer->index_size;
+            if (!ok) {
+                LOGE("Could not write raw stream");
+            }
+            buffer->size = 0;
+            buffer->index_size = 0;
+
+            util::mutex_lock(writer->mutex);
+            if (!ok) {
+                writer->failed = true;
+            }
+            writer->pending = false;
+            util::cond_signal(writer->done_cond);
+            util::mutex_unlock(writer->mutex);
+        }
+
+        LOGD("Raw writer thread ended");
+        return 0;
+    }
+
+    bool RawWriter::Start() {
+        LOGD("Starting raw writer thread");
+
+        this->thread = SDL_CreateThread(RunWriter, "raw_writer", this);
+        if (!this->thread) {
+            LOGC("Could not start raw writer thread");
+            return false;
+        }
+        return true;
+    }
+
+}
@@ -0,0 +1,122 @@
+//
+// Created by James Shen on 17/10/26.
+// Copyright (c) 2020 GUIDEBEE IT. All rights reserved
+//
+
+#ifndef ANDROID_IROBOT_RAW_WRITER_HPP
+#define ANDROID_IROBOT_RAW_WRITER_HPP
+
+#if defined (__cplusplus)
+extern "C" {
+#endif
+
+#include <unistd.h>
+#include <libavcodec/avcodec.h>
+
+#if defined (__cplusplus)
+}
+#endif
+
+#include <SDL2/SDL_mutex.h>
+
+#include <cstdint>
+#include <cstdio>
+
+#include "config.hpp"
+#include "core/actor.hpp"
+
+// each buffer is written by a single fwrite(), bypassing the stdio buffer
+#define RAW_WRITER_BUFFER_SIZE (4 * 1024 * 1024)
+#define RAW_WRITER_ALIGNMENT 4096
+#define RAW_WRITER_INDEX_ENTRIES 4096
+
+// sidecar index (<file>.idx): an 8-byte header, then one fixed-size entry
+// per packet, so that the entry i is at RAW_INDEX_HEADER_SIZE + i * size
+#define RAW_INDEX_MAGIC "IRIX"
+#define RAW_INDEX_VERSION 1
+#define RAW_INDEX_HEADER_SIZE 8
+// offset in the stream (8), pts (8), flags (4), all big-endian
+#define RAW_INDEX_ENTRY_SIZE 20
+#define RAW_INDEX_FLAG_KEY 1
+#define RAW_INDEX_FLAG_CONFIG 2 // SPS/PPS, no pts
+
+namespace irobot::video {
+
+    struct RawIndexEntry {
+        uint64_t offset;
+        int64_t pts; // AV_NOPTS_VALUE for a config packet
+        uint32_t flags;
+    };
+
+    struct RawBuffer {
+        uint8_t *data; // aligned on RAW_WRITER_ALIGNMENT
+        size_t size;
+        uint8_t *index;
+        size_t index_size;
+    };
+
+    // Append the Annex-B packets to a raw H.264 file, and their index to a
+    // sidecar file, without muxing.
+    //
+    // The caller fills one buffer while the writer thread writes the other
+    // one to disk.
+    class RawWriter : public Actor {
+    public:
+        FILE *file;
+        FILE *index_file;
+        void *allocations[2];
+        struct RawBuffer buffers[2];
+        // the buffer filled by Write(), the other one belongs to the thread
+        // while pending is set
+        int active;
+        // protected by the mutex
+        bool pending;
+        bool failed;
+        SDL_cond *done_cond;
+        uint64_t offset; // bytes appended to the stream
+        uint64_t nr_entries;
+
+        bool Open(const char *filename);
+
+        // append the packet data and its index entry
+        bool Write(const AVPacket *packet);
+
+        // write the buffered data, stop the thread and close the files
+        // return false if any write failed
+        bool Close();
+
+        bool Start() override;
+
+        // return a new allocated "<filename>.idx", to be freed by SDL_free()
+        static char *GetIndexFilename(const char *filename);
+
+        static void WriteIndexHeader(uint8_t *buf);
+
+        static bool ReadIndexHeader(const uint8_t *buf);
+
+        static void WriteIndexEntry(uint8_t *buf, const struct RawIndexEntry *entry);
+
+        static void ReadIndexEntry(const uint8_t *buf, struct RawIndexEntry *entry);
+
+        // binary search of the key frame to start from to play pts: the last
+        // key frame not after pts (or the first one)
+        // return -1 if there is no key frame
+        static ssize_t FindKeyFrame(const struct RawIndexEntry *entries,
+                                    size_t count, int64_t pts);
+
+        static int RunWriter(void *data);
+
+    private:
+        // hand the active buffer to the thread, wait for the previous one
+        bool Submit();
+
+        bool Append(const uint8_t *data, size_t len);
+
+        bool AppendIndexEntry(const struct RawIndexEntry *entry);
+
+        void Release();
+    };
+
+}
+
+#endif //ANDROID_IROBOT_RAW_WRITER_HPP
@@ -6,11 +6,21 @@
 #include "recorder.hpp"
 
 #include <cassert>
+#include <cinttypes>
+
 #include "config.hpp"
 
+#include "util/buffer_util.hpp"
 #include "util/lock.hpp"
 #include "util/log.hpp"
 
+// the spill file may exceed 2GB
+#ifdef _WIN32
+# define fseek64 _fseeki64
+#else
+# define fseek64 fseeko
+#endif
+
 namespace irobot::video {
 
     static const AVRational IROBOT_TIME_BASE = {1, 1000000}; // timestamps in us
@@ -18,7 +28,9 @@ namespace irobot::video {
     bool Recorder::Init(
             const char *filename,
             enum RecordFormat format,
-            struct Size declared_frame_size) {
+            struct Size declared_frame_size,
+            uint64_t pMax_bytes,
+            enum RecordOverflow pOverflow) {
 
         this->filename = SDL_strdup(filename);
         if (!this->filename) {
@@ -41,33 +53,97 @@ namespace irobot::video {
             return false;
         }
 
-        queue_init(&this->queue);
+        this->not_full_cond = SDL_CreateCond();
+        if (!this->not_full_cond) {
+            LOGC("Could not create cond");
+            SDL_DestroyCond(this->thread_cond);
+            SDL_DestroyMutex(this->mutex);
+            SDL_free(this->filename);
+            return false;
+        }
+
+        this->spill_mutex = SDL_CreateMutex();
+        if (!this->spill_mutex) {
+            LOGC("Could not create mutex");
+            SDL_DestroyCond(this->not_full_cond);
+            SDL_DestroyCond(this->thread_cond);
+            SDL_DestroyMutex(this->mutex);
+            SDL_free(this->filename);
+            return false;
+        }
+
+        // allocated once, the packets only reference the stream buffers
+        this->slots = (AVPacket *) SDL_calloc(RECORDER_QUEUE_SLOTS, sizeof(AVPacket));
+        if (!this->slots) {
+            LOGC("Could not allocate recorder queue");
+            SDL_DestroyMutex(this->spill_mutex);
+            SDL_DestroyCond(this->not_full_cond);
+            SDL_DestroyCond(this->thread_cond);
+            SDL_DestroyMutex(this->mutex);
+            SDL_free(this->filename);
+            return false;
+        }
+        for (int i = 0; i < RECORDER_QUEUE_SLOTS; ++i) {
+            av_init_packet(&this->slots[i]);
+        }
+
+        this->head = 0;
+        this->count = 0;
+        this->bytes = 0;
+        this->max_bytes = pMax_bytes;
+        this->overflow = pOverflow;
+        this->dropping = false;
+        this->spill_file = nullptr;
+        this->spill_read = 0;
+        this->spill_write = 0;
+        this->spill_writing = false;
+        this->stats = {};
         this->stopped = false;
         this->failed = false;
         this->format = format;
         this->declared_frame_size = declared_frame_size;
         this->header_written = false;
-        this->previous = nullptr;
+        av_init_packet(&this->previous);
+        this->has_previous = false;
+        this->segment_duration = 0;
+        this->segment_size = 0;
+        this->max_segments = 0;
+        this->codec = nullptr;
+        this->segment_filename = nullptr;
+        this->segment_index = 0;
+        this->segment_start = AV_NOPTS_VALUE;
+        this->config = nullptr;
+        this->config_size = 0;
+        this->finalizer_started = false;
+        this->fragment_duration = 0;
+        this->fragment_start = AV_NOPTS_VALUE;
 
         return true;
     }
 
     void Recorder::Destroy() {
+        this->Clear();
+        SDL_free(this->slots);
+        if (this->spill_file) {
+            fclose(this->spill_file);
+        }
+        SDL_DestroyMutex(this->spill_mutex);
+        SDL_DestroyCond(this->not_full_cond);
+        av_free(this->config);
+        SDL_free(this->segment_filename);
         Actor::Destroy();
         SDL_free(this->filename);
     }
 
-    void Recorder::RecordPacketDelete(struct RecordPacket *rec) {
-        av_packet_unref(&rec->packet);
-        SDL_free(rec);
-    }
-
-    void Recorder::RecorderQueueClear(struct RecordQueue *queue) {
-        while (!queue_is_empty(queue)) {
-            struct RecordPacket *rec;
-            queue_take(queue, next, &rec);
-            RecordPacketDelete(rec);
+    void Recorder::Clear() {
+        while (this->count) {
+            av_packet_unref(&this->slots[this->head]);
+            this->head = (this->head + 1) % RECORDER_QUEUE_SLOTS;
+            --this->count;
         }
+        this->bytes = 0;
+        this->spill_read = 0;
+        this->spill_write = 0;
     }
 
     const char *Recorder::RecorderGetFormatName(enum RecordFormat format) {
@@ -76,27 +152,13 @@ namespace irobot::video {
                 return "mp4";
             case RECORDER_FORMAT_MKV:
                 return "matroska";
+            case RECORDER_FORMAT_RAW:
+                return "raw";
             default:
                 return nullptr;
         }
     }
 
-    RecordPacket *Recorder::RecordPacketNew(const AVPacket *packet) {
-        auto rec = (struct RecordPacket *) SDL_malloc(sizeof(struct RecordPacket));
-        if (!rec) {
-            return nullptr;
-        }
-
-        // av_packet_ref() does not initialize all fields in old FFmpeg versions
-        av_init_packet(&rec->packet);
-
-        if (av_packet_ref(&rec->packet, packet)) {
-            SDL_free(rec);
-            return nullptr;
-        }
-        return rec;
-    }
-
     const AVOutputFormat *Recorder::FindMuxer(const char *name) {
 #ifdef IROBOT_LAVF_HAS_NEW_MUXER_ITERATOR_API
         void *opaque = nullptr;
@@ -113,7 +175,64 @@ namespace irobot::video {
         return oformat;
     }
 
+    bool Recorder::IsSegmented() const {
+        return (this->segment_duration || this->segment_size)
+               && this->format != RECORDER_FORMAT_RAW;
+    }
+
+    bool Recorder::IsFragmented() const {
+        return this->fragment_duration && this->format == RECORDER_FORMAT_MP4;
+    }
+
+    char *Recorder::GetSegmentFilename(const char *filename, int index) {
+        size_t len = strlen(filename);
+        const char *dot = strrchr(filename, '.');
+        const char *slash = strrchr(filename, '/');
+        size_t base_len = dot && (!slash || dot > slash) ? dot - filename : len;
+        // "-" + index (at most 10 digits)
+        auto *segment_filename = (char *) SDL_malloc(len + 12);
+        if (!segment_filename) {
+            return nullptr;
+        }
+        sprintf(segment_filename, "%.*s-%04d%s", (int) base_len, filename,
+                index, filename + base_len);
+        return segment_filename;
+    }
+
     bool Recorder::Open(const AVCodec *input_codec) {
+        this->codec = input_codec;
+        if (this->format == RECORDER_FORMAT_RAW) {
+            if (!this->raw_writer.Open(this->filename)) {
+                return false;
+            }
+            LOGI("Recording started to raw file: %s", this->filename);
+            return true;
+        }
+        if (!this->IsSegmented()) {
+            return this->OpenSegment(this->filename);
+        }
+
+        if (!this->finalizer.Init(this->max_segments)) {
+            return false;
+        }
+        if (!this->finalizer.Start()) {
+            this->finalizer.Destroy();
+            return false;
+        }
+        this->finalizer_started = true;
+
+        this->segment_filename = GetSegmentFilename(this->filename, 0);
+        if (!this->segment_filename || !this->OpenSegment(this->segment_filename)) {
+            this->finalizer.Stop();
+            this->finalizer.Join();
+            this->finalizer.Destroy();
+            this->finalizer_started = false;
+            return false;
+        }
+        return true;
+    }
+
+    bool Recorder::OpenSegment(const char *pFilename) {
 
         const char *format_name = RecorderGetFormatName(this->format);
         assert(format_name);
@@ -139,7 +258,7 @@ namespace irobot::video {
                     "Recorded by irobot "
                     IROBOT_SERVER_VERSION, 0);
 
-        AVStream *ostream = avformat_new_stream(this->ctx, input_codec);
+        AVStream *ostream = avformat_new_stream(this->ctx, this->codec);
         if (!ostream) {
             avformat_free_context(this->ctx);
             return false;
@@ -147,40 +266,66 @@ namespace irobot::video {
 
 
         ostream->codecpar->codec_type = AVMEDIA_TYPE_VIDEO;
-        ostream->codecpar->codec_id = input_codec->id;
+        ostream->codecpar->codec_id = this->codec->id;
         ostream->codecpar->format = AV_PIX_FMT_YUV420P;
         ostream->codecpar->width = this->declared_frame_size.width;
         ostream->codecpar->height = this->declared_frame_size.height;
 
 
-        int ret = avio_open(&this->ctx->pb, this->filename,
+        int ret = avio_open(&this->ctx->pb, pFilename,
                             AVIO_FLAG_WRITE);
         if (ret < 0) {
-            LOGE("Failed to open output file: %s", this->filename);
+            LOGE("Failed to open output file: %s", pFilename);
             // ostream will be cleaned up during context cleaning
             avformat_free_context(this->ctx);
             return false;
         }
 
-        LOGI("Recording started to %s file: %s", format_name, this->filename);
+        if (!this->segment_index) {
+            LOGI("Recording started to %s file: %s", format_name, pFilename);
+        } else {
+            LOGD("Recording segment started: %s", pFilename);
+        }
 
         return true;
     }
 
     void Recorder::Close() {
 
-        if (this->header_written) {
-            int ret = av_write_trailer(this->ctx);
-            if (ret < 0) {
-                LOGE("Failed to write trailer to %s", this->filename);
+        if (this->format == RECORDER_FORMAT_RAW) {
+            if (!this->raw_writer.Close() || !this->header_written) {
                 this->failed = true;
             }
-        } else {
-            // the recorded file is empty
-            this->failed = true;
+        } else if (!this->IsSegmented()) {
+            if (!SegmentFinalizer::Finalize(this->ctx, this->filename,
+                                            this->header_written)) {
+                this->failed = true;
+            }
+        } else if (this->finalizer_started) {
+            if (this->header_written) {
+                // finalized (and retained) with the previous segments
+                struct RecordSegment segment = {this->ctx, this->segment_filename};
+                this->segment_filename = nullptr;
+                this->finalizer.Push(&segment);
+            } else {
+                SegmentFinalizer::Finalize(this->ctx, this->segment_filename, false);
+                this->failed = true;
+            }
+            this->finalizer.Stop();
+            this->finalizer.Join();
+            if (this->finalizer.failed) {
+                this->failed = true;
+            }
+            this->finalizer.Destroy();
+            this->finalizer_started = false;
         }
-        avio_close(this->ctx->pb);
-        avformat_free_context(this->ctx);
+
+        struct RecorderStats queue_stats{};
+        this->GetStats(&queue_stats);
+        LOGI("Recorder queue: max %u packets, %.1f MB, %u blocked, %u dropped, "
+             "%u spilled", queue_stats.max_depth,
+             (double) queue_stats.max_bytes / 1000000, queue_stats.nr_blocked,
+             queue_stats.nr_dropped, queue_stats.nr_spilled);
 
         if (this->failed) {
             LOGE("Recording failed to %s", this->filename);
@@ -191,28 +336,97 @@ namespace irobot::video {
     }
 
     bool Recorder::WriteHeader(const AVPacket *packet) {
+        // keep the config packet for the next segments
+        this->config = static_cast<uint8_t *>(av_malloc(packet->size * sizeof(uint8_t)));
+        if (!this->config) {
+            LOGC("Could not allocate config packet");
+            return false;
+        }
+        memcpy(this->config, packet->data, packet->size);
+        this->config_size = packet->size;
+
+        return this->WriteSegmentHeader(this->segment_filename
+                                        ? this->segment_filename : this->filename);
+    }
+
+    bool Recorder::WriteSegmentHeader(const char *pFilename) {
 
         AVStream *ostream = this->ctx->streams[0];
 
-        auto *extradata = static_cast<uint8_t *>(av_malloc(packet->size * sizeof(uint8_t)));
+        // owned by the stream
+        auto *extradata = static_cast<uint8_t *>(av_malloc(this->config_size * sizeof(uint8_t)));
         if (!extradata) {
             LOGC("Could not allocate extradata");
             return false;
         }
 
         // copy the first packet to the extra data
-        memcpy(extradata, packet->data, packet->size);
+        memcpy(extradata, this->config, this->config_size);
 
         ostream->codecpar->extradata = extradata;
-        ostream->codecpar->extradata_size = packet->size;
+        ostream->codecpar->extradata_size = this->config_size;
 
 
-        int ret = avformat_write_header(this->ctx, nullptr);
+        AVDictionary *options = nullptr;
+        if (this->IsFragmented()) {
+            // the fragments are cut by FlushFragment(), the moov only
+            // describes the stream
+            av_dict_set(&options, "movflags",
+                        "frag_custom+empty_moov+default_base_moof", 0);
+        }
+        int ret = avformat_write_header(this->ctx, &options);
+        av_dict_free(&options);
         if (ret < 0) {
-            LOGE("Failed to write header to %s", this->filename);
+            LOGE("Failed to write header to %s", pFilename);
             return false;
         }
+        if (this->IsFragmented()) {
+            avio_flush(this->ctx->pb);
+        }
+
+        return true;
+    }
+
+    bool Recorder::Rotate() {
+        struct RecordSegment segment = {this->ctx, this->segment_filename};
+
+        char *next_filename = GetSegmentFilename(this->filename, this->segment_index + 1);
+        if (!next_filename) {
+            LOGC("Could not allocate segment filename");
+            return false;
+        }
+        if (!this->OpenSegment(next_filename)) {
+            SDL_free(next_filename);
+            this->ctx = segment.ctx;
+            return false;
+        }
+        if (!this->WriteSegmentHeader(next_filename)) {
+            SegmentFinalizer::Finalize(this->ctx, next_filename, false);
+            SDL_free(next_filename);
+            // keep the previous segment, to be finalized by Close()
+            this->ctx = segment.ctx;
+            return false;
+        }
+
+        ++this->segment_index;
+        this->segment_filename = next_filename;
+        this->segment_start = AV_NOPTS_VALUE;
+        this->fragment_start = AV_NOPTS_VALUE;
+        // the trailer is written on the finalizer thread
+        this->finalizer.Push(&segment);
+        return true;
+    }
 
+    bool Recorder::FlushFragment() {
+        // with frag_custom, a null packet writes the pending samples as a
+        // fragment
+        if (av_write_frame(this->ctx, nullptr) < 0) {
+            LOGE("Could not write fragment to %s", this->segment_filename
+                                                   ? this->segment_filename : this->filename);
+            return false;
+        }
+        // the fragment is complete on disk
+        avio_flush(this->ctx->pb);
         return true;
     }
 
@@ -224,6 +438,12 @@ namespace irobot::video {
 
     bool Recorder::Write(AVPacket *packet) {
 
+        if (this->format == RECORDER_FORMAT_RAW) {
+            // the config packets are kept in the stream, for the decoders
+            this->header_written = true;
+            return this->raw_writer.Write(packet);
+        }
+
         if (!this->header_written) {
             if (packet->pts != AV_NOPTS_VALUE) {
                 LOGE("The first packet is not a config packet");
@@ -242,6 +462,44 @@ namespace irobot::video {
             return true;
         }
 
+        if (this->IsSegmented()) {
+            // a segment starts on a key frame, so that it can be played alone
+            if (this->segment_start != AV_NOPTS_VALUE
+                && (packet->flags & AV_PKT_FLAG_KEY)) {
+                bool elapsed = this->segment_duration
+                               && packet->pts - this->segment_start >= this->segment_duration;
+                bool full = this->segment_size
+                            && (uint64_t) avio_tell(this->ctx->pb) >= this->segment_size;
+                if ((elapsed || full) && !this->Rotate()) {
+                    return false;
+                }
+            }
+            if (this->segment_start == AV_NOPTS_VALUE) {
+                this->segment_start = packet->pts;
+            }
+        }
+
+        if (this->IsFragmented()) {
+            // a fragment starts on a key frame
+            if (this->fragment_start != AV_NOPTS_VALUE
+                && (packet->flags & AV_PKT_FLAG_KEY)
+                && packet->pts - this->fragment_start >= this->fragment_duration) {
+                if (!this->FlushFragment()) {
+                    return false;
+                }
+                this->fragment_start = AV_NOPTS_VALUE;
+            }
+            if (this->fragment_start == AV_NOPTS_VALUE) {
+                this->fragment_start = packet->pts;
+            }
+        }
+
+        if (this->IsSegmented()) {
+            // each segment starts at 0
+            packet->pts -= this->segment_start;
+            packet->dts -= this->segment_start;
+        }
+
         this->RescalePacket(packet);
         return av_write_frame(this->ctx, packet) >= 0;
     }
@@ -250,69 +508,73 @@ namespace irobot::video {
         auto *recorder = static_cast<struct Recorder *>(data);
 
         for (;;) {
+            AVPacket packet;
             util::mutex_lock(recorder->mutex);
 
-            while (!recorder->stopped && queue_is_empty(&recorder->queue)) {
+            bool taken = recorder->Take(&packet);
+            while (!taken && !recorder->stopped && !recorder->failed) {
                 util::cond_wait(recorder->thread_cond, recorder->mutex);
+                taken = recorder->Take(&packet);
             }
 
-            // if stopped is set, continue to process the remaining events (to
+            // if stopped is set, continue to process the remaining packets (to
             // finish the recording) before actually stopping
 
-            if (recorder->stopped && queue_is_empty(&recorder->queue)) {
+            if (!taken) {
+                bool failed = recorder->failed;
                 util::mutex_unlock(recorder->mutex);
-                struct RecordPacket *last = recorder->previous;
-                if (last) {
+                if (recorder->has_previous && !failed) {
                     // assign an arbitrary duration to the last packet
-                    last->packet.duration = 100000;
-                    bool ok = recorder->Write(&last->packet);
+                    recorder->previous.duration = 100000;
+                    bool ok = recorder->Write(&recorder->previous);
                     if (!ok) {
                         // failing to write the last frame is not very serious, no
                         // future frame may depend on it, so the resulting file
                         // will still be valid
                         LOGW("Could not record last packet");
                     }
-                    RecordPacketDelete(last);
                 }
                 break;
             }
 
-            struct RecordPacket *rec;
-            queue_take(&recorder->queue, next, &rec);
-
             util::mutex_unlock(recorder->mutex);
 
             // recorder->previous is only written from this thread, no need to lock
-            struct RecordPacket *previous = recorder->previous;
-            recorder->previous = rec;
-
-            if (!previous) {
+            if (!recorder->has_previous) {
                 // we just received the first packet
+                av_packet_move_ref(&recorder->previous, &packet);
+                recorder->has_previous = true;
                 continue;
             }
 
+            AVPacket *previous = &recorder->previous;
             // config packets have no PTS, we must ignore them
-            if (rec->packet.pts != AV_NOPTS_VALUE
-                && previous->packet.pts != AV_NOPTS_VALUE) {
+            if (packet.pts != AV_NOPTS_VALUE
+                && previous->pts != AV_NOPTS_VALUE) {
                 // we now know the duration of the previous packet
-                previous->packet.duration = rec->packet.pts - previous->packet.pts;
+                previous->duration = packet.pts - previous->pts;
             }
 
-            bool ok = recorder->Write(&previous->packet);
-            RecordPacketDelete(previous);
+            bool ok = recorder->Write(previous);
+            av_packet_unref(previous);
+            av_packet_move_ref(previous, &packet);
             if (!ok) {
                 LOGE("Could not record packet");
 
                 util::mutex_lock(recorder->mutex);
                 recorder->failed = true;
                 // discard pending packets
-                RecorderQueueClear(&recorder->queue);
+                recorder->Clear();
+                // release a blocked Push()
+                util::cond_signal(recorder->not_full_cond);
                 util::mutex_unlock(recorder->mutex);
                 break;
             }
-
         }
 
+        av_packet_unref(&recorder->previous);
+        recorder->has_previous = false;
+
         LOGD("Recorder thread ended");
 
         return 0;
@@ -331,27 +593,210 @@ namespace irobot::video {
     }
 
 
+    bool Recorder::IsFull(const AVPacket *packet) {
+        if (this->count == RECORDER_QUEUE_SLOTS) {
+            return true;
+        }
+        // a single packet larger than the limit is accepted
+        return this->count && this->bytes + packet->size > this->max_bytes;
+    }
+
+    bool Recorder::Enqueue(const AVPacket *packet) {
+        AVPacket *slot = &this->slots[(this->head + this->count) % RECORDER_QUEUE_SLOTS];
+        // the stream packets are refcounted, no copy
+        if (av_packet_ref(slot, packet)) {
+            LOGC("Could not reference record packet");
+            return false;
+        }
+        ++this->count;
+        this->bytes += packet->size;
+        if ((unsigned) this->count > this->stats.max_depth) {
+            this->stats.max_depth = this->count;
+        }
+        if (this->bytes > this->stats.max_bytes) {
+            this->stats.max_bytes = this->bytes;
+        }
+        return true;
+    }
+
+    // spilled packet: pts (8) dts (8) flags (4) size (4) data
+#define SPILL_HEADER_SIZE 24
+
+    bool Recorder::Spill(const AVPacket *packet) {
+        if (!this->spill_file) {
+            this->spill_file = tmpfile();
+            if (!this->spill_file) {
+                LOGE("Could not create recorder spill file");
+                return false;
+            }
+        }
+        if (this->spill_read == this->spill_write) {
+            LOGW("Recorder queue full, spilling packets to disk");
+        }
+        // only readable once written: Push() is not reentered meanwhile,
+        // and the file is not rewound
+        uint64_t offset = this->spill_write;
+        this->spill_writing = true;
+        util::mutex_unlock(this->mutex);
+
+        uint8_t header[SPILL_HEADER_SIZE];
+        util::buffer_write64be(header, (uint64_t) packet->pts);
+        util::buffer_write64be(&header[8], (uint64_t) packet->dts);
+        util::buffer_write32be(&header[16], (uint32_t) packet->flags);
+        util::buffer_write32be(&header[20], (uint32_t) packet->size);
+        util::mutex_lock(this->spill_mutex);
+        bool ok = !fseek64(this->spill_file, (int64_t) offset, SEEK_SET)
+                  && fwrite(header, 1, SPILL_HEADER_SIZE, this->spill_file) == SPILL_HEADER_SIZE
+                  && fwrite(packet->data, 1, packet->size, this->spill_file)
+                     == (size_t) packet->size;
+        util::mutex_unlock(this->spill_mutex);
+
+        util::mutex_lock(this->mutex);
+        this->spill_writing = false;
+        if (!ok) {
+            LOGE("Could not spill packet");
+            return false;
+        }
+        if (!this->failed) {
+            // else the pending packets are discarded
+            this->spill_write = offset + SPILL_HEADER_SIZE + packet->size;
+            ++this->stats.nr_spilled;
+        }
+        return true;
+    }
+
+    bool Recorder::Unspill(AVPacket *packet) {
+        // only the recorder thread reads, spill_read does not change meanwhile
+        uint64_t offset = this->spill_read;
+        util::mutex_unlock(this->mutex);
+
+        uint8_t header[SPILL_HEADER_SIZE];
+        uint32_t size = 0;
+        util::mutex_lock(this->spill_mutex);
+        fflush(this->spill_file);
+        bool ok = !fseek64(this->spill_file, (int64_t) offset, SEEK_SET)
+                  && fread(header, 1, SPILL_HEADER_SIZE, this->spill_file) == SPILL_HEADER_SIZE;
+        if (ok) {
+            size = util::buffer_read32be(&header[20]);
+            ok = !av_new_packet(packet, (int) size);
+            if (ok && fread(packet->data, 1, size, this->spill_file) != size) {
+                av_packet_unref(packet);
+                ok = false;
+            }
+        }
+        util::mutex_unlock(this->spill_mutex);
+
+        util::mutex_lock(this->mutex);
+        if (!ok) {
+            LOGE("Could not read spilled packet");
+            return false;
+        }
+        packet->pts = (int64_t) util::buffer_read64be(header);
+        packet->dts = (int64_t) util::buffer_read64be(&header[8]);
+        packet->flags = (int) util::buffer_read32be(&header[16]);
+
+        this->spill_read = offset + SPILL_HEADER_SIZE + size;
+        if (this->spill_read == this->spill_write && !this->spill_writing) {
+            // drained, reuse the file from the start
+            this->spill_read = 0;
+            this->spill_write = 0;
+        }
+        return true;
+    }
+
+    bool Recorder::Take(AVPacket *packet) {
+        if (this->count) {
+            AVPacket *slot = &this->slots[this->head];
+            this->bytes -= slot->size;
+            av_packet_move_ref(packet, slot);
+            this->head = (this->head + 1) % RECORDER_QUEUE_SLOTS;
+            --this->count;
+            util::cond_signal(this->not_full_cond);
+            return true;
+        }
+        if (this->spill_read < this->spill_write) {
+            if (!this->Unspill(packet)) {
+                this->failed = true;
+                util::cond_signal(this->not_full_cond);
+                return false;
+            }
+            return true;
+        }
+        return false;
+    }
+
     bool Recorder::Push(const AVPacket *packet) {
 
         util::mutex_lock(this->mutex);
         assert(!this->stopped);
 
+        bool ok = false;
+        // config packets are kept with the key frames
+        bool key = packet->pts == AV_NOPTS_VALUE || (packet->flags & AV_PKT_FLAG_KEY);
+
         if (this->failed) {
             // reject any new packet (this will stop the stream)
-            return false;
+            goto end;
         }
 
-        struct RecordPacket *rec = RecordPacketNew(packet);
-        if (!rec) {
-            LOGC("Could not allocate record packet");
-            return false;
+        if (this->spill_read < this->spill_write) {
+            // keep the order: the spilled packets are older than the next ones
+            ok = this->Spill(packet);
+            goto signal;
+        }
+
+        if (this->dropping && !key) {
+            ++this->stats.nr_dropped;
+            ok = true;
+            goto end;
         }
 
-        queue_push(&this->queue, next, rec);
+        if (this->IsFull(packet)) {
+            switch (this->overflow) {
+                case RECORDER_OVERFLOW_BLOCK:
+                    ++this->stats.nr_blocked;
+                    while (this->IsFull(packet) && !this->failed) {
+                        util::cond_wait(this->not_full_cond, this->mutex);
+                    }
+                    if (this->failed) {
+                        goto end;
+                    }
+                    break;
+                case RECORDER_OVERFLOW_DROP:
+                    if (!this->dropping) {
+                        LOGW("Recorder queue full, dropping packets until the "
+                             "next key frame");
+                        this->dropping = true;
+                    }
+                    ++this->stats.nr_dropped;
+                    ok = true;
+                    goto end;
+                case RECORDER_OVERFLOW_SPILL:
+                    ok = this->Spill(packet);
+                    goto signal;
+            }
+        }
+
+        ok = this->Enqueue(packet);
+        if (!ok) {
+            goto end;
+        }
+        this->dropping = false;
+
+        signal:
         util::cond_signal(this->thread_cond);
+        end:
+        util::mutex_unlock(this->mutex);
+        return ok;
+    }
 
+    void Recorder::GetStats(struct RecorderStats *pStats) {
+        util::mutex_lock(this->mutex);
+        *pStats = this->stats;
+        pStats->depth = this->count;
+        pStats->bytes = this->bytes;
+        pStats->spill_bytes = this->spill_write - this->spill_read;
         util::mutex_unlock(this->mutex);
-        return true;
     }
 
-}
\ No newline at end of file
+}
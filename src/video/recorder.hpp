@@ -16,24 +16,48 @@ extern "C" {
 }
 #endif
 
+#include <cstdio>
+
 #include "config.hpp"
 #include "core/common.hpp"
 #include "core/actor.hpp"
-#include "util/queue.hpp"
+#include "video/raw_writer.hpp"
+#include "video/segment_finalizer.hpp"
+
+// 10 seconds at 60 fps
+#define RECORDER_QUEUE_SLOTS 600
+#define RECORDER_DEFAULT_MAX_BYTES (64 * 1000000)
 
 namespace irobot::video {
     enum RecordFormat {
         RECORDER_FORMAT_AUTO,
         RECORDER_FORMAT_MP4,
         RECORDER_FORMAT_MKV,
+        // Annex-B H.264 and a sidecar index, not muxed
+        RECORDER_FORMAT_RAW,
     };
 
-    struct RecordPacket {
-        AVPacket packet;
-        struct RecordPacket *next;
+    // what Push() does when the queue is full (slots or bytes)
+    enum RecordOverflow {
+        // wait for the recorder thread (the stream stalls)
+        RECORDER_OVERFLOW_BLOCK,
+        // drop the packets until the next key frame
+        RECORDER_OVERFLOW_DROP,
+        // write the packets to a temporary file, read back once the queue
+        // is drained
+        RECORDER_OVERFLOW_SPILL,
     };
 
-    struct RecordQueue QUEUE(struct RecordPacket);
+    struct RecorderStats {
+        unsigned depth;        // packets in the queue
+        unsigned max_depth;
+        uint64_t bytes;        // bytes in the queue
+        uint64_t max_bytes;
+        unsigned nr_blocked;   // pushes which waited for a slot
+        unsigned nr_dropped;
+        unsigned nr_spilled;
+        uint64_t spill_bytes;  // bytes in the spill file, not read yet
+    };
 
     class Recorder : public Actor {
     public:
@@ -45,16 +69,60 @@ namespace irobot::video {
         bool header_written;
 
         bool failed; // set on packet write failure
-        struct RecordQueue queue;
+
+        // preallocated ring of packets, protected by the mutex
+        AVPacket *slots;
+        int head; // index of the oldest packet
+        int count;
+        uint64_t bytes; // sum of the sizes of the queued packets
+        uint64_t max_bytes;
+        enum RecordOverflow overflow;
+        SDL_cond *not_full_cond; // for RECORDER_OVERFLOW_BLOCK
+        bool dropping; // waiting for a key frame
+        // packets are spilled (in order) while spill_read < spill_write
+        // the file is read and written out of the mutex, under spill_mutex
+        FILE *spill_file;
+        SDL_mutex *spill_mutex;
+        uint64_t spill_read;
+        uint64_t spill_write;
+        bool spill_writing; // a packet is written after spill_write
+        struct RecorderStats stats;
 
         // we can write a packet only once we received the next one so that we can
         // set its duration (next_pts - current_pts)
         // "previous" is only accessed from the recorder thread, so it does not
         // need to be protected by the mutex
-        struct RecordPacket *previous;
+        AVPacket previous;
+        bool has_previous;
+
+        // segmented recording, rotated at the first key frame after one of
+        // the limits (0 for none), to be set after Init()
+        int64_t segment_duration; // us
+        uint64_t segment_size; // bytes
+        int max_segments; // the oldest are deleted, 0 to keep all
+        const AVCodec *codec;
+        char *segment_filename; // current segment
+        int segment_index;
+        int64_t segment_start; // first pts of the current segment
+        // the config packet, written as extradata of each segment
+        uint8_t *config;
+        int config_size;
+        SegmentFinalizer finalizer;
+        bool finalizer_started;
+
+        // fragmented MP4 (0 for a plain MP4), to be set after Init(): the
+        // samples are flushed as a fragment at the first key frame after
+        // fragment_duration, so that a killed recording stays readable and
+        // the muxer does not keep the index of the whole session
+        int64_t fragment_duration; // us
+        int64_t fragment_start; // first pts of the current fragment
+
+        // for RECORDER_FORMAT_RAW, instead of ctx
+        RawWriter raw_writer;
 
         bool Init(const char *filename,
-                  enum RecordFormat format, struct Size declared_frame_size);
+                  enum RecordFormat format, struct Size declared_frame_size,
+                  uint64_t max_bytes, enum RecordOverflow overflow);
 
         void Destroy() override;
 
@@ -64,17 +132,26 @@ namespace irobot::video {
 
         bool Start() override;
 
+        // from a single thread (the stream)
         bool Push(const AVPacket *packet);
 
+        // take the oldest packet (from the queue, then from the spill file)
+        // return false if there is none
+        // the mutex must be locked, it is released while a spilled packet is
+        // read
+        bool Take(AVPacket *packet);
+
         bool Write(AVPacket *packet);
 
-        static const AVOutputFormat *FindMuxer(const char *name);
+        void GetStats(struct RecorderStats *stats);
 
-        static RecordPacket *RecordPacketNew(const AVPacket *packet);
+        bool IsSegmented() const;
 
-        static void RecordPacketDelete(struct RecordPacket *rec);
+        static const AVOutputFormat *FindMuxer(const char *name);
 
-        static void RecorderQueueClear(struct RecordQueue *queue);
+        // insert "-<index>" before the extension of filename
+        // return the new allocated string, to be freed by SDL_free()
+        static char *GetSegmentFilename(const char *filename, int index);
 
         static const char *RecorderGetFormatName(enum RecordFormat format);
 
@@ -82,8 +159,29 @@ namespace irobot::video {
 
     private:
 
+        bool IsFull(const AVPacket *packet);
+
+        bool Enqueue(const AVPacket *packet);
+
+        // the mutex must be locked, it is released during the I/O
+        bool Spill(const AVPacket *packet);
+
+        bool Unspill(AVPacket *packet);
+
+        void Clear();
+
+        bool OpenSegment(const char *filename);
+
         bool WriteHeader(const AVPacket *packet);
 
+        bool WriteSegmentHeader(const char *filename);
+
+        bool Rotate();
+
+        bool IsFragmented() const;
+
+        bool FlushFragment();
+
         void RescalePacket(AVPacket *packet);
 
     };
@@ -0,0 +1,370 @@
+//
+// Created by James Shen on 17/10/26.
+// Copyright (c) 2020 GUIDEBEE IT. All rights reserved
+//
+
+#include "replay_buffer.hpp"
+
+#include "util/lock.hpp"
+#include "util/log.hpp"
+
+namespace irobot::video {
+
+    static const AVRational IROBOT_TIME_BASE = {1, 1000000}; // timestamps in us
+
+    bool ReplayBuffer::Init(struct Size pDeclared_frame_size, int64_t pDuration,
+                            uint64_t pMax_bytes) {
+        if (!Actor::Init()) {
+            return false;
+        }
+        this->slots = (AVPacket *) SDL_calloc(REPLAY_INITIAL_SLOTS, sizeof(AVPacket));
+        if (!this->slots) {
+            LOGC("Could not allocate replay buffer");
+            Actor::Destroy();
+            return false;
+        }
+        this->capacity = REPLAY_INITIAL_SLOTS;
+        this->head = 0;
+        this->count = 0;
+        this->next_key = -1;
+        this->bytes = 0;
+        this->config = nullptr;
+        this->config_size = 0;
+        this->codec = nullptr;
+        this->declared_frame_size = pDeclared_frame_size;
+        this->duration = pDuration;
+        this->max_bytes = pMax_bytes;
+        cbuf_init(&this->clips);
+        this->stats = {};
+        return true;
+    }
+
+    void ReplayBuffer::Destroy() {
+        struct ReplayClip clip{};
+        // not saved if the thread was not started
+        while (cbuf_take(&this->clips, &clip)) {
+            DestroyClip(&clip);
+        }
+        this->Clear();
+        SDL_free(this->slots);
+        av_free(this->config);
+        Actor::Destroy();
+    }
+
+    void ReplayBuffer::Open(const AVCodec *input_codec) {
+        this->codec = input_codec;
+    }
+
+    AVPacket *ReplayBuffer::GetPacket(int index) {
+        return &this->slots[(this->head + index) % this->capacity];
+    }
+
+    uint64_t ReplayBuffer::GetPacketBytes(const AVPacket *packet) {
+        // a pooled buffer may be larger than the packet
+        return packet->buf ? packet->buf->size : packet->size;
+    }
+
+    bool ReplayBuffer::Grow() {
+        int new_capacity = this->capacity * 2;
+        auto *new_slots = (AVPacket *) SDL_calloc(new_capacity, sizeof(AVPacket));
+        if (!new_slots) {
+            LOGC("Could not grow replay buffer");
+            return false;
+        }
+        for (int i = 0; i < this->count; ++i) {
+            // the packets are moved, the references are kept
+            new_slots[i] = *this->GetPacket(i);
+        }
+        SDL_free(this->slots);
+        this->slots = new_slots;
+        this->capacity = new_capacity;
+        this->head = 0;
+        return true;
+    }
+
+    int ReplayBuffer::FindNextKeyFrame() {
+        for (int i = 1; i < this->count; ++i) {
+            if (this->GetPacket(i)->flags & AV_PKT_FLAG_KEY) {
+                return i;
+            }
+        }
+        return -1;
+    }
+
+    void ReplayBuffer::DropHead(int n) {
+        for (int i = 0; i < n; ++i) {
+            AVPacket *packet = this->GetPacket(0);
+            this->bytes -= GetPacketBytes(packet);
+            av_packet_unref(packet);
+            this->head = (this->head + 1) % this->capacity;
+            --this->count;
+        }
+        this->next_key = this->FindNextKeyFrame();
+    }
+
+    void ReplayBuffer::Clear() {
+        this->DropHead(this->count);
+    }
+
+    void ReplayBuffer::Trim() {
+        int64_t last_pts = this->GetPacket(this->count - 1)->pts;
+        // drop the first GOP while the next one still covers the duration
+        // (or while over the size limit)
+        while (this->next_key != -1) {
+            bool expired = last_pts - this->GetPacket(this->next_key)->pts >= this->duration;
+            bool full = this->bytes > this->max_bytes;
+            if (!expired && !full) {
+                break;
+            }
+            if (!expired) {
+                this->stats.nr_evicted += this->next_key;
+            }
+            this->DropHead(this->next_key);
+        }
+        if (this->bytes > this->max_bytes) {
+            // a single GOP does not fit, start again at the next key frame
+            LOGW("Replay buffer too small for the key frame interval");
+            this->stats.nr_evicted += this->count;
+            this->Clear();
+        }
+    }
+
+    bool ReplayBuffer::Push(const AVPacket *packet) {
+        util::mutex_lock(this->mutex);
+
+        if (packet->pts == AV_NOPTS_VALUE) {
+            // the previous packets cannot be decoded with a new config
+            this->Clear();
+            av_free(this->config);
+            this->config = (uint8_t *) av_malloc(packet->size);
+            if (!this->config) {
+                LOGC("Could not allocate replay config packet");
+                this->config_size = 0;
+                util::mutex_unlock(this->mutex);
+                return false;
+            }
+            memcpy(this->config, packet->data, packet->size);
+            this->config_size = packet->size;
+            util::mutex_unlock(this->mutex);
+            return true;
+        }
+
+        bool key = packet->flags & AV_PKT_FLAG_KEY;
+        if (!this->config || (!this->count && !key)) {
+            // the buffer starts on a key frame
+            util::mutex_unlock(this->mutex);
+            return true;
+        }
+
+        if (this->count == this->capacity && !this->Grow()) {
+            util::mutex_unlock(this->mutex);
+            return false;
+        }
+
+        AVPacket *slot = this->GetPacket(this->count);
+        if (av_packet_ref(slot, packet)) {
+            LOGE("Could not reference packet");
+            util::mutex_unlock(this->mutex);
+            return false;
+        }
+        slot->dts = slot->pts;
+        if (key && this->count && this->next_key == -1) {
+            this->next_key = this->count;
+        }
+        ++this->count;
+        this->bytes += GetPacketBytes(slot);
+        this->Trim();
+
+        util::mutex_unlock(this->mutex);
+        return true;
+    }
+
+    void ReplayBuffer::DestroyClip(struct ReplayClip *clip) {
+        for (int i = 0; i < clip->count; ++i) {
+            av_packet_unref(&clip->packets[i]);
+        }
+        SDL_free(clip->packets);
+        av_free(clip->config);
+        SDL_free(clip->filename);
+    }
+
+    bool ReplayBuffer::Save(const char *filename) {
+        util::mutex_lock(this->mutex);
+        if (this->stopped || !this->count) {
+            util::mutex_unlock(this->mutex);
+            LOGW("Replay buffer empty, nothing to save");
+            return false;
+        }
+        if (cbuf_is_full(&this->clips)) {
+            util::mutex_unlock(this->mutex);
+            LOGW("Too many replays being saved, %s dropped", filename);
+            return false;
+        }
+
+        struct ReplayClip clip{};
+        clip.packets = (AVPacket *) SDL_calloc(this->count, sizeof(AVPacket));
+        clip.config = (uint8_t *) av_malloc(this->config_size);
+        clip.filename = SDL_strdup(filename);
+        bool ok = clip.packets && clip.config && clip.filename;
+        if (ok) {
+            memcpy(clip.config, this->config, this->config_size);
+            clip.config_size = this->config_size;
+            // only the references are copied
+            for (; clip.count < this->count; ++clip.count) {
+                if (av_packet_ref(&clip.packets[clip.count],
+                                  this->GetPacket(clip.count))) {
+                    ok = false;
+                    break;
+                }
+            }
+        }
+        if (!ok) {
+            util::mutex_unlock(this->mutex);
+            LOGC("Could not snapshot replay buffer");
+            DestroyClip(&clip);
+            return false;
+        }
+
+        cbuf_push(&this->clips, clip);
+        util::cond_signal(this->thread_cond);
+        util::mutex_unlock(this->mutex);
+        return true;
+    }
+
+    bool ReplayBuffer::Mux(struct ReplayClip *clip) {
+        const AVOutputFormat *format = av_guess_format(nullptr, clip->filename, nullptr);
+        if (!format) {
+            format = av_guess_format("mp4", nullptr, nullptr);
+        }
+        if (!format) {
+            LOGE("Could not find muxer");
+            return false;
+        }
+
+        AVFormatContext *ctx = avformat_alloc_context();
+        if (!ctx) {
+            LOGE("Could not allocate output context");
+            return false;
+        }
+        // see Recorder::OpenSegment()
+        ctx->oformat = (AVOutputFormat *) format;
+
+        av_dict_set(&ctx->metadata, "comment",
+                    "Recorded by irobot "
+                    IROBOT_SERVER_VERSION, 0);
+
+        bool ok = false;
+        bool header_written = false;
+        AVStream *ostream = avformat_new_stream(ctx, this->codec);
+        if (!ostream) {
+            goto finally_free_context;
+        }
+        ostream->codecpar->codec_type = AVMEDIA_TYPE_VIDEO;
+        ostream->codecpar->codec_id = this->codec->id;
+        ostream->codecpar->format = AV_PIX_FMT_YUV420P;
+        ostream->codecpar->width = this->declared_frame_size.width;
+        ostream->codecpar->height = this->declared_frame_size.height;
+
+        // owned by the stream
+        ostream->codecpar->extradata = clip->config;
+        ostream->codecpar->extradata_size = clip->config_size;
+        clip->config = nullptr;
+
+        if (avio_open(&ctx->pb, clip->filename, AVIO_FLAG_WRITE) < 0) {
+            LOGE("Failed to open output file: %s", clip->filename);
+            goto finally_free_context;
+        }
+
+        if (avformat_write_header(ctx, nullptr) < 0) {
+            LOGE("Failed to write header to %s", clip->filename);
+            goto finally_close;
+        }
+        header_written = true;
+
+        {
+            // the replay starts at 0
+            int64_t start = clip->packets[0].pts;
+            int64_t end = clip->packets[clip->count - 1].pts;
+            ok = true;
+            for (int i = 0; i < clip->count; ++i) {
+                AVPacket *packet = &clip->packets[i];
+                if (i + 1 < clip->count) {
+                    packet->duration = clip->packets[i + 1].pts - packet->pts;
+                }
+                packet->pts -= start;
+                packet->dts = packet->pts;
+                av_packet_rescale_ts(packet, IROBOT_TIME_BASE, ostream->time_base);
+                if (av_write_frame(ctx, packet) < 0) {
+                    LOGE("Could not write replay packet");
+                    ok = false;
+                    break;
+                }
+            }
+            if (ok) {
+                LOGI("Replay saved to %s: %d packets, %.1f s", clip->filename,
+                     clip->count, (double) (end - start) / 1000000);
+            }
+        }
+
+        finally_close:
+        if (header_written && av_write_trailer(ctx) < 0) {
+            LOGE("Failed to write trailer to %s", clip->filename);
+            ok = false;
+        }
+        avio_close(ctx->pb);
+        finally_free_context:
+        avformat_free_context(ctx);
+        return ok;
+    }
+
+    int ReplayBuffer::RunReplay(void *data) {
+        auto *replay = static_cast<ReplayBuffer *>(data);
+
+        for (;;) {
+            util::mutex_lock(replay->mutex);
+            while (!replay->stopped && cbuf_is_empty(&replay->clips)) {
+                util::cond_wait(replay->thread_cond, replay->mutex);
+            }
+            struct ReplayClip clip{};
+            // save the pending clips before stopping
+            bool ok = cbuf_take(&replay->clips, &clip);
+            util::mutex_unlock(replay->mutex);
+            if (!ok) {
+                // stopped
+                break;
+            }
+            if (replay->Mux(&clip)) {
+                util::mutex_lock(replay->mutex);
+                ++replay->stats.nr_saved;
+                util::mutex_unlock(replay->mutex);
+            }
+            DestroyClip(&clip);
+        }
+
+        LOGD("Replay thread ended");
+        return 0;
+    }
+
+    bool ReplayBuffer::Start() {
+        LOGD("Starting replay thread");
+
+        this->thread = SDL_CreateThread(RunReplay, "replay", this);
+        if (!this->thread) {
+            LOGC("Could not start replay thread");
+            return false;
+        }
+        return true;
+    }
+
+    void ReplayBuffer::GetStats(struct ReplayStats *pStats) {
+        util::mutex_lock(this->mutex);
+        *pStats = this->stats;
+        pStats->depth = this->count;
+        pStats->bytes = this->bytes;
+        pStats->duration = this->count
+                           ? this->GetPacket(this->count - 1)->pts - this->GetPacket(0)->pts
+                           : 0;
+        util::mutex_unlock(this->mutex);
+    }
+
+}
@@ -0,0 +1,121 @@
+//
+// Created by James Shen on 17/10/26.
+// Copyright (c) 2020 GUIDEBEE IT. All rights reserved
+//
+
+#ifndef ANDROID_IROBOT_REPLAY_BUFFER_HPP
+#define ANDROID_IROBOT_REPLAY_BUFFER_HPP
+
+#if defined (__cplusplus)
+extern "C" {
+#endif
+
+#include <libavformat/avformat.h>
+
+#if defined (__cplusplus)
+}
+#endif
+
+#include "config.hpp"
+#include "core/common.hpp"
+#include "core/actor.hpp"
+#include "util/cbuf.hpp"
+
+#define REPLAY_DEFAULT_MAX_BYTES (32 * 1000000)
+#define REPLAY_INITIAL_SLOTS 256
+
+namespace irobot::video {
+
+    // a snapshot of the buffer, to be muxed to a file
+    struct ReplayClip {
+        AVPacket *packets; // references to the buffered packets
+        int count;
+        uint8_t *config; // owned, to be freed by av_free()
+        int config_size;
+        char *filename; // owned, to be freed by SDL_free()
+    };
+
+    struct ReplayClipQueue CBUF(struct ReplayClip, 4);
+
+    struct ReplayStats {
+        unsigned depth;     // packets in the buffer
+        uint64_t bytes;     // memory held by these packets
+        int64_t duration;   // us, from the first (key) frame to the last
+        unsigned nr_saved;
+        unsigned nr_evicted; // packets evicted by the size limit
+    };
+
+    // Keep the last encoded packets in memory ("instant replay"), so that
+    // the moments before a failure can be saved without recording all the
+    // time.
+    //
+    // The buffer holds references to the packets of the stream (no copy),
+    // always starts on a key frame, and keeps at least the last duration
+    // (if max_bytes allows it). The memory is bounded by max_bytes, counted
+    // on the underlying buffers. Save() snapshots the buffer and muxes it on
+    // a background thread.
+    class ReplayBuffer : public Actor {
+    public:
+        struct Size declared_frame_size;
+        int64_t duration; // us
+        uint64_t max_bytes;
+        const AVCodec *codec; // set by Open()
+
+        // ring of packets, protected by the mutex
+        AVPacket *slots;
+        int capacity;
+        int head; // index of the oldest packet, a key frame
+        int count;
+        int next_key; // index of the second key frame, -1 if none
+        uint64_t bytes;
+        // the last config packet, written as extradata
+        uint8_t *config;
+        int config_size;
+        struct ReplayClipQueue clips;
+        struct ReplayStats stats;
+
+        bool Init(struct Size declared_frame_size, int64_t duration,
+                  uint64_t max_bytes);
+
+        void Destroy() override;
+
+        void Open(const AVCodec *input_codec);
+
+        bool Start() override;
+
+        // add a reference to the packet (config or frame)
+        bool Push(const AVPacket *packet);
+
+        // mux the current content of the buffer to filename, asynchronously
+        // return false if there is nothing to save or if the save queue is full
+        bool Save(const char *filename);
+
+        void GetStats(struct ReplayStats *stats);
+
+        static int RunReplay(void *data);
+
+    private:
+        AVPacket *GetPacket(int index);
+
+        bool Grow();
+
+        // release the first n packets
+        void DropHead(int n);
+
+        // index of the first key frame after the head, -1 if none
+        int FindNextKeyFrame();
+
+        void Trim();
+
+        void Clear();
+
+        static uint64_t GetPacketBytes(const AVPacket *packet);
+
+        bool Mux(struct ReplayClip *clip);
+
+        static void DestroyClip(struct ReplayClip *clip);
+    };
+
+}
+
+#endif //ANDROID_IROBOT_REPLAY_BUFFER_HPP
@@ -0,0 +1,145 @@
+//
+// Created by James Shen on 17/10/26.
+// Copyright (c) 2020 GUIDEBEE IT. All rights reserved
+//
+
+#include "segment_finalizer.hpp"
+
+#include <cstdio>
+
+#include "util/lock.hpp"
+#include "util/log.hpp"
+
+namespace irobot::video {
+
+    bool SegmentFinalizer::Init(int pMax_segments) {
+        if (!Actor::Init()) {
+            return false;
+        }
+        this->retained = nullptr;
+        if (pMax_segments) {
+            this->retained = (char **) SDL_calloc(pMax_segments, sizeof(char *));
+            if (!this->retained) {
+                LOGC("Could not allocate retained segments");
+                Actor::Destroy();
+                return false;
+            }
+        }
+        cbuf_init(&this->queue);
+        this->max_segments = pMax_segments;
+        this->nr_retained = 0;
+        this->failed = false;
+        return true;
+    }
+
+    void SegmentFinalizer::Destroy() {
+        for (int i = 0; i < this->nr_retained; ++i) {
+            SDL_free(this->retained[i]);
+        }
+        SDL_free(this->retained);
+        Actor::Destroy();
+    }
+
+    bool SegmentFinalizer::Finalize(AVFormatContext *ctx, const char *filename,
+                                    bool header_written) {
+        bool ok = true;
+        if (header_written) {
+            if (av_write_trailer(ctx) < 0) {
+                LOGE("Failed to write trailer to %s", filename);
+                ok = false;
+            }
+        } else {
+            // the recorded file is empty
+            ok = false;
+        }
+        avio_close(ctx->pb);
+        avformat_free_context(ctx);
+        return ok;
+    }
+
+    void SegmentFinalizer::Retain(char *filename) {
+        if (!this->max_segments) {
+            SDL_free(filename);
+            return;
+        }
+        if (this->nr_retained == this->max_segments) {
+            char *oldest = this->retained[0];
+            if (remove(oldest)) {
+                LOGW("Could not delete segment %s", oldest);
+            } else {
+                LOGD("Deleted segment %s", oldest);
+            }
+            SDL_free(oldest);
+            --this->nr_retained;
+            memmove(this->retained, &this->retained[1],
+                    this->nr_retained * sizeof(char *));
+        }
+        this->retained[this->nr_retained++] = filename;
+    }
+
+    void SegmentFinalizer::Process(struct RecordSegment *segment) {
+        // a rotated segment always has its header
+        if (Finalize(segment->ctx, segment->filename, true)) {
+            LOGI("Recording segment complete: %s", segment->filename);
+        } else {
+            util::mutex_lock(this->mutex);
+            this->failed = true;
+            util::mutex_unlock(this->mutex);
+        }
+        this->Retain(segment->filename);
+    }
+
+    void SegmentFinalizer::Push(struct RecordSegment *segment) {
+        util::mutex_lock(this->mutex);
+        if (cbuf_is_full(&this->queue)) {
+            LOGW("Segment finalizer late, waiting");
+            do {
+                // the thread never waits while the queue is not empty, so
+                // thread_cond is only signaled to us
+                util::cond_wait(this->thread_cond, this->mutex);
+            } while (cbuf_is_full(&this->queue));
+        }
+        cbuf_push(&this->queue, *segment);
+        util::cond_signal(this->thread_cond);
+        util::mutex_unlock(this->mutex);
+    }
+
+    int SegmentFinalizer::RunFinalizer(void *data) {
+        auto *finalizer = static_cast<SegmentFinalizer *>(data);
+
+        for (;;) {
+            util::mutex_lock(finalizer->mutex);
+            while (!finalizer->stopped && cbuf_is_empty(&finalizer->queue)) {
+                util::cond_wait(finalizer->thread_cond, finalizer->mutex);
+            }
+            struct RecordSegment segment{};
+            // finalize the pending segments before stopping
+            bool ok = cbuf_take(&finalizer->queue, &segment);
+            if (ok) {
+                // release a Push() waiting for room
+                util::cond_signal(finalizer->thread_cond);
+            }
+            util::mutex_unlock(finalizer->mutex);
+            if (!ok) {
+                // stopped
+                break;
+            }
+            finalizer->Process(&segment);
+        }
+
+        LOGD("Segment finalizer thread ended");
+        return 0;
+    }
+
+    bool SegmentFinalizer::Start() {
+        LOGD("Starting segment finalizer thread");
+
+        this->thread = SDL_CreateThread(RunFinalizer, "segment_finalizer", this);
+        if (!this->thread) {
+            LOGC("Could not start segment finalizer thread");
+            return false;
+        }
+        return true;
+    }
+
+}
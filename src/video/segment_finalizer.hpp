@@ -0,0 +1,68 @@
+//
+// Created by James Shen on 17/10/26.
+// Copyright (c) 2020 GUIDEBEE IT. All rights reserved
+//
+
+#ifndef ANDROID_IROBOT_SEGMENT_FINALIZER_HPP
+#define ANDROID_IROBOT_SEGMENT_FINALIZER_HPP
+
+#if defined (__cplusplus)
+extern "C" {
+#endif
+
+#include <libavformat/avformat.h>
+
+#if defined (__cplusplus)
+}
+#endif
+
+#include "config.hpp"
+#include "core/actor.hpp"
+#include "util/cbuf.hpp"
+
+namespace irobot::video {
+
+    struct RecordSegment {
+        AVFormatContext *ctx;
+        char *filename; // owned, to be freed by SDL_free()
+    };
+
+    struct RecordSegmentQueue CBUF(struct RecordSegment, 8);
+
+    // Write the trailer and close the rotated recording segments on a
+    // background thread, so that the rotation does not stall the recorder.
+    // Once finalized, the oldest segments beyond max_segments are deleted.
+    class SegmentFinalizer : public Actor {
+    public:
+        struct RecordSegmentQueue queue;
+        // 0 to keep all the segments
+        int max_segments;
+        // the retained segment filenames, oldest first (thread only)
+        char **retained;
+        int nr_retained;
+        bool failed; // set if a segment could not be finalized
+
+        bool Init(int max_segments);
+
+        void Destroy() override;
+
+        bool Start() override;
+
+        // take the ownership of the segment, wait if the queue is full
+        void Push(struct RecordSegment *segment);
+
+        // write the trailer (if the header has been written) and close
+        static bool Finalize(AVFormatContext *ctx, const char *filename,
+                             bool header_written);
+
+        static int RunFinalizer(void *data);
+
+    private:
+        void Process(struct RecordSegment *segment);
+
+        void Retain(char *filename);
+    };
+
+}
+
+#endif //ANDROID_IROBOT_SEGMENT_FINALIZER_HPP
@@ -6,54 +6,96 @@
 #include "stream.hpp"
 #include "recorder.hpp"
 #include "ui/events.hpp"
-#include "util/buffer_util.hpp"
+#include "util/lock.hpp"
 #include "util/log.hpp"
 #include "video/decoder.hpp"
 
-#define HEADER_SIZE 12
-#define NO_PTS UINT64_C(-1)
-
 namespace irobot::video {
 
     bool VideoStream::ReceivePacket(AVPacket *packet) {
-        // The video stream contains raw packets, without time information. When we
-        // record, we retrieve the timestamps separately, from a "meta" header
-        // added by the server before each raw packet.
-        //
-        // The "meta" header length is 12 bytes:
-        // [. . . . . . . .|. . . .]. . . . . . . . . . . . . . . ...
-        //  <-------------> <-----> <-----------------------------...
-        //        PTS        packet        raw packet
-        //                    size
-        //
-        // It is followed by <packet_size> bytes containing the packet/frame.
-
-        uint8_t header[HEADER_SIZE];
-        ssize_t r = platform::net_recv_all(this->video_socket, header, HEADER_SIZE);
-        if (r < HEADER_SIZE) {
-            return false;
-        }
+        return this->reader.ReadPacket(packet);
+    }
 
-        uint64_t pts = util::buffer_read64be(header);
-        uint32_t len = util::buffer_read32be(&header[8]);
-        assert(pts == NO_PTS || (pts & 0x8000000000000000) == 0);
-        assert(len);
+    bool VideoStream::OnVideoData(void *userdata, const uint8_t *data, size_t len) {
+        auto *stream = (struct VideoStream *) userdata;
+        return stream->reader.Feed(data, len, OnVideoPacket, stream);
+    }
 
-        if (av_new_packet(packet, len)) {
-            LOGE("Could not allocate packet");
+    bool VideoStream::OnVideoPacket(void *userdata, AVPacket *packet) {
+        auto *stream = (struct VideoStream *) userdata;
+        util::mutex_lock(stream->mutex);
+        if (stream->failed) {
+            // stop receiving
+            util::mutex_unlock(stream->mutex);
             return false;
         }
-
-        r = platform::net_recv_all(this->video_socket, packet->data, len);
-        if (r < 0 || ((uint32_t) r) < len) {
-            av_packet_unref(packet);
-            return false;
+        if (stream->dropping) {
+            // a config packet precedes a key frame
+            struct NalInfo info{};
+            NalScan(packet->data, packet->size, &info);
+            if (packet->pts != AV_NOPTS_VALUE && !info.key) {
+                ++stream->nr_dropped;
+                util::mutex_unlock(stream->mutex);
+                return true;
+            }
+            stream->dropping = false;
         }
-
-        packet->pts = pts != NO_PTS ? (int64_t) pts : AV_NOPTS_VALUE;
+        struct StreamPacket item{};
+        item.header_time = stream->reader.header_time;
+        item.body_time = stream->reader.body_time;
+        av_packet_move_ref(&item.packet, packet);
+        if (cbuf_push(&stream->queue, item)) {
+            util::cond_signal(stream->thread_cond);
+        } else {
+            // never block the io loop, the other sockets would stall
+            LOGW("Video packet queue full, dropping until the next key frame");
+            av_packet_unref(&item.packet);
+            stream->dropping = true;
+            ++stream->nr_dropped;
+        }
+        util::mutex_unlock(stream->mutex);
         return true;
     }
 
+    void VideoStream::OnVideoEnd(void *userdata, bool closed) {
+        (void) closed;
+        auto *stream = (struct VideoStream *) userdata;
+        util::mutex_lock(stream->mutex);
+        stream->ended = true;
+        util::cond_signal(stream->thread_cond);
+        util::mutex_unlock(stream->mutex);
+    }
+
+    void VideoStream::ProcessQueue() {
+        for (;;) {
+            struct StreamPacket item{};
+            util::mutex_lock(this->mutex);
+            while (cbuf_is_empty(&this->queue) && !this->ended) {
+                util::cond_wait(this->thread_cond, this->mutex);
+            }
+            bool ok = cbuf_take(&this->queue, &item);
+            util::mutex_unlock(this->mutex);
+            if (!ok) {
+                // the watch ended and the queue is drained
+                break;
+            }
+
+            if (!this->failed) {
+                this->header_time = item.header_time;
+                this->body_time = item.body_time;
+                ok = this->PushPacket(&item.packet);
+                if (!ok) {
+                    // cannot process packet (error already logged), wait for
+                    // the io loop to stop watching the socket
+                    util::mutex_lock(this->mutex);
+                    this->failed = true;
+                    util::mutex_unlock(this->mutex);
+                }
+            }
+            av_packet_unref(&item.packet);
+        }
+    }
+
     void VideoStream::NotifyStopped() {
         SDL_Event stop_event;
         stop_event.type = EVENT_STREAM_STOPPED;
@@ -65,11 +107,15 @@ namespace irobot::video {
             LOGE("Could not send config packet to recorder");
             return false;
         }
+        if (this->replay && !this->replay->Push(packet)) {
+            LOGE("Could not send config packet to replay buffer");
+            return false;
+        }
         return true;
     }
 
-    bool VideoStream::ProcessFrame(AVPacket *packet) {
-        if (this->decoder && !this->decoder->Push(packet)) {
+    bool VideoStream::ProcessFrame(AVPacket *packet, int frame_id) {
+        if (this->decoder && !this->decoder->Push(packet, frame_id)) {
             return false;
         }
 
@@ -82,28 +128,37 @@ namespace irobot::video {
             }
         }
 
+        if (this->replay && !this->replay->Push(packet)) {
+            LOGE("Could not send packet to replay buffer");
+            return false;
+        }
+
         return true;
     }
 
     bool VideoStream::Parse(AVPacket *packet) {
-        uint8_t *in_data = packet->data;
-        int in_len = packet->size;
-        uint8_t *out_data = nullptr;
-        int out_len = 0;
-        int r = av_parser_parse2(this->parser, this->codec_ctx,
-                                 &out_data, &out_len, in_data, in_len,
-                                 AV_NOPTS_VALUE, AV_NOPTS_VALUE, -1);
-
-        // PARSER_FLAG_COMPLETE_FRAMES is set
-        assert(r == in_len);
-        (void) r;
-        assert(out_len == in_len);
-
-        if (this->parser->key_frame == 1) {
+        // the packets are complete frames, only their first NAL units are
+        // needed to classify them
+        NalScan(packet->data, packet->size, &this->nal_info);
+        if (this->nal_info.key) {
             packet->flags |= AV_PKT_FLAG_KEY;
+        } else if (this->nal_info.type && !this->nal_info.ref_idc) {
+            // not a reference frame, may be dropped
+            packet->flags |= AV_PKT_FLAG_DISPOSABLE;
+        }
+
+        if (this->clock_offset) {
+            this->clock_offset->Update(packet->pts, this->body_time);
         }
 
-        bool ok = this->ProcessFrame(packet);
+        int frame_id = 0;
+        if (this->latency) {
+            frame_id = this->latency->Begin(this->header_time, this->body_time);
+            this->latency->Mark(frame_id, LATENCY_STAGE_PARSED);
+            this->latency->Report(this->body_time);
+        }
+
+        bool ok = this->ProcessFrame(packet, frame_id);
         if (!ok) {
             LOGE("Could not process frame");
             return false;
@@ -170,21 +225,28 @@ namespace irobot::video {
 
     int VideoStream::RunStream(void *data) {
         auto *stream = (struct VideoStream *) data;
+        struct PacketPoolStats pool_stats{};
+        struct StreamReaderStats reader_stats{};
 
         AVCodec *codec = avcodec_find_decoder(AV_CODEC_ID_H264);
         if (!codec) {
             LOGE("H.264 decoder not found");
             goto end;
         }
-        stream->codec_ctx = avcodec_alloc_context3(codec);
-        if (!stream->codec_ctx) {
-            LOGC("Could not allocate codec context");
+
+        if (!stream->packet_pool.Init()) {
             goto end;
         }
 
+        if (!stream->reader.Init(stream->video_socket, &stream->packet_pool,
+                                 STREAM_READER_DEFAULT_CAPACITY,
+                                 stream->socket_buffer_size)) {
+            goto finally_destroy_packet_pool;
+        }
+
         if (stream->decoder && !stream->decoder->Open(codec)) {
             LOGE("Could not open decoder");
-            goto finally_free_codec_ctx;
+            goto finally_destroy_reader;
         }
 
         if (stream->recorder) {
@@ -199,40 +261,64 @@ namespace irobot::video {
             }
         }
 
-        stream->parser = av_parser_init(AV_CODEC_ID_H264);
-        if (!stream->parser) {
-            LOGE("Could not initialize parser");
-            goto finally_stop_and_join_recorder;
+        if (stream->replay) {
+            stream->replay->Open(codec);
+            if (!stream->replay->Start()) {
+                goto finally_stop_and_join_recorder;
+            }
         }
 
-        // We must only pass complete frames to av_parser_parse2()!
-        // It's more complicated, but this allows to reduce the latency by 1 frame!
-        stream->parser->flags |= PARSER_FLAG_COMPLETE_FRAMES;
-
-        for (;;) {
-            AVPacket packet;
-            bool ok = stream->ReceivePacket(&packet);
-            if (!ok) {
-                // end of stream
-                break;
+        if (stream->io_loop) {
+            // the packets are parsed on the io loop thread, processed here
+            if (stream->io_loop->Watch(stream->video_socket, OnVideoData,
+                                       OnVideoEnd, stream)) {
+                stream->ProcessQueue();
             }
-            ok = stream->PushPacket(&packet);
-
-            av_packet_unref(&packet);
-            if (!ok) {
-                // cannot process packet (error already logged)
-                break;
+            if (stream->nr_dropped) {
+                LOGW("Video stream: %u packets dropped", stream->nr_dropped);
             }
+        } else {
+            for (;;) {
+                AVPacket packet;
+                bool ok = stream->ReceivePacket(&packet);
+                if (!ok) {
+                    // end of stream
+                    break;
+                }
+                stream->header_time = stream->reader.header_time;
+                stream->body_time = stream->reader.body_time;
+                ok = stream->PushPacket(&packet);
+
+                av_packet_unref(&packet);
+                if (!ok) {
+                    // cannot process packet (error already logged)
+                    break;
+                }
 
+            }
         }
 
         LOGD("End of frames");
 
+        stream->packet_pool.GetStats(&pool_stats);
+        LOGI("Packet pool: %u hits, %u allocations, %u rejected",
+             pool_stats.hits, pool_stats.misses, pool_stats.rejected);
+        reader_stats = stream->reader.stats;
+        if (reader_stats.nr_packets) {
+            LOGI("Stream reader: %.2f recv per packet, %.1f KB per recv",
+                 (double) reader_stats.nr_recv / reader_stats.nr_packets,
+                 (double) reader_stats.nr_bytes / 1024 / reader_stats.nr_recv);
+        }
+
         if (stream->has_pending) {
             av_packet_unref(&stream->pending);
         }
 
-        av_parser_close(stream->parser);
+        if (stream->replay) {
+            // the pending replays are saved before the thread ends
+            stream->replay->Stop();
+            stream->replay->Join();
+        }
         finally_stop_and_join_recorder:
         if (stream->recorder) {
             stream->recorder->Stop();
@@ -247,20 +333,33 @@ namespace irobot::video {
         if (stream->decoder) {
             stream->decoder->Close();
         }
-        finally_free_codec_ctx:
-        avcodec_free_context(&stream->codec_ctx);
+        finally_destroy_reader:
+        stream->reader.Destroy();
+        finally_destroy_packet_pool:
+        stream->packet_pool.Destroy();
         end:
         NotifyStopped();
         return 0;
     }
 
-    void VideoStream::Init(socket_t socket,
-                           struct Decoder *pDecoder, struct Recorder *pRecorder) {
+    bool VideoStream::Init(socket_t socket,
+                           struct Decoder *pDecoder, struct Recorder *pRecorder,
+                           uint32_t buffer_size) {
+        // for the packet queue of the io loop
+        if (!Actor::Init()) {
+            return false;
+        }
         this->video_socket = socket;
+        this->socket_buffer_size = buffer_size;
         this->decoder = pDecoder,
                 this->recorder = pRecorder;
         this->has_pending = false;
-
+        cbuf_init(&this->queue);
+        this->ended = false;
+        this->failed = false;
+        this->dropping = false;
+        this->nr_dropped = 0;
+        return true;
     }
 
     bool VideoStream::Start() {
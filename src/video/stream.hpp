@@ -26,26 +26,74 @@ extern "C" {
 
 #include "config.hpp"
 #include "core/actor.hpp"
+#include "util/cbuf.hpp"
+#include "platform/io_loop.hpp"
 #include "platform/net.hpp"
+#include "video/clock_offset.hpp"
 #include "video/decoder.hpp"
+#include "video/latency.hpp"
+#include "video/nal_scanner.hpp"
+#include "video/packet_pool.hpp"
+#include "video/replay_buffer.hpp"
+#include "video/stream_reader.hpp"
+
+// packets received by the io loop, not processed yet by the stream thread
+// (4 seconds at 60 fps)
+#define STREAM_PACKET_QUEUE_SIZE 256
 
 namespace irobot::video {
 
+    struct StreamPacket {
+        AVPacket packet;
+        // see StreamReader
+        int64_t header_time;
+        int64_t body_time;
+    };
+
+    struct StreamPacketQueue CBUF(struct StreamPacket, STREAM_PACKET_QUEUE_SIZE);
+
     class VideoStream : public Actor {
 
     public:
         socket_t video_socket = 0;
         struct Decoder *decoder = nullptr;
         struct Recorder *recorder = nullptr;
-        AVCodecContext *codec_ctx = nullptr;
-        AVCodecParserContext *parser = nullptr;
+        // keeps the last packets in memory, if set
+        ReplayBuffer *replay = nullptr;
+        // the NAL units of the last frame packet
+        struct NalInfo nal_info{};
         // successive packets may need to be concatenated, until a non-config
         // packet is available
         bool has_pending = false;
         AVPacket pending{};
-
-        void Init(socket_t socket,
-                  struct Decoder *pDecoder, Recorder *pRecorder);
+        // recycled buffers for the received packets
+        PacketPool packet_pool;
+        // buffered reads of the "meta"-headered packets
+        StreamReader reader;
+        uint32_t socket_buffer_size = 0;
+        // if set, the socket is read by the io loop instead of this thread:
+        // the loop only parses the packets, they are processed (decoded) by
+        // this thread, so that a slow decoder does not stall the other
+        // sockets of the loop
+        platform::IoLoop *io_loop = nullptr;
+        // protected by the mutex
+        struct StreamPacketQueue queue;
+        bool ended = false;   // the io loop watch ended
+        bool failed = false;  // a packet could not be processed
+        // the queue was full, drop until the next key frame (io loop only)
+        bool dropping = false;
+        unsigned nr_dropped = 0;
+        // times of the packet being processed
+        int64_t header_time = 0;
+        int64_t body_time = 0;
+        // begins the timeline of each frame, if set
+        LatencyTracker *latency = nullptr;
+        // estimates the device clock from the PTS, if set
+        ClockOffset *clock_offset = nullptr;
+
+        bool Init(socket_t socket,
+                  struct Decoder *pDecoder, Recorder *pRecorder,
+                  uint32_t socket_buffer_size);
 
         bool Start() override;
 
@@ -63,10 +111,19 @@ namespace irobot::video {
 
         bool ProcessConfigPacket(AVPacket *packet);
 
-        bool ProcessFrame(AVPacket *packet);
+        bool ProcessFrame(AVPacket *packet, int frame_id);
 
         bool Parse(AVPacket *packet);
 
+        // process the packets queued by the io loop until its watch ends
+        void ProcessQueue();
+
+        static bool OnVideoData(void *userdata, const uint8_t *data, size_t len);
+
+        static bool OnVideoPacket(void *userdata, AVPacket *packet);
+
+        static void OnVideoEnd(void *userdata, bool closed);
+
     };
 
 }
@@ -0,0 +1,221 @@
+//
+// Created by James Shen on 17/10/26.
+// Copyright (c) 2020 GUIDEBEE IT. All rights reserved
+//
+
+#include "stream_reader.hpp"
+
+#if defined (__cplusplus)
+extern "C" {
+#endif
+
+#include <libavutil/time.h>
+
+#if defined (__cplusplus)
+}
+#endif
+
+#include <cassert>
+#include <cstring>
+
+#include "util/buffer_util.hpp"
+#include "util/log.hpp"
+
+#define NO_PTS UINT64_C(-1)
+
+namespace irobot::video {
+
+    bool StreamReader::Init(socket_t video_socket, PacketPool *packet_pool,
+                            size_t buffer_capacity,
+                            uint32_t socket_buffer_size) {
+        assert(buffer_capacity > STREAM_READER_HEADER_SIZE);
+        this->buffer = (uint8_t *) av_malloc(buffer_capacity);
+        if (!this->buffer) {
+            LOGC("Could not allocate stream reader buffer");
+            return false;
+        }
+        this->socket = video_socket;
+        this->pool = packet_pool;
+        this->capacity = buffer_capacity;
+        this->head = 0;
+        this->tail = 0;
+        this->has_partial = false;
+        this->partial_filled = 0;
+        this->stats = {};
+
+        if (socket_buffer_size) {
+            // not fatal, the error is logged
+            platform::net_set_recv_buffer_size(video_socket, socket_buffer_size);
+        }
+        return true;
+    }
+
+    void StreamReader::Destroy() {
+        if (this->has_partial) {
+            av_packet_unref(&this->partial);
+            this->has_partial = false;
+        }
+        av_freep(&this->buffer);
+    }
+
+    enum StreamReaderResult StreamReader::Parse(AVPacket *packet) {
+        // The video stream contains raw packets, without time information. When we
+        // record, we retrieve the timestamps separately, from a "meta" header
+        // added by the server before each raw packet.
+        //
+        // The "meta" header length is 12 bytes:
+        // [. . . . . . . .|. . . .]. . . . . . . . . . . . . . . ...
+        //  <-------------> <-----> <-----------------------------...
+        //        PTS        packet        raw packet
+        //                    size
+        //
+        // It is followed by <packet_size> bytes containing the packet/frame.
+        if (!this->has_partial) {
+            if (this->tail - this->head < STREAM_READER_HEADER_SIZE) {
+                return STREAM_READER_NEED_MORE;
+            }
+            const uint8_t *header = &this->buffer[this->head];
+            uint64_t pts = util::buffer_read64be(header);
+            uint32_t len = util::buffer_read32be(&header[8]);
+            assert(pts == NO_PTS || (pts & 0x8000000000000000) == 0);
+            assert(len);
+            this->head += STREAM_READER_HEADER_SIZE;
+
+            // the pool rejects any len above PACKET_MAX_SIZE
+            if (!this->pool->Alloc(&this->partial, len)) {
+                return STREAM_READER_ERROR;
+            }
+            this->partial.pts = pts != NO_PTS ? (int64_t) pts : AV_NOPTS_VALUE;
+            this->partial_filled = 0;
+            this->partial_header_time = av_gettime_relative();
+            this->has_partial = true;
+        }
+
+        size_t available = this->tail - this->head;
+        size_t missing = this->partial.size - this->partial_filled;
+        size_t n = available < missing ? available : missing;
+        memcpy(this->partial.data + this->partial_filled,
+               &this->buffer[this->head], n);
+        this->partial_filled += n;
+        this->head += n;
+
+        if (this->partial_filled < (uint32_t) this->partial.size) {
+            // all the buffered bytes have been consumed
+            assert(this->head == this->tail);
+            return STREAM_READER_NEED_MORE;
+        }
+
+        av_packet_move_ref(packet, &this->partial);
+        this->has_partial = false;
+        this->header_time = this->partial_header_time;
+        this->body_time = av_gettime_relative();
+        ++this->stats.nr_packets;
+        return STREAM_READER_PACKET;
+    }
+
+    void StreamReader::Compact() {
+        // only the bytes of an incomplete header may remain (a partial body is
+        // always moved to its packet), so this memmove() is at most 11 bytes
+        size_t remaining = this->tail - this->head;
+        assert(remaining < STREAM_READER_HEADER_SIZE);
+        if (this->head) {
+            memmove(this->buffer, &this->buffer[this->head], remaining);
+            this->head = 0;
+            this->tail = remaining;
+        }
+    }
+
+    bool StreamReader::Fill() {
+        this->Compact();
+
+        ssize_t r = platform::net_recv(this->socket, &this->buffer[this->tail],
+                                       this->capacity - this->tail);
+        if (r <= 0) {
+            return false;
+        }
+        ++this->stats.nr_recv;
+        this->tail += r;
+        this->stats.nr_bytes += r;
+        return true;
+    }
+
+    bool StreamReader::FillPartial() {
+        assert(this->has_partial);
+        assert(this->head == this->tail);
+        size_t missing = this->partial.size - this->partial_filled;
+        ssize_t r = platform::net_recv_all(this->socket,
+                                           this->partial.data + this->partial_filled,
+                                           missing);
+        if (r < 0 || (size_t) r < missing) {
+            return false;
+        }
+        ++this->stats.nr_recv;
+        this->partial_filled += missing;
+        this->stats.nr_bytes += missing;
+        return true;
+    }
+
+    bool StreamReader::Feed(const uint8_t *data, size_t len,
+                            StreamPacketHandler handler, void *userdata) {
+        ++this->stats.nr_recv;
+        this->stats.nr_bytes += len;
+        while (len) {
+            size_t n;
+            if (this->has_partial) {
+                assert(this->head == this->tail);
+                size_t missing = this->partial.size - this->partial_filled;
+                n = len < missing ? len : missing;
+                memcpy(this->partial.data + this->partial_filled, data, n);
+                this->partial_filled += n;
+            } else {
+                // only buffer the bytes required to complete the header
+                this->Compact();
+                size_t missing = STREAM_READER_HEADER_SIZE - this->tail;
+                n = len < missing ? len : missing;
+                memcpy(&this->buffer[this->tail], data, n);
+                this->tail += n;
+            }
+            data += n;
+            len -= n;
+
+            AVPacket packet;
+            enum StreamReaderResult result = this->Parse(&packet);
+            if (result == STREAM_READER_ERROR) {
+                return false;
+            }
+            if (result == STREAM_READER_PACKET) {
+                bool ok = handler(userdata, &packet);
+                av_packet_unref(&packet);
+                if (!ok) {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
+    bool StreamReader::ReadPacket(AVPacket *packet) {
+        for (;;) {
+            enum StreamReaderResult result = this->Parse(packet);
+            if (result == STREAM_READER_PACKET) {
+                return true;
+            }
+            if (result == STREAM_READER_ERROR) {
+                return false;
+            }
+
+            bool ok;
+            if (this->has_partial && this->partial.size - this->partial_filled
+                                     >= STREAM_READER_DIRECT_THRESHOLD) {
+                // large body (typically a key frame), avoid the extra copy
+                ok = this->FillPartial();
+            } else {
+                ok = this->Fill();
+            }
+            if (!ok) {
+                return false;
+            }
+        }
+    }
+
+}
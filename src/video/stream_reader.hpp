@@ -0,0 +1,116 @@
+//
+// Created by James Shen on 17/10/26.
+// Copyright (c) 2020 GUIDEBEE IT. All rights reserved
+//
+
+#ifndef ANDROID_IROBOT_STREAM_READER_HPP
+#define ANDROID_IROBOT_STREAM_READER_HPP
+
+#if defined (__cplusplus)
+extern "C" {
+#endif
+
+#include <libavcodec/avcodec.h>
+
+#if defined (__cplusplus)
+}
+#endif
+
+#include <cstddef>
+#include <cstdint>
+
+#include "config.hpp"
+#include "platform/net.hpp"
+#include "video/packet_pool.hpp"
+
+#define STREAM_READER_HEADER_SIZE 12
+#define STREAM_READER_DEFAULT_CAPACITY (256 * 1024)
+// a packet body still missing at least this many bytes is received directly
+// into the packet, instead of going through the reader buffer
+#define STREAM_READER_DIRECT_THRESHOLD (64 * 1024)
+
+namespace irobot::video {
+
+    enum StreamReaderResult {
+        STREAM_READER_PACKET,    // a complete packet has been returned
+        STREAM_READER_NEED_MORE, // more bytes are required
+        STREAM_READER_ERROR,     // corrupted or unallocatable packet
+    };
+
+    // called for each complete packet in push mode
+    // the packet is unreferenced on return, return false to stop
+    typedef bool (*StreamPacketHandler)(void *userdata, AVPacket *packet);
+
+    struct StreamReaderStats {
+        uint64_t nr_recv;    // recv() calls (or completions) on the video socket
+        uint64_t nr_packets; // complete packets returned
+        uint64_t nr_bytes;   // bytes received (headers included)
+    };
+
+    // Read the "meta"-headered packets of the video socket.
+    //
+    // Instead of two blocking recv() per packet (one for the header, one for
+    // the body), the reader receives as many bytes as available into a large
+    // buffer, and parses as many headers and bodies as possible from it.
+    //
+    // Each body byte is copied once, from the buffer to its pooled packet.
+    // Since the bytes of an incomplete body are moved into the packet
+    // immediately, at most the bytes of an incomplete header (less than 12)
+    // are left at the end of the buffer and moved back to its start before
+    // the next recv().
+    class StreamReader {
+    public:
+        socket_t socket = INVALID_SOCKET;
+        PacketPool *pool = nullptr;
+        uint8_t *buffer = nullptr;
+        size_t capacity = 0;
+        // the unparsed bytes are in [head; tail)
+        size_t head = 0;
+        size_t tail = 0;
+
+        // the packet being assembled, if any
+        bool has_partial = false;
+        AVPacket partial{};
+        uint32_t partial_filled = 0;
+        // av_gettime_relative() when the header of the partial packet was parsed
+        int64_t partial_header_time = 0;
+
+        // times of the last returned packet, for the latency tracker
+        int64_t header_time = 0;
+        int64_t body_time = 0;
+
+        struct StreamReaderStats stats{};
+
+        // socket_buffer_size, if not 0, is applied as SO_RCVBUF
+        bool Init(socket_t socket, PacketPool *pool, size_t capacity,
+                  uint32_t socket_buffer_size);
+
+        void Destroy();
+
+        // block until a complete packet is read
+        // return false on end of stream or error
+        bool ReadPacket(AVPacket *packet);
+
+        // parse the next packet from the bytes already received, never block
+        enum StreamReaderResult Parse(AVPacket *packet);
+
+        // push mode: consume len bytes received by someone else (the io loop)
+        // body bytes are copied directly to their packet
+        // return false on error or if handler returned false
+        bool Feed(const uint8_t *data, size_t len,
+                  StreamPacketHandler handler, void *userdata);
+
+    private:
+        // move the bytes of an incomplete header to the start of the buffer
+        void Compact();
+
+        // receive as many bytes as available into the buffer
+        bool Fill();
+
+        // receive the rest of the partial packet body directly into it
+        bool FillPartial();
+    };
+
+}
+
+#endif //ANDROID_IROBOT_STREAM_READER_HPP
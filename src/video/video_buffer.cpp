@@ -5,106 +5,410 @@
 
 #include "video_buffer.hpp"
 
+#if defined (__cplusplus)
+extern "C" {
+#endif
+
+#include <libavutil/imgutils.h>
+#include <libavutil/pixdesc.h>
+#include <libavutil/time.h>
+
+#if defined (__cplusplus)
+}
+#endif
+
+#include <SDL2/SDL_events.h>
+
 #include <cassert>
+#include <cstring>
+
 #include <util/lock.hpp>
+#include "util/log.hpp"
 
 namespace irobot::video {
 
     bool VideoBuffer::Init(struct FpsCounter *fps_counter,
-                           bool render_expired_frames) {
+                           bool render_expired_frames, int nr_slots) {
         this->fps_counter = fps_counter;
+        this->latency = nullptr;
+        if (nr_slots < 3) {
+            nr_slots = 3;
+        } else if (nr_slots > VIDEO_BUFFER_MAX_SLOTS) {
+            nr_slots = VIDEO_BUFFER_MAX_SLOTS;
+        }
+        this->nr_slots = 0;
+        this->nr_consumers = 0;
+        this->frame_number = 0;
+        SDL_AtomicSet(&this->latest, -1);
+        SDL_AtomicSet(&this->latest_number, 0);
+        this->lock_stats = {};
 
         if (!(this->decoding_frame = av_frame_alloc())) {
             goto error_0;
         }
 
-        if (!(this->rendering_frame = av_frame_alloc())) {
-            goto error_1;
-        }
-
-        if (!(this->rgb_frame = av_frame_alloc())) {
-            goto error_2;
+        for (; this->nr_slots < nr_slots; ++this->nr_slots) {
+            struct FrameSlot *slot = &this->slots[this->nr_slots];
+            if (!(slot->frame = av_frame_alloc())) {
+                goto error_1;
+            }
+            slot->frame_number = 0;
+            slot->decode_time = 0;
+            SDL_AtomicSet(&slot->pins, 0);
         }
 
         if (!(this->mutex = SDL_CreateMutex())) {
-            goto error_3;
+            goto error_1;
         }
 
         this->render_expired_frames = render_expired_frames;
         if (render_expired_frames) {
             if (!(this->rendering_frame_consumed_cond = SDL_CreateCond())) {
                 SDL_DestroyMutex(this->mutex);
-                goto error_2;
+                goto error_1;
             }
             // interrupted is not used if expired frames are not rendered
             // since offering a frame will never block
             this->interrupted = false;
         }
 
-        // there is initially no rendering frame, so consider it has already been
-        // consumed
-        this->rendering_frame_consumed = true;
-
+        fps_counter->reporter = ReportSkippedFrames;
+        fps_counter->reporter_data = this;
         return true;
 
-        error_3:
-        av_frame_free(&this->rgb_frame);
-        error_2:
-        av_frame_free(&this->rendering_frame);
         error_1:
+        while (this->nr_slots--) {
+            av_frame_free(&this->slots[this->nr_slots].frame);
+        }
         av_frame_free(&this->decoding_frame);
         error_0:
         return false;
     }
 
     void VideoBuffer::Destroy() {
+        for (int i = 0; i < this->nr_consumers; ++i) {
+            struct FrameConsumer *c = &this->consumers[i];
+            if (c->wait_cond) {
+                SDL_DestroyCond(c->wait_cond);
+                SDL_DestroyMutex(c->wait_mutex);
+            }
+            LOGD("Video buffer %s: %d frames, %d skipped, %d static", c->name,
+                 SDL_AtomicGet(&c->nr_frames), SDL_AtomicGet(&c->nr_skipped),
+                 SDL_AtomicGet(&c->nr_static));
+        }
+        util::mutex_lock(this->fps_counter->mutex);
+        this->fps_counter->reporter = nullptr;
+        util::mutex_unlock(this->fps_counter->mutex);
         if (this->render_expired_frames) {
             SDL_DestroyCond(this->rendering_frame_consumed_cond);
         }
         SDL_DestroyMutex(this->mutex);
-        av_frame_free(&this->rendering_frame);
+        for (int i = 0; i < this->nr_slots; ++i) {
+            av_frame_free(&this->slots[i].frame);
+        }
         av_frame_free(&this->decoding_frame);
-        av_frame_free(&this->rgb_frame);
     }
 
-    void VideoBuffer::SwapFrames() {
-        AVFrame *tmp = this->decoding_frame;
-        this->decoding_frame = this->rendering_frame;
-        this->rendering_frame = tmp;
+    int VideoBuffer::RegisterConsumer(const char *name, uint32_t event_type,
+                                      bool blocking) {
+        // each consumer pins at most one slot, the last frame may be pinned
+        // too, and the decoder needs a free one
+        if (this->nr_consumers == VIDEO_BUFFER_MAX_CONSUMERS
+            || this->nr_consumers + 1 + 2 > this->nr_slots) {
+            LOGE("Not enough video buffer slots (%d) for consumer %s",
+                 this->nr_slots, name);
+            return -1;
+        }
+        struct FrameConsumer *c = &this->consumers[this->nr_consumers];
+        c->name = name;
+        c->event_type = event_type;
+        SDL_AtomicSet(&c->notified, 0);
+        c->wait_mutex = nullptr;
+        c->wait_cond = nullptr;
+        if (!event_type) {
+            if (!(c->wait_mutex = SDL_CreateMutex())) {
+                return -1;
+            }
+            if (!(c->wait_cond = SDL_CreateCond())) {
+                SDL_DestroyMutex(c->wait_mutex);
+                return -1;
+            }
+        }
+        c->woken = false;
+        c->interrupted = false;
+        c->blocking = blocking && this->render_expired_frames;
+        c->slot = -1;
+        c->frame_number = 0;
+        SDL_AtomicSet(&c->nr_frames, 0);
+        SDL_AtomicSet(&c->nr_skipped, 0);
+        c->nr_skipped_reported = 0;
+        SDL_AtomicSet(&c->nr_static, 0);
+        c->nr_static_reported = 0;
+        return this->nr_consumers++;
     }
 
-    void VideoBuffer::OfferDecodedFrame(
-            bool *previous_frame_skipped) {
-        util::mutex_lock(this->mutex);
-        if (this->render_expired_frames) {
+    int VideoBuffer::FindFreeSlot() {
+        int latest = SDL_AtomicGet(&this->latest);
+        for (int i = 0; i < this->nr_slots; ++i) {
+            // a consumer may only pin the latest slot, so a slot seen unpinned
+            // here cannot be pinned before it is published again
+            if (i != latest && !SDL_AtomicGet(&this->slots[i].pins)) {
+                return i;
+            }
+        }
+        return -1;
+    }
+
+    void VideoBuffer::WaitBlockingConsumers() {
+        util::mutex_lock(this->mutex, &this->lock_stats);
+        for (int i = 0; i < this->nr_consumers; ++i) {
+            struct FrameConsumer *c = &this->consumers[i];
+            if (!c->blocking) {
+                continue;
+            }
             // wait for the current (expired) frame to be consumed
-            while (!this->rendering_frame_consumed && !this->interrupted) {
+            while (c->frame_number != this->frame_number && !this->interrupted) {
                 util::cond_wait(this->rendering_frame_consumed_cond, this->mutex);
             }
-        } else if (!this->rendering_frame_consumed) {
-            this->fps_counter->AddSkippedFrame();
         }
+        util::mutex_unlock(this->mutex);
+    }
 
-        this->SwapFrames();
+    void VideoBuffer::OfferDecodedFrame() {
+        if (this->render_expired_frames) {
+            this->WaitBlockingConsumers();
+        }
 
-        *previous_frame_skipped = !this->rendering_frame_consumed;
-        this->rendering_frame_consumed = false;
+        int index = this->FindFreeSlot();
+        if (index == -1) {
+            // cannot happen if the consumers have been registered
+            LOGW("No free video buffer slot, frame dropped");
+            av_frame_unref(this->decoding_frame);
+            return;
+        }
+        struct FrameSlot *slot = &this->slots[index];
+        av_frame_unref(slot->frame);
+        av_frame_move_ref(slot->frame, this->decoding_frame);
+        slot->frame_number = ++this->frame_number;
+        slot->decode_time = av_gettime_relative();
+        // publish the frame (SDL atomics are full barriers)
+        SDL_AtomicSet(&this->latest, index);
+        SDL_AtomicSet(&this->latest_number, this->frame_number);
 
-        util::mutex_unlock(this->mutex);
+        for (int i = 0; i < this->nr_consumers; ++i) {
+            struct FrameConsumer *c = &this->consumers[i];
+            // one pending notification per consumer, it will acquire the last
+            // frame anyway
+            if (!SDL_AtomicCAS(&c->notified, 0, 1)) {
+                continue;
+            }
+            if (c->event_type) {
+                SDL_Event event{};
+                event.type = c->event_type;
+                SDL_PushEvent(&event);
+            } else {
+                util::mutex_lock(c->wait_mutex);
+                util::cond_signal(c->wait_cond);
+                util::mutex_unlock(c->wait_mutex);
+            }
+        }
     }
 
-    const AVFrame *VideoBuffer::ConsumeRenderedFrame() {
-        assert(!this->rendering_frame_consumed);
-        this->rendering_frame_consumed = true;
-        this->fps_counter->AddRenderedFrame();
-        if (this->render_expired_frames) {
-            // unblock video_buffer_offer_decoded_frame()
+    bool VideoBuffer::WaitFrame(int consumer) {
+        struct FrameConsumer *c = &this->consumers[consumer];
+        assert(c->wait_cond);
+        util::mutex_lock(c->wait_mutex);
+        // frame_number is only written by this thread
+        while (!c->interrupted && !c->woken
+               && SDL_AtomicGet(&this->latest_number) == c->frame_number) {
+            util::cond_wait(c->wait_cond, c->wait_mutex);
+        }
+        c->woken = false;
+        bool interrupted = c->interrupted;
+        util::mutex_unlock(c->wait_mutex);
+        return !interrupted;
+    }
+
+    void VideoBuffer::WakeConsumer(int consumer) {
+        if (consumer < 0 || !this->consumers[consumer].wait_cond) {
+            return;
+        }
+        struct FrameConsumer *c = &this->consumers[consumer];
+        util::mutex_lock(c->wait_mutex);
+        c->woken = true;
+        util::cond_signal(c->wait_cond);
+        util::mutex_unlock(c->wait_mutex);
+    }
+
+    const AVFrame *VideoBuffer::AcquireFrame(int consumer) {
+        if (consumer < 0) {
+            return nullptr;
+        }
+        struct FrameConsumer *c = &this->consumers[consumer];
+        this->ReleaseFrame(consumer);
+        // the frames offered from now on will be notified
+        SDL_AtomicSet(&c->notified, 0);
+
+        int index;
+        for (;;) {
+            index = SDL_AtomicGet(&this->latest);
+            if (index == -1) {
+                return nullptr;
+            }
+            SDL_AtomicIncRef(&this->slots[index].pins);
+            if (SDL_AtomicGet(&this->latest) == index) {
+                // still the last frame, it cannot be reused while pinned
+                break;
+            }
+            // the decoder may be writing to this slot, retry
+            SDL_AtomicAdd(&this->slots[index].pins, -1);
+        }
+        c->slot = index;
+
+        int frame_number = this->slots[index].frame_number;
+        if (frame_number != c->frame_number) {
+            SDL_AtomicIncRef(&c->nr_frames);
+            if (c->frame_number && frame_number > c->frame_number + 1) {
+                SDL_AtomicAdd(&c->nr_skipped, frame_number - c->frame_number - 1);
+            }
+        }
+        if (c->blocking) {
+            util::mutex_lock(this->mutex, &this->lock_stats);
+            c->frame_number = frame_number;
+            // unblock OfferDecodedFrame()
             util::cond_signal(this->rendering_frame_consumed_cond);
+            util::mutex_unlock(this->mutex);
+        } else {
+            c->frame_number = frame_number;
+        }
+        return this->slots[index].frame;
+    }
+
+    const AVFrame *VideoBuffer::GetFrame(int consumer) {
+        if (consumer < 0 || this->consumers[consumer].slot == -1) {
+            return nullptr;
+        }
+        return this->slots[this->consumers[consumer].slot].frame;
+    }
+
+    const struct FrameSlot *VideoBuffer::GetFrameSlot(int consumer) {
+        if (consumer < 0 || this->consumers[consumer].slot == -1) {
+            return nullptr;
+        }
+        return &this->slots[this->consumers[consumer].slot];
+    }
+
+    void VideoBuffer::ReleaseFrame(int consumer) {
+        if (consumer < 0) {
+            return;
+        }
+        struct FrameConsumer *c = &this->consumers[consumer];
+        if (c->slot != -1) {
+            SDL_AtomicAdd(&this->slots[c->slot].pins, -1);
+            c->slot = -1;
         }
-        return this->rendering_frame;
+    }
+
+    int VideoBuffer::PinFrame(int consumer) {
+        if (consumer < 0 || this->consumers[consumer].slot == -1) {
+            return -1;
+        }
+        int slot = this->consumers[consumer].slot;
+        SDL_AtomicIncRef(&this->slots[slot].pins);
+        return slot;
+    }
+
+    void VideoBuffer::UnpinFrame(int slot) {
+        SDL_AtomicAdd(&this->slots[slot].pins, -1);
+    }
+
+    void VideoBuffer::ReportSkippedFrames(void *data) {
+        auto *vb = (VideoBuffer *) data;
+        for (int i = 0; i < vb->nr_consumers; ++i) {
+            struct FrameConsumer *c = &vb->consumers[i];
+            auto nr_skipped = (unsigned) SDL_AtomicGet(&c->nr_skipped);
+            if (nr_skipped != c->nr_skipped_reported) {
+                LOGI("%s: +%u frames skipped", c->name,
+                     nr_skipped - c->nr_skipped_reported);
+                c->nr_skipped_reported = nr_skipped;
+            }
+            auto nr_static = (unsigned) SDL_AtomicGet(&c->nr_static);
+            if (nr_static != c->nr_static_reported) {
+                LOGI("%s: +%u static frames suppressed", c->name,
+                     nr_static - c->nr_static_reported);
+                c->nr_static_reported = nr_static;
+            }
+        }
+    }
+
+    void VideoBuffer::CountStaticFrame(int consumer) {
+        SDL_AtomicIncRef(&this->consumers[consumer].nr_static);
+    }
+
+#define FNV_PRIME UINT64_C(0x100000001b3)
+#define FNV_OFFSET UINT64_C(0xcbf29ce484222325)
+
+    // FNV-1a on 8-byte words, in 4 interleaved lanes so that the
+    // multiplications do not wait for each other
+    static void HashRow(uint64_t lanes[4], const uint8_t *row, int len) {
+        int x = 0;
+        for (; x + 32 <= len; x += 32) {
+            uint64_t words[4];
+            memcpy(words, &row[x], sizeof(words));
+            lanes[0] = (lanes[0] ^ words[0]) * FNV_PRIME;
+            lanes[1] = (lanes[1] ^ words[1]) * FNV_PRIME;
+            lanes[2] = (lanes[2] ^ words[2]) * FNV_PRIME;
+            lanes[3] = (lanes[3] ^ words[3]) * FNV_PRIME;
+        }
+        for (; x + 8 <= len; x += 8) {
+            uint64_t word;
+            memcpy(&word, &row[x], sizeof(word));
+            lanes[0] = (lanes[0] ^ word) * FNV_PRIME;
+        }
+        for (; x < len; ++x) {
+            lanes[0] = (lanes[0] ^ row[x]) * FNV_PRIME;
+        }
+    }
+
+    uint64_t VideoBuffer::ComputeChecksum(const AVFrame *frame) {
+        // each step is a bijection of the lane, so a change of any byte of
+        // the visible pixels (of any plane) alters the hash
+        uint64_t hash = FNV_OFFSET;
+        hash = (hash ^ (uint64_t) frame->format) * FNV_PRIME;
+        hash = (hash ^ ((uint64_t) frame->width << 32 | (uint32_t) frame->height))
+               * FNV_PRIME;
+        const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get((enum AVPixelFormat) frame->format);
+        if (!desc) {
+            return hash;
+        }
+        uint64_t lanes[4] = {hash, FNV_OFFSET, FNV_OFFSET, FNV_OFFSET};
+        for (int p = 0; p < AV_NUM_DATA_POINTERS && frame->data[p]; ++p) {
+            int len = av_image_get_linesize((enum AVPixelFormat) frame->format,
+                                            frame->width, p);
+            // the chroma planes of YUV formats (U, V, or UV interleaved)
+            int height = p == 1 || p == 2
+                         ? AV_CEIL_RSHIFT(frame->height, desc->log2_chroma_h)
+                         : frame->height;
+            for (int y = 0; y < height; ++y) {
+                HashRow(lanes, frame->data[p] + (ptrdiff_t) y * frame->linesize[p], len);
+            }
+        }
+        for (uint64_t lane : lanes) {
+            hash = (hash ^ lane) * FNV_PRIME;
+        }
+        return hash;
     }
 
     void VideoBuffer::Interrupt() {
+        for (int i = 0; i < this->nr_consumers; ++i) {
+            struct FrameConsumer *c = &this->consumers[i];
+            if (c->wait_cond) {
+                util::mutex_lock(c->wait_mutex);
+                c->interrupted = true;
+                util::cond_signal(c->wait_cond);
+                util::mutex_unlock(c->wait_mutex);
+            }
+        }
         if (this->render_expired_frames) {
             util::mutex_lock(this->mutex);
             this->interrupted = true;
@@ -17,53 +17,163 @@ extern "C" {
 }
 #endif
 
+#include <SDL2/SDL_atomic.h>
 #include <SDL2/SDL_mutex.h>
 
 #include "config.hpp"
 
 #include "fps_counter.hpp"
+#include "latency.hpp"
+#include "util/lock.hpp"
+
+#define IMAGE_ALIGN 1
+
+#define VIDEO_BUFFER_MAX_SLOTS 16
+#define VIDEO_BUFFER_DEFAULT_SLOTS 4
+#define VIDEO_BUFFER_MAX_CONSUMERS 4
 
 namespace irobot::video {
     // forward declarations
     typedef struct AVFrame AVFrame;
 
+    struct FrameSlot {
+        AVFrame *frame;
+        // number of the frame in the slot, 0 if empty
+        int frame_number;
+        // av_gettime_relative() when the frame was offered
+        int64_t decode_time;
+        // number of consumers using the frame, the decoder never reuses
+        // a pinned slot
+        SDL_atomic_t pins;
+    };
+
+    // a reader of the decoded frames (the screen, the agent...)
+    struct FrameConsumer {
+        const char *name;
+        // pushed when a new frame is available, 0 to wait in WaitFrame()
+        uint32_t event_type;
+        // set when the consumer is notified, cleared by AcquireFrame(), so
+        // that it is notified at most once whatever the number of frames
+        SDL_atomic_t notified;
+        // without event type, to wait for the frames
+        SDL_mutex *wait_mutex;
+        SDL_cond *wait_cond;
+        // protected by wait_mutex
+        bool woken;
+        bool interrupted;
+        // with --render-expired-frames, the decoder waits for this consumer
+        bool blocking;
+        // the following fields are only accessed by the consumer thread
+        // (frame_number is protected by the mutex for a blocking consumer)
+        int slot; // pinned slot, -1 if none
+        int frame_number; // last acquired frame
+        // read by the fps counter thread
+        SDL_atomic_t nr_frames;
+        SDL_atomic_t nr_skipped;
+        unsigned nr_skipped_reported;
+        // frames not processed because identical to the previous one,
+        // counted by the consumer, see CountStaticFrame()
+        SDL_atomic_t nr_static;
+        unsigned nr_static_reported;
+    };
+
+    // Ring of decoded frames, in which each consumer pins the last frame
+    // while using it: a slow consumer never blocks the decoder or the other
+    // consumers, it just skips the frames decoded meanwhile.
     class VideoBuffer {
     public:
+        // the frame being decoded, only accessed by the decoder
         AVFrame *decoding_frame;
-        AVFrame *rendering_frame;
+        struct FrameSlot slots[VIDEO_BUFFER_MAX_SLOTS];
+        int nr_slots;
+        // index of the slot of the last decoded frame, -1 if none
+        SDL_atomic_t latest;
+        // number of the last decoded frame, 0 if none
+        SDL_atomic_t latest_number;
+        // number of frames offered, only accessed by the decoder
+        int frame_number;
+        struct FrameConsumer consumers[VIDEO_BUFFER_MAX_CONSUMERS];
+        int nr_consumers;
+
+        // protects the blocking consumer
         SDL_mutex *mutex;
+        // waits for the mutex (of the decoder and the consumers)
+        util::LockWaitStats lock_stats;
         bool render_expired_frames;
         bool interrupted;
         SDL_cond *rendering_frame_consumed_cond;
-        bool rendering_frame_consumed;
         struct FpsCounter *fps_counter;
-        int frame_number;
-
-        AVFrame *rgb_frame;
-        uint8_t *buffer;
+        // the frames carry their timeline id, nullptr if not tracked
+        // required by the decoder
+        struct LatencyTracker *latency;
 
         bool Init(struct FpsCounter *fps_counter,
-                  bool render_expired_frames);
+                  bool render_expired_frames, int nr_slots);
 
         void Destroy();
 
+        // register a consumer, before any frame is offered
+        // event_type is pushed when a new frame is available; with 0, the
+        // consumer thread waits for the frames in WaitFrame() instead
+        // if blocking and --render-expired-frames, the decoder waits for the
+        // consumer to acquire each frame
+        // return the consumer id, -1 if there are not enough slots (or on
+        // error)
+        int RegisterConsumer(const char *name, uint32_t event_type,
+                             bool blocking);
 
-        // set the decoded frame as ready for rendering
-        // this function locks frames->mutex during its execution
-        // the output flag is set to report whether the previous frame has been skipped
-        void OfferDecodedFrame(bool *previous_frame_skipped);
+        // move the decoded frame to a free slot, and notify the consumers
+        void OfferDecodedFrame();
 
-        // mark the rendering frame as consumed and return it
-        // MUST be called with frames->mutex locked!!!
-        // the caller is expected to render the returned frame to some texture before
-        // unlocking frames->mutex
-        const AVFrame *ConsumeRenderedFrame();
+        // pin the last decoded frame for the consumer (releasing the one
+        // it held) and return it
+        // return nullptr if no frame has been decoded yet
+        // the frame is valid until ReleaseFrame(), without any lock
+        const AVFrame *AcquireFrame(int consumer);
 
-        // wake up and avoid any blocking call
+        // return the frame pinned by the consumer, nullptr if none
+        const AVFrame *GetFrame(int consumer);
+
+        // return the slot pinned by the consumer (frame number, decode
+        // time...), nullptr if none
+        const struct FrameSlot *GetFrameSlot(int consumer);
+
+        // unpin the frame of the consumer
+        void ReleaseFrame(int consumer);
+
+        // pin the slot of the frame pinned by the consumer once more, so that
+        // it stays valid after ReleaseFrame() (see ai::FrameSnapshot)
+        // return the slot index, -1 if no frame is pinned
+        int PinFrame(int consumer);
+
+        void UnpinFrame(int slot);
+
+        // for a consumer without event type: block until a frame more recent
+        // than the last acquired one is available, or WakeConsumer()
+        // return false if interrupted
+        bool WaitFrame(int consumer);
+
+        // make the current (or next) WaitFrame() return
+        void WakeConsumer(int consumer);
+
+        // wake up and avoid any blocking call (of the decoder and consumers)
         void Interrupt();
 
+        // for the consumers skipping the frames of a static screen
+        void CountStaticFrame(int consumer);
+
+        // checksum of all the planes (and size) of a decoded frame, to
+        // detect the unchanged frames, computed by the consumers which
+        // need it (a full pass, never on the decoder thread)
+        static uint64_t ComputeChecksum(const AVFrame *frame);
+
+        // log the frames skipped by each consumer since the last call
+        static void ReportSkippedFrames(void *data);
+
     private:
-        void SwapFrames();
+        int FindFreeSlot();
+
+        void WaitBlockingConsumers();
 
     };
 
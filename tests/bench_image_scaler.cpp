@@ -0,0 +1,107 @@
+//
+// Created by James Shen on 17/10/26.
+// Copyright (c) 2020 GUIDEBEE IT. All rights reserved
+//
+
+// Benchmarks are hidden, run them explicitly:
+//     all_tests "[benchmark]"
+
+#include <algorithm>
+#include <cstdio>
+
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+
+#if defined (__cplusplus)
+extern "C" {
+#endif
+
+#include <libavutil/imgutils.h>
+#include <libswscale/swscale.h>
+
+#if defined (__cplusplus)
+}
+#endif
+
+#include "catch2/catch.hpp"
+#include "ai/image_scaler.hpp"
+#include "test_frames.hpp"
+
+using namespace irobot::ai;
+
+#define BENCH_NR_RUNS 100
+#define BGR_PADDING 64
+
+// what ai::ConvertToMat() did: full size BGR, resize, then gray
+static cv::Mat run_chain(const AVFrame *frame, SwsContext **sws_ctx,
+                         uint8_t *bgr, int max_size, bool color) {
+    *sws_ctx = sws_getCachedContext(*sws_ctx, frame->width, frame->height,
+                                    (enum AVPixelFormat) frame->format,
+                                    frame->width, frame->height, AV_PIX_FMT_BGR24,
+                                    SWS_BILINEAR, nullptr, nullptr, nullptr);
+    uint8_t *dst_data[4];
+    int dst_linesize[4];
+    av_image_fill_arrays(dst_data, dst_linesize, bgr, AV_PIX_FMT_BGR24,
+                         frame->width, frame->height, 1);
+    sws_scale(*sws_ctx, (const uint8_t *const *) frame->data, frame->linesize,
+              0, frame->height, dst_data, dst_linesize);
+    cv::Mat image(frame->height, frame->width, CV_8UC3, bgr, dst_linesize[0]);
+    cv::Mat out;
+    float scale = (float) max_size / (float) std::max(frame->width, frame->height);
+    cv::resize(image, out, cv::Size(), scale, scale);
+    if (!color) {
+        cv::Mat gray;
+        cv::cvtColor(out, gray, cv::COLOR_BGR2GRAY);
+        out = gray;
+    }
+    return out;
+}
+
+static cv::Mat run_fused(const AVFrame *frame, int max_size, bool color,
+                         enum ScalerIsa isa) {
+    int width;
+    int height;
+    GetScaledSize(frame->width, frame->height, max_size, &width, &height);
+    cv::Mat out(height, width, color ? CV_8UC3 : CV_8UC1);
+    bool ok = color
+              ? ScaleI420ToBGR(frame, out.data, (int) out.step, width, height, isa)
+              : ScaleI420ToGray(frame, out.data, (int) out.step, width, height, isa);
+    REQUIRE(ok);
+    return out;
+}
+
+static void run(int width, int height, int max_size, bool color) {
+    AVFrame *frame = alloc_screen(width, height);
+    int size = av_image_get_buffer_size(AV_PIX_FMT_BGR24, width, height, 1);
+    // the SIMD paths of sws_scale() write past the last pixel
+    auto *bgr = (uint8_t *) av_malloc(size + BGR_PADDING);
+    REQUIRE(bgr);
+    SwsContext *sws_ctx = nullptr;
+
+    double chain = measure_us([&] { run_chain(frame, &sws_ctx, bgr, max_size, color); },
+                              BENCH_NR_RUNS);
+    printf("%dx%d -> %d %-5s chain  %8.0f us\n", width, height, max_size,
+           color ? "bgr" : "gray", chain);
+    enum ScalerIsa isas[] = {SCALER_ISA_SCALAR, SCALER_ISA_SSE41, SCALER_ISA_AVX2};
+    for (enum ScalerIsa isa : isas) {
+        if (isa > GetScalerIsa()) {
+            continue;
+        }
+        double fused = measure_us([&] { run_fused(frame, max_size, color, isa); },
+                                  BENCH_NR_RUNS);
+        printf("%dx%d -> %d %-5s %-6s %8.0f us (x%.1f)\n", width, height, max_size,
+               color ? "bgr" : "gray", GetScalerIsaName(isa), fused, chain / fused);
+    }
+
+    sws_freeContext(sws_ctx);
+    av_free(bgr);
+    av_frame_free(&frame);
+}
+
+TEST_CASE("fused scaler vs conversion chain", "[.][benchmark][image_scaler]") {
+    // the two images sent to the agent for each frame
+    run(1080, 2400, 800, false);
+    run(1080, 2400, 240, true);
+    run(720, 1600, 800, false);
+    run(720, 1600, 240, true);
+}
@@ -0,0 +1,180 @@
+//
+// Created by James Shen on 17/10/26.
+// Copyright (c) 2020 GUIDEBEE IT. All rights reserved
+//
+
+// Benchmarks are hidden, run them explicitly:
+//     all_tests "[benchmark]"
+
+#ifndef _WIN32
+
+#include <sys/resource.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+#include "catch2/catch.hpp"
+#include "platform/io_loop.hpp"
+#include "util/buffer_util.hpp"
+#include "video/stream_reader.hpp"
+
+using namespace irobot;
+using namespace irobot::video;
+
+#define BENCH_NR_FRAMES 20000
+#define BENCH_PORT 27290
+#define BENCH_CONTROL_MSG_SIZE 64
+
+struct BenchSockets {
+    socket_t server;
+    socket_t video[2];   // client, device
+    socket_t control[2]; // client, device
+};
+
+static bool open_sockets(struct BenchSockets *s) {
+    s->server = platform::net_listen(IPV4_LOCALHOST, BENCH_PORT, 2);
+    if (s->server == INVALID_SOCKET) {
+        return false;
+    }
+    s->video[1] = platform::net_connect(IPV4_LOCALHOST, BENCH_PORT);
+    s->video[0] = platform::net_accept(s->server);
+    s->control[1] = platform::net_connect(IPV4_LOCALHOST, BENCH_PORT);
+    s->control[0] = platform::net_accept(s->server);
+    return true;
+}
+
+static void close_sockets(struct BenchSockets *s) {
+    platform::close_socket(&s->video[0]);
+    platform::close_socket(&s->video[1]);
+    platform::close_socket(&s->control[0]);
+    platform::close_socket(&s->control[1]);
+    platform::close_socket(&s->server);
+}
+
+// the device: a video packet and a control message per frame
+static void write_device(struct BenchSockets *s) {
+    std::vector<uint8_t> frame(12 + 200000);
+    uint8_t msg[BENCH_CONTROL_MSG_SIZE] = {};
+    for (uint32_t i = 0; i < BENCH_NR_FRAMES; ++i) {
+        uint32_t len = i % 60 ? 2000 + (i * 7919) % 6000 : 200000;
+        util::buffer_write64be(frame.data(), i);
+        util::buffer_write32be(&frame[8], len);
+        platform::net_send_all(s->video[1], frame.data(), 12 + len);
+        platform::net_send_all(s->control[1], msg, sizeof(msg));
+    }
+    platform::net_shutdown(s->video[1], SHUT_WR);
+    platform::net_shutdown(s->control[1], SHUT_WR);
+}
+
+struct BenchCounters {
+    std::atomic<uint64_t> nr_frames{0};
+    std::atomic<uint64_t> nr_control_bytes{0};
+};
+
+static bool count_frame(void *userdata, AVPacket *packet) {
+    (void) packet;
+    ++((struct BenchCounters *) userdata)->nr_frames;
+    return true;
+}
+
+struct VideoContext {
+    StreamReader *reader;
+    struct BenchCounters *counters;
+};
+
+static bool on_video(void *userdata, const uint8_t *data, size_t len) {
+    auto *ctx = (struct VideoContext *) userdata;
+    return ctx->reader->Feed(data, len, count_frame, ctx->counters);
+}
+
+static bool on_control(void *userdata, const uint8_t *data, size_t len) {
+    (void) data;
+    ((struct BenchCounters *) userdata)->nr_control_bytes += len;
+    return true;
+}
+
+static void run(const char *name, platform::IoLoop *loop) {
+    struct BenchSockets s{};
+    REQUIRE(open_sockets(&s));
+
+    PacketPool pool;
+    REQUIRE(pool.Init());
+    StreamReader reader;
+    REQUIRE(reader.Init(s.video[0], &pool, STREAM_READER_DEFAULT_CAPACITY, 0));
+    struct BenchCounters counters;
+    struct VideoContext video_ctx = {&reader, &counters};
+
+    struct rusage usage_start{};
+    getrusage(RUSAGE_SELF, &usage_start);
+    auto start = std::chrono::steady_clock::now();
+
+    std::thread device(write_device, &s);
+    std::thread video([&] {
+        if (loop) {
+            loop->RecvUntilClosed(s.video[0], on_video, &video_ctx);
+            return;
+        }
+        AVPacket packet;
+        while (reader.ReadPacket(&packet)) {
+            count_frame(&counters, &packet);
+            av_packet_unref(&packet);
+        }
+    });
+    std::thread control([&] {
+        if (loop) {
+            loop->RecvUntilClosed(s.control[0], on_control, &counters);
+            return;
+        }
+        uint8_t buf[4096];
+        ssize_t r;
+        while ((r = platform::net_recv(s.control[0], buf, sizeof(buf))) > 0) {
+            on_control(&counters, buf, r);
+        }
+    });
+    device.join();
+    video.join();
+    control.join();
+
+    auto end = std::chrono::steady_clock::now();
+    struct rusage usage_end{};
+    getrusage(RUSAGE_SELF, &usage_end);
+
+    double secs = std::chrono::duration<double>(end - start).count();
+    auto cpu_us = [](const struct rusage &u) {
+        return (u.ru_utime.tv_sec + u.ru_stime.tv_sec) * 1e6
+               + u.ru_utime.tv_usec + u.ru_stime.tv_usec;
+    };
+    double cpu = cpu_us(usage_end) - cpu_us(usage_start);
+    long switches = (usage_end.ru_nvcsw + usage_end.ru_nivcsw)
+                    - (usage_start.ru_nvcsw + usage_start.ru_nivcsw);
+    uint64_t nr_frames = counters.nr_frames;
+    printf("%-9s %9.0f frames/s %7.2f us cpu/frame %6.2f ctx switches/frame\n",
+           name, nr_frames / secs, cpu / nr_frames, (double) switches / nr_frames);
+    REQUIRE(nr_frames == BENCH_NR_FRAMES);
+    REQUIRE(counters.nr_control_bytes == BENCH_NR_FRAMES * BENCH_CONTROL_MSG_SIZE);
+
+    reader.Destroy();
+    pool.Destroy();
+    close_sockets(&s);
+}
+
+TEST_CASE("io loop vs blocking threads", "[.][benchmark][io_loop]") {
+    REQUIRE(platform::net_init());
+    run("blocking", nullptr);
+
+    platform::IoLoop loop;
+    if (!loop.Init()) {
+        WARN("io_uring not available, skipped");
+        return;
+    }
+    REQUIRE(loop.Start());
+    run("io_uring", &loop);
+    loop.Stop();
+    loop.Join();
+    loop.Destroy();
+}
+
+#endif
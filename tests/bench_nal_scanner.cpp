@@ -0,0 +1,98 @@
+//
+// Created by James Shen on 17/10/26.
+// Copyright (c) 2020 GUIDEBEE IT. All rights reserved
+//
+
+// Benchmarks are hidden, run them explicitly:
+//     all_tests "[benchmark]"
+
+#if defined (__cplusplus)
+extern "C" {
+#endif
+
+#include <libavcodec/avcodec.h>
+
+#if defined (__cplusplus)
+}
+#endif
+
+#include <chrono>
+#include <cstdio>
+#include <vector>
+
+#include "catch2/catch.hpp"
+#include "video/nal_scanner.hpp"
+
+using namespace irobot::video;
+
+#define BENCH_NR_FRAMES 20000
+
+// complete frames, like the device sends them: a large IDR (with its config)
+// every 60 frames, small P-frames in between
+static std::vector<std::vector<uint8_t>> make_frames() {
+    std::vector<std::vector<uint8_t>> frames;
+    for (uint32_t i = 0; i < BENCH_NR_FRAMES; ++i) {
+        std::vector<uint8_t> frame;
+        bool key = !(i % 60);
+        size_t len = key ? 200000 : 2000 + (i * 7919) % 6000;
+        if (key) {
+            const uint8_t config[] = {0, 0, 0, 1, 0x67, 0x42, 0xc0, 0x28,
+                                      0, 0, 0, 1, 0x68, 0xce, 0x3c, 0x80};
+            frame.insert(frame.end(), config, config + sizeof(config));
+        }
+        const uint8_t start[] = {0, 0, 0, 1, (uint8_t) (key ? 0x65 : 0x41)};
+        frame.insert(frame.end(), start, start + sizeof(start));
+        for (size_t j = 0; j < len; ++j) {
+            frame.push_back((uint8_t) (j * 31 + i) | 0x10);
+        }
+        frame.insert(frame.end(), AV_INPUT_BUFFER_PADDING_SIZE, 0);
+        frames.push_back(std::move(frame));
+    }
+    return frames;
+}
+
+TEST_CASE("nal scanner vs parser", "[.][benchmark][nal]") {
+    std::vector<std::vector<uint8_t>> frames = make_frames();
+
+    av_log_set_level(AV_LOG_QUIET);
+    AVCodec *codec = avcodec_find_decoder(AV_CODEC_ID_H264);
+    REQUIRE(codec);
+    AVCodecContext *codec_ctx = avcodec_alloc_context3(codec);
+    REQUIRE(codec_ctx);
+    AVCodecParserContext *parser = av_parser_init(AV_CODEC_ID_H264);
+    REQUIRE(parser);
+    parser->flags |= PARSER_FLAG_COMPLETE_FRAMES;
+
+    size_t nr_keys = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (auto &frame : frames) {
+        uint8_t *out_data = nullptr;
+        int out_len = 0;
+        int len = (int) frame.size() - AV_INPUT_BUFFER_PADDING_SIZE;
+        av_parser_parse2(parser, codec_ctx, &out_data, &out_len,
+                         frame.data(), len, AV_NOPTS_VALUE, AV_NOPTS_VALUE, -1);
+        nr_keys += parser->key_frame == 1;
+    }
+    auto end = std::chrono::steady_clock::now();
+    double parser_secs = std::chrono::duration<double>(end - start).count();
+    size_t parser_keys = nr_keys;
+
+    nr_keys = 0;
+    start = std::chrono::steady_clock::now();
+    for (auto &frame : frames) {
+        struct NalInfo info{};
+        NalScan(frame.data(), frame.size() - AV_INPUT_BUFFER_PADDING_SIZE, &info);
+        nr_keys += info.key;
+    }
+    end = std::chrono::steady_clock::now();
+    double scanner_secs = std::chrono::duration<double>(end - start).count();
+    REQUIRE(nr_keys == BENCH_NR_FRAMES / 60 + 1);
+    // the parser also flags the IDR slices it cannot parse (fake SPS/PPS)
+    CHECK(parser_keys == nr_keys);
+
+    printf("%-8s %8.3f us/frame\n", "parser", parser_secs * 1e6 / BENCH_NR_FRAMES);
+    printf("%-8s %8.3f us/frame\n", "scanner", scanner_secs * 1e6 / BENCH_NR_FRAMES);
+
+    av_parser_close(parser);
+    avcodec_free_context(&codec_ctx);
+}
@@ -0,0 +1,121 @@
+//
+// Created by James Shen on 17/10/26.
+// Copyright (c) 2020 GUIDEBEE IT. All rights reserved
+//
+
+// Benchmarks are hidden, run them explicitly:
+//     all_tests "[benchmark]"
+
+#ifndef _WIN32
+
+#include <chrono>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+#include "catch2/catch.hpp"
+#include "util/buffer_util.hpp"
+#include "video/stream_reader.hpp"
+
+using namespace irobot;
+using namespace irobot::video;
+
+#define BENCH_NR_FRAMES 20000
+
+// a typical screen stream: small P-frames, and a large I-frame every 60 frames
+static std::vector<uint8_t> make_stream() {
+    std::vector<uint8_t> data;
+    for (uint32_t i = 0; i < BENCH_NR_FRAMES; ++i) {
+        uint32_t len = i % 60 ? 2000 + (i * 7919) % 6000 : 200000;
+        uint8_t header[STREAM_READER_HEADER_SIZE];
+        util::buffer_write64be(header, i);
+        util::buffer_write32be(&header[8], len);
+        data.insert(data.end(), header, header + STREAM_READER_HEADER_SIZE);
+        data.insert(data.end(), len, (uint8_t) i);
+    }
+    return data;
+}
+
+// the previous implementation: one blocking recv() for the header, one for
+// the body
+static bool read_packet_unbuffered(socket_t socket, PacketPool *pool,
+                                   AVPacket *packet, uint64_t *nr_recv) {
+    uint8_t header[STREAM_READER_HEADER_SIZE];
+    ssize_t r = platform::net_recv_all(socket, header, sizeof(header));
+    ++*nr_recv;
+    if (r < STREAM_READER_HEADER_SIZE) {
+        return false;
+    }
+    uint32_t len = util::buffer_read32be(&header[8]);
+    if (!pool->Alloc(packet, len)) {
+        return false;
+    }
+    r = platform::net_recv_all(socket, packet->data, len);
+    ++*nr_recv;
+    if (r < 0 || (uint32_t) r < len) {
+        av_packet_unref(packet);
+        return false;
+    }
+    return true;
+}
+
+static void run(const char *name, const std::vector<uint8_t> &data,
+                bool buffered) {
+    int fds[2];
+    REQUIRE(!socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+
+    PacketPool pool;
+    REQUIRE(pool.Init());
+    StreamReader reader;
+    REQUIRE(reader.Init(fds[0], &pool, STREAM_READER_DEFAULT_CAPACITY, 0));
+
+    std::thread writer([&] {
+        // write in chunks, like the device socket does
+        size_t offset = 0;
+        while (offset < data.size()) {
+            size_t len = std::min<size_t>(data.size() - offset, 16384);
+            platform::net_send_all(fds[1], &data[offset], len);
+            offset += len;
+        }
+        platform::net_shutdown(fds[1], SHUT_WR);
+    });
+
+    auto start = std::chrono::steady_clock::now();
+    uint64_t nr_frames = 0;
+    uint64_t nr_recv = 0;
+    for (;;) {
+        AVPacket packet;
+        bool ok = buffered
+                  ? reader.ReadPacket(&packet)
+                  : read_packet_unbuffered(fds[0], &pool, &packet, &nr_recv);
+        if (!ok) {
+            break;
+        }
+        ++nr_frames;
+        av_packet_unref(&packet);
+    }
+    auto end = std::chrono::steady_clock::now();
+    writer.join();
+    if (buffered) {
+        nr_recv = reader.stats.nr_recv;
+    }
+
+    double secs = std::chrono::duration<double>(end - start).count();
+    printf("%-10s %6.2f recv/frame %9.0f frames/s %8.1f MB/s\n", name,
+           (double) nr_recv / nr_frames, nr_frames / secs,
+           data.size() / secs / 1e6);
+    REQUIRE(nr_frames == BENCH_NR_FRAMES);
+
+    reader.Destroy();
+    pool.Destroy();
+    close(fds[0]);
+    close(fds[1]);
+}
+
+TEST_CASE("stream reader throughput", "[.][benchmark][stream_reader]") {
+    std::vector<uint8_t> data = make_stream();
+    run("unbuffered", data, false);
+    run("buffered", data, true);
+}
+
+#endif
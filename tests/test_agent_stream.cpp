@@ -0,0 +1,51 @@
+//
+// Created by James Shen on 17/10/26.
+// Copyright (c) 2020 GUIDEBEE IT. All rights reserved
+//
+
+#include "catch2/catch.hpp"
+#include "agent/agent_stream.hpp"
+#include "util/buffer_util.hpp"
+
+using namespace irobot;
+using namespace irobot::message;
+
+#define TEST_PORT 27291
+
+TEST_CASE("agent stream drops the messages of a previous client", "[agent][agent_stream]") {
+    REQUIRE(platform::net_init());
+    socket_t server = platform::net_listen(IPV4_LOCALHOST, TEST_PORT, 1);
+    REQUIRE(server != INVALID_SOCKET);
+    socket_t client = platform::net_connect(IPV4_LOCALHOST, TEST_PORT);
+    REQUIRE(client != INVALID_SOCKET);
+
+    agent::AgentStream stream{};
+    stream.video_socket = platform::net_accept(server);
+    REQUIRE(stream.video_socket != INVALID_SOCKET);
+    stream.SetVersion(BLOB_VERSION_1);
+    // the second client
+    SDL_AtomicSet(&stream.connection, 2);
+
+    // e.g. LZ4 compressed for the first one
+    BlobMessage stale{};
+    stale.type = BLOB_MSG_TYPE_SCREEN_SHOT;
+    stale.id = 1;
+    stale.connection = 1;
+    REQUIRE(stream.ProcessMessage(&stale));
+
+    BlobMessage msg{};
+    msg.type = BLOB_MSG_TYPE_SCREEN_SHOT;
+    msg.id = 2;
+    msg.connection = 2;
+    REQUIRE(stream.ProcessMessage(&msg));
+
+    // only the current one is received
+    unsigned char header[BLOB_MSG_HEADER_SIZE_V1];
+    REQUIRE(platform::net_recv_all(client, header, sizeof(header)) == sizeof(header));
+    REQUIRE(util::buffer_read64be(&header[16]) == 2);
+
+    platform::close_socket(&stream.video_socket);
+    platform::close_socket(&client);
+    platform::close_socket(&server);
+    platform::net_cleanup();
+}
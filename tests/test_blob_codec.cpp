@@ -0,0 +1,188 @@
+//
+// Created by James Shen on 17/10/26.
+// Copyright (c) 2020 GUIDEBEE IT. All rights reserved
+//
+
+#include <SDL2/SDL_stdinc.h>
+
+#include <cstring>
+#include <vector>
+
+#include "catch2/catch.hpp"
+#include "message/blob_codec.hpp"
+#include "message/blob_msg.hpp"
+#include "util/buffer_util.hpp"
+#include "util/lz4.hpp"
+
+using namespace irobot;
+using namespace irobot::message;
+
+static void check_round_trip(const std::vector<uint8_t> &data, uint32_t *table) {
+    std::vector<uint8_t> compressed(util::lz4_compress_bound(data.size()));
+    size_t len = util::lz4_compress(data.data(), data.size(), compressed.data(),
+                                    compressed.size(), table);
+    REQUIRE(len);
+    std::vector<uint8_t> decompressed(data.size());
+    REQUIRE(util::lz4_decompress(compressed.data(), len, decompressed.data(),
+                                 decompressed.size()));
+    REQUIRE(decompressed == data);
+    // not one byte more or less
+    if (!data.empty()) {
+        REQUIRE(!util::lz4_decompress(compressed.data(), len, decompressed.data(),
+                                      decompressed.size() - 1));
+    }
+}
+
+TEST_CASE("lz4 compress and decompress", "[util][lz4]") {
+    // reused, with the positions of the previous inputs
+    std::vector<uint32_t> table(LZ4_HASH_SIZE, 0);
+
+    check_round_trip({}, table.data());
+    check_round_trip({1, 2, 3, 4, 5}, table.data());
+
+    std::vector<uint8_t> zeros(1 << 20, 0);
+    check_round_trip(zeros, table.data());
+    std::vector<uint8_t> compressed(util::lz4_compress_bound(zeros.size()));
+    size_t len = util::lz4_compress(zeros.data(), zeros.size(), compressed.data(),
+                                    compressed.size(), table.data());
+    REQUIRE(len < zeros.size() / 200);
+
+    // rows of an image, with a flat background
+    std::vector<uint8_t> image;
+    for (int y = 0; y < 300; ++y) {
+        for (int x = 0; x < 400; ++x) {
+            bool button = x > 100 && x < 200 && y > 50 && y < 80;
+            image.push_back(button ? (uint8_t) (x * 3) : 0xf0);
+            image.push_back(button ? (uint8_t) y : 0xf0);
+            image.push_back(0xf0);
+        }
+    }
+    check_round_trip(image, table.data());
+
+    // incompressible: larger than the input, up to the bound
+    std::vector<uint8_t> noise(100000);
+    uint32_t seed = 42;
+    for (auto &b : noise) {
+        seed = seed * 1103515245 + 12345;
+        b = (uint8_t) (seed >> 16);
+    }
+    check_round_trip(noise, table.data());
+    REQUIRE(!util::lz4_compress(noise.data(), noise.size(), compressed.data(),
+                                noise.size(), table.data()));
+
+    // corrupted
+    len = util::lz4_compress(image.data(), image.size(), compressed.data(),
+                             compressed.size(), table.data());
+    std::vector<uint8_t> decompressed(image.size());
+    REQUIRE(!util::lz4_decompress(compressed.data(), len - 1, decompressed.data(),
+                                  decompressed.size()));
+}
+
+static unsigned char *make_buffer(const std::vector<uint8_t> &data) {
+    auto *buf = (unsigned char *) SDL_malloc(data.size());
+    memcpy(buf, data.data(), data.size());
+    return buf;
+}
+
+static BlobMessage make_message(const std::vector<uint8_t> &image,
+                                const std::vector<uint8_t> &hash) {
+    BlobMessage msg{};
+    msg.type = BLOB_MSG_TYPE_OPENCV_MAT;
+    msg.count = 2;
+    msg.buffers[0].width = 100;
+    msg.buffers[0].height = image.size() / 300;
+    msg.SetBuffer(0, make_buffer(image), image.size(), nullptr);
+    msg.buffers[1].width = 8;
+    msg.buffers[1].height = 1;
+    msg.SetBuffer(1, make_buffer(hash), hash.size(), nullptr);
+    msg.total_length = image.size() + 24 + hash.size() + 24;
+    return msg;
+}
+
+TEST_CASE("blob compressor", "[message][blob_codec]") {
+    std::vector<uint8_t> image(100 * 50 * 3, 0x80);
+    image[1000] = 1;
+    std::vector<uint8_t> hash = {1, 2, 3, 4, 5, 6, 7, 8};
+    BlobCompressor compressor{};
+
+    BlobMessage msg = make_message(image, hash);
+    Uint64 total_length = msg.total_length;
+    compressor.Compress(&msg, BLOB_CODEC_LZ4);
+    REQUIRE(msg.raw_length == total_length);
+    REQUIRE(msg.buffers[0].codec == BLOB_CODEC_LZ4);
+    REQUIRE(msg.buffers[0].length < image.size());
+    REQUIRE(msg.total_length == msg.buffers[0].length + 24 + hash.size() + 24);
+    // the hash is too small
+    REQUIRE(msg.buffers[1].codec == BLOB_CODEC_NONE);
+    // referenced until sent
+    BlobBuffer *output = compressor.outputs[0][0];
+    REQUIRE(msg.buffers[0].ref == output);
+    REQUIRE(output->GetRefCount() == 2);
+
+    // raw length, LZ4 block
+    const unsigned char *data = msg.buffers[0].data;
+    REQUIRE(util::buffer_read64be(data) == image.size());
+    std::vector<uint8_t> decompressed(image.size());
+    REQUIRE(util::lz4_decompress(data + 8, msg.buffers[0].length - 8,
+                                 decompressed.data(), decompressed.size()));
+    REQUIRE(decompressed == image);
+
+    // the codec in the serialized buffer length
+    std::vector<unsigned char> buf(BLOB_MSG_HEADER_SIZE + msg.total_length);
+    REQUIRE(msg.Serialize(buf.data(), BLOB_VERSION_2) == buf.size());
+    uint64_t length = util::buffer_read64be(&buf[56]);
+    REQUIRE(length >> BLOB_MSG_CODEC_SHIFT == BLOB_CODEC_LZ4);
+    REQUIRE((length & ((UINT64_C(1) << BLOB_MSG_CODEC_SHIFT) - 1))
+            == msg.buffers[0].length);
+    REQUIRE(util::buffer_read64be(&buf[64]) == 100);
+    REQUIRE(util::buffer_read64be(&buf[72]) == 50);
+    size_t hash_offset = 56 + 24 + msg.buffers[0].length;
+    REQUIRE(util::buffer_read64be(&buf[hash_offset]) == hash.size());
+
+    // the next message while this one is not sent
+    BlobMessage next = make_message(image, hash);
+    compressor.Compress(&next, BLOB_CODEC_LZ4);
+    REQUIRE(next.buffers[0].ref == compressor.outputs[0][1]);
+    next.Destroy();
+    msg.Destroy();
+    REQUIRE(output->GetRefCount() == 1);
+
+    // reused once sent
+    msg = make_message(image, hash);
+    compressor.Compress(&msg, BLOB_CODEC_LZ4);
+    REQUIRE(msg.buffers[0].ref == output);
+    msg.Destroy();
+
+    // incompressible: sent raw
+    uint32_t seed = 1;
+    for (auto &b : image) {
+        seed = seed * 1103515245 + 12345;
+        b = (uint8_t) (seed >> 16);
+    }
+    msg = make_message(image, hash);
+    unsigned char *raw = msg.buffers[0].data;
+    compressor.Compress(&msg, BLOB_CODEC_LZ4);
+    REQUIRE(msg.buffers[0].codec == BLOB_CODEC_NONE);
+    REQUIRE(msg.buffers[0].data == raw);
+    REQUIRE(msg.total_length == msg.raw_length);
+    msg.Destroy();
+
+    // no codec
+    msg = make_message(image, hash);
+    compressor.Compress(&msg, BLOB_CODEC_NONE);
+    REQUIRE(msg.raw_length == 0);
+    REQUIRE(msg.buffers[0].codec == BLOB_CODEC_NONE);
+    msg.Destroy();
+
+    compressor.Destroy();
+}
+
+TEST_CASE("blob codec names", "[message][blob_codec]") {
+    BlobCodec codec = BLOB_CODEC_NONE;
+    REQUIRE(ParseBlobCodec("lz4", &codec));
+    REQUIRE(codec == BLOB_CODEC_LZ4);
+    REQUIRE(!strcmp(GetBlobCodecName(codec), "lz4"));
+    REQUIRE(ParseBlobCodec("none", &codec));
+    REQUIRE(codec == BLOB_CODEC_NONE);
+    REQUIRE(!ParseBlobCodec("zstd", &codec));
+}
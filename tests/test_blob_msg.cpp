@@ -0,0 +1,113 @@
+//
+// Created by James Shen on 17/10/26.
+// Copyright (c) 2020 GUIDEBEE IT. All rights reserved
+//
+
+#include <SDL2/SDL_stdinc.h>
+
+#include <vector>
+
+#include "catch2/catch.hpp"
+#include "message/blob_msg.hpp"
+#include "util/buffer_util.hpp"
+
+using namespace irobot::message;
+
+static BlobMessage make_message(BlobMessageType type, Uint64 id) {
+    BlobMessage msg{};
+    msg.type = type;
+    msg.image_type = type;
+    msg.id = id;
+    msg.count = 1;
+    auto *data = (unsigned char *) SDL_malloc(16);
+    msg.SetBuffer(0, data, 16, nullptr);
+    msg.total_length = 16 + BLOB_MSG_BUFFER_HEADER_SIZE;
+    return msg;
+}
+
+TEST_CASE("blob mailbox latest wins", "[message][blob_msg]") {
+    BlobMailbox mailbox{};
+    REQUIRE(mailbox.IsEmpty());
+
+    BlobMessage replaced{};
+    BlobMessage msg = make_message(BLOB_MSG_TYPE_OPENCV_MAT, 1);
+    REQUIRE(!mailbox.Put(&msg, &replaced));
+    msg = make_message(BLOB_MSG_TYPE_SCREEN_SHOT, 1);
+    REQUIRE(!mailbox.Put(&msg, &replaced));
+
+    // a newer image of the same type replaces the unsent one
+    msg = make_message(BLOB_MSG_TYPE_OPENCV_MAT, 2);
+    REQUIRE(mailbox.Put(&msg, &replaced));
+    REQUIRE(replaced.id == 1);
+    REQUIRE(replaced.type == BLOB_MSG_TYPE_OPENCV_MAT);
+    replaced.Destroy();
+
+    // the oldest first: the screen shot, then the newest mat
+    BlobMessage taken{};
+    REQUIRE(mailbox.Take(&taken));
+    REQUIRE(taken.type == BLOB_MSG_TYPE_SCREEN_SHOT);
+    taken.Destroy();
+    REQUIRE(mailbox.Take(&taken));
+    REQUIRE(taken.type == BLOB_MSG_TYPE_OPENCV_MAT);
+    REQUIRE(taken.id == 2);
+    taken.Destroy();
+    REQUIRE(mailbox.IsEmpty());
+    REQUIRE(!mailbox.Take(&taken));
+}
+
+TEST_CASE("blob mailbox tile deltas", "[message][blob_msg]") {
+    BlobMailbox mailbox{};
+    BlobMessage replaced{};
+
+    // the slot of a tile delta is its image type
+    BlobMessage msg = make_message(BLOB_MSG_TYPE_OPENCV_MAT, 1);
+    msg.type = BLOB_MSG_TYPE_TILE_DELTA;
+    REQUIRE(BlobMailbox::GetSlot(&msg) == BLOB_MSG_TYPE_OPENCV_MAT);
+    REQUIRE(!mailbox.Put(&msg, &replaced));
+    msg = make_message(BLOB_MSG_TYPE_SCREEN_SHOT, 1);
+    msg.type = BLOB_MSG_TYPE_TILE_DELTA;
+    REQUIRE(!mailbox.Put(&msg, &replaced));
+
+    BlobMessage taken{};
+    REQUIRE(mailbox.TakeSlot(BLOB_MSG_TYPE_SCREEN_SHOT, &taken));
+    REQUIRE(taken.image_type == BLOB_MSG_TYPE_SCREEN_SHOT);
+    taken.Destroy();
+    REQUIRE(!mailbox.TakeSlot(BLOB_MSG_TYPE_SCREEN_SHOT, &taken));
+    REQUIRE(!mailbox.IsEmpty());
+    REQUIRE(mailbox.Take(&taken));
+    REQUIRE(taken.image_type == BLOB_MSG_TYPE_OPENCV_MAT);
+    taken.Destroy();
+    REQUIRE(mailbox.IsEmpty());
+}
+
+TEST_CASE("blob message header versions", "[message][blob_msg]") {
+    BlobMessage msg = make_message(BLOB_MSG_TYPE_OPENCV_MAT, 7);
+    msg.timestamp = 1000;
+    msg.capture_time = 2000;
+    msg.decode_time = 3000;
+    std::vector<unsigned char> buf(BLOB_MSG_HEADER_SIZE + msg.total_length);
+
+    // the layout of the clients which do not ask for a version
+    REQUIRE(BlobMessage::GetHeaderSize(BLOB_VERSION_1) == 40);
+    REQUIRE(msg.Serialize(buf.data(), BLOB_VERSION_1) == 40 + msg.total_length);
+    REQUIRE(irobot::util::buffer_read64be(&buf[16]) == 7);
+    REQUIRE(irobot::util::buffer_read64be(&buf[24]) == 1);
+    REQUIRE(irobot::util::buffer_read64be(&buf[32]) == msg.total_length);
+    REQUIRE(irobot::util::buffer_read64be(&buf[40]) == 16);
+
+    REQUIRE(BlobMessage::GetHeaderSize(BLOB_VERSION_2) == 56);
+    REQUIRE(msg.Serialize(buf.data(), BLOB_VERSION_2) == 56 + msg.total_length);
+    REQUIRE(irobot::util::buffer_read64be(&buf[16]) == 7);
+    REQUIRE(irobot::util::buffer_read64be(&buf[24]) == 2000);
+    REQUIRE(irobot::util::buffer_read64be(&buf[32]) == 3000);
+    REQUIRE(irobot::util::buffer_read64be(&buf[40]) == 1);
+    REQUIRE(irobot::util::buffer_read64be(&buf[48]) == msg.total_length);
+    REQUIRE(irobot::util::buffer_read64be(&buf[56]) == 16);
+
+    // only the hash buffer changes
+    std::vector<unsigned char> v3(buf.size());
+    REQUIRE(BlobMessage::GetHeaderSize(BLOB_VERSION_3) == 56);
+    REQUIRE(msg.Serialize(v3.data(), BLOB_VERSION_3) == 56 + msg.total_length);
+    REQUIRE(v3 == buf);
+    msg.Destroy();
+}
@@ -45,23 +45,37 @@ TEST_CASE("options", "[ui][cli]") {
 
     char *argv[] = {
             const_cast<char *>("irobot"),
+            const_cast<char *>("--agent-tile-delta"),
             const_cast<char *>("--always-on-top"),
             const_cast<char *>("--bit-rate"), const_cast<char *>("5M"),
             const_cast<char *>("--crop"), const_cast<char *>("100:200:300:400"),
+            const_cast<char *>("--decode-mode"), const_cast<char *>("frame"),
+            const_cast<char *>("--frame-buffers"), const_cast<char *>("6"),
             const_cast<char *>("--fullscreen"),
+            const_cast<char *>("--io-uring"),
+            const_cast<char *>("--latency-report"), const_cast<char *>("10"),
             const_cast<char *>("--max-fps"), const_cast<char *>("30"),
             const_cast<char *>("--max-size"), const_cast<char *>("1024"),
+            // "--mock-server" is not compatible with "--show-touches"
             // "--no-control" is not compatible with "--turn-screen-off"
             // "--no-display" is not compatible with "--fulscreen"
             const_cast<char *>("--port"), const_cast<char *>("1234"),
             const_cast<char *>("--push-target"), const_cast<char *>("/sdcard/Movies"),
             const_cast<char *>("--record"), const_cast<char *>("file"),
+            const_cast<char *>("--record-buffer-size"), const_cast<char *>("16M"),
             const_cast<char *>("--record-format"), const_cast<char *>("mkv"),
+            const_cast<char *>("--record-overflow"), const_cast<char *>("spill"),
+            const_cast<char *>("--record-segment-size"), const_cast<char *>("50M"),
+            const_cast<char *>("--record-segment-time"), const_cast<char *>("60"),
+            const_cast<char *>("--record-segments"), const_cast<char *>("5"),
             const_cast<char *>("--render-expired-frames"),
+            const_cast<char *>("--replay-buffer"), const_cast<char *>("30"),
+            const_cast<char *>("--replay-buffer-size"), const_cast<char *>("8M"),
             const_cast<char *>("--serial"), const_cast<char *>("0123456789abcdef"),
             const_cast<char *>("--show-touches"),
             const_cast<char *>("--turn-screen-off"),
             const_cast<char *>("--prefer-text"),
+            const_cast<char *>("--video-buffer-size"), const_cast<char *>("4M"),
             const_cast<char *>("--window-title"), const_cast<char *>("my device"),
             const_cast<char *>("--window-x"), const_cast<char *>("100"),
             const_cast<char *>("--window-y"), const_cast<char *>("-1"),
@@ -74,22 +88,35 @@ TEST_CASE("options", "[ui][cli]") {
     REQUIRE(ok);
 
     const struct IRobotCore *opts = &args;
+    REQUIRE(opts->agent_tile_delta);
     REQUIRE(opts->always_on_top);
 //    fprintf(stderr, "%d\n", (int) opts->bit_rate);
     REQUIRE(opts->bit_rate == 5000000);
     REQUIRE(!strcmp(opts->crop, "100:200:300:400"));
+    REQUIRE(opts->decode_mode == video::DECODE_MODE_FRAME);
+    REQUIRE(opts->frame_buffers == 6);
     REQUIRE(opts->fullscreen);
+    REQUIRE(opts->io_uring);
+    REQUIRE(opts->latency_report == 10);
     REQUIRE(opts->max_fps == 30);
     REQUIRE(opts->max_size == 1024);
     REQUIRE(opts->port == 1234);
     REQUIRE(!strcmp(opts->push_target, "/sdcard/Movies"));
     REQUIRE(!strcmp(opts->record_filename, "file"));
+    REQUIRE(opts->record_buffer_size == 16000000);
     REQUIRE(opts->record_format == video::RECORDER_FORMAT_MKV);
+    REQUIRE(opts->record_overflow == video::RECORDER_OVERFLOW_SPILL);
+    REQUIRE(opts->record_segment_size == 50000000);
+    REQUIRE(opts->record_segment_time == 60);
+    REQUIRE(opts->record_segments == 5);
     REQUIRE(opts->render_expired_frames);
+    REQUIRE(opts->replay_buffer_time == 30);
+    REQUIRE(opts->replay_buffer_size == 8000000);
     REQUIRE(!strcmp(opts->serial, "0123456789abcdef"));
     REQUIRE(opts->show_touches);
     REQUIRE(opts->turn_screen_off);
     REQUIRE(opts->prefer_text);
+    REQUIRE(opts->video_buffer_size == 4000000);
     REQUIRE(!strcmp(opts->window_title, "my device"));
     REQUIRE(opts->window_x == 100);
     REQUIRE(opts->window_y == -1);
@@ -106,9 +133,11 @@ TEST_CASE("options2", "[ui][cli]") {
     char *argv[] = {
             const_cast<char *>("irobot"),
             const_cast<char *>("--no-control"),
+            const_cast<char *>("--mock-server"),
             const_cast<char *>("--no-display"),
             const_cast<char *>("--record"),
             const_cast<char *>("file.mp4"), // cannot enable --no-display without recording
+            const_cast<char *>("--record-fragment-duration"), const_cast<char *>("2000"),
     };
 
     bool ok = args.ParseArgs(ARRAY_LEN(argv), argv);
@@ -117,6 +146,24 @@ TEST_CASE("options2", "[ui][cli]") {
     const struct IRobotCore *opts = &args;
     REQUIRE(!opts->control);
     REQUIRE(!opts->display);
+    REQUIRE(opts->mock_server);
     REQUIRE(!strcmp(opts->record_filename, "file.mp4"));
     REQUIRE(opts->record_format == video::RECORDER_FORMAT_MP4);
-}
\ No newline at end of file
+    REQUIRE(opts->record_fragment_duration == 2000);
+}
+TEST_CASE("options raw record format", "[ui][cli]") {
+    struct IRobotCore args = {
+
+    };
+
+    char *argv[] = {
+            const_cast<char *>("irobot"),
+            const_cast<char *>("--no-display"),
+            const_cast<char *>("--record"),
+            const_cast<char *>("file.h264"),
+    };
+
+    bool ok = args.ParseArgs(ARRAY_LEN(argv), argv);
+    REQUIRE(ok);
+    REQUIRE(args.record_format == video::RECORDER_FORMAT_RAW);
+}
@@ -0,0 +1,44 @@
+//
+// Created by James Shen on 17/10/26.
+// Copyright (c) 2020 GUIDEBEE IT. All rights reserved
+//
+
+#include "catch2/catch.hpp"
+#include "video/clock_offset.hpp"
+
+using namespace irobot::video;
+
+#define HOST_ORIGIN 5000000000LL
+
+TEST_CASE("clock offset unknown", "[video][clock_offset]") {
+    ClockOffset clock;
+    REQUIRE(clock.ToHost(1000) == 0);
+}
+
+TEST_CASE("clock offset minimum delay", "[video][clock_offset]") {
+    ClockOffset clock;
+    // 60 fps, captured at HOST_ORIGIN + pts, received 5 to 40 ms later
+    int64_t delays[] = {20000, 5000, 40000, 12000, 7000};
+    for (int i = 0; i < 60; ++i) {
+        int64_t pts = i * 16667;
+        clock.Update(pts, HOST_ORIGIN + pts + delays[i % 5]);
+    }
+    REQUIRE(clock.ToHost(100000) == HOST_ORIGIN + 100000 + 5000);
+}
+
+TEST_CASE("clock offset drift", "[video][clock_offset]") {
+    ClockOffset clock;
+    int64_t pts = 0;
+    for (; pts < 2000000; pts += 16667) {
+        clock.Update(pts, HOST_ORIGIN + pts + 10000);
+    }
+    REQUIRE(clock.ToHost(pts) == HOST_ORIGIN + pts + 10000);
+
+    // the device clock falls 20 ms behind: the old minimum is forgotten
+    // once its window is out of the last CLOCK_OFFSET_NR_WINDOWS
+    int64_t end = pts + (CLOCK_OFFSET_NR_WINDOWS + 1) * CLOCK_OFFSET_WINDOW_US;
+    for (; pts < end; pts += 16667) {
+        clock.Update(pts, HOST_ORIGIN + pts + 30000);
+    }
+    REQUIRE(clock.ToHost(pts) == HOST_ORIGIN + pts + 30000);
+}
@@ -68,6 +68,103 @@ TEST_CASE("json serialize inject keycode", "[message][ControlMessage]") {
 }
 
 
+TEST_CASE("json serialize save replay", "[message][ControlMessage]") {
+    struct ControlMessage msg = {
+            .type = CONTROL_MSG_TYPE_SAVE_REPLAY,
+            .save_replay = {
+                    .filename = const_cast<char *>("failure.mp4"),
+            },
+    };
+
+    auto json_str = msg.JsonSerialize();
+    REQUIRE(json::accept(json_str));
+    char cstr[json_str.size() + 1];
+    strcpy(cstr, json_str.c_str());
+    struct ControlMessage msg1{};
+    msg1.JsonDeserialize((const unsigned char *) cstr, strlen(cstr));
+    REQUIRE(msg1.type == CONTROL_MSG_TYPE_SAVE_REPLAY);
+    REQUIRE(!strcmp(msg1.save_replay.filename, "failure.mp4"));
+    msg1.Destroy();
+
+    const char *no_filename = R"({"msg_type": "CONTROL_MSG_TYPE_SAVE_REPLAY"})";
+    struct ControlMessage msg2{};
+    msg2.JsonDeserialize((const unsigned char *) no_filename, strlen(no_filename));
+    REQUIRE(msg2.type == CONTROL_MSG_TYPE_SAVE_REPLAY);
+    REQUIRE(!msg2.save_replay.filename);
+}
+
+TEST_CASE("json serialize request key frame", "[message][ControlMessage]") {
+    struct ControlMessage msg = {
+            .type = CONTROL_MSG_TYPE_REQUEST_KEY_FRAME,
+    };
+
+    auto json_str = msg.JsonSerialize();
+    REQUIRE(json::accept(json_str));
+    char cstr[json_str.size() + 1];
+    strcpy(cstr, json_str.c_str());
+    struct ControlMessage msg1{};
+    REQUIRE(msg1.JsonDeserialize((const unsigned char *) cstr, strlen(cstr)));
+    REQUIRE(msg1.type == CONTROL_MSG_TYPE_REQUEST_KEY_FRAME);
+}
+
+TEST_CASE("json serialize set blob codec", "[message][ControlMessage]") {
+    struct ControlMessage msg = {
+            .type = CONTROL_MSG_TYPE_SET_BLOB_CODEC,
+            .set_blob_codec = {
+                    .codec = BLOB_CODEC_LZ4,
+            },
+    };
+
+    auto json_str = msg.JsonSerialize();
+    REQUIRE(json::accept(json_str));
+    struct ControlMessage msg1{};
+    REQUIRE(msg1.JsonDeserialize((const unsigned char *) json_str.c_str(), json_str.size()));
+    REQUIRE(msg1.type == CONTROL_MSG_TYPE_SET_BLOB_CODEC);
+    REQUIRE(msg1.set_blob_codec.codec == BLOB_CODEC_LZ4);
+
+    // the first codec supported
+    const char *codecs = R"({"msg_type": "CONTROL_MSG_TYPE_SET_BLOB_CODEC",
+                             "blob_codec": {"codecs": ["zstd", "lz4"]}})";
+    struct ControlMessage msg2{};
+    REQUIRE(msg2.JsonDeserialize((const unsigned char *) codecs, strlen(codecs)));
+    REQUIRE(msg2.set_blob_codec.codec == BLOB_CODEC_LZ4);
+
+    const char *unsupported = R"({"msg_type": "CONTROL_MSG_TYPE_SET_BLOB_CODEC",
+                                  "blob_codec": {"codecs": ["zstd"]}})";
+    struct ControlMessage msg3{};
+    REQUIRE(msg3.JsonDeserialize((const unsigned char *) unsupported, strlen(unsupported)));
+    REQUIRE(msg3.set_blob_codec.codec == BLOB_CODEC_NONE);
+}
+
+TEST_CASE("json serialize set blob version", "[message][ControlMessage]") {
+    struct ControlMessage msg = {
+            .type = CONTROL_MSG_TYPE_SET_BLOB_VERSION,
+            .set_blob_version = {
+                    .version = BLOB_VERSION_2,
+            },
+    };
+
+    auto json_str = msg.JsonSerialize();
+    REQUIRE(json::accept(json_str));
+    struct ControlMessage msg1{};
+    REQUIRE(msg1.JsonDeserialize((const unsigned char *) json_str.c_str(), json_str.size()));
+    REQUIRE(msg1.type == CONTROL_MSG_TYPE_SET_BLOB_VERSION);
+    REQUIRE(msg1.set_blob_version.version == BLOB_VERSION_2);
+
+    // a newer client gets the latest version supported
+    const char *newer = R"({"msg_type": "CONTROL_MSG_TYPE_SET_BLOB_VERSION",
+                            "blob_version": {"version": 9}})";
+    struct ControlMessage msg2{};
+    REQUIRE(msg2.JsonDeserialize((const unsigned char *) newer, strlen(newer)));
+    REQUIRE(msg2.set_blob_version.version == BLOB_VERSION_LATEST);
+
+    const char *missing = R"({"msg_type": "CONTROL_MSG_TYPE_SET_BLOB_VERSION"})";
+    struct ControlMessage msg3{};
+    REQUIRE(msg3.JsonDeserialize((const unsigned char *) missing, strlen(missing)));
+    REQUIRE(msg3.set_blob_version.version == BLOB_VERSION_1);
+}
+
+
 TEST_CASE("serialize inject text", "[message][ControlMessage]") {
     struct ControlMessage msg = {
             .type = CONTROL_MSG_TYPE_INJECT_TEXT,
@@ -390,3 +487,67 @@ TEST_CASE("deserialize clipboard", "[message][ControlMessage]") {
 }
 
 
+TEST_CASE("deserialize inject touch event", "[message][ControlMessage]") {
+    const unsigned char input[] = {
+            CONTROL_MSG_TYPE_INJECT_TOUCH_EVENT,
+            0x00, // AKEY_EVENT_ACTION_DOWN
+            0x12, 0x34, 0x56, 0x78, 0x87, 0x65, 0x43, 0x21, // pointer id
+            0x00, 0x00, 0x00, 0x64, 0x00, 0x00, 0x00, 0xc8, // 100 200
+            0x04, 0x38, 0x07, 0x80, // 1080 1920
+            0x80, 0x00, // pressure
+            0x00, 0x00, 0x00, 0x01 // AMOTION_EVENT_BUTTON_PRIMARY
+    };
+
+    struct ControlMessage msg{};
+    // incomplete
+    REQUIRE(msg.Deserialize(input, sizeof(input) - 1) == 0);
+    REQUIRE(msg.Deserialize(input, sizeof(input)) == 28);
+    REQUIRE(msg.type == CONTROL_MSG_TYPE_INJECT_TOUCH_EVENT);
+    REQUIRE(msg.inject_touch_event.action == AMOTION_EVENT_ACTION_DOWN);
+    REQUIRE(msg.inject_touch_event.pointer_id == 0x1234567887654321L);
+    REQUIRE(msg.inject_touch_event.position.point.x == 100);
+    REQUIRE(msg.inject_touch_event.position.point.y == 200);
+    REQUIRE(msg.inject_touch_event.position.screen_size.width == 1080);
+    REQUIRE(msg.inject_touch_event.position.screen_size.height == 1920);
+    REQUIRE(msg.inject_touch_event.pressure == 0.5f);
+    REQUIRE(msg.inject_touch_event.buttons == AMOTION_EVENT_BUTTON_PRIMARY);
+}
+
+TEST_CASE("deserialize set clipboard", "[message][ControlMessage]") {
+    struct ControlMessage msg = {
+            .type = CONTROL_MSG_TYPE_SET_CLIPBOARD,
+            .set_clipboard = {
+                    .text = const_cast<char *>("hello, world!"),
+            },
+    };
+    unsigned char buf[CONTROL_MSG_SERIALIZED_MAX_SIZE];
+    int size = msg.Serialize(buf);
+
+    struct ControlMessage out{};
+    REQUIRE(out.Deserialize(buf, size - 1) == 0);
+    REQUIRE(out.Deserialize(buf, size) == size);
+    REQUIRE(out.type == CONTROL_MSG_TYPE_SET_CLIPBOARD);
+    REQUIRE(!strcmp("hello, world!", out.set_clipboard.text));
+
+    out.Destroy();
+}
+
+TEST_CASE("serialize clipboard", "[message][ControlMessage]") {
+    struct DeviceMessage msg = {
+            .type = DEVICE_MSG_TYPE_CLIPBOARD,
+            .clipboard = {
+                    .text = const_cast<char *>("ABC"),
+            },
+    };
+
+    unsigned char buf[DEVICE_MSG_SERIALIZED_MAX_SIZE];
+    size_t size = msg.Serialize(buf);
+    REQUIRE(size == 6);
+
+    const unsigned char expected[] = {
+            DEVICE_MSG_TYPE_CLIPBOARD,
+            0x00, 0x03, // text length
+            0x41, 0x42, 0x43, // "ABC"
+    };
+    REQUIRE(!memcmp(buf, expected, sizeof(expected)));
+}
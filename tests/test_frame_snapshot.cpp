@@ -0,0 +1,112 @@
+//
+// Created by James Shen on 17/10/26.
+// Copyright (c) 2020 GUIDEBEE IT. All rights reserved
+//
+
+#include <thread>
+
+#include "catch2/catch.hpp"
+#include "ai/frame_snapshot.hpp"
+#include "test_frames.hpp"
+
+using namespace irobot;
+using namespace irobot::ai;
+
+TEST_CASE("frame snapshot", "[ai][frame_snapshot]") {
+    video::FpsCounter fps_counter;
+    REQUIRE(fps_counter.Init());
+    video::VideoBuffer vb{};
+    REQUIRE(vb.Init(&fps_counter, false, 4));
+    int agent = vb.RegisterConsumer("agent", 0, false);
+
+    REQUIRE(!FrameSnapshot::Create(&vb, agent));
+    offer_frame(&vb, 100, 64, 48, 100 * 1000);
+    REQUIRE(vb.AcquireFrame(agent));
+    int slot = vb.consumers[agent].slot;
+    FrameSnapshot *snapshot = FrameSnapshot::Create(&vb, agent);
+    REQUIRE(snapshot);
+    REQUIRE(snapshot->frame_number == 1);
+    REQUIRE(snapshot->pts == 100000);
+    REQUIRE(snapshot->width == 64);
+    REQUIRE(snapshot->height == 48);
+
+    // still pinned once the consumer moves on
+    vb.ReleaseFrame(agent);
+    REQUIRE(SDL_AtomicGet(&vb.slots[slot].pins) == 1);
+
+    // converted once, shared
+    cv::Mat gray = snapshot->GetScaled(32, false);
+    REQUIRE(gray.size() == cv::Size(32, 24));
+    REQUIRE(gray.type() == CV_8UC1);
+    REQUIRE(snapshot->GetScaled(32, false).data == gray.data);
+    REQUIRE(snapshot->GetImageCount() == 1);
+    // the levels of the BGR image
+    cv::Mat bgr = snapshot->GetBGR();
+    REQUIRE(bgr.size() == cv::Size(64, 48));
+    REQUIRE(bgr.type() == CV_8UC3);
+    REQUIRE(gray.at<uint8_t>(10, 10) == bgr.at<cv::Vec3b>(10, 10)[1]);
+    // not smaller: the full size image
+    REQUIRE(snapshot->GetScaled(64, true).data == bgr.data);
+    REQUIRE(snapshot->GetImageCount() == 2);
+
+    // analyses on other threads
+    cv::Mat images[4];
+    std::thread threads[4];
+    for (int i = 0; i < 4; ++i) {
+        snapshot->Acquire();
+        threads[i] = std::thread([snapshot, &images, i] {
+            images[i] = snapshot->GetScaled(16, i % 2);
+            snapshot->Release();
+        });
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+    REQUIRE(images[0].data == images[2].data);
+    REQUIRE(images[1].data == images[3].data);
+    REQUIRE(images[0].type() == CV_8UC1);
+    REQUIRE(images[1].type() == CV_8UC3);
+    REQUIRE(snapshot->GetImageCount() == 4);
+
+    // the images outlive the snapshot
+    snapshot->Release();
+    REQUIRE(SDL_AtomicGet(&vb.slots[slot].pins) == 0);
+    REQUIRE(gray.at<uint8_t>(0, 0) == bgr.at<cv::Vec3b>(0, 0)[0]);
+
+    vb.Destroy();
+    fps_counter.Destroy();
+}
+
+TEST_CASE("frame snapshot hash", "[ai][frame_snapshot]") {
+    video::FpsCounter fps_counter;
+    REQUIRE(fps_counter.Init());
+    video::VideoBuffer vb{};
+    REQUIRE(vb.Init(&fps_counter, false, 4));
+    int agent = vb.RegisterConsumer("agent", 0, false);
+    offer_frame(&vb, 100, 64, 48, 100 * 1000);
+    REQUIRE(vb.AcquireFrame(agent));
+
+    FrameSnapshot *snapshot = FrameSnapshot::Create(&vb, agent);
+    REQUIRE(snapshot);
+    // computed once, from the full size gray image (not larger than the
+    // hash size)
+    cv::Mat hash = snapshot->GetHash();
+    REQUIRE(!hash.empty());
+    REQUIRE(snapshot->GetHash().data == hash.data);
+    REQUIRE(snapshot->GetImageCount() == 2);
+    snapshot->Release();
+    vb.ReleaseFrame(agent);
+
+    // the same for the same content
+    offer_frame(&vb, 100, 64, 48, 200 * 1000);
+    REQUIRE(vb.AcquireFrame(agent));
+    snapshot = FrameSnapshot::Create(&vb, agent);
+    cv::Mat other = snapshot->GetHash();
+    REQUIRE(other.size() == hash.size());
+    REQUIRE(!memcmp(other.data, hash.data, other.cols));
+    snapshot->Release();
+    vb.ReleaseFrame(agent);
+
+    vb.Destroy();
+    fps_counter.Destroy();
+}
@@ -0,0 +1,69 @@
+//
+// Created by James Shen on 17/10/26.
+// Copyright (c) 2020 GUIDEBEE IT. All rights reserved
+//
+
+#ifndef ANDROID_IROBOT_TEST_FRAMES_HPP
+#define ANDROID_IROBOT_TEST_FRAMES_HPP
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+
+#include "catch2/catch.hpp"
+#include "video/video_buffer.hpp"
+
+// allocate a YUV420P frame whose luma is the value luma, with gray chroma
+inline void fill_frame(AVFrame *frame, int width, int height, int luma) {
+    frame->format = AV_PIX_FMT_YUV420P;
+    frame->width = width;
+    frame->height = height;
+    REQUIRE(av_frame_get_buffer(frame, 32) == 0);
+    memset(frame->data[0], luma, frame->linesize[0] * height);
+    memset(frame->data[1], 128, frame->linesize[1] * height / 2);
+    memset(frame->data[2], 128, frame->linesize[2] * height / 2);
+}
+
+// decode such a frame
+inline void offer_frame(irobot::video::VideoBuffer *vb, int luma, int width = 16,
+                        int height = 16, int64_t pts = AV_NOPTS_VALUE) {
+    AVFrame *frame = vb->decoding_frame;
+    fill_frame(frame, width, height, luma);
+    frame->pts = pts;
+    vb->OfferDecodedFrame();
+}
+
+// a device screen, as decoded (a textured one, the caller frees it)
+inline AVFrame *alloc_screen(int width, int height) {
+    AVFrame *frame = av_frame_alloc();
+    REQUIRE(frame);
+    frame->format = AV_PIX_FMT_YUV420P;
+    frame->width = width;
+    frame->height = height;
+    REQUIRE(av_frame_get_buffer(frame, 32) == 0);
+    srand(42);
+    for (int p = 0; p < 3; ++p) {
+        int plane_height = p ? height / 2 : height;
+        for (int y = 0; y < plane_height; ++y) {
+            for (int x = 0; x < frame->linesize[p]; ++x) {
+                frame->data[p][y * frame->linesize[p] + x] = (uint8_t) (x + y + rand() % 16);
+            }
+        }
+    }
+    return frame;
+}
+
+// mean time of f() in microseconds, over nr_runs
+template<typename F>
+inline double measure_us(F f, int nr_runs) {
+    // the first run initializes OpenCV (e.g. its thread pool)
+    f();
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < nr_runs; ++i) {
+        f();
+    }
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::micro>(end - start).count() / nr_runs;
+}
+
+#endif //ANDROID_IROBOT_TEST_FRAMES_HPP
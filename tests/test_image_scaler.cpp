@@ -0,0 +1,163 @@
+//
+// Created by James Shen on 17/10/26.
+// Copyright (c) 2020 GUIDEBEE IT. All rights reserved
+//
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <vector>
+
+#include "catch2/catch.hpp"
+#include "ai/image_scaler.hpp"
+
+using namespace irobot::ai;
+
+static AVFrame *alloc_frame(int width, int height) {
+    AVFrame *frame = av_frame_alloc();
+    REQUIRE(frame);
+    frame->format = AV_PIX_FMT_YUV420P;
+    frame->width = width;
+    frame->height = height;
+    REQUIRE(av_frame_get_buffer(frame, 32) == 0);
+    return frame;
+}
+
+static void fill_random(AVFrame *frame) {
+    srand(42);
+    for (int p = 0; p < 3; ++p) {
+        int height = p ? (frame->height + 1) / 2 : frame->height;
+        for (int y = 0; y < height; ++y) {
+            for (int x = 0; x < frame->linesize[p]; ++x) {
+                frame->data[p][y * frame->linesize[p] + x] = (uint8_t) rand();
+            }
+        }
+    }
+}
+
+// smooth content, so that the bilinear sampling differences stay small
+static void fill_gradient(AVFrame *frame) {
+    for (int p = 0; p < 3; ++p) {
+        int width = p ? (frame->width + 1) / 2 : frame->width;
+        int height = p ? (frame->height + 1) / 2 : frame->height;
+        for (int y = 0; y < height; ++y) {
+            for (int x = 0; x < width; ++x) {
+                double v = 128 + 100 * sin((x + 3 * p) / 37.0) * cos(y / 53.0);
+                frame->data[p][y * frame->linesize[p] + x] = (uint8_t) v;
+            }
+        }
+    }
+}
+
+// bilinear sample of a plane in floating point, like cv::resize()
+static double sample(const AVFrame *frame, int p, int dst_width, int dst_height,
+                     int x, int y) {
+    int width = p ? (frame->width + 1) / 2 : frame->width;
+    int height = p ? (frame->height + 1) / 2 : frame->height;
+    double sx = std::max(0.0, (x + 0.5) * width / dst_width - 0.5);
+    double sy = std::max(0.0, (y + 0.5) * height / dst_height - 0.5);
+    int x0 = std::min((int) sx, width - 1);
+    int y0 = std::min((int) sy, height - 1);
+    int x1 = std::min(x0 + 1, width - 1);
+    int y1 = std::min(y0 + 1, height - 1);
+    double fx = sx - x0;
+    double fy = sy - y0;
+    auto at = [&](int px, int py) {
+        return (double) frame->data[p][py * frame->linesize[p] + px];
+    };
+    return (at(x0, y0) * (1 - fx) + at(x1, y0) * fx) * (1 - fy)
+           + (at(x0, y1) * (1 - fx) + at(x1, y1) * fx) * fy;
+}
+
+static double clip(double v) {
+    return std::min(255.0, std::max(0.0, v));
+}
+
+TEST_CASE("image scaler computes the scaled size", "[ai][image_scaler]") {
+    int width;
+    int height;
+    GetScaledSize(1080, 2400, 800, &width, &height);
+    REQUIRE(width == 360);
+    REQUIRE(height == 800);
+    GetScaledSize(2400, 1080, 240, &width, &height);
+    REQUIRE(width == 240);
+    REQUIRE(height == 108);
+}
+
+TEST_CASE("image scaler paths give the same output", "[ai][image_scaler]") {
+    // odd sizes, to exercise the SIMD tails and the chroma rounding
+    AVFrame *frame = alloc_frame(1079, 2401);
+    fill_random(frame);
+
+    int max_sizes[] = {800, 240, 1500};
+    for (int max_size : max_sizes) {
+        int width;
+        int height;
+        GetScaledSize(frame->width, frame->height, max_size, &width, &height);
+        std::vector<uint8_t> gray_ref(width * height);
+        std::vector<uint8_t> bgr_ref(width * height * 3);
+        REQUIRE(ScaleI420ToGray(frame, gray_ref.data(), width, width, height,
+                                SCALER_ISA_SCALAR));
+        REQUIRE(ScaleI420ToBGR(frame, bgr_ref.data(), width * 3, width, height,
+                               SCALER_ISA_SCALAR));
+
+        enum ScalerIsa isas[] = {SCALER_ISA_SSE41, SCALER_ISA_AVX2, SCALER_ISA_AUTO};
+        for (enum ScalerIsa isa : isas) {
+            std::vector<uint8_t> gray(width * height);
+            std::vector<uint8_t> bgr(width * height * 3);
+            REQUIRE(ScaleI420ToGray(frame, gray.data(), width, width, height, isa));
+            REQUIRE(ScaleI420ToBGR(frame, bgr.data(), width * 3, width, height, isa));
+            REQUIRE(gray == gray_ref);
+            REQUIRE(bgr == bgr_ref);
+        }
+    }
+
+    av_frame_free(&frame);
+}
+
+TEST_CASE("image scaler matches the conversion chain", "[ai][image_scaler]") {
+    AVFrame *frame = alloc_frame(1080, 2400);
+    fill_gradient(frame);
+
+    int width;
+    int height;
+    GetScaledSize(frame->width, frame->height, 240, &width, &height);
+    std::vector<uint8_t> gray(width * height);
+    std::vector<uint8_t> bgr(width * height * 3);
+    REQUIRE(ScaleI420ToGray(frame, gray.data(), width, width, height, SCALER_ISA_AUTO));
+    REQUIRE(ScaleI420ToBGR(frame, bgr.data(), width * 3, width, height, SCALER_ISA_AUTO));
+
+    int max_error = 0;
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            // BT.601 limited range
+            double c = 1.164 * (sample(frame, 0, width, height, x, y) - 16);
+            double d = sample(frame, 1, width, height, x, y) - 128;
+            double e = sample(frame, 2, width, height, x, y) - 128;
+            double expected[4] = {
+                    clip(c + 2.018 * d),
+                    clip(c - 0.391 * d - 0.813 * e),
+                    clip(c + 1.596 * e),
+                    clip(c),
+            };
+            const uint8_t *pixel = &bgr[(y * width + x) * 3];
+            uint8_t actual[4] = {pixel[0], pixel[1], pixel[2], gray[y * width + x]};
+            for (int i = 0; i < 4; ++i) {
+                max_error = std::max(max_error,
+                                     (int) std::lround(std::fabs(actual[i] - expected[i])));
+            }
+        }
+    }
+    REQUIRE(max_error <= 3);
+
+    av_frame_free(&frame);
+}
+
+TEST_CASE("image scaler rejects other formats", "[ai][image_scaler]") {
+    AVFrame *frame = alloc_frame(64, 64);
+    frame->format = AV_PIX_FMT_NV12;
+    uint8_t out[32 * 32 * 3];
+    REQUIRE(!ScaleI420ToGray(frame, out, 32, 32, 32, SCALER_ISA_AUTO));
+    REQUIRE(!ScaleI420ToBGR(frame, out, 32 * 3, 32, 32, SCALER_ISA_AUTO));
+    av_frame_free(&frame);
+}
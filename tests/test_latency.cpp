@@ -0,0 +1,91 @@
+//
+// Created by James Shen on 17/10/26.
+// Copyright (c) 2020 GUIDEBEE IT. All rights reserved
+//
+
+#include "catch2/catch.hpp"
+#include "video/latency.hpp"
+
+using namespace irobot::video;
+
+TEST_CASE("latency buckets", "[video][latency]") {
+    // exact below 64 us
+    for (uint32_t v = 0; v < 64; ++v) {
+        REQUIRE(LatencyHistogram::GetBucket(v) == (int) v);
+        REQUIRE(LatencyHistogram::GetBucketValue((int) v) == v);
+    }
+    // then each bucket covers its values, with a 1/32 precision
+    uint32_t values[] = {64, 65, 100, 1000, 16667, 100000, 5000000, UINT32_MAX};
+    for (uint32_t v : values) {
+        int bucket = LatencyHistogram::GetBucket(v);
+        REQUIRE(bucket < LATENCY_NR_BUCKETS);
+        uint32_t upper = LatencyHistogram::GetBucketValue(bucket);
+        REQUIRE(upper >= v);
+        REQUIRE(upper - v <= v / 32);
+        REQUIRE(LatencyHistogram::GetBucketValue(bucket - 1) < v);
+    }
+}
+
+TEST_CASE("latency percentiles", "[video][latency]") {
+    LatencyHistogram histogram;
+    REQUIRE(histogram.Percentile(0.5) == 0);
+
+    // 1..1000 ms
+    for (uint32_t i = 1; i <= 1000; ++i) {
+        histogram.Record(i * 1000);
+    }
+    REQUIRE(SDL_AtomicGet(&histogram.count) == 1000);
+    REQUIRE(SDL_AtomicGet(&histogram.max) == 1000000);
+    uint32_t p50 = histogram.Percentile(0.5);
+    uint32_t p99 = histogram.Percentile(0.99);
+    uint32_t p999 = histogram.Percentile(0.999);
+    REQUIRE(p50 >= 500000);
+    REQUIRE(p50 <= 500000 + 500000 / 32);
+    REQUIRE(p99 >= 990000);
+    REQUIRE(p99 <= 990000 + 990000 / 32);
+    REQUIRE(p999 >= 999000);
+    // never above the max
+    REQUIRE(histogram.Percentile(1) == 1000000);
+}
+
+TEST_CASE("latency tracker marks", "[video][latency]") {
+    LatencyTracker tracker;
+    int id = tracker.Begin(1000, 3000);
+    REQUIRE(id > 0);
+    REQUIRE(SDL_AtomicGet(&tracker.stages[LATENCY_STAGE_BODY].count) == 1);
+    REQUIRE(tracker.stages[LATENCY_STAGE_BODY].Percentile(0.5) == 2000);
+
+    // no conversion yet, the agent cannot be measured
+    REQUIRE(tracker.Mark(id, LATENCY_STAGE_PARSED) >= 0);
+    REQUIRE(tracker.Mark(id, LATENCY_STAGE_DECODED) >= 0);
+    REQUIRE(tracker.Mark(id, LATENCY_STAGE_SERIALIZED) == -1);
+    REQUIRE(tracker.Mark(id, LATENCY_STAGE_RENDERED) >= 0);
+    // only the first mark counts
+    REQUIRE(tracker.Mark(id, LATENCY_STAGE_RENDERED) == -1);
+    REQUIRE(SDL_AtomicGet(&tracker.stages[LATENCY_STAGE_RENDERED].count) == 1);
+    REQUIRE(SDL_AtomicGet(&tracker.screen_total.count) == 1);
+    REQUIRE(SDL_AtomicGet(&tracker.agent_total.count) == 0);
+
+    // the timeline of a frame is reused LATENCY_NR_TIMELINES frames later
+    for (int i = 0; i < LATENCY_NR_TIMELINES; ++i) {
+        tracker.Begin(0, 0);
+    }
+    REQUIRE(tracker.Mark(id, LATENCY_STAGE_CONVERTED) == -1);
+    REQUIRE(tracker.Mark(0, LATENCY_STAGE_PARSED) == -1);
+}
+
+TEST_CASE("latency tracker periodic report", "[video][latency]") {
+    LatencyTracker tracker;
+    // disabled
+    tracker.Report(1000);
+    REQUIRE(tracker.last_report == 0);
+
+    tracker.report_interval = 1000;
+    // the first call starts the interval
+    tracker.Report(5000);
+    REQUIRE(tracker.last_report == 5000);
+    tracker.Report(5999);
+    REQUIRE(tracker.last_report == 5000);
+    tracker.Report(6000);
+    REQUIRE(tracker.last_report == 6000);
+}
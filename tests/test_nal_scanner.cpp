@@ -0,0 +1,219 @@
+//
+// Created by James Shen on 17/10/26.
+// Copyright (c) 2020 GUIDEBEE IT. All rights reserved
+//
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "catch2/catch.hpp"
+#include "video/nal_scanner.hpp"
+#include "video/raw_writer.hpp"
+
+using namespace irobot::video;
+
+static void AppendNal(std::vector<uint8_t> *data, uint8_t header, size_t len,
+                      bool long_start_code = false) {
+    if (long_start_code) {
+        data->push_back(0);
+    }
+    data->push_back(0);
+    data->push_back(0);
+    data->push_back(1);
+    data->push_back(header);
+    for (size_t i = 0; i < len; ++i) {
+        // emulation prevention: never two zeros followed by a byte <= 3
+        data->push_back(i % 3 == 2 ? 3 : 0);
+    }
+}
+
+TEST_CASE("nal find start code", "[video][nal]") {
+    uint8_t buf[64] = {};
+    memset(buf, 0xff, sizeof(buf));
+    REQUIRE(NalFindStartCode(buf, buf + sizeof(buf)) == buf + sizeof(buf));
+
+    // at every position, including across the 8-byte words and at the end
+    for (size_t i = 0; i + 3 <= sizeof(buf); ++i) {
+        memset(buf, 0xff, sizeof(buf));
+        buf[i] = 0;
+        buf[i + 1] = 0;
+        buf[i + 2] = 1;
+        REQUIRE(NalFindStartCode(buf, buf + sizeof(buf)) == buf + i);
+    }
+
+    // 00 00 03 is not a start code
+    memset(buf, 0, sizeof(buf));
+    for (size_t i = 2; i < sizeof(buf); i += 3) {
+        buf[i] = 3;
+    }
+    REQUIRE(NalFindStartCode(buf, buf + sizeof(buf)) == buf + sizeof(buf));
+
+    // truncated
+    uint8_t truncated[] = {0x42, 0, 0};
+    REQUIRE(NalFindStartCode(truncated, truncated + 3) == truncated + 3);
+}
+
+TEST_CASE("nal scan", "[video][nal]") {
+    struct NalInfo info{};
+
+    // config + IDR, as concatenated by the stream
+    std::vector<uint8_t> key;
+    AppendNal(&key, 0x67, 20, true); // SPS
+    AppendNal(&key, 0x68, 4, true);  // PPS
+    AppendNal(&key, 0x65, 5000);     // IDR, nal_ref_idc 3
+    AppendNal(&key, 0x65, 100);      // second slice
+    REQUIRE(NalScan(key.data(), key.size(), &info));
+    REQUIRE(info.key);
+    REQUIRE(info.type == NAL_TYPE_IDR);
+    REQUIRE(info.ref_idc == 3);
+    REQUIRE(info.types == (NAL_TYPE_MASK(NAL_TYPE_SPS)
+                           | NAL_TYPE_MASK(NAL_TYPE_PPS)
+                           | NAL_TYPE_MASK(NAL_TYPE_IDR)));
+
+    std::vector<uint8_t> ref;
+    AppendNal(&ref, 0x09, 1);  // AUD
+    AppendNal(&ref, 0x41, 500); // P, nal_ref_idc 2
+    REQUIRE(NalScan(ref.data(), ref.size(), &info));
+    REQUIRE(!info.key);
+    REQUIRE(info.type == NAL_TYPE_SLICE);
+    REQUIRE(info.ref_idc == 2);
+
+    std::vector<uint8_t> disposable;
+    AppendNal(&disposable, 0x01, 500); // nal_ref_idc 0
+    REQUIRE(NalScan(disposable.data(), disposable.size(), &info));
+    REQUIRE(info.type == NAL_TYPE_SLICE);
+    REQUIRE(info.ref_idc == 0);
+
+    // no slice
+    std::vector<uint8_t> sei;
+    AppendNal(&sei, 0x06, 10);
+    REQUIRE(NalScan(sei.data(), sei.size(), &info));
+    REQUIRE(info.type == 0);
+    REQUIRE(info.types == NAL_TYPE_MASK(NAL_TYPE_SEI));
+
+    uint8_t garbage[] = {1, 2, 3, 4, 5, 0, 0};
+    REQUIRE(!NalScan(garbage, sizeof(garbage), &info));
+    REQUIRE(!NalScan(garbage, 0, &info));
+}
+
+static std::vector<uint8_t> ReadFile(const char *filename) {
+    FILE *file = fopen(filename, "rb");
+    REQUIRE(file);
+    std::vector<uint8_t> data;
+    uint8_t buf[4096];
+    size_t r;
+    while ((r = fread(buf, 1, sizeof(buf), file)) > 0) {
+        data.insert(data.end(), buf, buf + r);
+    }
+    fclose(file);
+    return data;
+}
+
+// Split a raw recording (irobot -Nr file.h264) with av_parser_parse2(), fed
+// as a byte stream: each frame must be a packet of the recording (with the
+// config packet before it, as the stream concatenates them), with the key
+// frame flag of the parser.
+static void CompareWithParser(const char *filename, size_t *nr_frames,
+                              size_t *nr_keys) {
+    std::vector<uint8_t> data = ReadFile(filename);
+    char *index_filename = RawWriter::GetIndexFilename(filename);
+    std::vector<uint8_t> index = ReadFile(index_filename);
+    SDL_free(index_filename);
+    REQUIRE(index.size() >= RAW_INDEX_HEADER_SIZE);
+    REQUIRE(RawWriter::ReadIndexHeader(index.data()));
+
+    // the packet boundaries
+    std::vector<uint64_t> starts;
+    bool config = false;
+    uint64_t config_offset = 0;
+    for (size_t offset = RAW_INDEX_HEADER_SIZE; offset + RAW_INDEX_ENTRY_SIZE <= index.size();
+         offset += RAW_INDEX_ENTRY_SIZE) {
+        struct RawIndexEntry entry{};
+        RawWriter::ReadIndexEntry(&index[offset], &entry);
+        if (entry.flags & RAW_INDEX_FLAG_CONFIG) {
+            if (!config) {
+                config_offset = entry.offset;
+            }
+            config = true;
+            continue;
+        }
+        starts.push_back(config ? config_offset : entry.offset);
+        config = false;
+    }
+
+    AVCodec *codec = avcodec_find_decoder(AV_CODEC_ID_H264);
+    REQUIRE(codec);
+    AVCodecContext *codec_ctx = avcodec_alloc_context3(codec);
+    REQUIRE(codec_ctx);
+    AVCodecParserContext *parser = av_parser_init(AV_CODEC_ID_H264);
+    REQUIRE(parser);
+
+    *nr_frames = 0;
+    *nr_keys = 0;
+    uint64_t frame_start = 0;
+    size_t pos = 0;
+    std::vector<uint8_t> chunk;
+    for (;;) {
+        // arbitrary chunks, the parser finds the frame boundaries
+        size_t len = std::min((size_t) 1000, data.size() - pos);
+        chunk.assign(len + AV_INPUT_BUFFER_PADDING_SIZE, 0);
+        memcpy(chunk.data(), &data[pos], len);
+        uint8_t *out_data = nullptr;
+        int out_len = 0;
+        int r = av_parser_parse2(parser, codec_ctx, &out_data, &out_len,
+                                 chunk.data(), (int) len,
+                                 AV_NOPTS_VALUE, AV_NOPTS_VALUE, -1);
+        REQUIRE(r >= 0);
+        pos += r;
+        if (out_len) {
+            INFO("frame " << *nr_frames);
+            REQUIRE(*nr_frames < starts.size());
+            REQUIRE(frame_start == starts[*nr_frames]);
+
+            struct NalInfo info{};
+            REQUIRE(NalScan(out_data, out_len, &info));
+            REQUIRE(info.key == (parser->key_frame == 1));
+
+            frame_start += out_len;
+            ++*nr_frames;
+            *nr_keys += info.key;
+        }
+        if (!len) {
+            // flushed
+            break;
+        }
+    }
+    REQUIRE(*nr_frames == starts.size());
+    REQUIRE(frame_start == data.size());
+
+    av_parser_close(parser);
+    avcodec_free_context(&codec_ctx);
+}
+
+TEST_CASE("nal scan recorded stream", "[video][nal]") {
+    // 60 frames of 160x96, 2 slices each, an IDR every 20 frames: encoded
+    // by x264 (config packet, then a packet per frame, like the device), and
+    // written by RawWriter
+    size_t nr_frames;
+    size_t nr_keys;
+    CompareWithParser(IROBOT_TEST_DATA_DIR "/screen_record.h264", &nr_frames, &nr_keys);
+    REQUIRE(nr_frames == 60);
+    REQUIRE(nr_keys == 3);
+}
+
+// The same on any raw recording:
+//     IROBOT_TEST_RECORDING=file.h264 all_tests "[recording]"
+TEST_CASE("nal scan raw recording", "[.][video][nal][recording]") {
+    const char *filename = getenv("IROBOT_TEST_RECORDING");
+    if (!filename) {
+        WARN("IROBOT_TEST_RECORDING not set");
+        return;
+    }
+    size_t nr_frames;
+    size_t nr_keys;
+    CompareWithParser(filename, &nr_frames, &nr_keys);
+    REQUIRE(nr_frames);
+}
@@ -0,0 +1,66 @@
+//
+// Created by James Shen on 17/10/26.
+// Copyright (c) 2020 GUIDEBEE IT. All rights reserved
+//
+
+#include "catch2/catch.hpp"
+#include "video/packet_pool.hpp"
+
+using namespace irobot::video;
+
+TEST_CASE("packet pool size classes", "[video][packet_pool]") {
+    REQUIRE(PacketPool::GetSizeClass(1) == 0);
+    REQUIRE(PacketPool::GetSizeClass(PACKET_POOL_MIN_CLASS_SIZE
+                                      - AV_INPUT_BUFFER_PADDING_SIZE) == 0);
+    REQUIRE(PacketPool::GetSizeClass(PACKET_POOL_MIN_CLASS_SIZE) == 1);
+    REQUIRE(PacketPool::GetSizeClass(PACKET_MAX_SIZE)
+            == PACKET_POOL_NR_CLASSES - 1);
+    REQUIRE(PacketPool::GetSizeClass(PACKET_MAX_SIZE + 1) == -1);
+}
+
+TEST_CASE("packet pool reuses released buffers", "[video][packet_pool]") {
+    PacketPool pool;
+    REQUIRE(pool.Init());
+
+    for (int i = 0; i < 10; ++i) {
+        AVPacket packet;
+        REQUIRE(pool.Alloc(&packet, 1000));
+        REQUIRE(packet.size == 1000);
+        REQUIRE(packet.buf);
+        REQUIRE(packet.data[1000] == 0); // padding
+        memset(packet.data, 0xff, 1000 + AV_INPUT_BUFFER_PADDING_SIZE);
+
+        // a downstream reference shares the same buffer
+        AVPacket ref;
+        av_init_packet(&ref);
+        REQUIRE(!av_packet_ref(&ref, &packet));
+        REQUIRE(ref.data == packet.data);
+
+        av_packet_unref(&packet);
+        av_packet_unref(&ref);
+    }
+
+    struct PacketPoolStats stats{};
+    pool.GetStats(&stats);
+    REQUIRE(stats.misses == 1);
+    REQUIRE(stats.hits == 9);
+    REQUIRE(stats.rejected == 0);
+
+    pool.Destroy();
+}
+
+TEST_CASE("packet pool rejects oversized packets", "[video][packet_pool]") {
+    PacketPool pool;
+    REQUIRE(pool.Init());
+
+    AVPacket packet;
+    REQUIRE(!pool.Alloc(&packet, 0xFFFFFFFF));
+    REQUIRE(!pool.Alloc(&packet, PACKET_MAX_SIZE + 1));
+
+    struct PacketPoolStats stats{};
+    pool.GetStats(&stats);
+    REQUIRE(stats.rejected == 2);
+    REQUIRE(stats.misses == 0);
+
+    pool.Destroy();
+}
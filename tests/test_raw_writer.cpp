@@ -0,0 +1,82 @@
+//
+// Created by James Shen on 17/10/26.
+// Copyright (c) 2020 GUIDEBEE IT. All rights reserved
+//
+
+#include "catch2/catch.hpp"
+#include "video/raw_writer.hpp"
+
+using namespace irobot::video;
+
+static void WritePacket(RawWriter *writer, int64_t pts, int size, bool key) {
+    AVPacket packet;
+    REQUIRE(!av_new_packet(&packet, size));
+    memset(packet.data, (int) (pts & 0xff), size);
+    packet.pts = pts;
+    if (key) {
+        packet.flags |= AV_PKT_FLAG_KEY;
+    }
+    REQUIRE(writer->Write(&packet));
+    av_packet_unref(&packet);
+}
+
+TEST_CASE("raw writer stream and index", "[video][raw]") {
+    const char *filename = "test_raw_writer.h264";
+    RawWriter writer{};
+    REQUIRE(writer.Open(filename));
+    WritePacket(&writer, AV_NOPTS_VALUE, 30, false);
+    // larger than a buffer
+    WritePacket(&writer, 0, RAW_WRITER_BUFFER_SIZE + 100, true);
+    for (int i = 1; i < 5000; ++i) {
+        WritePacket(&writer, i, 100, i % 1000 == 0);
+    }
+    REQUIRE(writer.Close());
+
+    FILE *file = fopen(filename, "rb");
+    REQUIRE(file);
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    REQUIRE(size == 30 + RAW_WRITER_BUFFER_SIZE + 100 + 4999 * 100);
+
+    char *index_filename = RawWriter::GetIndexFilename(filename);
+    FILE *index_file = fopen(index_filename, "rb");
+    REQUIRE(index_file);
+    fseek(index_file, 0, SEEK_END);
+    REQUIRE(ftell(index_file) == RAW_INDEX_HEADER_SIZE + 5001 * RAW_INDEX_ENTRY_SIZE);
+
+    uint8_t buf[RAW_INDEX_ENTRY_SIZE];
+    fseek(index_file, 0, SEEK_SET);
+    REQUIRE(fread(buf, 1, RAW_INDEX_HEADER_SIZE, index_file) == RAW_INDEX_HEADER_SIZE);
+    REQUIRE(RawWriter::ReadIndexHeader(buf));
+
+    auto *entries = new RawIndexEntry[5001];
+    for (int i = 0; i < 5001; ++i) {
+        REQUIRE(fread(buf, 1, RAW_INDEX_ENTRY_SIZE, index_file) == RAW_INDEX_ENTRY_SIZE);
+        RawWriter::ReadIndexEntry(buf, &entries[i]);
+    }
+    REQUIRE(entries[0].flags == RAW_INDEX_FLAG_CONFIG);
+    REQUIRE(entries[0].pts == AV_NOPTS_VALUE);
+    REQUIRE(entries[1].offset == 30);
+    REQUIRE(entries[1].flags == RAW_INDEX_FLAG_KEY);
+    REQUIRE(entries[2002].pts == 2001);
+    REQUIRE(entries[2002].flags == 0);
+
+    // the data of packet 2001
+    uint8_t data;
+    fseek(file, (long) entries[2002].offset, SEEK_SET);
+    REQUIRE(fread(&data, 1, 1, file) == 1);
+    REQUIRE(data == (2001 & 0xff));
+
+    REQUIRE(RawWriter::FindKeyFrame(entries, 5001, -1) == 1);
+    REQUIRE(RawWriter::FindKeyFrame(entries, 5001, 999) == 1);
+    REQUIRE(RawWriter::FindKeyFrame(entries, 5001, 1000) == 1001);
+    REQUIRE(RawWriter::FindKeyFrame(entries, 5001, 3500) == 3001);
+    REQUIRE(RawWriter::FindKeyFrame(entries, 5001, 100000) == 4001);
+
+    delete[] entries;
+    fclose(index_file);
+    fclose(file);
+    remove(index_filename);
+    remove(filename);
+    SDL_free(index_filename);
+}
@@ -0,0 +1,299 @@
+//
+// Created by James Shen on 17/10/26.
+// Copyright (c) 2020 GUIDEBEE IT. All rights reserved
+//
+
+#include <filesystem>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "catch2/catch.hpp"
+#include "util/lock.hpp"
+#include "video/recorder.hpp"
+
+using namespace irobot;
+using namespace irobot::video;
+
+static void PushPacket(Recorder *recorder, int64_t pts, int size, bool key) {
+    AVPacket packet;
+    REQUIRE(!av_new_packet(&packet, size));
+    memset(packet.data, (int) pts & 0xff, size);
+    packet.pts = pts;
+    packet.dts = pts;
+    if (key) {
+        packet.flags |= AV_PKT_FLAG_KEY;
+    }
+    REQUIRE(recorder->Push(&packet));
+    av_packet_unref(&packet);
+}
+
+static int64_t TakePacket(Recorder *recorder) {
+    AVPacket packet;
+    util::mutex_lock(recorder->mutex);
+    bool taken = recorder->Take(&packet);
+    util::mutex_unlock(recorder->mutex);
+    REQUIRE(taken);
+    int64_t pts = packet.pts;
+    if (pts != AV_NOPTS_VALUE) {
+        REQUIRE(packet.data[packet.size - 1] == (pts & 0xff));
+    }
+    av_packet_unref(&packet);
+    return pts;
+}
+
+TEST_CASE("recorder queue drops until key frame", "[video][recorder]") {
+    Recorder recorder{};
+    struct Size size = {1080, 1920};
+    REQUIRE(recorder.Init("test.mp4", RECORDER_FORMAT_MP4, size, 1000,
+                          RECORDER_OVERFLOW_DROP));
+
+    PushPacket(&recorder, AV_NOPTS_VALUE, 10, false); // config
+    PushPacket(&recorder, 0, 400, true);
+    PushPacket(&recorder, 1, 400, false);
+    // full: dropped, as the next packets until a key frame
+    PushPacket(&recorder, 2, 400, false);
+    PushPacket(&recorder, 3, 400, true);
+
+    struct RecorderStats stats{};
+    recorder.GetStats(&stats);
+    REQUIRE(stats.depth == 3);
+    REQUIRE(stats.bytes == 810);
+    REQUIRE(stats.nr_dropped == 2);
+
+    REQUIRE(TakePacket(&recorder) == AV_NOPTS_VALUE);
+    REQUIRE(TakePacket(&recorder) == 0);
+    // room again, but not a key frame
+    PushPacket(&recorder, 4, 400, false);
+    PushPacket(&recorder, 5, 400, true);
+    PushPacket(&recorder, 6, 100, false);
+
+    recorder.GetStats(&stats);
+    REQUIRE(stats.nr_dropped == 3);
+    REQUIRE(stats.max_depth == 3);
+    REQUIRE(TakePacket(&recorder) == 1);
+    REQUIRE(TakePacket(&recorder) == 5);
+    REQUIRE(TakePacket(&recorder) == 6);
+
+    AVPacket packet;
+    REQUIRE(!recorder.Take(&packet));
+    recorder.Destroy();
+}
+
+TEST_CASE("recorder queue spills in order", "[video][recorder]") {
+    Recorder recorder{};
+    struct Size size = {1080, 1920};
+    REQUIRE(recorder.Init("test.mp4", RECORDER_FORMAT_MP4, size, 1000,
+                          RECORDER_OVERFLOW_SPILL));
+
+    for (int i = 0; i < 6; ++i) {
+        PushPacket(&recorder, i, 400, i == 0);
+    }
+    struct RecorderStats stats{};
+    recorder.GetStats(&stats);
+    REQUIRE(stats.depth == 2);
+    REQUIRE(stats.nr_spilled == 4);
+    REQUIRE(stats.spill_bytes == 4 * (24 + 400));
+
+    REQUIRE(TakePacket(&recorder) == 0);
+    // still spilled, to keep the order
+    PushPacket(&recorder, 6, 400, false);
+    for (int i = 1; i < 7; ++i) {
+        REQUIRE(TakePacket(&recorder) == i);
+    }
+
+    // drained, queued again
+    PushPacket(&recorder, 7, 400, false);
+    recorder.GetStats(&stats);
+    REQUIRE(stats.depth == 1);
+    REQUIRE(stats.nr_spilled == 5);
+    REQUIRE(stats.spill_bytes == 0);
+    REQUIRE(TakePacket(&recorder) == 7);
+    recorder.Destroy();
+}
+
+TEST_CASE("recorder queue spills while taken", "[video][recorder]") {
+    Recorder recorder{};
+    struct Size size = {1080, 1920};
+    REQUIRE(recorder.Init("test.mp4", RECORDER_FORMAT_MP4, size, 1000,
+                          RECORDER_OVERFLOW_SPILL));
+
+    // the spill file is read and written out of the recorder mutex
+    const int nr_packets = 500;
+    std::vector<int64_t> taken;
+    std::thread consumer([&] {
+        while (taken.size() < nr_packets) {
+            AVPacket packet;
+            util::mutex_lock(recorder.mutex);
+            bool ok = recorder.Take(&packet);
+            util::mutex_unlock(recorder.mutex);
+            if (!ok) {
+                std::this_thread::yield();
+                continue;
+            }
+            REQUIRE(packet.data[packet.size - 1] == (packet.pts & 0xff));
+            taken.push_back(packet.pts);
+            av_packet_unref(&packet);
+        }
+    });
+    for (int i = 0; i < nr_packets; ++i) {
+        PushPacket(&recorder, i, 400, !(i % 30));
+    }
+    consumer.join();
+
+    for (int i = 0; i < nr_packets; ++i) {
+        REQUIRE(taken[i] == i);
+    }
+    struct RecorderStats stats{};
+    recorder.GetStats(&stats);
+    REQUIRE(stats.spill_bytes == 0);
+    recorder.Destroy();
+}
+
+// SPS and PPS of a 64x64 H.264 baseline stream
+static const uint8_t config_packet[] = {
+        0x00, 0x00, 0x00, 0x01, 0x67, 0x42, 0xc0, 0x0a, 0xd9, 0x04, 0x26, 0xc0,
+        0x44, 0x00, 0x00, 0x03, 0x00, 0x04, 0x00, 0x00, 0x03, 0x00, 0xf0, 0x3c,
+        0x48, 0x99, 0x20, 0x00, 0x00, 0x00, 0x01, 0x68, 0xcb, 0x83, 0xcb, 0x20};
+
+// as RunRecorder() would, from the calling thread
+static void WritePacket(Recorder *recorder, int64_t pts, bool key) {
+    AVPacket packet;
+    if (pts == AV_NOPTS_VALUE) {
+        REQUIRE(!av_new_packet(&packet, sizeof(config_packet)));
+        memcpy(packet.data, config_packet, sizeof(config_packet));
+    } else {
+        REQUIRE(!av_new_packet(&packet, 100));
+        memset(packet.data, 0x80, 100);
+        packet.data[0] = 0;
+        packet.data[1] = 0;
+        packet.data[2] = 1;
+        packet.data[3] = key ? 0x65 : 0x41;
+        packet.duration = 100000;
+    }
+    packet.pts = pts;
+    packet.dts = pts;
+    if (key) {
+        packet.flags |= AV_PKT_FLAG_KEY;
+    }
+    REQUIRE(recorder->Write(&packet));
+    av_packet_unref(&packet);
+}
+
+static int CountPackets(const std::string &filename) {
+    AVFormatContext *ctx = nullptr;
+    // without its trailer, a MP4 has no index and cannot be opened
+    if (avformat_open_input(&ctx, filename.c_str(), nullptr, nullptr) < 0) {
+        return -1;
+    }
+    int count = 0;
+    AVPacket packet;
+    while (av_read_frame(ctx, &packet) >= 0) {
+        ++count;
+        av_packet_unref(&packet);
+    }
+    avformat_close_input(&ctx);
+    return count;
+}
+
+TEST_CASE("recorder segments rotation and retention", "[video][recorder]") {
+    namespace fs = std::filesystem;
+    fs::path dir = fs::temp_directory_path() / "irobot_test_segments";
+    fs::remove_all(dir);
+    REQUIRE(fs::create_directories(dir));
+    std::string filename = (dir / "record.mp4").string();
+
+    Recorder recorder{};
+    struct Size size = {64, 64};
+    REQUIRE(recorder.Init(filename.c_str(), RECORDER_FORMAT_MP4, size, 1000000,
+                          RECORDER_OVERFLOW_BLOCK));
+    recorder.segment_duration = 1000000;
+    recorder.max_segments = 2;
+    REQUIRE(recorder.Open(avcodec_find_decoder(AV_CODEC_ID_H264)));
+
+    // 10 packets per second, a key frame every second: 6 segments
+    WritePacket(&recorder, AV_NOPTS_VALUE, false);
+    for (int i = 0; i < 60; ++i) {
+        WritePacket(&recorder, i * 100000, !(i % 10));
+    }
+    REQUIRE(recorder.segment_index == 5);
+    recorder.Close();
+    REQUIRE(!recorder.failed);
+    recorder.Destroy();
+
+    // the trailers are written by the finalizer thread, which deleted the
+    // oldest segments once finalized
+    for (int i = 0; i < 4; ++i) {
+        char *segment = Recorder::GetSegmentFilename(filename.c_str(), i);
+        REQUIRE(!fs::exists(segment));
+        SDL_free(segment);
+    }
+    for (int i = 4; i < 6; ++i) {
+        char *segment = Recorder::GetSegmentFilename(filename.c_str(), i);
+        REQUIRE(CountPackets(segment) == 10);
+        SDL_free(segment);
+    }
+    REQUIRE(!fs::exists(filename));
+    fs::remove_all(dir);
+}
+
+static int CountBoxes(const char *filename, const char *type) {
+    FILE *file = fopen(filename, "rb");
+    REQUIRE(file);
+    std::vector<char> data;
+    char buf[4096];
+    size_t r;
+    while ((r = fread(buf, 1, sizeof(buf), file)) > 0) {
+        data.insert(data.end(), buf, buf + r);
+    }
+    fclose(file);
+    int count = 0;
+    for (size_t i = 0; i + 4 <= data.size(); ++i) {
+        if (!memcmp(&data[i], type, 4)) {
+            ++count;
+        }
+    }
+    return count;
+}
+
+TEST_CASE("recorder fragments flushed before close", "[video][recorder]") {
+    namespace fs = std::filesystem;
+    std::string filename = (fs::temp_directory_path() / "irobot_test_fragments.mp4").string();
+
+    Recorder recorder{};
+    struct Size size = {64, 64};
+    REQUIRE(recorder.Init(filename.c_str(), RECORDER_FORMAT_MP4, size, 1000000,
+                          RECORDER_OVERFLOW_BLOCK));
+    recorder.fragment_duration = 1000000;
+    REQUIRE(recorder.Open(avcodec_find_decoder(AV_CODEC_ID_H264)));
+
+    WritePacket(&recorder, AV_NOPTS_VALUE, false);
+    for (int i = 0; i < 10; ++i) {
+        WritePacket(&recorder, i * 100000, !i);
+    }
+    // the first fragment is cut at the next key frame
+    REQUIRE(CountBoxes(filename.c_str(), "moof") == 0);
+    WritePacket(&recorder, 1000000, true);
+    REQUIRE(CountBoxes(filename.c_str(), "moof") == 1);
+    for (int i = 11; i < 21; ++i) {
+        WritePacket(&recorder, i * 100000, !(i % 10));
+    }
+    // readable as is, if the recording is killed
+    REQUIRE(CountBoxes(filename.c_str(), "moof") == 2);
+
+    recorder.Close();
+    REQUIRE(!recorder.failed);
+    recorder.Destroy();
+    REQUIRE(CountPackets(filename) == 21);
+    remove(filename.c_str());
+}
+
+TEST_CASE("recorder segment filename", "[video][recorder]") {
+    char *filename = Recorder::GetSegmentFilename("file.mp4", 1);
+    REQUIRE(!strcmp(filename, "file-0001.mp4"));
+    SDL_free(filename);
+
+    filename = Recorder::GetSegmentFilename("dir.x/file", 12);
+    REQUIRE(!strcmp(filename, "dir.x/file-0012"));
+    SDL_free(filename);
+}
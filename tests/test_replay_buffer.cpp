@@ -0,0 +1,94 @@
+//
+// Created by James Shen on 17/10/26.
+// Copyright (c) 2020 GUIDEBEE IT. All rights reserved
+//
+
+#include "catch2/catch.hpp"
+#include "video/replay_buffer.hpp"
+
+using namespace irobot;
+using namespace irobot::video;
+
+// 10 fps, a key frame every second
+#define FRAME_US 100000
+
+static void PushPacket(ReplayBuffer *replay, int64_t pts, int size, bool key) {
+    AVPacket packet;
+    REQUIRE(!av_new_packet(&packet, size));
+    packet.pts = pts;
+    packet.dts = pts;
+    if (key) {
+        packet.flags |= AV_PKT_FLAG_KEY;
+    }
+    REQUIRE(replay->Push(&packet));
+    av_packet_unref(&packet);
+}
+
+static void PushFrames(ReplayBuffer *replay, int first, int last, int size) {
+    for (int i = first; i < last; ++i) {
+        PushPacket(replay, (int64_t) i * FRAME_US, size, i % 10 == 0);
+    }
+}
+
+TEST_CASE("replay buffer keeps the last seconds", "[video][replay]") {
+    ReplayBuffer replay{};
+    struct Size size = {1080, 1920};
+    REQUIRE(replay.Init(size, 2000000, 1000000));
+
+    // not a key frame, and no config yet
+    PushPacket(&replay, 0, 100, true);
+    PushPacket(&replay, AV_NOPTS_VALUE, 10, false); // config
+    PushPacket(&replay, 0, 100, false);
+    REQUIRE(replay.count == 0);
+
+    PushFrames(&replay, 0, 45, 100);
+    struct ReplayStats stats{};
+    replay.GetStats(&stats);
+    // from the key frame at 2s, the last one covering the 2 seconds
+    REQUIRE(stats.depth == 25);
+    REQUIRE(stats.duration == 24 * FRAME_US);
+    REQUIRE(stats.nr_evicted == 0);
+
+    // a new config invalidates the buffer
+    PushPacket(&replay, AV_NOPTS_VALUE, 10, false);
+    replay.GetStats(&stats);
+    REQUIRE(stats.depth == 0);
+    REQUIRE(stats.bytes == 0);
+    REQUIRE(!replay.Save("replay.mp4"));
+
+    replay.Destroy();
+}
+
+TEST_CASE("replay buffer bounded by bytes", "[video][replay]") {
+    ReplayBuffer replay{};
+    struct Size size = {1080, 1920};
+    REQUIRE(replay.Init(size, 60000000, 25000));
+
+    PushPacket(&replay, AV_NOPTS_VALUE, 10, false);
+    // more than REPLAY_INITIAL_SLOTS packets, the ring grows
+    PushFrames(&replay, 0, 300, 10);
+    REQUIRE(replay.count == 300);
+    REQUIRE(replay.capacity > REPLAY_INITIAL_SLOTS);
+    for (int i = 0; i < replay.count; ++i) {
+        int index = (replay.head + i) % replay.capacity;
+        REQUIRE(replay.slots[index].pts == (int64_t) i * FRAME_US);
+    }
+
+    // the oldest GOPs are evicted
+    PushFrames(&replay, 300, 330, 1000);
+    struct ReplayStats stats{};
+    replay.GetStats(&stats);
+    REQUIRE(stats.bytes <= 25000);
+    REQUIRE(replay.slots[replay.head].flags & AV_PKT_FLAG_KEY);
+    REQUIRE(stats.nr_evicted > 0);
+
+    // a GOP larger than the limit cannot be kept
+    PushFrames(&replay, 330, 340, 4000);
+    replay.GetStats(&stats);
+    REQUIRE(stats.depth == 0);
+    PushFrames(&replay, 340, 345, 1000);
+    replay.GetStats(&stats);
+    REQUIRE(stats.depth == 5);
+
+    replay.Destroy();
+}
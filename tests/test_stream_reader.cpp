@@ -0,0 +1,204 @@
+//
+// Created by James Shen on 17/10/26.
+// Copyright (c) 2020 GUIDEBEE IT. All rights reserved
+//
+
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+#include "catch2/catch.hpp"
+#include "util/buffer_util.hpp"
+#include "video/stream_reader.hpp"
+
+using namespace irobot;
+using namespace irobot::video;
+
+static void append_packet(std::vector<uint8_t> &out, uint64_t pts,
+                          uint32_t len, uint8_t value) {
+    uint8_t header[STREAM_READER_HEADER_SIZE];
+    util::buffer_write64be(header, pts);
+    util::buffer_write32be(&header[8], len);
+    out.insert(out.end(), header, header + STREAM_READER_HEADER_SIZE);
+    out.insert(out.end(), len, value);
+}
+
+// copy data into the reader buffer, as a recv() would
+static void feed(StreamReader &reader, const uint8_t *data, size_t len) {
+    REQUIRE(reader.tail + len <= reader.capacity);
+    memcpy(&reader.buffer[reader.tail], data, len);
+    reader.tail += len;
+}
+
+TEST_CASE("stream reader parses buffered packets", "[video][stream_reader]") {
+    PacketPool pool;
+    REQUIRE(pool.Init());
+    StreamReader reader;
+    REQUIRE(reader.Init(INVALID_SOCKET, &pool, 4096, 0));
+
+    std::vector<uint8_t> data;
+    append_packet(data, 100, 10, 0x11);
+    append_packet(data, UINT64_C(-1), 20, 0x22);
+    append_packet(data, 300, 1000, 0x33);
+    feed(reader, data.data(), data.size());
+
+    AVPacket packet;
+    REQUIRE(reader.Parse(&packet) == STREAM_READER_PACKET);
+    REQUIRE(packet.pts == 100);
+    REQUIRE(packet.size == 10);
+    REQUIRE(packet.data[9] == 0x11);
+    av_packet_unref(&packet);
+
+    REQUIRE(reader.Parse(&packet) == STREAM_READER_PACKET);
+    REQUIRE(packet.pts == AV_NOPTS_VALUE);
+    REQUIRE(packet.size == 20);
+    av_packet_unref(&packet);
+
+    REQUIRE(reader.Parse(&packet) == STREAM_READER_PACKET);
+    REQUIRE(packet.pts == 300);
+    REQUIRE(packet.size == 1000);
+    REQUIRE(packet.data[999] == 0x33);
+    av_packet_unref(&packet);
+
+    REQUIRE(reader.Parse(&packet) == STREAM_READER_NEED_MORE);
+    REQUIRE(reader.stats.nr_packets == 3);
+
+    reader.Destroy();
+    pool.Destroy();
+}
+
+TEST_CASE("stream reader assembles split packets", "[video][stream_reader]") {
+    PacketPool pool;
+    REQUIRE(pool.Init());
+    StreamReader reader;
+    REQUIRE(reader.Init(INVALID_SOCKET, &pool, 4096, 0));
+
+    std::vector<uint8_t> data;
+    append_packet(data, 42, 500, 0x44);
+
+    AVPacket packet;
+    // split in the header
+    feed(reader, data.data(), 5);
+    REQUIRE(reader.Parse(&packet) == STREAM_READER_NEED_MORE);
+    REQUIRE(!reader.has_partial);
+
+    // split in the body
+    feed(reader, &data[5], 200);
+    REQUIRE(reader.Parse(&packet) == STREAM_READER_NEED_MORE);
+    REQUIRE(reader.has_partial);
+    REQUIRE(reader.head == reader.tail);
+
+    feed(reader, &data[205], data.size() - 205);
+    REQUIRE(reader.Parse(&packet) == STREAM_READER_PACKET);
+    REQUIRE(packet.pts == 42);
+    REQUIRE(packet.size == 500);
+    REQUIRE(packet.data[0] == 0x44);
+    REQUIRE(packet.data[499] == 0x44);
+    REQUIRE(packet.data[500] == 0); // padding
+    av_packet_unref(&packet);
+
+    reader.Destroy();
+    pool.Destroy();
+}
+
+TEST_CASE("stream reader rejects oversized packets", "[video][stream_reader]") {
+    PacketPool pool;
+    REQUIRE(pool.Init());
+    StreamReader reader;
+    REQUIRE(reader.Init(INVALID_SOCKET, &pool, 4096, 0));
+
+    uint8_t header[STREAM_READER_HEADER_SIZE];
+    util::buffer_write64be(header, 0);
+    util::buffer_write32be(&header[8], 0xFFFFFFFF);
+    feed(reader, header, sizeof(header));
+
+    AVPacket packet;
+    REQUIRE(reader.Parse(&packet) == STREAM_READER_ERROR);
+
+    reader.Destroy();
+    pool.Destroy();
+}
+
+static bool collect_packet(void *userdata, AVPacket *packet) {
+    auto *sizes = static_cast<std::vector<int> *>(userdata);
+    sizes->push_back(packet->size);
+    REQUIRE(packet->data[packet->size - 1] == (uint8_t) packet->pts);
+    return true;
+}
+
+TEST_CASE("stream reader consumes fed bytes", "[video][stream_reader]") {
+    PacketPool pool;
+    REQUIRE(pool.Init());
+    StreamReader reader;
+    REQUIRE(reader.Init(INVALID_SOCKET, &pool, 4096, 0));
+
+    std::vector<uint8_t> data;
+    append_packet(data, 1, 10, 1);
+    append_packet(data, 2, 100000, 2);
+    append_packet(data, 3, 30, 3);
+
+    std::vector<int> sizes;
+    // one chunk
+    REQUIRE(reader.Feed(data.data(), data.size(), collect_packet, &sizes));
+    REQUIRE(sizes == std::vector<int>{10, 100000, 30});
+
+    // arbitrary chunks, splitting headers and bodies
+    sizes.clear();
+    size_t offset = 0;
+    for (size_t chunk = 1; offset < data.size(); chunk = chunk * 3 + 1) {
+        size_t len = std::min(chunk, data.size() - offset);
+        REQUIRE(reader.Feed(&data[offset], len, collect_packet, &sizes));
+        offset += len;
+    }
+    REQUIRE(sizes == std::vector<int>{10, 100000, 30});
+    REQUIRE(!reader.has_partial);
+
+    reader.Destroy();
+    pool.Destroy();
+}
+
+#ifndef _WIN32
+
+TEST_CASE("stream reader reads from a socket", "[video][stream_reader]") {
+    int fds[2];
+    REQUIRE(!socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+
+    std::vector<uint8_t> data;
+    for (uint32_t i = 0; i < 50; ++i) {
+        // every 10th packet is large enough to be received directly
+        uint32_t len = i % 10 ? 100 + i : 300000;
+        append_packet(data, i, len, (uint8_t) i);
+    }
+    std::thread writer([&] {
+        platform::net_send_all(fds[1], data.data(), data.size());
+        platform::net_shutdown(fds[1], SHUT_WR);
+    });
+
+    PacketPool pool;
+    REQUIRE(pool.Init());
+    StreamReader reader;
+    REQUIRE(reader.Init(fds[0], &pool, STREAM_READER_DEFAULT_CAPACITY, 0));
+
+    for (uint32_t i = 0; i < 50; ++i) {
+        AVPacket packet;
+        REQUIRE(reader.ReadPacket(&packet));
+        REQUIRE(packet.pts == i);
+        REQUIRE(packet.size == (i % 10 ? 100 + (int) i : 300000));
+        REQUIRE(packet.data[packet.size - 1] == (uint8_t) i);
+        av_packet_unref(&packet);
+    }
+    AVPacket packet;
+    uint64_t nr_recv = reader.stats.nr_recv;
+    REQUIRE(!reader.ReadPacket(&packet)); // end of stream
+    // the failed recv() is not counted
+    REQUIRE(reader.stats.nr_recv == nr_recv);
+    REQUIRE(reader.stats.nr_bytes == data.size());
+
+    writer.join();
+    reader.Destroy();
+    pool.Destroy();
+    close(fds[0]);
+    close(fds[1]);
+}
+
+#endif
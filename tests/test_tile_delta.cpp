@@ -0,0 +1,247 @@
+//
+// Created by James Shen on 17/10/26.
+// Copyright (c) 2020 GUIDEBEE IT. All rights reserved
+//
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+#include "catch2/catch.hpp"
+#include "message/blob_msg.hpp"
+#include "message/tile_delta.hpp"
+#include "util/buffer_util.hpp"
+
+using namespace irobot;
+using namespace irobot::message;
+
+// reference decoder of the client: apply a payload to the image
+// return false if the payload does not apply (sequence gap, bad size...)
+struct TileDeltaDecoder {
+    std::vector<uint8_t> image;
+    int width = 0;
+    int height = 0;
+    int channels = 0;
+    uint32_t sequence = 0;
+
+    bool Decode(const uint8_t *buf, size_t len, int image_width, int image_height) {
+        if (len < TILE_DELTA_HEADER_SIZE) {
+            return false;
+        }
+        int image_channels = buf[2];
+        int tile = buf[3];
+        uint32_t seq = util::buffer_read32be(&buf[4]);
+        const uint8_t *in = buf + TILE_DELTA_HEADER_SIZE;
+        const uint8_t *end = buf + len;
+        size_t row_size = (size_t) image_width * image_channels;
+
+        if (buf[1] & TILE_DELTA_FLAG_KEY) {
+            if ((size_t) (end - in) != row_size * image_height) {
+                return false;
+            }
+            this->image.assign(in, end);
+            this->width = image_width;
+            this->height = image_height;
+            this->channels = image_channels;
+            this->sequence = seq;
+            return true;
+        }
+
+        if (this->image.empty() || seq != this->sequence + 1
+            || image_width != this->width || image_height != this->height
+            || image_channels != this->channels || !tile) {
+            // request a key frame
+            return false;
+        }
+        int tiles_x = (image_width + tile - 1) / tile;
+        int tiles_y = (image_height + tile - 1) / tile;
+        const uint8_t *bitmap = in;
+        in += ((size_t) tiles_x * tiles_y + 7) / 8;
+        for (int ty = 0; ty < tiles_y; ++ty) {
+            for (int tx = 0; tx < tiles_x; ++tx) {
+                int index = ty * tiles_x + tx;
+                if (!(bitmap[index / 8] & (0x80 >> (index % 8)))) {
+                    continue;
+                }
+                int tile_width = std::min(tile, image_width - tx * tile);
+                int tile_height = std::min(tile, image_height - ty * tile);
+                size_t tile_row_size = (size_t) tile_width * image_channels;
+                for (int y = ty * tile; y < ty * tile + tile_height; ++y) {
+                    if (in + tile_row_size > end) {
+                        return false;
+                    }
+                    memcpy(&this->image[y * row_size + (size_t) tx * tile * image_channels],
+                           in, tile_row_size);
+                    in += tile_row_size;
+                }
+            }
+        }
+        this->sequence = seq;
+        return in == end;
+    }
+};
+
+static size_t Encode(TileDeltaEncoder *encoder, const std::vector<uint8_t> &image,
+                     int width, int height, int channels,
+                     std::vector<uint8_t> *buf) {
+    buf->resize(TileDeltaEncoder::GetMaxSize(width, height, channels));
+    size_t len = encoder->Encode(BLOB_MSG_TYPE_OPENCV_MAT, image.data(),
+                                 width, height, channels,
+                                 (size_t) width * channels, buf->data());
+    buf->resize(len);
+    return len;
+}
+
+TEST_CASE("tile delta encode and decode", "[message][tile_delta]") {
+    // not a multiple of the tile size
+    const int width = 100;
+    const int height = 70;
+    const int channels = 3;
+    std::vector<uint8_t> image((size_t) width * height * channels);
+    for (size_t i = 0; i < image.size(); ++i) {
+        image[i] = (uint8_t) (i * 7);
+    }
+
+    TileDeltaEncoder encoder{};
+    TileDeltaDecoder decoder{};
+    std::vector<uint8_t> buf;
+
+    // the first image is a key frame
+    size_t len = Encode(&encoder, image, width, height, channels, &buf);
+    REQUIRE(len == TILE_DELTA_HEADER_SIZE + image.size());
+    REQUIRE(buf[0] == BLOB_MSG_TYPE_OPENCV_MAT);
+    REQUIRE(buf[1] == TILE_DELTA_FLAG_KEY);
+    REQUIRE(decoder.Decode(buf.data(), buf.size(), width, height));
+    REQUIRE(decoder.image == image);
+
+    // unchanged: only the bitmap (4 x 3 tiles)
+    len = Encode(&encoder, image, width, height, channels, &buf);
+    REQUIRE(len == TILE_DELTA_HEADER_SIZE + 2);
+    REQUIRE(buf[1] == 0);
+    REQUIRE(decoder.Decode(buf.data(), buf.size(), width, height));
+    REQUIRE(decoder.image == image);
+
+    // a pixel in the last (partial) tile, and one in the first tile
+    image[((size_t) 69 * width + 99) * channels] ^= 0xff;
+    image[((size_t) 5 * width + 5) * channels + 2] ^= 0xff;
+    len = Encode(&encoder, image, width, height, channels, &buf);
+    size_t last_tile = (size_t) (100 - 96) * (70 - 64) * channels;
+    size_t first_tile = (size_t) 32 * 32 * channels;
+    REQUIRE(len == TILE_DELTA_HEADER_SIZE + 2 + first_tile + last_tile);
+    REQUIRE(buf[TILE_DELTA_HEADER_SIZE] == 0x80);
+    REQUIRE(buf[TILE_DELTA_HEADER_SIZE + 1] == 0x10);
+    REQUIRE(decoder.Decode(buf.data(), buf.size(), width, height));
+    REQUIRE(decoder.image == image);
+
+    // a lost delta cannot be applied
+    image[0] ^= 0xff;
+    Encode(&encoder, image, width, height, channels, &buf);
+    image[1] ^= 0xff;
+    Encode(&encoder, image, width, height, channels, &buf);
+    REQUIRE(!decoder.Decode(buf.data(), buf.size(), width, height));
+
+    // until the client requests a key frame
+    encoder.RequestKeyFrame();
+    Encode(&encoder, image, width, height, channels, &buf);
+    REQUIRE(buf[1] == TILE_DELTA_FLAG_KEY);
+    REQUIRE(decoder.Decode(buf.data(), buf.size(), width, height));
+    REQUIRE(decoder.image == image);
+
+    // all the tiles changed: a key frame is smaller
+    for (auto &pixel : image) {
+        pixel ^= 0x55;
+    }
+    Encode(&encoder, image, width, height, channels, &buf);
+    REQUIRE(buf[1] == TILE_DELTA_FLAG_KEY);
+    REQUIRE(decoder.Decode(buf.data(), buf.size(), width, height));
+    REQUIRE(decoder.image == image);
+
+    // rotated
+    len = Encode(&encoder, image, height, width, channels, &buf);
+    REQUIRE(buf[1] == TILE_DELTA_FLAG_KEY);
+    REQUIRE(decoder.Decode(buf.data(), buf.size(), height, width));
+    REQUIRE(decoder.image == image);
+
+    encoder.Destroy();
+}
+
+TEST_CASE("tile delta padded rows", "[message][tile_delta]") {
+    // a cv::Mat roi has a stride larger than its width
+    const int width = 40;
+    const int height = 40;
+    const size_t stride = 64;
+    std::vector<uint8_t> image(stride * height, 0);
+    TileDeltaEncoder encoder{};
+    encoder.tile_size = 16;
+    TileDeltaDecoder decoder{};
+    std::vector<uint8_t> buf(TileDeltaEncoder::GetMaxSize(width, height, 1));
+
+    size_t len = encoder.Encode(BLOB_MSG_TYPE_OPENCV_MAT, image.data(), width,
+                                height, 1, stride, buf.data());
+    REQUIRE(decoder.Decode(buf.data(), len, width, height));
+
+    // the padding is ignored
+    image[50] = 1;
+    len = encoder.Encode(BLOB_MSG_TYPE_OPENCV_MAT, image.data(), width,
+                         height, 1, stride, buf.data());
+    REQUIRE(len == TILE_DELTA_HEADER_SIZE + 2);
+    REQUIRE(decoder.Decode(buf.data(), len, width, height));
+
+    image[stride * 39 + 39] = 1;
+    len = encoder.Encode(BLOB_MSG_TYPE_OPENCV_MAT, image.data(), width,
+                         height, 1, stride, buf.data());
+    REQUIRE(decoder.Decode(buf.data(), len, width, height));
+    REQUIRE(decoder.image[(size_t) 39 * width + 39] == 1);
+    REQUIRE(len == TILE_DELTA_HEADER_SIZE + 2 + 8 * 8);
+
+    encoder.Destroy();
+}
+
+TEST_CASE("tile delta cancel", "[message][tile_delta]") {
+    const int width = 64;
+    const int height = 64;
+    std::vector<uint8_t> image((size_t) width * height, 0);
+    TileDeltaEncoder encoder{};
+    TileDeltaDecoder decoder{};
+    std::vector<uint8_t> buf;
+    std::vector<uint8_t> cancelled;
+
+    Encode(&encoder, image, width, height, 1, &buf);
+    REQUIRE(decoder.Decode(buf.data(), buf.size(), width, height));
+
+    // a delta replaced before it was sent
+    image[0] = 1;
+    Encode(&encoder, image, width, height, 1, &cancelled);
+    encoder.Cancel(cancelled.data(), cancelled.size());
+
+    // the next one has the tiles of both, and the sequence of the first
+    image[(size_t) 63 * width + 63] = 1;
+    size_t len = Encode(&encoder, image, width, height, 1, &buf);
+    REQUIRE(len == TILE_DELTA_HEADER_SIZE + 1 + 2 * 32 * 32);
+    REQUIRE(buf[TILE_DELTA_HEADER_SIZE] == 0x90);
+    REQUIRE(decoder.Decode(buf.data(), buf.size(), width, height));
+    REQUIRE(decoder.image == image);
+
+    // the tile changed back is sent again
+    image[0] = 0;
+    Encode(&encoder, image, width, height, 1, &cancelled);
+    encoder.Cancel(cancelled.data(), cancelled.size());
+    Encode(&encoder, image, width, height, 1, &cancelled);
+    encoder.Cancel(cancelled.data(), cancelled.size());
+    len = Encode(&encoder, image, width, height, 1, &buf);
+    REQUIRE(len == TILE_DELTA_HEADER_SIZE + 1 + 32 * 32);
+    REQUIRE(decoder.Decode(buf.data(), buf.size(), width, height));
+    REQUIRE(decoder.image == image);
+
+    // a key frame replaced: the next one is a key frame
+    encoder.RequestKeyFrame();
+    Encode(&encoder, image, width, height, 1, &cancelled);
+    REQUIRE(cancelled[1] == TILE_DELTA_FLAG_KEY);
+    encoder.Cancel(cancelled.data(), cancelled.size());
+    Encode(&encoder, image, width, height, 1, &buf);
+    REQUIRE(buf[1] == TILE_DELTA_FLAG_KEY);
+    REQUIRE(decoder.Decode(buf.data(), buf.size(), width, height));
+    REQUIRE(decoder.image == image);
+
+    encoder.Destroy();
+}
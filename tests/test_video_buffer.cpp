@@ -0,0 +1,220 @@
+//
+// Created by James Shen on 17/10/26.
+// Copyright (c) 2020 GUIDEBEE IT. All rights reserved
+//
+
+#include <atomic>
+#include <thread>
+
+#include "catch2/catch.hpp"
+#include "video/video_buffer.hpp"
+#include "test_frames.hpp"
+
+using namespace irobot::video;
+
+TEST_CASE("video buffer consumers read the last frame", "[video][video_buffer]") {
+    FpsCounter fps_counter;
+    REQUIRE(fps_counter.Init());
+    VideoBuffer vb{};
+    REQUIRE(vb.Init(&fps_counter, false, 4));
+    int screen = vb.RegisterConsumer("screen", 0, true);
+    int agent = vb.RegisterConsumer("agent", 0, false);
+    REQUIRE(screen == 0);
+    REQUIRE(agent == 1);
+    // 4 slots: no room for a third consumer
+    REQUIRE(vb.RegisterConsumer("other", 0, false) == -1);
+
+    REQUIRE(!vb.AcquireFrame(screen));
+
+    offer_frame(&vb, 1);
+    const AVFrame *frame = vb.AcquireFrame(screen);
+    REQUIRE(frame);
+    REQUIRE(frame->data[0][0] == 1);
+    vb.ReleaseFrame(screen);
+
+    offer_frame(&vb, 2);
+    offer_frame(&vb, 3);
+    frame = vb.AcquireFrame(screen);
+    REQUIRE(frame->data[0][0] == 3);
+    vb.ReleaseFrame(screen);
+    REQUIRE(SDL_AtomicGet(&vb.consumers[screen].nr_frames) == 2);
+    REQUIRE(SDL_AtomicGet(&vb.consumers[screen].nr_skipped) == 1);
+
+    // the agent has its own cursor
+    frame = vb.AcquireFrame(agent);
+    REQUIRE(frame->data[0][0] == 3);
+    vb.ReleaseFrame(agent);
+    REQUIRE(SDL_AtomicGet(&vb.consumers[agent].nr_frames) == 1);
+    REQUIRE(SDL_AtomicGet(&vb.consumers[agent].nr_skipped) == 0);
+
+    vb.Destroy();
+    fps_counter.Destroy();
+}
+
+TEST_CASE("video buffer keeps pinned frames", "[video][video_buffer]") {
+    FpsCounter fps_counter;
+    REQUIRE(fps_counter.Init());
+    VideoBuffer vb{};
+    REQUIRE(vb.Init(&fps_counter, false, 4));
+    int screen = vb.RegisterConsumer("screen", 0, false);
+    int agent = vb.RegisterConsumer("agent", 0, false);
+
+    offer_frame(&vb, 1);
+    const AVFrame *agent_frame = vb.AcquireFrame(agent);
+    offer_frame(&vb, 2);
+    const AVFrame *screen_frame = vb.AcquireFrame(screen);
+
+    // a slow agent does not block the decoder
+    for (int i = 3; i < 100; ++i) {
+        offer_frame(&vb, i);
+    }
+    REQUIRE(agent_frame->data[0][0] == 1);
+    REQUIRE(screen_frame->data[0][0] == 2);
+    REQUIRE(vb.GetFrame(agent) == agent_frame);
+
+    REQUIRE(vb.AcquireFrame(agent)->data[0][0] == 99);
+    REQUIRE(SDL_AtomicGet(&vb.consumers[agent].nr_skipped) == 97);
+    vb.ReleaseFrame(agent);
+    vb.ReleaseFrame(screen);
+    REQUIRE(!vb.GetFrame(agent));
+
+    vb.Destroy();
+    fps_counter.Destroy();
+}
+
+TEST_CASE("video buffer frame checksum", "[video][video_buffer]") {
+    FpsCounter fps_counter;
+    REQUIRE(fps_counter.Init());
+    VideoBuffer vb{};
+    REQUIRE(vb.Init(&fps_counter, false, 4));
+    int agent = vb.RegisterConsumer("agent", 0, false);
+
+    offer_frame(&vb, 1);
+    uint64_t checksum = VideoBuffer::ComputeChecksum(vb.AcquireFrame(agent));
+    vb.ReleaseFrame(agent);
+
+    // same content
+    offer_frame(&vb, 1);
+    REQUIRE(VideoBuffer::ComputeChecksum(vb.AcquireFrame(agent)) == checksum);
+    vb.CountStaticFrame(agent);
+    REQUIRE(SDL_AtomicGet(&vb.consumers[agent].nr_static) == 1);
+    vb.ReleaseFrame(agent);
+
+    // a single byte of any row, of any plane
+    AVFrame *other = av_frame_alloc();
+    REQUIRE(other);
+    fill_frame(other, 16, 16, 1);
+    REQUIRE(VideoBuffer::ComputeChecksum(other) == checksum);
+    for (int p = 0; p < 3; ++p) {
+        int height = p ? 8 : 16;
+        int width = p ? 8 : 16;
+        for (int y = 0; y < height; ++y) {
+            for (int x = 0; x < width; ++x) {
+                uint8_t *pixel = &other->data[p][y * other->linesize[p] + x];
+                uint8_t value = *pixel;
+                *pixel = value + 1;
+                REQUIRE(VideoBuffer::ComputeChecksum(other) != checksum);
+                *pixel = value;
+            }
+        }
+    }
+    // the padding is ignored
+    other->data[0][other->linesize[0] - 1] = 2;
+    REQUIRE(VideoBuffer::ComputeChecksum(other) == checksum);
+    // the size
+    other->height = 14;
+    REQUIRE(VideoBuffer::ComputeChecksum(other) != checksum);
+    other->height = 16;
+    av_frame_free(&other);
+
+    offer_frame(&vb, 2);
+    REQUIRE(VideoBuffer::ComputeChecksum(vb.AcquireFrame(agent)) != checksum);
+    vb.ReleaseFrame(agent);
+
+    vb.Destroy();
+    fps_counter.Destroy();
+}
+
+TEST_CASE("video buffer concurrent consumer", "[video][video_buffer]") {
+    FpsCounter fps_counter;
+    REQUIRE(fps_counter.Init());
+    VideoBuffer vb{};
+    REQUIRE(vb.Init(&fps_counter, false, 3));
+    int agent = vb.RegisterConsumer("agent", 0, false);
+
+    std::atomic<bool> stopped{false};
+    std::atomic<bool> corrupted{false};
+    std::thread consumer([&] {
+        int last = 0;
+        while (!stopped) {
+            const AVFrame *frame = vb.AcquireFrame(agent);
+            if (frame) {
+                // the frame must not change while pinned, nor go backwards
+                int value = frame->data[0][0];
+                for (int i = 0; i < frame->linesize[0] * frame->height; ++i) {
+                    if (frame->data[0][i] != value) {
+                        corrupted = true;
+                    }
+                }
+                if (value < last) {
+                    corrupted = true;
+                }
+                last = value;
+            }
+            vb.ReleaseFrame(agent);
+        }
+    });
+    for (int i = 1; i < 256; ++i) {
+        offer_frame(&vb, i);
+    }
+    stopped = true;
+    consumer.join();
+    REQUIRE(!corrupted);
+
+    vb.Destroy();
+    fps_counter.Destroy();
+}
+
+TEST_CASE("video buffer waiting consumer", "[video][video_buffer]") {
+    FpsCounter fps_counter;
+    REQUIRE(fps_counter.Init());
+    VideoBuffer vb{};
+    REQUIRE(vb.Init(&fps_counter, false, 3));
+    int agent = vb.RegisterConsumer("agent", 0, false);
+
+    std::atomic<int> nr_woken{0};
+    std::atomic<int> last{0};
+    std::thread consumer([&] {
+        while (vb.WaitFrame(agent)) {
+            ++nr_woken;
+            const AVFrame *frame = vb.AcquireFrame(agent);
+            if (frame) {
+                last = frame->data[0][0];
+            }
+            vb.ReleaseFrame(agent);
+        }
+    });
+    for (int i = 1; i < 256; ++i) {
+        offer_frame(&vb, i);
+    }
+    // the wakeups are coalesced, but the last frame is always consumed
+    while (last != 255) {
+        std::this_thread::yield();
+    }
+    REQUIRE(nr_woken <= 255);
+
+    // woken without any new frame
+    int woken = nr_woken;
+    vb.WakeConsumer(agent);
+    while (nr_woken == woken) {
+        std::this_thread::yield();
+    }
+
+    vb.Interrupt();
+    consumer.join();
+    // each wakeup but the last one was for a new frame
+    REQUIRE(SDL_AtomicGet(&vb.consumers[agent].nr_frames) == nr_woken - 1);
+
+    vb.Destroy();
+    fps_counter.Destroy();
+}
@@ -0,0 +1,97 @@
+//
+// Created by James Shen on 17/10/26.
+// Copyright (c) 2020 GUIDEBEE IT. All rights reserved
+//
+
+#include <SDL2/SDL_atomic.h>
+#include <SDL2/SDL_timer.h>
+
+#include "catch2/catch.hpp"
+#include "core/worker_pool.hpp"
+#include "util/lock.hpp"
+
+using namespace irobot;
+
+struct Job {
+    SDL_atomic_t *running;
+    // set if the other job ran meanwhile
+    SDL_atomic_t *parallel;
+    bool done;
+};
+
+static void RunJob(void *data) {
+    auto *job = (Job *) data;
+    int running = SDL_AtomicAdd(job->running, 1) + 1;
+    if (running > 1) {
+        SDL_AtomicSet(job->parallel, 1);
+    }
+    SDL_Delay(20);
+    SDL_AtomicAdd(job->running, -1);
+    job->done = true;
+}
+
+TEST_CASE("worker pool fork join", "[core][worker_pool]") {
+    WorkerPool pool{};
+    REQUIRE(!pool.Init("test worker", 0));
+    REQUIRE(pool.Init("test worker", 2));
+    REQUIRE(pool.Start());
+
+    SDL_atomic_t running{};
+    SDL_atomic_t parallel{};
+    Job jobs[2] = {{&running, &parallel, false}, {&running, &parallel, false}};
+    for (int round = 0; round < 3; ++round) {
+        for (auto &job : jobs) {
+            job.done = false;
+            REQUIRE(pool.Submit(RunJob, &job));
+        }
+        pool.Wait();
+        // all done on return
+        REQUIRE(jobs[0].done);
+        REQUIRE(jobs[1].done);
+        REQUIRE(SDL_AtomicGet(&running) == 0);
+    }
+    REQUIRE(SDL_AtomicGet(&parallel));
+
+    pool.Stop();
+    REQUIRE(!pool.Submit(RunJob, &jobs[0]));
+    // nothing to wait for
+    pool.Wait();
+    pool.Join();
+    pool.Destroy();
+}
+
+TEST_CASE("lock wait stats", "[util][lock]") {
+    SDL_mutex *mutex = SDL_CreateMutex();
+    util::LockWaitStats stats{};
+
+    util::mutex_lock(mutex, &stats);
+    util::mutex_unlock(mutex);
+    REQUIRE(SDL_AtomicGet(&stats.nr_locks) == 1);
+    REQUIRE(SDL_AtomicGet(&stats.nr_waits) == 0);
+
+    // held by another thread for 50 ms
+    struct Holder {
+        SDL_mutex *mutex;
+        SDL_atomic_t locked;
+    } holder{mutex, {}};
+    SDL_Thread *thread = SDL_CreateThread([](void *data) {
+        auto *h = (Holder *) data;
+        util::mutex_lock(h->mutex);
+        SDL_AtomicSet(&h->locked, 1);
+        SDL_Delay(50);
+        util::mutex_unlock(h->mutex);
+        return 0;
+    }, "lock holder", &holder);
+    while (!SDL_AtomicGet(&holder.locked)) {
+        SDL_Delay(1);
+    }
+    util::mutex_lock(mutex, &stats);
+    util::mutex_unlock(mutex);
+    SDL_WaitThread(thread, nullptr);
+
+    REQUIRE(SDL_AtomicGet(&stats.nr_locks) == 2);
+    REQUIRE(SDL_AtomicGet(&stats.nr_waits) == 1);
+    REQUIRE(SDL_AtomicGet(&stats.wait_us) >= 20000);
+    REQUIRE(SDL_AtomicGet(&stats.max_wait_us) == SDL_AtomicGet(&stats.wait_us));
+    SDL_DestroyMutex(mutex);
+}